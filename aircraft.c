@@ -9,6 +9,7 @@ void freeAircraftBack() {
             sfree(Modes.aircraftBack);
         }
         Modes.aircraft_data_size -= aircraftBackAlloc;
+        memAccountBytes(MEM_AIRCRAFT_SLABS, -aircraftBackAlloc);
         Modes.aircraftBack = prev;
     }
 }
@@ -33,10 +34,12 @@ static struct aircraft *allocAircraft() {
         Modes.aircraftBackFree = a->next;
 
         unlockBack();
+        memAccountBytes(MEM_AIRCRAFT, sizeof(struct aircraft));
         return a;
     }
     if (!Modes.aircraftBack) {
         Modes.aircraft_data_size += aircraftBackAlloc;
+        memAccountBytes(MEM_AIRCRAFT_SLABS, aircraftBackAlloc);
         if (Modes.thp) {
             Modes.aircraftBack = cmMmap(aircraftBackAlloc, CM_HUGEPAGE);
         } else {
@@ -49,6 +52,7 @@ static struct aircraft *allocAircraft() {
     if (Modes.aircraftBack->used >= aircraftBackCap) {
         struct aircraftBack *prev = Modes.aircraftBack;
         Modes.aircraft_data_size += aircraftBackAlloc;
+        memAccountBytes(MEM_AIRCRAFT_SLABS, aircraftBackAlloc);
         if (Modes.thp) {
             Modes.aircraftBack = cmMmap(aircraftBackAlloc, CM_HUGEPAGE);
         } else {
@@ -71,6 +75,7 @@ static struct aircraft *allocAircraft() {
     Modes.aircraftBack->used++;
 
     unlockBack();
+    memAccountBytes(MEM_AIRCRAFT, sizeof(struct aircraft));
 
     return a;
 }
@@ -85,14 +90,10 @@ static void deallocAircraft(struct aircraft *a) {
     Modes.aircraftBackFree = a;
 
     unlockBack();
+    memAccountBytes(MEM_AIRCRAFT, -(int64_t) sizeof(struct aircraft));
 }
 
 static int isMilRange(uint32_t i);
-static void updateDetails(struct aircraft *curr, struct char_buffer cb, uint32_t offset);
-
-static inline uint32_t dbHash(uint32_t addr) {
-    return addrHash(addr, DB_HASH_BITS);
-}
 
 uint32_t aircraftHash(uint32_t addr) {
     return addrHash(addr, Modes.acHashBits);
@@ -224,6 +225,17 @@ struct aircraft *aircraftGet(uint32_t addr) {
     return a;
 }
 
+// teardown of an aircraft no thread can reach anymore, runs outside of lockThreads()
+static void reclaimAircraft(void *ptr) {
+    struct aircraft *a = ptr;
+
+    traceCleanup(a);
+
+    memset(a, 0x0, sizeof (struct aircraft));
+    deallocAircraft(a);
+}
+
+// the caller has unlinked the aircraft from Modes.aircraft
 void freeAircraft(struct aircraft *a) {
     if (Modes.quickFree) {
         traceCleanupNoUnlink(a);
@@ -239,10 +251,9 @@ void freeAircraft(struct aircraft *a) {
     if (a->onActiveList) {
         ca_remove(&Modes.aircraftActive, a);
     }
-    traceCleanup(a);
 
-    memset(a, 0x0, sizeof (struct aircraft));
-    deallocAircraft(a);
+    // freeing the trace and unlinking the trace files is deferred until the threads are running again
+    epochRetire(reclaimAircraft, a);
 }
 
 void aircraftZeroTail(struct aircraft *a) {
@@ -302,7 +313,7 @@ void toBinCraft(struct aircraft *a, struct binCraft *new, int64_t now) {
     for (unsigned i = 0; i < sizeof(new->callsign); i++)
         new->callsign[i] = a->callsign[i] * new->callsign_valid;
 
-    if (Modes.db) {
+    if (Modes.dbBin) {
         memcpy(new->registration, a->registration, sizeof(new->registration));
         memcpy(new->typeCode, a->typeCode, sizeof(new->typeCode));
         new->dbFlags = a->dbFlags;
@@ -446,67 +457,21 @@ void toBinCraft(struct aircraft *a, struct binCraft *new, int64_t now) {
 }
 
 
-// rudimentary sanitization so the json output hopefully won't be invalid
-static inline void sanitize(char *str, int len) {
-    unsigned char b2 = (1<<7) + (1<<6); // 2 byte code or more
-    unsigned char b3 = (1<<7) + (1<<6) + (1<<5); // 3 byte code or more
-    unsigned char b4 = (1<<7) + (1<<6) + (1<<5) + (1<<4); // 4 byte code
-
-    int debug = 0;
-
-    // UTF that goes beyond our string is cut off by terminating the string
-
-    if (len >= 3 && (str[len - 3] & b4) == b4) {
-        if (debug) { fprintf(stderr, "b4%d\n", str[len - 3]); }
-        str[len - 3] = '\0';
-    }
-    if (len >= 2 && (str[len - 2] & b3) == b3) {
-        if (debug) { fprintf(stderr, "b3%d\n", str[len - 2]); }
-        str[len - 2] = '\0';
-    }
-    if (len >= 1 && (str[len - 1] & b2) == b2) {
-        if (debug) { fprintf(stderr, "b2%d\n", str[len - 1]); }
-        str[len - 1] = '\0';
-    }
-    char *p = str;
-    // careful str might be unterminated, use len
-    while(p - str < len) {
-        if (*p == '"') {
-            //if (debug) { fprintf(stderr, "quotation marks: %s\n", str); }
-            // replace with single quote
-            *p = '\'';
-        }
-        if (*p > 0 && *p < 0x1f) {
-            if (debug) { fprintf(stderr, "non-printable: %s\n", str); }
-            // replace with space
-            *p = ' ';
-        }
-        p++;
-    }
-    if (p - 1 >= str && *(p - 1) == '\\') {
-        *(p - 1) = '\0';
-    }
-}
-static char *sprintDB2(char *p, char *end, dbEntry *d) {
-    struct aircraft aBack;
-    struct aircraft *a = &aBack;
-
-    updateDetails(a, Modes.db2Raw, d->rawOffset);
-    a->addr = d->addr;
-    p = safe_snprintf(p, end, "\n\"%s%06x\":{", (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
+static char *sprintDB(char *p, char *end, struct dbBin *db, const struct dbBinRecord *d) {
+    p = safe_snprintf(p, end, "\n\"%s%06x\":{", (d->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", d->addr & 0xFFFFFF);
     char *regInfo = p;
-    if (a->registration[0])
-        p = safe_snprintf(p, end, "\"r\":\"%.*s\",", (int) sizeof(a->registration), a->registration);
-    if (a->typeCode[0])
-        p = safe_snprintf(p, end, "\"t\":\"%.*s\",", (int) sizeof(a->typeCode), a->typeCode);
-    if (a->typeLong[0])
-        p = safe_snprintf(p, end, "\"desc\":\"%.*s\",", (int) sizeof(a->typeLong), a->typeLong);
-    if (a->dbFlags)
-        p = safe_snprintf(p, end, "\"dbFlags\":%u,", a->dbFlags);
-    if (a->ownOp[0])
-        p = safe_snprintf(p, end, "\"ownOp\":\"%.*s\",", (int) sizeof(a->ownOp), a->ownOp);
-    if (a->year[0])
-        p = safe_snprintf(p, end, "\"year\":\"%.*s\",", (int) sizeof(a->year), a->year);
+    if (d->registration)
+        p = safe_snprintf(p, end, "\"r\":\"%s\",", dbBinString(db, d->registration));
+    if (d->typeCode)
+        p = safe_snprintf(p, end, "\"t\":\"%s\",", dbBinString(db, d->typeCode));
+    if (d->typeLong)
+        p = safe_snprintf(p, end, "\"desc\":\"%s\",", dbBinString(db, d->typeLong));
+    if (d->dbFlags)
+        p = safe_snprintf(p, end, "\"dbFlags\":%u,", d->dbFlags);
+    if (d->ownOp)
+        p = safe_snprintf(p, end, "\"ownOp\":\"%s\",", dbBinString(db, d->ownOp));
+    if (d->year)
+        p = safe_snprintf(p, end, "\"year\":\"%s\",", dbBinString(db, d->year));
     if (p == regInfo)
         p = safe_snprintf(p, end, "\"noRegData\":true,");
     if (*(p-1) == ',')
@@ -514,24 +479,19 @@ static char *sprintDB2(char *p, char *end, dbEntry *d) {
     p = safe_snprintf(p, end, "},");
     return p;
 }
-static void db2ToJson() {
+static void dbToJson(struct dbBin *db) {
     size_t buflen = 32 * 1024 * 1024;
     char *buf = (char *) cmalloc(buflen), *p = buf, *end = buf + buflen;
     p = safe_snprintf(p, end, "{");
 
-    for (int j = 0; j < DB_BUCKETS; j++) {
-        if (0 && j % 1000 == 0) {
-            fprintf(stderr, "db print %d\n", j);
-        }
-        for (dbEntry *d = Modes.db2Index[j]; d; d = d->next) {
-            p = sprintDB2(p, end, d);
-            if ((p + 1000) >= end) {
-                int used = p - buf;
-                buflen *= 2;
-                buf = (char *) realloc(buf, buflen);
-                p = buf + used;
-                end = buf + buflen;
-            }
+    for (uint32_t j = 0; j < db->count; j++) {
+        p = sprintDB(p, end, db, &db->records[j]);
+        if ((p + 1000) >= end) {
+            int used = p - buf;
+            buflen *= 2;
+            buf = (char *) realloc(buf, buflen);
+            p = buf + used;
+            end = buf + buflen;
         }
     }
 
@@ -545,19 +505,6 @@ static void db2ToJson() {
     free(buf);
 }
 
-// get next CSV token based on the assumption eot points to the previous delimiter
-static inline int nextToken(char delim, char **sot, char **eot, char **eol) {
-    *sot = *eot + 1;
-    if (*sot >= *eol)
-        return 0;
-    *eot = memchr(*sot, delim, *eol - *sot);
-
-    if (!*eot)
-        return 0;
-
-    return 1;
-}
-
 static int is_df18_exception(uint32_t addr) {
     switch (addr) {
         case 0xa08508:
@@ -585,6 +532,9 @@ static int is_df18_exception(uint32_t addr) {
 
 
 // meant to be used with this DB: https://raw.githubusercontent.com/wiedehopf/tar1090-db/csv/aircraft.csv.gz
+// or the binary database written from it by db_convert
+// the new database replaces the old one with a pointer swap, the details of existing aircraft are
+// updated by activeUpdateRange() / removeStaleRange() when they are from an older database
 int dbUpdate(int64_t now) {
     static int64_t next_db_check;
     if (now < next_db_check) {
@@ -592,304 +542,101 @@ int dbUpdate(int64_t now) {
     }
     // db update check every 30 seconds
     next_db_check = now + 30 * SECONDS;
-    // this update only takes effect in dbFinishUpdate with all other threads locked
 
     char *filename = Modes.db_file;
     if (!filename) {
         return 0;
     }
 
-    struct timespec watch;
-    startWatch(&watch);
-
-    gzFile gzfp = NULL;
-    struct char_buffer cb = {0};
-
-    int fd = open(filename, O_RDONLY);
-    if (fd == -1) {
-        fprintf(stderr, "dbUpdate: open db-file failed:");
+    struct stat fileinfo = {0};
+    if (stat(filename, &fileinfo)) {
+        fprintf(stderr, "dbUpdate: stat db-file failed:");
         perror(filename);
         return 0;
     }
-
-    //fprintf(stderr, "checking for db Update\n");
-
-    struct stat fileinfo = {0};
-    if (fstat(fd, &fileinfo)) {
-        fprintf(stderr, "%s: dbUpdate: fstat failed, wat?!\n", filename);
-        goto DBU0;
-    }
     int64_t modTime = fileinfo.st_mtim.tv_sec;
 
     if (Modes.dbModificationTime == modTime)
-        goto DBU0;
-
-    gzfp = gzdopen(fd, "r");
-    if (!gzfp) {
-        fprintf(stderr, "db update error: gzdopen failed.\n");
-        goto DBU0;
-    }
+        return 0;
 
+    struct timespec watch;
+    startWatch(&watch);
 
-    cb = readWholeGz(gzfp, filename);
-    if (!cb.buffer) {
-        fprintf(stderr, "database read failed due to readWholeGz.\n");
-        goto DBU0;
-    }
-    if (cb.len < 1000) {
-        fprintf(stderr, "database file very small, bailing out of dbUpdate.\n");
-        goto DBU0;
-    }
+    struct dbBin *db = NULL;
 
-    if (1) {
-        // reallocate so we don't waste memory
-        char *oldBuffer = cb.buffer;
-        cb.len++; // for adding zero termination
-        cb.buffer = realloc(cb.buffer, cb.len);
+    if (dbBinIsBinary(filename)) {
+        db = dbBinOpen(filename);
+    } else {
+        gzFile gzfp = gzopen(filename, "r");
+        if (!gzfp) {
+            fprintf(stderr, "db update error: gzopen failed.\n");
+            return 1;
+        }
+        struct char_buffer cb = readWholeGz(gzfp, filename);
+        gzclose(gzfp);
         if (!cb.buffer) {
-            fprintf(stderr, "database read failed due to realloc\n");
-            sfree(oldBuffer);
-            goto DBU0;
+            fprintf(stderr, "database read failed due to readWholeGz.\n");
+            return 1;
         }
-        cb.buffer[cb.len - 1] = '\0'; // zero terminate for good measure
-    }
-
-    int alloc = 0;
-
-    // memchr is not faster, seems the compiler is smart enough to optimize a simple loop that counts the newlines
-    for (uint32_t i = 0; i < cb.len; i++) {
-        if (cb.buffer[i] == '\n')
-            alloc++;
-    }
-
-    int indexSize = DB_BUCKETS * sizeof(void*);
-    int entriesSize = alloc * sizeof(dbEntry);
-
-    Modes.db2 = cmalloc(entriesSize);
-    Modes.db2Raw = cb;
-    Modes.db2Index = cmalloc(indexSize);
-    memset(Modes.db2Index, 0, indexSize);
-
-    if (0) {
-        fprintf(stderr, "db mem usage: total %d index %d entries %d text %d kB\n",
-                indexSize / 1024 +  entriesSize / 1024 +  (int) (cb.len / 1024),
-                indexSize / 1024, entriesSize / 1024, (int) (cb.len / 1024));
+        if (cb.len < 1000) {
+            fprintf(stderr, "database file very small, bailing out of dbUpdate.\n");
+            free(cb.buffer);
+            return 1;
+        }
+        fprintf(stderr, "Database update in progress!\n");
+        db = dbBinFromCsv(cb);
     }
 
-    if (!Modes.db2 || !Modes.db2Index) {
-        fprintf(stderr, "db update error: malloc failure!\n");
-        goto DBU0;
+    if (!db) {
+        return 1;
     }
-
-    fprintf(stderr, "Database update in progress!\n");
-
-    char *eob = cb.buffer + cb.len;
-    char *sol = cb.buffer;
-    char *eol;
-    int i;
-    for (i = 0; eob > sol && (eol = memchr(sol, '\n', eob - sol)); sol = eol + 1) {
-
-        char *sot;
-        char *eot = sol - 1; // this pointer must not be dereferenced, nextToken will increment it.
-
-        dbEntry *curr = &Modes.db2[i];
-        memset(curr, 0, sizeof(dbEntry));
-
-        if (!nextToken(';', &sot, &eot, &eol)) continue;
-        curr->addr = strtol(sot, NULL, 16);
-        if (curr->addr == 0)
-            continue;
-
-        if (!nextToken(';', &sot, &eot, &eol)) continue;
-        curr->rawOffset = sot - cb.buffer;
-
-        i++; // increment db array index
-        // add to hashtable
-        dbPut(curr->addr, Modes.db2Index, curr);
-    }
-
-    if (i < 1) {
+    if (db->count < 1) {
         fprintf(stderr, "db update error: DB has no entries, maybe old / incorrect format?!\n");
-        goto DBU0;
+        dbBinFree(db);
+        return 1;
     }
-    //fflush(stdout);
 
-    //fprintf(stderr, "dbUpdate() done\n");
+    db->generation = imax(now, atomic_load(&Modes.dbGeneration) + 1);
+
+    // readers (updateTypeReg) hold an epoch while using the database
+    struct dbBin *old = atomic_exchange(&Modes.dbBin, db);
+    atomic_store(&Modes.dbGeneration, db->generation);
+    epochRetire(dbBinFree, old);
 
-    gzclose(gzfp);
     Modes.dbModificationTime = modTime;
     if (Modes.json_dir) {
         free(writeJsonToFile(Modes.json_dir, "receiver.json", generateReceiverJson()).buffer);
     }
 
-
     double elapsed = stopWatch(&watch) / 1000.0;
-    fprintf(stderr, "Database update first part took %.3f seconds!\n", elapsed);
-
+    fprintf(stderr, "Database update done! (%u aircraft, took %.3f seconds)\n", db->count, elapsed);
 
     // write database to json dir for testing
     if (Modes.json_dir && Modes.debug_dbJson) {
-        db2ToJson();
+        dbToJson(db);
     }
 
-    return 1;
-DBU0:
-    if (gzfp)
-        gzclose(gzfp);
-    free(cb.buffer);
-    free(Modes.db2);
-    free(Modes.db2Index);
-    Modes.db2 = NULL;
-    Modes.db2Index = NULL;
-    Modes.db2Raw.buffer = NULL;
-    Modes.db2Raw.len = 0;
-    close(fd);
     return 1;
 }
 
-static void updateTypeRegRange(void *arg, threadpool_threadbuffers_t *threadbuffers) {
-    MODES_NOTUSED(threadbuffers);
-    readsb_task_t *info = (readsb_task_t *) arg;
-    //fprintf(stderr, "%d %d\n", info->from, info->to);
-    for (int j = info->from; j < info->to; j++) {
-        for (struct aircraft *a = Modes.aircraft[j]; a; a = a->next) {
-            updateTypeReg(a);
-        }
-    }
-}
-
-int dbFinishUpdate() {
-    if (!Modes.db2) {
-        return 0;
-    }
-    // finish db update
-
-    struct timespec watch;
-    startWatch(&watch);
-
-
-    sfree(Modes.dbIndex);
-    sfree(Modes.dbRaw.buffer);
-    sfree(Modes.db);
-
-    Modes.dbIndex = Modes.db2Index;
-    Modes.dbRaw = Modes.db2Raw;
-    Modes.db = Modes.db2;
-    Modes.db2Index = NULL;
-    Modes.db2 = NULL;
-    Modes.db2Raw.buffer = NULL;
-    Modes.db2Raw.len = 0;
-
-    /*
-    for (int j = 0; j < Modes.acBuckets; j++) {
-        for (struct aircraft *a = Modes.aircraft[j]; a; a = a->next) {
-            updateTypeReg(a);
-        }
-    }
-    */
-
-    int64_t now = mstime();
-
-    threadpool_distribute_and_run(Modes.allPool, Modes.allTasks, updateTypeRegRange, Modes.acBuckets, 0, now);
-
-    double elapsed = stopWatch(&watch) / 1000.0;
-    fprintf(stderr, "Database update done! (critical part took %.3f seconds)\n", elapsed);
-
-
-
-    return 1;
-}
-
-
-dbEntry *dbGet(uint32_t addr, dbEntry **index) {
-    if (!index)
-        return NULL;
-    dbEntry *d = index[dbHash(addr)];
-
-    while (d && d->addr != addr) {
-        d = d->next;
-    }
-    return d;
-}
-
-void dbPut(uint32_t addr, dbEntry **index, dbEntry *d) {
-    uint32_t hash = dbHash(addr);
-    d->next = index[hash];
-    index[hash] = d;
-}
-
-static void copyDetailFunc(char *sot, char *eot, char *target, int alloc) {
-    int len = imin(alloc, eot - sot);
-    memcpy(target, sot, len);
-    // terminate if string doesn't fill up alloc
-    // this mildly insane program can hopefully handle unterminated database strings
-    if (len < alloc) {
-        target[len] = '\0';
-    }
-    sanitize(target, len);
-}
-
-static void updateDetails(struct aircraft *curr, struct char_buffer cb, uint32_t offset) {
-    //fprintf(stdout, "%u %u\n", offset, (uint32_t) cb.len);
-    char *eob = cb.buffer + cb.len;
-    char *sol = cb.buffer + offset;
-    char *eol = memchr(sol, '\n', eob - sol);
-    char *sot;
-    char *eot = sol - 1; // this pointer must not be dereferenced, nextToken will increment it.
-
-    if (!eol) goto BAD_ENTRY;
-
-#define copyDetail(d) do { copyDetailFunc(sot, eot, curr->d, sizeof(curr->d)); } while (0)
-
-    if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
-    copyDetail(registration);
-
-    if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
-    copyDetail(typeCode);
-
-    if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
-    curr->dbFlags = 0;
-    for (int j = 0; j < 8 * (int) sizeof(curr->dbFlags) && sot < eot; j++, sot++)
-        curr->dbFlags |= ((*sot == '1') << j);
-
-
-    if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
-    copyDetail(typeLong);
-
-    if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
-    copyDetail(year);
-
-    if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
-    copyDetail(ownOp);
-
-#undef copyDetail
-
-    if (false) {
-        // debugging output
-        fprintf(stdout, "%06X;%.12s;%.4s;%c%c;%.54s\n",
-                curr->addr,
-                curr->registration,
-                curr->typeCode,
-                curr->dbFlags & 1 ? '1' : '0',
-                curr->dbFlags & 2 ? '1' : '0',
-                curr->typeLong);
-    }
-
-    return;
-
-BAD_ENTRY:
-    curr->registration[0] = '\0';
-    curr->typeCode[0] = '\0';
-    curr->typeLong[0] = '\0';
-    curr->ownOp[0] = '\0';
-    curr->year[0] = '\0';
-    curr->dbFlags = 0;
+// zero fill like strncpy, the fields aren't necessarily terminated
+static void copyDetail(char *target, int alloc, const char *str) {
+    int len = strnlen(str, alloc);
+    memcpy(target, str, len);
+    memset(target + len, 0, alloc - len);
 }
 
 void updateTypeReg(struct aircraft *a) {
-    dbEntry *d = dbGet(a->addr, Modes.dbIndex);
+    epochEnter();
+    struct dbBin *db = atomic_load(&Modes.dbBin);
+    const struct dbBinRecord *d = dbBinFind(db, a->addr);
     if (d) {
-        updateDetails(a, Modes.dbRaw, d->rawOffset);
+        copyDetail(a->registration, sizeof(a->registration), dbBinString(db, d->registration));
+        copyDetail(a->typeCode, sizeof(a->typeCode), dbBinString(db, d->typeCode));
+        copyDetail(a->typeLong, sizeof(a->typeLong), dbBinString(db, d->typeLong));
+        copyDetail(a->year, sizeof(a->year), dbBinString(db, d->year));
+        copyDetail(a->ownOp, sizeof(a->ownOp), dbBinString(db, d->ownOp));
+        a->dbFlags = d->dbFlags;
     } else {
         a->registration[0] = '\0';
         a->typeCode[0] = '\0';
@@ -898,6 +645,9 @@ void updateTypeReg(struct aircraft *a) {
         a->year[0] = '\0';
         a->dbFlags = 0;
     }
+    a->dbGeneration = db ? db->generation : 0;
+    epochExit();
+
     if (is_df18_exception(a->addr)) {
         a->is_df18_exception = 1;
     }
@@ -905,6 +655,13 @@ void updateTypeReg(struct aircraft *a) {
         a->dbFlags |= 1;
     }
 }
+
+int dbContains(uint32_t addr) {
+    epochEnter();
+    int res = dbBinFind(atomic_load(&Modes.dbBin), addr) != NULL;
+    epochExit();
+    return res;
+}
 static int isMilRange(uint32_t i) {
     return
         false
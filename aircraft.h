@@ -39,14 +39,8 @@ struct aircraft *aircraftGet(uint32_t addr);
 struct aircraft *aircraftCreate(uint32_t addr);
 void freeAircraft(struct aircraft *a);
 
-typedef struct dbEntry {
-    struct dbEntry *next;
-    uint32_t addr;
-    uint32_t rawOffset;
-} dbEntry;
-
-dbEntry *dbGet(uint32_t addr, dbEntry **index);
-void dbPut(uint32_t addr, dbEntry **index, dbEntry *d);
+// 1 if addr is in the aircraft database
+int dbContains(uint32_t addr);
 
 #define BINCRAFT_ALT_FACTOR (1.0f/25.0f)
 
@@ -183,7 +177,6 @@ struct binCraft {
 
 void toBinCraft(struct aircraft *a, struct binCraft *new, int64_t now);
 int dbUpdate(int64_t now);
-int dbFinishUpdate();
 
 void updateTypeReg(struct aircraft *a);
 
@@ -0,0 +1,428 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// aircraft_db.c: binary aircraft database
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+#define fieldSize(field) ((int) sizeof(((struct aircraft *) 0)->field))
+
+// rudimentary sanitization so the json output hopefully won't be invalid
+static inline void sanitize(char *str, int len) {
+    unsigned char b2 = (1<<7) + (1<<6); // 2 byte code or more
+    unsigned char b3 = (1<<7) + (1<<6) + (1<<5); // 3 byte code or more
+    unsigned char b4 = (1<<7) + (1<<6) + (1<<5) + (1<<4); // 4 byte code
+
+    int debug = 0;
+
+    // UTF that goes beyond our string is cut off by terminating the string
+
+    if (len >= 3 && (str[len - 3] & b4) == b4) {
+        if (debug) { fprintf(stderr, "b4%d\n", str[len - 3]); }
+        str[len - 3] = '\0';
+    }
+    if (len >= 2 && (str[len - 2] & b3) == b3) {
+        if (debug) { fprintf(stderr, "b3%d\n", str[len - 2]); }
+        str[len - 2] = '\0';
+    }
+    if (len >= 1 && (str[len - 1] & b2) == b2) {
+        if (debug) { fprintf(stderr, "b2%d\n", str[len - 1]); }
+        str[len - 1] = '\0';
+    }
+    char *p = str;
+    // careful str might be unterminated, use len
+    while(p - str < len) {
+        if (*p == '"') {
+            //if (debug) { fprintf(stderr, "quotation marks: %s\n", str); }
+            // replace with single quote
+            *p = '\'';
+        }
+        if (*p > 0 && *p < 0x1f) {
+            if (debug) { fprintf(stderr, "non-printable: %s\n", str); }
+            // replace with space
+            *p = ' ';
+        }
+        p++;
+    }
+    if (p - 1 >= str && *(p - 1) == '\\') {
+        *(p - 1) = '\0';
+    }
+}
+
+// get next CSV token based on the assumption eot points to the previous delimiter
+static inline int nextToken(char delim, char **sot, char **eot, char **eol) {
+    *sot = *eot + 1;
+    if (*sot >= *eol)
+        return 0;
+    *eot = memchr(*sot, delim, *eol - *sot);
+
+    if (!*eot)
+        return 0;
+
+    return 1;
+}
+
+// string pool with deduplication, type codes / descriptions / owners repeat a lot
+struct poolBuilder {
+    char *buf;
+    uint64_t len;
+    uint64_t alloc;
+    uint32_t *table; // offsets, 0: empty slot
+    uint32_t tableBits;
+    uint32_t tableCount;
+};
+
+static uint32_t poolHash(const char *str, int len) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char) str[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void poolTableInsert(struct poolBuilder *pb, uint32_t offset) {
+    const char *str = pb->buf + offset;
+    uint32_t mask = (1 << pb->tableBits) - 1;
+    uint32_t i = poolHash(str, strlen(str)) & mask;
+    while (pb->table[i]) {
+        i = (i + 1) & mask;
+    }
+    pb->table[i] = offset;
+}
+
+static void poolTableGrow(struct poolBuilder *pb) {
+    uint32_t *old = pb->table;
+    uint32_t oldSize = old ? (1 << pb->tableBits) : 0;
+    pb->tableBits = old ? pb->tableBits + 1 : 16;
+    pb->table = cmCalloc((1 << pb->tableBits) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < oldSize; i++) {
+        if (old[i]) {
+            poolTableInsert(pb, old[i]);
+        }
+    }
+    sfree(old);
+}
+
+// returns the offset of str in the pool, len is the string length without termination
+static uint32_t poolAdd(struct poolBuilder *pb, const char *str, int len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (!pb->table || pb->tableCount >= (1u << pb->tableBits) / 2) {
+        poolTableGrow(pb);
+    }
+    uint32_t mask = (1 << pb->tableBits) - 1;
+    uint32_t i = poolHash(str, len) & mask;
+    while (pb->table[i]) {
+        const char *cand = pb->buf + pb->table[i];
+        if (strncmp(cand, str, len) == 0 && cand[len] == '\0') {
+            return pb->table[i];
+        }
+        i = (i + 1) & mask;
+    }
+    if (pb->len + len + 1 > pb->alloc) {
+        pb->alloc = 2 * (pb->len + len + 1);
+        pb->buf = cmRealloc(pb->buf, pb->alloc);
+    }
+    uint32_t offset = pb->len;
+    memcpy(pb->buf + offset, str, len);
+    pb->buf[offset + len] = '\0';
+    pb->len += len + 1;
+    pb->table[i] = offset;
+    pb->tableCount++;
+    return offset;
+}
+
+// cut to the size of the aircraft struct field and sanitize, like the csv was always handled
+static uint32_t poolAddField(struct poolBuilder *pb, char *sot, char *eot, int alloc) {
+    char tmp[256];
+    int len = imin(imin(alloc, eot - sot), (int) sizeof(tmp));
+    memcpy(tmp, sot, len);
+    sanitize(tmp, len);
+    return poolAdd(pb, tmp, strnlen(tmp, len));
+}
+
+struct csvEntry {
+    struct dbBinRecord rec;
+    uint32_t line;
+};
+
+static int csvEntryCompare(const void *p1, const void *p2) {
+    const struct csvEntry *e1 = p1;
+    const struct csvEntry *e2 = p2;
+    if (e1->rec.addr != e2->rec.addr) {
+        return e1->rec.addr < e2->rec.addr ? -1 : 1;
+    }
+    return (e1->line > e2->line) - (e1->line < e2->line);
+}
+
+static void dbBinInit(struct dbBin *db) {
+    const struct dbBinHeader *header = db->base;
+    db->count = header->count;
+    db->records = (const struct dbBinRecord *) ((const char *) db->base + sizeof(struct dbBinHeader));
+    db->pool = (const char *) db->base + header->poolOffset;
+}
+
+struct dbBin *dbBinFromCsv(struct char_buffer csv) {
+    uint32_t lines = 0;
+    // memchr is not faster, seems the compiler is smart enough to optimize a simple loop that counts the newlines
+    for (uint32_t i = 0; i < csv.len; i++) {
+        if (csv.buffer[i] == '\n')
+            lines++;
+    }
+
+    struct csvEntry *entries = cmalloc(imax(1, lines) * sizeof(struct csvEntry));
+    struct poolBuilder pb = { 0 };
+    pb.alloc = 1024 * 1024;
+    pb.buf = cmalloc(pb.alloc);
+    pb.buf[0] = '\0';
+    pb.len = 1;
+
+    char *eob = csv.buffer + csv.len;
+    char *sol = csv.buffer;
+    char *eol;
+    uint32_t n = 0;
+    for (; eob > sol && (eol = memchr(sol, '\n', eob - sol)); sol = eol + 1) {
+        char *sot;
+        char *eot = sol - 1; // this pointer must not be dereferenced, nextToken will increment it.
+
+        struct csvEntry *e = &entries[n];
+        memset(e, 0, sizeof(struct csvEntry));
+        e->line = n;
+        struct dbBinRecord *rec = &e->rec;
+
+        if (!nextToken(';', &sot, &eot, &eol)) continue;
+        rec->addr = strtol(sot, NULL, 16);
+        if (rec->addr == 0)
+            continue;
+
+        if (!nextToken(';', &sot, &eot, &eol)) continue;
+        n++;
+
+        // an incomplete line is kept with empty details
+        rec->registration = poolAddField(&pb, sot, eot, fieldSize(registration));
+
+        if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
+        rec->typeCode = poolAddField(&pb, sot, eot, fieldSize(typeCode));
+
+        if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
+        for (int j = 0; j < 8 * (int) sizeof(rec->dbFlags) && sot < eot; j++, sot++)
+            rec->dbFlags |= ((*sot == '1') << j);
+
+        if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
+        rec->typeLong = poolAddField(&pb, sot, eot, fieldSize(typeLong));
+
+        if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
+        rec->year = poolAddField(&pb, sot, eot, fieldSize(year));
+
+        if (!nextToken(';', &sot, &eot, &eol)) goto BAD_ENTRY;
+        rec->ownOp = poolAddField(&pb, sot, eot, fieldSize(ownOp));
+
+        continue;
+BAD_ENTRY:
+        {
+            uint32_t addr = rec->addr;
+            memset(rec, 0, sizeof(*rec));
+            rec->addr = addr;
+        }
+    }
+    sfree(csv.buffer);
+    sfree(pb.table);
+
+    // for duplicate hex ids the last line wins
+    qsort(entries, n, sizeof(struct csvEntry), csvEntryCompare);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (i + 1 < n && entries[i + 1].rec.addr == entries[i].rec.addr) {
+            continue;
+        }
+        entries[count++] = entries[i];
+    }
+
+    uint64_t poolOffset = sizeof(struct dbBinHeader) + (uint64_t) count * sizeof(struct dbBinRecord);
+    size_t size = poolOffset + pb.len;
+
+    struct dbBin *db = cmCalloc(sizeof(struct dbBin));
+    db->base = cmalloc(size);
+    db->size = size;
+
+    struct dbBinHeader *header = db->base;
+    *header = (struct dbBinHeader) {
+        .magic = DBBIN_MAGIC,
+        .version = DBBIN_VERSION,
+        .count = count,
+        .recordSize = sizeof(struct dbBinRecord),
+        .poolOffset = poolOffset,
+        .poolSize = pb.len,
+    };
+    struct dbBinRecord *records = (struct dbBinRecord *) ((char *) db->base + sizeof(struct dbBinHeader));
+    for (uint32_t i = 0; i < count; i++) {
+        records[i] = entries[i].rec;
+    }
+    memcpy((char *) db->base + poolOffset, pb.buf, pb.len);
+
+    sfree(entries);
+    sfree(pb.buf);
+
+    dbBinInit(db);
+    memAccountAlloc(MEM_DATABASE, db->base);
+    return db;
+}
+
+// make sure lookups can't read outside the mapping
+static int dbBinCheck(struct dbBin *db, const char *file) {
+    const struct dbBinHeader *header = db->base;
+    if (db->size < sizeof(struct dbBinHeader)
+            || header->magic != DBBIN_MAGIC
+            || header->version != DBBIN_VERSION
+            || header->recordSize != sizeof(struct dbBinRecord)) {
+        fprintf(stderr, "%s: not a binary aircraft database or unsupported version\n", file);
+        return 0;
+    }
+    if (header->poolOffset != sizeof(struct dbBinHeader) + (uint64_t) header->count * sizeof(struct dbBinRecord)
+            || header->poolSize < 1
+            || header->poolOffset + header->poolSize != db->size) {
+        fprintf(stderr, "%s: binary aircraft database has an invalid size\n", file);
+        return 0;
+    }
+    dbBinInit(db);
+    uint64_t poolSize = header->poolSize;
+    if (db->pool[0] != '\0' || db->pool[poolSize - 1] != '\0') {
+        fprintf(stderr, "%s: binary aircraft database string pool is damaged\n", file);
+        return 0;
+    }
+    for (uint32_t i = 0; i < db->count; i++) {
+        const struct dbBinRecord *r = &db->records[i];
+        if ((i > 0 && r->addr <= db->records[i - 1].addr)
+                || r->registration >= poolSize || r->typeCode >= poolSize || r->typeLong >= poolSize
+                || r->year >= poolSize || r->ownOp >= poolSize) {
+            fprintf(stderr, "%s: binary aircraft database record %u is damaged\n", file, i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+struct dbBin *dbBinOpen(const char *file) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        perror(file);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(struct dbBinHeader)) {
+        fprintf(stderr, "%s: binary aircraft database too small\n", file);
+        close(fd);
+        return NULL;
+    }
+    // the mapping stays valid when the file is replaced by rename(), it must not be modified in place
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(file);
+        return NULL;
+    }
+
+    struct dbBin *db = cmCalloc(sizeof(struct dbBin));
+    db->base = base;
+    db->size = st.st_size;
+    db->mmapped = 1;
+
+    if (!dbBinCheck(db, file)) {
+        dbBinFree(db);
+        return NULL;
+    }
+    return db;
+}
+
+void dbBinFree(void *arg) {
+    struct dbBin *db = arg;
+    if (!db) {
+        return;
+    }
+    if (db->mmapped) {
+        munmap(db->base, db->size);
+    } else {
+        memAccountFree(MEM_DATABASE, db->base);
+        sfree(db->base);
+    }
+    sfree(db);
+}
+
+int dbBinWrite(struct dbBin *db, const char *file) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, PATH_MAX, "%s.tmp", file);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(tmp);
+        return -1;
+    }
+    const char *p = db->base;
+    size_t left = db->size;
+    while (left > 0) {
+        ssize_t res = write(fd, p, left);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror(tmp);
+            close(fd);
+            unlink(tmp);
+            return -1;
+        }
+        p += res;
+        left -= res;
+    }
+    if (close(fd) || rename(tmp, file)) {
+        perror(file);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+const struct dbBinRecord *dbBinFind(struct dbBin *db, uint32_t addr) {
+    if (!db) {
+        return NULL;
+    }
+    uint32_t lo = 0;
+    uint32_t hi = db->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t cand = db->records[mid].addr;
+        if (cand == addr) {
+            return &db->records[mid];
+        }
+        if (cand < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+int dbBinIsBinary(const char *file) {
+    uint32_t magic = 0;
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t res = read(fd, &magic, sizeof(magic));
+    close(fd);
+    return res == sizeof(magic) && magic == DBBIN_MAGIC;
+}
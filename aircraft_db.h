@@ -0,0 +1,69 @@
+#ifndef AIRCRAFT_DB_H
+#define AIRCRAFT_DB_H
+
+// Binary aircraft database (--db-file)
+//
+// Fixed width records sorted by hex followed by a pool of zero terminated strings. The file is
+// mmapped and searched in place, nothing has to be parsed when it is loaded.
+// The csv database (https://github.com/wiedehopf/tar1090-db/tree/csv) is converted into the same
+// layout in memory when loaded, db_convert writes the binary file from it.
+//
+// Strings are sanitized for json output and cut to the size of the fields in struct aircraft
+// when the database is built.
+
+#define DBBIN_MAGIC (0x31424452) // "RDB1"
+#define DBBIN_VERSION (1)
+
+struct dbBinHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count; // number of records
+    uint32_t recordSize; // sizeof(struct dbBinRecord)
+    uint64_t poolOffset; // offset of the string pool from the start of the file
+    uint64_t poolSize;
+};
+
+// string fields are offsets into the string pool, 0 is the empty string
+struct dbBinRecord {
+    uint32_t addr;
+    uint32_t registration;
+    uint32_t typeCode;
+    uint32_t typeLong;
+    uint32_t year;
+    uint32_t ownOp;
+    uint16_t dbFlags;
+    uint16_t reserved;
+};
+
+struct dbBin {
+    const struct dbBinRecord *records;
+    const char *pool;
+    uint32_t count;
+    int64_t generation; // unique per loaded database, see updateTypeReg()
+    void *base;
+    size_t size;
+    int mmapped;
+};
+
+// mmap a binary database, returns NULL if the file isn't one or is damaged
+struct dbBin *dbBinOpen(const char *file);
+
+// build a database in memory from the csv format, takes ownership of csv.buffer
+struct dbBin *dbBinFromCsv(struct char_buffer csv);
+
+// write db in the binary format, atomically replaces file
+int dbBinWrite(struct dbBin *db, const char *file);
+
+void dbBinFree(void *db);
+
+// binary search by hex, NULL if not found
+const struct dbBinRecord *dbBinFind(struct dbBin *db, uint32_t addr);
+
+static inline const char *dbBinString(struct dbBin *db, uint32_t offset) {
+    return db->pool + offset;
+}
+
+// 1 if the file starts with DBBIN_MAGIC
+int dbBinIsBinary(const char *file);
+
+#endif
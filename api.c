@@ -44,6 +44,28 @@ static inline uint32_t callsignHash(char *callsign, struct apiBuffer *buffer) {
     return (uint32_t) res;
 }
 
+static inline uint32_t typeHash(char *typeCode, struct apiBuffer *buffer) {
+    const uint64_t seed = 0x30732349f7810465ULL;
+    uint64_t h = fasthash64(typeCode, memberSize(struct binCraft, typeCode), seed);
+
+    uint32_t bits = buffer->hashBits;
+    uint64_t res = h ^ (h >> 32);
+
+    if (bits < 16)
+        res ^= (res >> 16);
+
+    res ^= (res >> bits);
+
+    // mask to fit the requested bit width
+    res &= (((uint64_t) 1) << bits) - 1;
+
+    return (uint32_t) res;
+}
+
+static inline uint32_t squawkHash(unsigned squawk, struct apiBuffer *buffer) {
+    return addrHash(squawk, buffer->hashBits);
+}
+
 static int antiSpam(int64_t *nextPrint, int64_t interval) {
     int64_t now = mstime();
     if (now > *nextPrint) {
@@ -133,17 +155,21 @@ static int filter_uuid(struct apiEntry *haystack, int haylen, struct apiEntry *m
 }
 #endif
 
+// barometric altitude in ft as used by the altitude filter, ground is 0, INT32_MIN if unknown
+static inline int32_t apiAltBaro(struct apiEntry *e) {
+    if (e->bin.baro_alt_valid) {
+        return e->bin.baro_alt * (1.0f / BINCRAFT_ALT_FACTOR);
+    } else if (e->bin.airground == AG_GROUND) {
+        return 0;
+    }
+    return INT32_MIN;
+}
+
 static int filter_alt_baro(struct apiEntry *haystack, int haylen, struct apiEntry *matches, size_t *alloc, struct apiOptions *options) {
     int count = 0;
-    float reverse_alt_factor = 1.0f / BINCRAFT_ALT_FACTOR;
     for (int i = 0; i < haylen; i++) {
         struct apiEntry *e = &haystack[i];
-        int32_t alt = INT32_MIN;
-        if (e->bin.baro_alt_valid) {
-            alt = e->bin.baro_alt * reverse_alt_factor;
-        } else if (e->bin.airground == AG_GROUND) {
-            alt = 0;
-        }
+        int32_t alt = apiAltBaro(e);
         if (alt >= options->above_alt_baro && alt <= options->below_alt_baro && alt != INT32_MIN) {
             matches[count++] = *e;
             *alloc += e->jsonOffset.len;
@@ -253,12 +279,9 @@ static int inLatRange(struct apiEntry *e, int32_t lat1, int32_t lat2, struct api
     return (e->bin.lat >= lat1 && e->bin.lat <= lat2 && (e->bin.position_valid || options->binCraft));
 }
 
-static int findInBox(struct apiEntry *haystack, int haylen, struct apiOptions *options, struct apiEntry *matches, size_t *alloc) {
-    double *box = options->box;
-    struct range r[2];
-    memset(r, 0, sizeof(r));
-    int count = 0;
-
+// lon ranges in haystack and lat bounds of the box
+static void boxBounds(double *box, struct apiEntry *haystack, int haylen, struct range *r, int32_t *lat1Out, int32_t *lat2Out) {
+    memset(r, 0, 2 * sizeof(struct range));
 
     int32_t lat1 = (int32_t) (box[0] * 1E6);
     int32_t lat2 = (int32_t) (box[1] * 1E6);
@@ -272,6 +295,18 @@ static int findInBox(struct apiEntry *haystack, int haylen, struct apiOptions *o
         r[1] = findLonRange(-180E6, lon2, haystack, haylen);
         //fprintf(stderr, "%.1f to 180 and -180 to %1.f\n", lon1 / 1E6, lon2 / 1E6);
     }
+    *lat1Out = lat1;
+    *lat2Out = lat2;
+}
+
+static int findInBox(struct apiEntry *haystack, int haylen, struct apiOptions *options, struct apiEntry *matches, size_t *alloc) {
+    double *box = options->box;
+    struct range r[2];
+    int count = 0;
+    int32_t lat1, lat2;
+
+    boxBounds(box, haystack, haylen, r, &lat1, &lat2);
+
     for (int k = 0; k < 2; k++) {
         for (int j = r[k].from; j < r[k].to; j++) {
             struct apiEntry *e = &haystack[j];
@@ -373,15 +408,13 @@ static int filterSquawkList(struct apiEntry *haystack, int haylen, unsigned *squ
     }
     return count;
 }
-static int findInCircle(struct apiEntry *haystack, int haylen, struct apiOptions *options, struct apiEntry *matches, size_t *alloc) {
-    struct apiCircle *circle = &options->circle;
-    struct range r[2];
-    memset(r, 0, sizeof(r));
-    int count = 0;
+// lon ranges in haystack and lat bounds of a box enclosing the circle
+static void circleBounds(struct apiCircle *circle, struct apiEntry *haystack, int haylen, struct range *r, int32_t *lat1Out, int32_t *lat2Out) {
     double lat = circle->lat;
     double lon = circle->lon;
     double radius = circle->radius; // in meters
-    bool onlyClosest = circle->onlyClosest;
+
+    memset(r, 0, 2 * sizeof(struct range));
 
     double circum = 40075e3; // earth circumference is 40075km
     double fudge = 1.002; // make the box we check a little bigger
@@ -419,6 +452,22 @@ static int findInCircle(struct apiEntry *haystack, int haylen, struct apiOptions
         r[1] = findLonRange(-180E6, lon2, haystack, haylen);
         //fprintf(stderr, "%.1f to 180 and -180 to %1.f\n", lon1 / 1E6, lon2 / 1E6);
     }
+    *lat1Out = lat1;
+    *lat2Out = lat2;
+}
+
+static int findInCircle(struct apiEntry *haystack, int haylen, struct apiOptions *options, struct apiEntry *matches, size_t *alloc) {
+    struct apiCircle *circle = &options->circle;
+    struct range r[2];
+    int count = 0;
+    double lat = circle->lat;
+    double lon = circle->lon;
+    double radius = circle->radius; // in meters
+    bool onlyClosest = circle->onlyClosest;
+    int32_t lat1, lat2;
+
+    circleBounds(circle, haystack, haylen, r, &lat1, &lat2);
+
     if (onlyClosest) {
         bool found = false;
         double minDistance = 300E6; // larger than any distances we encounter, also how far light travels in a second
@@ -476,11 +525,347 @@ static struct apiEntry *apiAlloc(int count) {
     return buf;
 }
 
-static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *options) {
+// upper case / pad the list inputs, the filter functions do the same (idempotent)
+static void apiNormalizeOptions(struct apiOptions *options) {
+    int typeLen = memberSize(struct binCraft, typeCode);
+    for (int i = 0; i < options->typeCount * typeLen; i++) {
+        options->typeList[i] = toupper(options->typeList[i]);
+    }
+    for (int i = 0; options->callsign_prefix[i]; i++) {
+        options->callsign_prefix[i] = toupper(options->callsign_prefix[i]);
+    }
+    if (options->filter_callsign_exact) {
+        int callLen = memberSize(struct binCraft, callsign);
+        for (int i = 0; i < callLen; i++) {
+            if (options->callsign_exact[i] == '\0') {
+                options->callsign_exact[i] = ' ';
+            }
+            options->callsign_exact[i] = toupper(options->callsign_exact[i]);
+        }
+    }
+}
+
+static inline int inTypeList(struct apiEntry *e, struct apiOptions *options) {
+    int typeLen = memberSize(struct binCraft, typeCode);
+    for (int k = 0; k < options->typeCount; k++) {
+        if (strncmp(e->bin.typeCode, options->typeList + typeLen * k, typeLen) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    int flip = atomic_load(&Modes.apiFlip[thread->index]);
+static inline int inSquawkList(struct apiEntry *e, struct apiOptions *options) {
+    if (!e->bin.squawk_valid) {
+        return 0;
+    }
+    for (int k = 0; k < options->squawkCount; k++) {
+        if (e->bin.squawk == options->squawkList[k]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline int inLonRange(int32_t lon, int32_t lon1, int32_t lon2) {
+    if (lon < -180E6 || lon > 180E6) {
+        return 0;
+    }
+    if (lon1 <= lon2) {
+        return lon >= lon1 && lon <= lon2;
+    } else {
+        return lon >= lon1 || lon <= lon2;
+    }
+}
+
+// check all predicates of the query for a single entry, same semantics as the primary selectors and filter passes
+// on a match the entry is copied to out (with distance / direction for circle queries)
+static int apiMatchEntry(struct apiEntry *e, struct apiOptions *options, struct apiEntry *out) {
+    double dist = 0;
+    if (options->is_box) {
+        double *box = options->box;
+        if (!inLatRange(e, box[0] * 1E6, box[1] * 1E6, options)
+                || !inLonRange(e->bin.lon, box[2] * 1E6, box[3] * 1E6)) {
+            return 0;
+        }
+    } else if (options->is_circle) {
+        struct apiCircle *circle = &options->circle;
+        if (!inLatRange(e, -90E6, 90E6, options) || !inLonRange(e->bin.lon, -180E6, 180E6)) {
+            return 0;
+        }
+        dist = greatcircle(circle->lat, circle->lon, e->bin.lat / 1E6, e->bin.lon / 1E6, 0);
+        if (!(dist < circle->radius)) {
+            return 0;
+        }
+    } else if (options->is_typeList) {
+        if (!inTypeList(e, options)) {
+            return 0;
+        }
+    } else if (options->is_squawkList) {
+        if (!inSquawkList(e, options)) {
+            return 0;
+        }
+    } else if (options->all_with_pos) {
+        if (e->bin.lon < -180E6 || e->bin.lon > 180E6) {
+            return 0;
+        }
+    }
+
+    if ((options->filter_with_pos || options->all_with_pos) && !e->bin.position_valid) {
+        return 0;
+    }
+    if (options->filter_dbFlag && !(
+                (options->filter_mil && (e->bin.dbFlags & 1))
+                || (options->filter_interesting && (e->bin.dbFlags & 2))
+                || (options->filter_pia && (e->bin.dbFlags & 4))
+                || (options->filter_ladd && (e->bin.dbFlags & 8)))) {
+        return 0;
+    }
+#if defined(WITH_UUIDS)
+    if (options->filter_uuid) {
+        int match = 0;
+        for (int i = 0; i < RECENT_RECEIVER_IDS; i++) {
+            match += (e->recentReceiverIds[i] == options->filter_uuid);
+        }
+        if (!match) {
+            return 0;
+        }
+    }
+#endif
+    if (options->filter_alt_baro) {
+        int32_t alt = apiAltBaro(e);
+        if (alt == INT32_MIN || alt < options->above_alt_baro || alt > options->below_alt_baro) {
+            return 0;
+        }
+    }
+    if (options->filter_callsign_prefix && !(e->bin.callsign_valid
+                && strncmp(e->bin.callsign, options->callsign_prefix, strlen(options->callsign_prefix)) == 0)) {
+        return 0;
+    }
+    if (options->filter_callsign_exact && !(e->bin.callsign_valid
+                && strncmp(e->bin.callsign, options->callsign_exact, memberSize(struct binCraft, callsign)) == 0)) {
+        return 0;
+    }
+    if (options->filter_squawkList && !inSquawkList(e, options)) {
+        return 0;
+    }
+    if (options->filter_typeList && !inTypeList(e, options)) {
+        return 0;
+    }
+
+    *out = *e;
+    if (options->is_circle) {
+        struct apiCircle *circle = &options->circle;
+        out->distance = (float) dist;
+        out->direction = (float) bearing(circle->lat, circle->lon, e->bin.lat / 1E6, e->bin.lon / 1E6);
+    }
+    return 1;
+}
+
+// first index in a sorted index with a key >= ref (cmp returns the sign of key - ref)
+static int indexLowerBound(struct apiEntry **index, int len, int (*cmp)(struct apiEntry *, void *), void *ref) {
+    int lo = 0;
+    int hi = len;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cmp(index[mid], ref) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int cmpAltBelow(struct apiEntry *e, void *ref) {
+    // entries with alt <= ref sort before the bound
+    return apiAltBaro(e) <= *(int32_t *) ref ? -1 : 1;
+}
+static int cmpAltAbove(struct apiEntry *e, void *ref) {
+    return apiAltBaro(e) < *(int32_t *) ref ? -1 : 1;
+}
+static int cmpPrefixBefore(struct apiEntry *e, void *ref) {
+    char *prefix = ref;
+    return strncmp(e->bin.callsign, prefix, strlen(prefix)) < 0 ? -1 : 1;
+}
+static int cmpPrefixAfter(struct apiEntry *e, void *ref) {
+    char *prefix = ref;
+    return strncmp(e->bin.callsign, prefix, strlen(prefix)) <= 0 ? -1 : 1;
+}
+
+// candidates of a secondary index, only counted if out is NULL
+static int apiSourceCandidates(struct apiBuffer *buffer, struct apiOptions *options, enum apiSource source, struct apiEntry **out) {
+    int count = 0;
+    if (source == API_SRC_TYPE) {
+        int typeLen = memberSize(struct binCraft, typeCode);
+        for (int k = 0; k < options->typeCount; k++) {
+            char *typeCode = options->typeList + typeLen * k;
+            int dupe = 0;
+            for (int l = 0; l < k; l++) {
+                dupe |= (strncmp(typeCode, options->typeList + typeLen * l, typeLen) == 0);
+            }
+            if (dupe) {
+                continue;
+            }
+            for (struct apiEntry *e = buffer->typeHash[typeHash(typeCode, buffer)]; e; e = e->nextType) {
+                if (strncmp(e->bin.typeCode, typeCode, typeLen) == 0) {
+                    if (out) { out[count] = e; }
+                    count++;
+                }
+            }
+        }
+    } else if (source == API_SRC_SQUAWK) {
+        for (int k = 0; k < options->squawkCount; k++) {
+            unsigned squawk = options->squawkList[k];
+            int dupe = 0;
+            for (int l = 0; l < k; l++) {
+                dupe |= (squawk == options->squawkList[l]);
+            }
+            if (dupe) {
+                continue;
+            }
+            for (struct apiEntry *e = buffer->squawkHash[squawkHash(squawk, buffer)]; e; e = e->nextSquawk) {
+                if (e->bin.squawk == squawk) {
+                    if (out) { out[count] = e; }
+                    count++;
+                }
+            }
+        }
+    } else if (source == API_SRC_ALT) {
+        int from = indexLowerBound(buffer->altIndex, buffer->altIndexLen, cmpAltAbove, &options->above_alt_baro);
+        int to = indexLowerBound(buffer->altIndex, buffer->altIndexLen, cmpAltBelow, &options->below_alt_baro);
+        for (int i = from; i < to; i++) {
+            if (out) { out[count] = buffer->altIndex[i]; }
+            count++;
+        }
+    } else if (source == API_SRC_CALLSIGN_PREFIX) {
+        int from = indexLowerBound(buffer->callsignIndex, buffer->callsignIndexLen, cmpPrefixBefore, options->callsign_prefix);
+        int to = indexLowerBound(buffer->callsignIndex, buffer->callsignIndexLen, cmpPrefixAfter, options->callsign_prefix);
+        for (int i = from; i < to; i++) {
+            if (out) { out[count] = buffer->callsignIndex[i]; }
+            count++;
+        }
+    } else if (source == API_SRC_CALLSIGN) {
+        int callLen = memberSize(struct binCraft, callsign);
+        for (struct apiEntry *e = buffer->callsignHash[callsignHash(options->callsign_exact, buffer)]; e; e = e->nextCallsign) {
+            if (strncmp(e->bin.callsign, options->callsign_exact, callLen) == 0) {
+                if (out) { out[count] = e; }
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// query planner: if one of the secondary indexes yields fewer candidates than the primary selector
+// has to look at, walk that index and check all predicates per candidate
+// returns -2 if the primary selector is the better choice
+static int apiFindIndexed(struct apiBuffer *buffer, struct apiOptions *options, struct apiEntry **matchesOut, size_t *alloc) {
+    if (options->is_hexList || options->is_regList || options->is_callsignList) {
+        // hash lookups, hardly anything to filter
+        return -2;
+    }
+    if (options->is_circle && options->circle.onlyClosest) {
+        // closest picks the closest aircraft in the circle before the filters are applied,
+        // a candidate from an index would be the closest one passing the filters
+        return -2;
+    }
+
+    struct apiEntry *haystack = options->filter_dbFlag ? buffer->list_flag : buffer->list;
+    int haylen = options->filter_dbFlag ? buffer->len_flag : buffer->len;
+
+    apiNormalizeOptions(options);
+
+    // number of entries the primary selector looks at
+    int bestCost;
+    struct range r[2];
+    int32_t lat1, lat2;
+    if (options->is_box) {
+        boxBounds(options->box, haystack, haylen, r, &lat1, &lat2);
+        bestCost = (r[0].to - r[0].from) + (r[1].to - r[1].from);
+    } else if (options->is_circle) {
+        circleBounds(&options->circle, haystack, haylen, r, &lat1, &lat2);
+        bestCost = (r[0].to - r[0].from) + (r[1].to - r[1].from);
+    } else if (options->all_with_pos) {
+        struct range pos = options->filter_dbFlag ? buffer->list_flag_pos_range : buffer->list_pos_range;
+        bestCost = pos.to - pos.from;
+    } else {
+        bestCost = haylen;
+    }
+
+    enum apiSource best = API_SRC_PRIMARY;
+    enum apiSource sources[5];
+    int sourceCount = 0;
+    if (options->is_typeList || options->filter_typeList) {
+        sources[sourceCount++] = API_SRC_TYPE;
+    }
+    if (options->is_squawkList || options->filter_squawkList) {
+        sources[sourceCount++] = API_SRC_SQUAWK;
+    }
+    if (options->filter_alt_baro) {
+        sources[sourceCount++] = API_SRC_ALT;
+    }
+    if (options->filter_callsign_prefix) {
+        sources[sourceCount++] = API_SRC_CALLSIGN_PREFIX;
+    }
+    if (options->filter_callsign_exact) {
+        sources[sourceCount++] = API_SRC_CALLSIGN;
+    }
+    for (int i = 0; i < sourceCount; i++) {
+        int cost = apiSourceCandidates(buffer, options, sources[i], NULL);
+        if (cost < bestCost) {
+            bestCost = cost;
+            best = sources[i];
+        }
+    }
+
+    if (best == API_SRC_PRIMARY) {
+        return -2;
+    }
+
+    struct apiEntry **candidates = cmalloc((bestCost + 1) * sizeof(struct apiEntry *));
+    struct apiEntry *matches = apiAlloc(bestCost + 1);
+    if (!candidates || !matches) {
+        sfree(candidates);
+        sfree(matches);
+        return -1;
+    }
+    int candidateCount = apiSourceCandidates(buffer, options, best, candidates);
+
+    int count = 0;
+    for (int i = 0; i < candidateCount; i++) {
+        if (!apiMatchEntry(candidates[i], options, &matches[count])) {
+            continue;
+        }
+        count++;
+    }
+    sfree(candidates);
+
+    // keep the order of the primary selectors
+    qsort(matches, count, sizeof(struct apiEntry), compareLon);
+
+    for (int i = 0; i < count; i++) {
+        *alloc += matches[i].jsonOffset.len;
+    }
+    if (options->is_circle) {
+        *alloc += count * 30;
+    }
+
+    *matchesOut = matches;
+    return count;
+}
+
+// select the entries matching the options
+// matches either points into the buffer or is allocated (doFree is set)
+// alloc is increased by the approximate json size of the matches
+// returns the number of matches or -1 on allocation failure
+static int apiFind(struct apiBuffer *buffer, struct apiOptions *options, struct apiEntry **matchesOut, int *doFreeOut, size_t *allocOut) {
+    int indexed = apiFindIndexed(buffer, options, matchesOut, allocOut);
+    if (indexed != -2) {
+        *doFreeOut = (indexed >= 0);
+        return indexed;
+    }
 
-    struct apiBuffer *buffer = &Modes.apiBuffer[flip];
     struct apiEntry *haystack;
     int haylen;
     struct range pos_range;
@@ -503,10 +888,9 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
         all_range.to = haylen;
     }
 
-    struct char_buffer cb = { 0 };
     struct apiEntry *matches = NULL;
 
-    size_t alloc_base = API_REQ_PADSTART + 1024;
+    size_t alloc_base = *allocOut;
     size_t alloc = alloc_base;
     int count = 0;
 
@@ -521,7 +905,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
             combined_len += options->hexCount;
         }
 
-        doFree = 1; matches = apiAlloc(combined_len); if (!matches) { return cb; };
+        doFree = 1; matches = apiAlloc(combined_len); if (!matches) { return -1; };
 
         // first get matches for the box
         count = findInBox(haystack, haylen, options, matches, &alloc);
@@ -531,29 +915,29 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
             count += findHexList(buffer, options->hexList, options->hexCount, matches + count, &alloc);
         }
     } else if (options->is_circle) {
-        doFree = 1; matches = apiAlloc(haylen); if (!matches) { return cb; };
+        doFree = 1; matches = apiAlloc(haylen); if (!matches) { return -1; };
 
         count = findInCircle(haystack, haylen, options, matches, &alloc);
 
         alloc += count * 30; // adding 27 characters per entry: ,"dst":1000.000, "dir":357
     } else if (options->is_hexList) {
-        doFree = 1; matches = apiAlloc(options->hexCount); if (!matches) { return cb; };
+        doFree = 1; matches = apiAlloc(options->hexCount); if (!matches) { return -1; };
 
         count = findHexList(buffer, options->hexList, options->hexCount, matches, &alloc);
     } else if (options->is_regList) {
-        doFree = 1; matches = apiAlloc(options->regCount); if (!matches) { return cb; };
+        doFree = 1; matches = apiAlloc(options->regCount); if (!matches) { return -1; };
 
         count = findRegList(buffer, options->regList, options->regCount, matches, &alloc);
     } else if (options->is_callsignList) {
-        doFree = 1; matches = apiAlloc(options->callsignCount); if (!matches) { return cb; };
+        doFree = 1; matches = apiAlloc(options->callsignCount); if (!matches) { return -1; };
 
         count = findCallsignList(buffer, options->callsignList, options->callsignCount, matches, &alloc);
     } else if (options->is_typeList) {
-        doFree = 1; matches = apiAlloc(haylen); if (!matches) { return cb; };
+        doFree = 1; matches = apiAlloc(haylen); if (!matches) { return -1; };
 
         count = filterTypeList(haystack, haylen, options->typeList, options->typeCount, matches, &alloc);
     } else if (options->is_squawkList) {
-        doFree = 1; matches = apiAlloc(haylen); if (!matches) { return cb; };
+        doFree = 1; matches = apiAlloc(haylen); if (!matches) { return -1; };
 
         count = filterSquawkList(haystack, haylen, options->squawkList, options->squawkCount, matches, &alloc);
     } else if (options->all || options->all_with_pos) {
@@ -565,7 +949,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
         } else {
             fprintf(stderr, "FATAL: unreachablei ahchoh8R\n");
             setExit(2);
-            return cb;
+            return -1;
         }
         count = range.to - range.from;
         if (count > 0) {
@@ -583,7 +967,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
 
     // filter all_with_pos as pos_range unreliable due do gpsOkBefore f***ery
     if (options->filter_with_pos || options->all_with_pos) {
-        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return cb; }
+        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return -1; }
 
         size_t alloc = alloc_base;
         count = filterWithPos(matches, count, filtered, &alloc);
@@ -591,7 +975,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
         if (doFree) { sfree(matches); }; doFree = 1; matches = filtered;
     }
     if (options->filter_dbFlag) {
-        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return cb; }
+        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return -1; }
 
         size_t alloc = alloc_base;
         count = filter_dbFlags(matches, count, filtered, &alloc, options);
@@ -600,7 +984,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
     }
 #if defined(WITH_UUIDS)
     if (options->filter_uuid) {
-        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return cb; }
+        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return -1; }
 
         size_t alloc = alloc_base;
         count = filter_uuid(matches, count, filtered, &alloc, options);
@@ -609,7 +993,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
     }
 #endif
     if (options->filter_alt_baro) {
-        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return cb; }
+        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return -1; }
 
         size_t alloc = alloc_base;
         count = filter_alt_baro(matches, count, filtered, &alloc, options);
@@ -617,7 +1001,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
         if (doFree) { sfree(matches); }; doFree = 1; matches = filtered;
     }
     if (options->filter_callsign_prefix) {
-        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return cb; }
+        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return -1; }
 
         size_t alloc = alloc_base;
         count = filterCallsignPrefix(matches, count, filtered, &alloc, options->callsign_prefix);
@@ -625,7 +1009,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
         if (doFree) { sfree(matches); }; doFree = 1; matches = filtered;
     }
     if (options->filter_callsign_exact) {
-        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return cb; }
+        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return -1; }
 
         size_t alloc = alloc_base;
         count = filterCallsignExact(matches, count, filtered, &alloc, options->callsign_exact);
@@ -633,7 +1017,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
         if (doFree) { sfree(matches); }; doFree = 1; matches = filtered;
     }
     if (options->filter_squawkList) {
-        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return cb; }
+        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return -1; }
 
         size_t alloc = alloc_base;
         count = filterSquawkList(matches, count, options->squawkList, options->squawkCount, filtered, &alloc);
@@ -641,7 +1025,7 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
         if (doFree) { sfree(matches); }; doFree = 1; matches = filtered;
     }
     if (options->filter_typeList) {
-        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return cb; }
+        struct apiEntry *filtered = apiAlloc(count); if (!filtered) { return -1; }
 
         size_t alloc = alloc_base;
         count = filterTypeList(matches, count, options->typeList, options->typeCount, filtered, &alloc);
@@ -649,79 +1033,134 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
         if (doFree) { sfree(matches); }; doFree = 1; matches = filtered;
     }
 
-    // elementSize only applies to binCraft output
+    *matchesOut = matches;
+    *doFreeOut = doFree;
+    *allocOut = alloc;
+    return count;
+}
+
+// the first binCraft element is a header with details about the response
+static char *apiWriteBinCraftHeader(char *p, char *end, struct apiBuffer *buffer, struct apiOptions *options, uint32_t resultCount, uint32_t flags) {
     uint32_t elementSize = sizeof(struct binCraft);
-    if (options->binCraft) {
-        alloc = API_REQ_PADSTART + 2 * elementSize + count * elementSize;
+    char *start = p;
+    memset(p, 0, elementSize);
+
+#define memWrite(p, var) do { if (p + sizeof(var) > end) { break; }; memcpy(p, &var, sizeof(var)); p += sizeof(var); } while(0)
+
+    int64_t now = buffer->timestamp;
+    memWrite(p, now);
+
+    memWrite(p, elementSize);
+
+    uint32_t ac_count_pos = Modes.globalStatsCount.readsb_aircraft_with_position;
+    memWrite(p, ac_count_pos);
+
+    uint32_t index = 0;
+    memWrite(p, index);
+
+    int16_t south = -90;
+    int16_t west = -180;
+    int16_t north = 90;
+    int16_t east = 180;
+    if (options->is_box) {
+        south = nearbyint(options->box[0]);
+        north = nearbyint(options->box[1]);
+        west = nearbyint(options->box[2]);
+        east = nearbyint(options->box[3]);
     }
 
-    cb.buffer = cmalloc(alloc);
-    if (!cb.buffer)
-        return cb;
+    memWrite(p, south);
+    memWrite(p, west);
+    memWrite(p, north);
+    memWrite(p, east);
 
-    char *payload = cb.buffer + API_REQ_PADSTART;
-    char *p = payload;
-    char *end = cb.buffer + alloc;
+    uint32_t messageCount = Modes.stats_current.messages_total + Modes.stats_alltime.messages_total;
+    memWrite(p, messageCount);
 
+    memWrite(p, resultCount);
 
-    if (options->binCraft) {
-        memset(p, 0, elementSize);
+    int32_t dummy = 0;
+    memWrite(p, dummy);
 
-#define memWrite(p, var) do { if (p + sizeof(var) > end) { break; }; memcpy(p, &var, sizeof(var)); p += sizeof(var); } while(0)
+    memWrite(p, Modes.binCraftVersion);
 
-        int64_t now = buffer->timestamp;
-        memWrite(p, now);
+    uint32_t messageRate = nearbyint(Modes.messageRate * 10);
+    memWrite(p, messageRate);
 
-        memWrite(p, elementSize);
+    if (Modes.json_globe_index || Modes.apiShutdownDelay) {
+        flags |= (1 << 0);
+    }
+    memWrite(p, flags);
 
-        uint32_t ac_count_pos = Modes.globalStatsCount.readsb_aircraft_with_position;
-        memWrite(p, ac_count_pos);
+#undef memWrite
+    if (p - start > (int) elementSize) {
+        fprintf(stderr, "apiBin: too many details in first element\n");
+    }
 
-        uint32_t index = 0;
-        memWrite(p, index);
+    return start + elementSize;
+}
 
-        int16_t south = -90;
-        int16_t west = -180;
-        int16_t north = 90;
-        int16_t east = 180;
-        if (options->is_box) {
-            south = nearbyint(options->box[0]);
-            north = nearbyint(options->box[1]);
-            west = nearbyint(options->box[2]);
-            east = nearbyint(options->box[3]);
-        }
+// zstd compress the payload of cb (frees cb)
+static struct char_buffer apiCompress(struct apiThread *thread, struct char_buffer cb) {
+    char *payload = cb.buffer + API_REQ_PADSTART;
+    size_t payload_len = cb.len - API_REQ_PADSTART;
 
-        memWrite(p, south);
-        memWrite(p, west);
-        memWrite(p, north);
-        memWrite(p, east);
+    struct char_buffer new = { 0 };
+    size_t new_alloc = API_REQ_PADSTART + ZSTD_compressBound(payload_len);
+    new.buffer = cmalloc(new_alloc);
+    if (!new.buffer) {
+        sfree(cb.buffer);
+        return new;
+    }
+    memset(new.buffer, 0x0, new_alloc);
 
-        uint32_t messageCount = Modes.stats_current.messages_total + Modes.stats_alltime.messages_total;
-        memWrite(p, messageCount);
+    size_t compressedSize = ZSTD_compressCCtx(thread->cctx,
+            new.buffer + API_REQ_PADSTART, new_alloc - API_REQ_PADSTART,
+            payload, payload_len,
+            API_ZSTD_LVL);
 
-        uint32_t resultCount = count;
-        memWrite(p, resultCount);
+    //free uncompressed buffer
+    sfree(cb.buffer);
 
-        int32_t dummy = 0;
-        memWrite(p, dummy);
+    if (ZSTD_isError(compressedSize)) {
+        fprintf(stderr, "API zstd error: %s\n", ZSTD_getErrorName(compressedSize));
+        sfree(new.buffer);
+        new.len = 0;
+        return new;
+    }
 
-        memWrite(p, Modes.binCraftVersion);
+    new.len = API_REQ_PADSTART + compressedSize;
+    return new;
+}
 
-        uint32_t messageRate = nearbyint(Modes.messageRate * 10);
-        memWrite(p, messageRate);
+static struct char_buffer apiReq(struct apiThread *thread, struct apiBuffer *buffer, struct apiOptions *options) {
+    struct char_buffer cb = { 0 };
+    struct apiEntry *matches = NULL;
+    int doFree = 0;
+    size_t alloc = API_REQ_PADSTART + 1024;
 
-        uint32_t flags = 0;
-        if (Modes.json_globe_index || Modes.apiShutdownDelay) {
-            flags |= (1 << 0);
-        }
-        memWrite(p, flags);
+    int count = apiFind(buffer, options, &matches, &doFree, &alloc);
+    if (count < 0) {
+        return cb;
+    }
 
-#undef memWrite
-        if (p - payload > (int) elementSize) {
-            fprintf(stderr, "apiBin: too many details in first element\n");
-        }
+    // elementSize only applies to binCraft output
+    uint32_t elementSize = sizeof(struct binCraft);
+    if (options->binCraft) {
+        alloc = API_REQ_PADSTART + 2 * elementSize + count * elementSize;
+    }
 
-        p = payload + elementSize;
+    cb.buffer = cmalloc(alloc);
+    if (!cb.buffer)
+        return cb;
+
+    char *payload = cb.buffer + API_REQ_PADSTART;
+    char *p = payload;
+    char *end = cb.buffer + alloc;
+
+
+    if (options->binCraft) {
+        p = apiWriteBinCraftHeader(p, end, buffer, options, count, 0);
 
         for (int i = 0; i < count; i++) {
             if (unlikely(p + elementSize > end)) {
@@ -780,7 +1219,6 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
     }
 
     cb.len = p - cb.buffer;
-    size_t payload_len = p - payload;
 
     if (cb.len > alloc) {
         fprintf(stderr, "apiReq buffer insufficient\n");
@@ -792,44 +1230,521 @@ static struct char_buffer apiReq(struct apiThread *thread, struct apiOptions *op
     }
 
     if (options->zstd || options->zstd_encode) {
-        struct char_buffer new = { 0 };
-        size_t new_alloc = API_REQ_PADSTART + ZSTD_compressBound(alloc);
-        new.buffer = cmalloc(new_alloc);
-        memset(new.buffer, 0x0, new_alloc);
+        cb = apiCompress(thread, cb);
+    }
 
-        struct char_buffer dst;
-        dst.buffer = new.buffer + API_REQ_PADSTART;
-        dst.len = new_alloc - API_REQ_PADSTART;
+    return cb;
+}
+
+static int compareEntryHex(const void *p1, const void *p2) {
+    uint32_t h1 = (*(struct apiEntry **) p1)->bin.hex;
+    uint32_t h2 = (*(struct apiEntry **) p2)->bin.hex;
+    return (h1 > h2) - (h1 < h2);
+}
 
-        //fprintf(stderr, "payload_len %ld\n", (long) payload_len);
+// seen / seen_pos change every update without anything new being received, ignore them
+static uint32_t apiStreamHash(struct apiEntry *e) {
+    struct binCraft bin = e->bin;
+    bin.seen = 0;
+    bin.seen_pos = 0;
+    return fasthash32(&bin, sizeof(bin), 0x5c8e1f27);
+}
+
+// generate a server-sent event containing the aircraft that were added or changed
+// and the hex ids of the aircraft no longer matching since the previous event
+// pad bytes are left free at the start of the buffer
+// make sure at least need bytes are left after *p, returns 0 if the buffer can't be grown
+static int apiStreamReserve(struct char_buffer *cb, size_t *alloc, char **p, char **end, size_t need) {
+    if (*p + need < *end) {
+        return 1;
+    }
+    size_t used = *p - cb->buffer;
+    size_t newAlloc = imax(2 * *alloc, used + need + 1024);
+    char *buf = realloc(cb->buffer, newAlloc);
+    if (!buf) {
+        return 0;
+    }
+    cb->buffer = buf;
+    *p = buf + used;
+    *end = buf + newAlloc;
+    *alloc = newAlloc;
+    return 1;
+}
+
+static struct char_buffer apiStreamEvent(struct apiBuffer *buffer, struct apiStream *stream, int pad) {
+    struct char_buffer cb = { 0 };
+    struct apiEntry *matches = NULL;
+    int doFree = 0;
+    size_t alloc = pad + 1024;
 
-        size_t compressedSize = ZSTD_compressCCtx(thread->cctx,
-                dst.buffer, dst.len,
-                payload, payload_len,
-                API_ZSTD_LVL);
+    int count = apiFind(buffer, &stream->options, &matches, &doFree, &alloc);
+    if (count < 0) {
+        return cb;
+    }
 
-        dst.len = compressedSize;
-        new.len = API_REQ_PADSTART + compressedSize;
-        ident(dst);
+    alloc += stream->len * 12; // "~abcdef",
 
-        //free uncompressed buffer
+    struct apiEntry **sorted = cmalloc((count + 1) * sizeof(struct apiEntry *));
+    struct apiStreamEntry *list = cmalloc((count + 1) * sizeof(struct apiStreamEntry));
+    cb.buffer = cmalloc(alloc);
+    if (!sorted || !list || !cb.buffer) {
+        sfree(sorted);
+        sfree(list);
         sfree(cb.buffer);
+        if (doFree) {
+            sfree(matches);
+        }
+        return cb;
+    }
 
-        cb = new;
+    for (int i = 0; i < count; i++) {
+        sorted[i] = &matches[i];
+    }
+    qsort(sorted, count, sizeof(struct apiEntry *), compareEntryHex);
 
-        if (ZSTD_isError(compressedSize)) {
-            fprintf(stderr, "API zstd error: %s\n", ZSTD_getErrorName(compressedSize));
-            sfree(cb.buffer);
-            cb.buffer = NULL;
-            cb.len = 0;
-            return cb;
+    // box + hexList can return an aircraft twice
+    int len = 0;
+    for (int i = 0; i < count; i++) {
+        if (len > 0 && list[len - 1].hex == sorted[i]->bin.hex) {
+            continue;
+        }
+        sorted[len] = sorted[i];
+        list[len].hex = sorted[i]->bin.hex;
+        list[len].hash = apiStreamHash(sorted[i]);
+        len++;
+    }
+
+    struct apiStreamEntry *old = stream->list;
+    int oldLen = stream->len;
+
+    char *p = cb.buffer + pad;
+    char *end = cb.buffer + alloc;
+    char *json = buffer->json;
+
+    p = safe_snprintf(p, end, "data: {\"now\":%.3f,\"ac\":[", buffer->timestamp / 1000.0);
+
+    for (int i = 0, j = 0; i < len; i++) {
+        while (j < oldLen && old[j].hex < list[i].hex) {
+            j++;
+        }
+        if (j < oldLen && old[j].hex == list[i].hex && old[j].hash == list[i].hash) {
+            continue; // unchanged
+        }
+        struct apiEntry *e = sorted[i];
+        struct offset off = e->jsonOffset; // READ-ONLY here
+        if (unlikely(!apiStreamReserve(&cb, &alloc, &p, &end, off.len + 100))) {
+            goto fail;
+        }
+        // json objects in cache are preceded by a newline which is not allowed in a data line
+        memcpy(p, json + off.offset + 1, off.len - 1);
+        p += off.len - 1;
+        if (stream->options.is_circle) {
+            p -= 2;
+            p = safe_snprintf(p, end, ",\"dst\":%.3f,\"dir\":%.1f},", e->distance / 1852.0, e->direction);
+        }
+    }
+    if (*(p - 1) == ',')
+        p--;
+
+    if (!apiStreamReserve(&cb, &alloc, &p, &end, oldLen * 12 + 100)) {
+        goto fail;
+    }
+    p = safe_snprintf(p, end, "],\"remove\":[");
+    for (int i = 0, j = 0; j < oldLen; j++) {
+        while (i < len && list[i].hex < old[j].hex) {
+            i++;
+        }
+        if (i < len && list[i].hex == old[j].hex) {
+            continue;
+        }
+        p = safe_snprintf(p, end, "\"%s%06x\",", (old[j].hex & MODES_NON_ICAO_ADDRESS) ? "~" : "", old[j].hex & 0xFFFFFF);
+    }
+    if (*(p - 1) == ',')
+        p--;
+    p = safe_snprintf(p, end, "]}\n\n");
+
+    if (p >= end) {
+        // a truncated event isn't valid json, send nothing and keep the list of sent aircraft
+        fprintf(stderr, "apiStreamEvent: buffer insufficient, event dropped\n");
+        goto fail;
+    }
+
+    cb.len = p - cb.buffer;
+    cb.alloc = alloc;
+
+    sfree(stream->list);
+    stream->list = list;
+    stream->len = len;
+    stream->alloc = count + 1;
+    stream->timestamp = buffer->timestamp;
+
+    sfree(sorted);
+    if (doFree) {
+        sfree(matches);
+    }
+
+    return cb;
+
+fail:
+    sfree(cb.buffer);
+    cb.len = 0;
+    sfree(list);
+    sfree(sorted);
+    if (doFree) {
+        sfree(matches);
+    }
+    return cb;
+}
+
+struct cacheToken {
+    char *token;
+    int index;
+};
+
+// sort by option name, repeated options keep their order (the last one wins when parsing)
+static int compareToken(const void *p1, const void *p2) {
+    const struct cacheToken *t1 = p1;
+    const struct cacheToken *t2 = p2;
+    size_t l1 = strcspn(t1->token, "=");
+    size_t l2 = strcspn(t2->token, "=");
+    int res = memcmp(t1->token, t2->token, imin(l1, l2));
+    if (res == 0 && l1 != l2) {
+        res = (l1 < l2) ? -1 : 1;
+    }
+    if (res == 0) {
+        res = t1->index - t2->index;
+    }
+    return res;
+}
+
+// normalize the query for use as cache key: options sorted by name, include_version dropped (only affects the header)
+// returns 0 if the query is not cacheable
+static int apiCacheKey(char *query, char *eoq, char *key) {
+    char tmp[API_CACHE_KEY_MAX];
+    int qlen = eoq - query;
+    if (qlen <= 0 || qlen >= API_CACHE_KEY_MAX - 8) {
+        return 0;
+    }
+    if (memchr(query, '|', qlen)) {
+        // batch requests: order of the sub-queries matters, use as is
+        memcpy(key, query, qlen);
+        return qlen;
+    }
+    memcpy(tmp, query, qlen);
+    tmp[qlen] = '\0';
+
+    struct cacheToken tokens[API_CACHE_TOKENS_MAX];
+    int count = 0;
+    char *p = tmp;
+    char *token;
+    while ((token = strsep(&p, "&"))) {
+        if (!*token || strcmp(token, "include_version") == 0) {
+            continue;
+        }
+        if (count == API_CACHE_TOKENS_MAX) {
+            return 0;
+        }
+        tokens[count].token = token;
+        tokens[count].index = count;
+        count++;
+    }
+    qsort(tokens, count, sizeof(struct cacheToken), compareToken);
+
+    char *k = key;
+    char *end = key + API_CACHE_KEY_MAX;
+    for (int i = 0; i < count; i++) {
+        k = safe_snprintf(k, end, "%s&", tokens[i].token);
+    }
+    return k - key;
+}
+
+// returns a copy of the cached response or an empty buffer
+// generation is set to the generation the cache was looked up in or -1 if the cache can't be used
+static struct char_buffer apiCacheLookup(struct apiBuffer *buffer, char *key, int keyLen, int64_t *generation) {
+    struct char_buffer cb = { 0 };
+    uint32_t hash = fasthash32(key, keyLen, 0x3b2a8e11);
+
+    pthread_mutex_lock(&buffer->cacheMutex);
+    *generation = buffer->cacheGeneration;
+    if (*generation % 2) {
+        *generation = -1;
+    } else {
+        for (int i = 0; i < buffer->cacheCount; i++) {
+            struct apiCacheEntry *entry = &buffer->cache[i];
+            if (entry->hash != hash || entry->keyLen != keyLen || memcmp(entry->key, key, keyLen) != 0) {
+                continue;
+            }
+            cb.buffer = cmalloc(API_REQ_PADSTART + entry->len);
+            if (cb.buffer) {
+                memcpy(cb.buffer + API_REQ_PADSTART, entry->payload, entry->len);
+                cb.len = API_REQ_PADSTART + entry->len;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&buffer->cacheMutex);
+    return cb;
+}
+
+// a cached json response carries the ptime of the request that produced it, replace it
+static struct char_buffer apiCacheUpdatePtime(struct char_buffer cb, struct apiOptions *options) {
+    static const char marker[] = "\n,\"ptime\": ";
+    int markerLen = sizeof(marker) - 1;
+    char *start = cb.buffer + API_REQ_PADSTART;
+    char *pos = NULL;
+    // the ptime is the last field, only look at the end of the response
+    for (char *p = cb.buffer + cb.len - markerLen; p >= start && p >= cb.buffer + cb.len - 64; p--) {
+        if (memcmp(p, marker, markerLen) == 0) {
+            pos = p;
+            break;
+        }
+    }
+    if (!pos) {
+        return cb;
+    }
+    size_t used = pos - cb.buffer;
+    char *buf = realloc(cb.buffer, used + 64);
+    if (!buf) {
+        return cb;
+    }
+    char *p = buf + used;
+    char *end = buf + used + 64;
+    options->request_processed = microtime();
+    if (options->jamesv2) {
+        p = safe_snprintf(p, end, "\n,\"ptime\": %lld", (long long) nearbyint((options->request_processed - options->request_received) / 1000.0));
+    } else {
+        p = safe_snprintf(p, end, "\n,\"ptime\": %.3f", (options->request_processed - options->request_received) / 1000.0);
+    }
+    p = safe_snprintf(p, end, "\n}\n");
+    cb.buffer = buf;
+    cb.len = p - buf;
+    cb.alloc = used + 64;
+    return cb;
+}
+
+static void apiCacheInsert(struct apiBuffer *buffer, char *key, int keyLen, int64_t generation, struct char_buffer *cb) {
+    uint32_t hash = fasthash32(key, keyLen, 0x3b2a8e11);
+    int len = cb->len - API_REQ_PADSTART;
+
+    pthread_mutex_lock(&buffer->cacheMutex);
+    // the buffer might have been rebuilt since the lookup
+    if (generation != buffer->cacheGeneration
+            || buffer->cacheCount >= API_CACHE_ENTRIES
+            || buffer->cacheBytes + len > API_CACHE_MAX_BYTES) {
+        goto out;
+    }
+    for (int i = 0; i < buffer->cacheCount; i++) {
+        struct apiCacheEntry *entry = &buffer->cache[i];
+        if (entry->hash == hash && entry->keyLen == keyLen && memcmp(entry->key, key, keyLen) == 0) {
+            // another thread was faster
+            goto out;
+        }
+    }
+    char *payload = cmalloc(len);
+    if (!payload) {
+        goto out;
+    }
+    memcpy(payload, cb->buffer + API_REQ_PADSTART, len);
+
+    struct apiCacheEntry *entry = &buffer->cache[buffer->cacheCount++];
+    entry->hash = hash;
+    entry->keyLen = keyLen;
+    memcpy(entry->key, key, keyLen);
+    entry->payload = payload;
+    entry->len = len;
+    buffer->cacheBytes += len;
+out:
+    pthread_mutex_unlock(&buffer->cacheMutex);
+}
+
+// Traces generated on request (trace_recent / trace_full) are kept gzip compressed in a small LRU.
+// An entry is reused while the trace length and the last reliable position of the aircraft are
+// unchanged and it's younger than API_TRACE_CACHE_MAX_AGE.
+struct apiTraceCacheEntry {
+    uint32_t addr;
+    int type;
+    int32_t traceLen;
+    int64_t seenPosReliable;
+    int64_t created;
+    uint64_t lastUsed;
+    char *payload;
+    int len;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    uint64_t tick;
+    int64_t bytes;
+    struct apiTraceCacheEntry entries[API_TRACE_CACHE_ENTRIES];
+} traceCache = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void traceCacheDrop(struct apiTraceCacheEntry *entry) {
+    traceCache.bytes -= entry->len;
+    memAccountFree(MEM_API, entry->payload);
+    sfree(entry->payload);
+    entry->len = 0;
+    entry->lastUsed = 0;
+}
+
+static struct char_buffer traceCacheLookup(uint32_t addr, int type, int32_t traceLen, int64_t seenPosReliable, int64_t now) {
+    struct char_buffer cb = { 0 };
+    pthread_mutex_lock(&traceCache.mutex);
+    for (int i = 0; i < API_TRACE_CACHE_ENTRIES; i++) {
+        struct apiTraceCacheEntry *entry = &traceCache.entries[i];
+        if (!entry->payload || entry->addr != addr || entry->type != type) {
+            continue;
+        }
+        if (entry->traceLen != traceLen || entry->seenPosReliable != seenPosReliable
+                || now > entry->created + API_TRACE_CACHE_MAX_AGE) {
+            traceCacheDrop(entry);
+            break;
+        }
+        entry->lastUsed = ++traceCache.tick;
+        cb.buffer = cmalloc(API_REQ_PADSTART + entry->len);
+        memcpy(cb.buffer + API_REQ_PADSTART, entry->payload, entry->len);
+        cb.len = API_REQ_PADSTART + entry->len;
+        break;
+    }
+    pthread_mutex_unlock(&traceCache.mutex);
+    return cb;
+}
+
+static void traceCacheInsert(uint32_t addr, int type, int32_t traceLen, int64_t seenPosReliable, int64_t now, struct char_buffer *cb) {
+    int len = cb->len - API_REQ_PADSTART;
+    if (len > API_TRACE_CACHE_MAX_BYTES / 8) {
+        return;
+    }
+    char *payload = cmalloc(len);
+    memAccountAlloc(MEM_API, payload);
+    memcpy(payload, cb->buffer + API_REQ_PADSTART, len);
+
+    pthread_mutex_lock(&traceCache.mutex);
+    struct apiTraceCacheEntry *victim = NULL;
+    for (int i = 0; i < API_TRACE_CACHE_ENTRIES; i++) {
+        struct apiTraceCacheEntry *entry = &traceCache.entries[i];
+        if (entry->payload && entry->addr == addr && entry->type == type) {
+            // another thread was faster or the entry is outdated
+            victim = entry;
+            break;
+        }
+        if (!victim || entry->lastUsed < victim->lastUsed) {
+            victim = entry;
+        }
+    }
+    if (victim->payload) {
+        traceCacheDrop(victim);
+    }
+    // evict least recently used entries until the new one fits
+    while (traceCache.bytes + len > API_TRACE_CACHE_MAX_BYTES) {
+        struct apiTraceCacheEntry *lru = NULL;
+        for (int i = 0; i < API_TRACE_CACHE_ENTRIES; i++) {
+            struct apiTraceCacheEntry *entry = &traceCache.entries[i];
+            if (entry->payload && (!lru || entry->lastUsed < lru->lastUsed)) {
+                lru = entry;
+            }
+        }
+        traceCacheDrop(lru);
+    }
+    *victim = (struct apiTraceCacheEntry) {
+        .addr = addr,
+        .type = type,
+        .traceLen = traceLen,
+        .seenPosReliable = seenPosReliable,
+        .created = now,
+        .lastUsed = ++traceCache.tick,
+        .payload = payload,
+        .len = len,
+    };
+    traceCache.bytes += len;
+    pthread_mutex_unlock(&traceCache.mutex);
+}
+
+static void traceCacheCleanup() {
+    pthread_mutex_lock(&traceCache.mutex);
+    for (int i = 0; i < API_TRACE_CACHE_ENTRIES; i++) {
+        if (traceCache.entries[i].payload) {
+            traceCacheDrop(&traceCache.entries[i]);
+        }
+    }
+    pthread_mutex_unlock(&traceCache.mutex);
+}
+
+// trace_recent / trace_full json for one aircraft, generated from the in memory trace
+static struct char_buffer apiTraceReq(struct apiCon *con, struct apiThread *thread, struct apiOptions *options) {
+    struct char_buffer cb = { 0 };
+    if (!Modes.writeTraces) {
+        options->traceNotFound = 1;
+        return cb;
+    }
+    int64_t now = mstime();
+
+    con->content_type = "application/json";
+    options->zstd_encode = 0;
+
+    // the aircraft can be freed by removeStale while we're using it
+    epochEnter();
+
+    struct aircraft *a = aircraftGet(options->traceHex);
+    if (!a || a->trace_len == 0) {
+        options->traceNotFound = 1;
+        goto out;
+    }
+    int32_t traceLen = a->trace_len;
+    int64_t seenPosReliable = a->seenPosReliable;
+
+    if (!options->gzip_accept) {
+        // the cache only holds gzipped traces, generate the plain json for this client
+        struct char_buffer json = traceGenerateJson(a, options->trace, &thread->traceBuffers[0], &thread->traceBuffers[1]);
+        if (json.len == 0) {
+            options->traceNotFound = 1;
+            goto out;
         }
-        //fprintf(stderr, "first 4 bytes: %08x len: %ld\n", *((uint32_t *) cb.buffer), (long) cb.len);
+        cb.buffer = cmalloc(API_REQ_PADSTART + json.len);
+        memcpy(cb.buffer + API_REQ_PADSTART, json.buffer, json.len);
+        cb.len = API_REQ_PADSTART + json.len;
+        goto out;
     }
 
+    cb = traceCacheLookup(a->addr, options->trace, traceLen, seenPosReliable, now);
+    if (cb.len) {
+        thread->traceCacheHits++;
+        options->gzip_encoded = 1;
+        goto out;
+    }
+    thread->traceCacheMisses++;
+
+    struct char_buffer json = traceGenerateJson(a, options->trace, &thread->traceBuffers[0], &thread->traceBuffers[1]);
+    if (json.len == 0) {
+        options->traceNotFound = 1;
+        goto out;
+    }
+    struct char_buffer gz = gzipToBuffer("trace.json", json, 1);
+    if (!gz.buffer) {
+        goto out;
+    }
+    cb.buffer = cmalloc(API_REQ_PADSTART + gz.len);
+    memcpy(cb.buffer + API_REQ_PADSTART, gz.buffer, gz.len);
+    cb.len = API_REQ_PADSTART + gz.len;
+    fileWriterFree(gz.buffer);
+
+    options->gzip_encoded = 1;
+    traceCacheInsert(a->addr, options->trace, traceLen, seenPosReliable, now, &cb);
+
+out:
+    epochExit();
     return cb;
 }
 
+static void apiCacheClear(struct apiBuffer *buffer) {
+    for (int i = 0; i < buffer->cacheCount; i++) {
+        sfree(buffer->cache[i].payload);
+    }
+    buffer->cacheCount = 0;
+    buffer->cacheBytes = 0;
+}
+
 static inline int apiAdd(struct apiBuffer *buffer, struct aircraft *a, int64_t now) {
     if (!(includeAircraftJson(now, a)))
         return 0;
@@ -871,12 +1786,57 @@ static inline int apiAdd(struct apiBuffer *buffer, struct aircraft *a, int64_t n
     return 1;
 }
 
-static inline void apiGenerateJson(struct apiBuffer *buffer, int64_t now) {
-    sfree(buffer->json);
-    buffer->json = NULL;
+static int compareAlt(const void *p1, const void *p2) {
+    int32_t a1 = apiAltBaro(*(struct apiEntry **) p1);
+    int32_t a2 = apiAltBaro(*(struct apiEntry **) p2);
+    return (a1 > a2) - (a1 < a2);
+}
+
+static int compareCallsign(const void *p1, const void *p2) {
+    return strncmp((*(struct apiEntry **) p1)->bin.callsign, (*(struct apiEntry **) p2)->bin.callsign, memberSize(struct binCraft, callsign));
+}
+
+// sorted indexes for altitude range and callsign prefix queries
+static void apiBuildIndexes(struct apiBuffer *buffer) {
+    buffer->altIndexLen = 0;
+    buffer->callsignIndexLen = 0;
+    for (int i = 0; i < buffer->len; i++) {
+        struct apiEntry *e = &buffer->list[i];
+        if (apiAltBaro(e) != INT32_MIN) {
+            buffer->altIndex[buffer->altIndexLen++] = e;
+        }
+        if (e->bin.callsign_valid) {
+            buffer->callsignIndex[buffer->callsignIndexLen++] = e;
+        }
+    }
+    qsort(buffer->altIndex, buffer->altIndexLen, sizeof(struct apiEntry *), compareAlt);
+    qsort(buffer->callsignIndex, buffer->callsignIndexLen, sizeof(struct apiEntry *), compareCallsign);
+}
 
+// account the allocations of the buffer in MEM_API, the buffers only change in apiUpdate
+static void apiBufferAccount(struct apiBuffer *buffer, int release) {
+    int64_t bytes = 0;
+    if (!release) {
+        void *ptrs[] = { buffer->list, buffer->list_flag, buffer->json, buffer->hexHash, buffer->regHash,
+            buffer->callsignHash, buffer->typeHash, buffer->squawkHash, buffer->altIndex, buffer->callsignIndex };
+        for (size_t i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); i++) {
+            if (ptrs[i]) {
+                bytes += cmUsableSize(ptrs[i]);
+            }
+        }
+    }
+    memAccountBytes(MEM_API, bytes - buffer->memBytes);
+    buffer->memBytes = bytes;
+}
+
+static inline void apiGenerateJson(struct apiBuffer *buffer, int64_t now) {
     size_t alloc = buffer->len * 1024 + 4096; // The initial buffer is resized as needed
-    buffer->json = (char *) cmalloc(alloc);
+    if (buffer->jsonAlloc < alloc) {
+        sfree(buffer->json);
+        buffer->json = (char *) cmalloc(alloc);
+        buffer->jsonAlloc = alloc;
+    }
+    alloc = buffer->jsonAlloc;
     char *p = buffer->json;
     char *end = buffer->json + alloc;
 
@@ -884,7 +1844,8 @@ static inline void apiGenerateJson(struct apiBuffer *buffer, int64_t now) {
         if ((p + 16 * 1024) >= end) {
             int used = p - buffer->json;
             alloc *= 2;
-            buffer->json = (char *) realloc(buffer->json, alloc);
+            buffer->json = (char *) cmRealloc(buffer->json, alloc);
+            buffer->jsonAlloc = alloc;
             p = buffer->json + used;
             end = buffer->json + alloc;
         }
@@ -916,6 +1877,18 @@ static inline void apiGenerateJson(struct apiBuffer *buffer, int64_t now) {
             entry->nextCallsign = buffer->callsignHash[hash];
             buffer->callsignHash[hash] = entry;
         }
+
+        if (entry->bin.typeCode[0]) {
+            hash = typeHash(entry->bin.typeCode, buffer);
+            entry->nextType = buffer->typeHash[hash];
+            buffer->typeHash[hash] = entry;
+        }
+
+        if (entry->bin.squawk_valid) {
+            hash = squawkHash(entry->bin.squawk, buffer);
+            entry->nextSquawk = buffer->squawkHash[hash];
+            buffer->squawkHash[hash] = entry;
+        }
         //fprintf(stderr, "callsign: %8s hash: %u\n", entry->bin.callsign, hash);
 
         char *start = p;
@@ -945,6 +1918,12 @@ static int apiUpdate() {
     int flip = (atomic_load(&Modes.apiFlip[0]) + 1) % 2;
     struct apiBuffer *buffer = &Modes.apiBuffer[flip];
 
+    // cached responses belong to the old contents of this buffer
+    pthread_mutex_lock(&buffer->cacheMutex);
+    apiCacheClear(buffer);
+    buffer->cacheGeneration++;
+    pthread_mutex_unlock(&buffer->cacheMutex);
+
     // reset buffer lengths
     buffer->len = 0;
     buffer->len_flag = 0;
@@ -957,9 +1936,13 @@ static int apiUpdate() {
         buffer->alloc = acCount + 64;
         sfree(buffer->list);
         sfree(buffer->list_flag);
+        sfree(buffer->altIndex);
+        sfree(buffer->callsignIndex);
         buffer->list = cmalloc(buffer->alloc * sizeof(struct apiEntry));
         buffer->list_flag = cmalloc(buffer->alloc * sizeof(struct apiEntry));
-        if (!buffer->list || !buffer->list_flag) {
+        buffer->altIndex = cmalloc(buffer->alloc * sizeof(struct apiEntry *));
+        buffer->callsignIndex = cmalloc(buffer->alloc * sizeof(struct apiEntry *));
+        if (!buffer->list || !buffer->list_flag || !buffer->altIndex || !buffer->callsignIndex) {
             fprintf(stderr, "apiList alloc: out of memory!\n");
             exit(1);
         }
@@ -978,16 +1961,22 @@ static int apiUpdate() {
         sfree(buffer->hexHash);
         sfree(buffer->regHash);
         sfree(buffer->callsignHash);
+        sfree(buffer->typeHash);
+        sfree(buffer->squawkHash);
 
         buffer->hexHash = cmalloc(buffer->hashBuckets * sizeof(struct apiEntry*));
         buffer->regHash = cmalloc(buffer->hashBuckets * sizeof(struct apiEntry*));
         buffer->callsignHash = cmalloc(buffer->hashBuckets * sizeof(struct apiEntry*));
+        buffer->typeHash = cmalloc(buffer->hashBuckets * sizeof(struct apiEntry*));
+        buffer->squawkHash = cmalloc(buffer->hashBuckets * sizeof(struct apiEntry*));
     }
 
     // reset hashList to NULL
     memset(buffer->hexHash, 0x0, buffer->hashBuckets * sizeof(struct apiEntry*));
     memset(buffer->regHash, 0x0, buffer->hashBuckets * sizeof(struct apiEntry*));
     memset(buffer->callsignHash, 0x0, buffer->hashBuckets * sizeof(struct apiEntry*));
+    memset(buffer->typeHash, 0x0, buffer->hashBuckets * sizeof(struct apiEntry*));
+    memset(buffer->squawkHash, 0x0, buffer->hashBuckets * sizeof(struct apiEntry*));
 
     // reset api list, just in case we don't set the entries completely due to oversight
     memset(buffer->list, 0x0, buffer->alloc * sizeof(struct apiEntry));
@@ -1016,6 +2005,10 @@ static int apiUpdate() {
 
     apiGenerateJson(buffer, now);
 
+    apiBuildIndexes(buffer);
+
+    apiBufferAccount(buffer, 0);
+
     for (int i = 0; i < buffer->len; i++) {
         struct apiEntry entry = buffer->list[i];
         if (entry.bin.dbFlags) {
@@ -1030,11 +2023,26 @@ static int apiUpdate() {
 
     buffer->timestamp = now;
 
+    pthread_mutex_lock(&buffer->cacheMutex);
+    buffer->cacheGeneration++;
+    pthread_mutex_unlock(&buffer->cacheMutex);
+
     // doesn't matter which of the 2 buffers the api req will use they are both pretty current
     for (int i = 0; i < Modes.apiThreadCount; i++) {
         atomic_store(&Modes.apiFlip[i], flip);
     }
 
+    // wake api threads with stream connections
+    uint64_t one = 1;
+    for (int i = 0; i < Modes.apiThreadCount; i++) {
+        struct apiThread *thread = &Modes.apiThread[i];
+        if (thread->eventfd >= 0 && thread->streamCount) {
+            if (write(thread->eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                perror("apiUpdate: eventfd write");
+            }
+        }
+    }
+
     pthread_cond_signal(&Threads.json.cond);
     pthread_cond_signal(&Threads.globeJson.cond);
 
@@ -1082,6 +2090,13 @@ static void apiCloseCon(struct apiCon *con, struct apiThread *thread) {
     reply->len = 0;
     reply->alloc = 0;
 
+    if (con->stream) {
+        sfree(con->stream->list);
+        sfree(con->stream);
+        thread->streamCount--;
+        atomic_fetch_add(&Modes.apiStreamCount, -1);
+    }
+
     con->open = 0;
     thread->conCount--;
     // put it back on the stack of free connection structs
@@ -1144,6 +2159,9 @@ static void send200(int fd, int keepalive) {
 static void send400(int fd, int keepalive) {
     sendStatus(fd, keepalive, "400 Bad Request");
 }
+static void send404(int fd, int keepalive) {
+    sendStatus(fd, keepalive, "404 Not Found");
+}
 static void send405(int fd, int keepalive) {
     sendStatus(fd, keepalive, "405 Method Not Allowed");
 }
@@ -1199,42 +2217,23 @@ static int parseDoubles(char *start, char *end, double *results, int max) {
         if (!eot) {
             eot = end; // last token memchr returns NULL and eot is set to end
         }
-        *eot = '\0';
-
-        results[count++] = strtod(sot, &endptr);
-        if (eot != endptr) {
-            return -1;
-        }
-        if (count > max) {
-            return -1;
-        }
-    }
-    return count;
-}
-
-// expects lower cased input
-static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *request, struct apiOptions *options, struct apiThread *thread) {
-    struct char_buffer invalid = { 0 };
-
-    char *req = request->buffer;
-
-    // GET URL HTTPVERSION
-    char *query = memchr(req, '?', request->len);
-    if (!query) {
-        return invalid;
-    }
-    // skip URL to after ? which signifies start of query options
-    query++;
-
-    // find end of query
-    char *eoq = memchr(query, ' ', request->len);
-    if (!eoq) {
-        return invalid;
-    }
+        *eot = '\0';
 
-    // we only want the URL
-    *eoq = '\0';
+        results[count++] = strtod(sot, &endptr);
+        if (eot != endptr) {
+            return -1;
+        }
+        if (count > max) {
+            return -1;
+        }
+    }
+    return count;
+}
 
+// expects lower cased input
+// parse the query options between query and eoq (modified in place)
+// returns 0 if the query is invalid
+static int parseQuery(struct apiCon *con, char *query, char *eoq, struct apiOptions *options, int requireMain) {
     // set some option defaults:
     options->above_alt_baro = INT32_MIN;
     options->below_alt_baro = INT32_MAX;
@@ -1262,14 +2261,14 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                 double *box = options->box;
                 int count = parseDoubles(value, eot, box, 4);
                 if (count < 4)
-                    return invalid;
+                    return 0;
 
                 for (int i = 0; i < 4; i++) {
                     if (box[i] > 180 || box[i] < -180)
-                        return invalid;
+                        return 0;
                 }
                 if (box[0] > box[1])
-                    return invalid;
+                    return 0;
 
             } else if (byteMatchStrict(option, "closest") || byteMatchStrict(option, "circle")) {
                 options->is_circle = 1;
@@ -1280,7 +2279,7 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                 double numbers[3];
                 int count = parseDoubles(value, eot, numbers, 3);
                 if (count < 3)
-                    return invalid;
+                    return 0;
 
                 circle->onlyClosest = options->closest;
 
@@ -1292,9 +2291,9 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                 //fprintf(stderr, "%.1f, %.1f, %.1f\n", circle->lat, circle->lon, circle->radius);
 
                 if (circle->lat > 90 || circle->lat < -90)
-                    return invalid;
+                    return 0;
                 if (circle->lon > 180 || circle->lon < -180)
-                    return invalid;
+                    return 0;
 
             } else if (byteMatchStrict(option, "find_hex") || byteMatchStrict(option, "hexlist")) {
                 options->is_hexList = 1;
@@ -1323,6 +2322,19 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                 }
 
                 options->hexCount = hexCount;
+            } else if (byteMatchStrict(option, "trace_recent") || byteMatchStrict(option, "trace_full")) {
+                options->trace = byteMatchStrict(option, "trace_recent") ? WRECENT : WMEM;
+                char *endptr = NULL;
+                int other = 0;
+                if (value[0] == '~') {
+                    other = 1;
+                    value++;
+                }
+                options->traceHex = (uint32_t) strtol(value, &endptr, 16);
+                if (value == endptr || *endptr != '\0') {
+                    return 0;
+                }
+                options->traceHex |= (other ? MODES_NON_ICAO_ADDRESS : 0);
             } else if (byteMatchStrict(option, "find_callsign")) {
                 options->is_callsignList = 1;
 
@@ -1340,7 +2352,7 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                     tok = strtok_r(NULL, ",", &saveptr);
                 }
                 if (callsignCount == 0)
-                    return invalid;
+                    return 0;
 
                 options->callsignCount = callsignCount;
             } else if (byteMatchStrict(option, "find_reg")) {
@@ -1362,7 +2374,7 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                     tok = strtok_r(NULL, ",", &saveptr);
                 }
                 if (regCount == 0)
-                    return invalid;
+                    return 0;
 
                 options->regCount = regCount;
             } else if (byteMatchStrict(option, "find_squawk") || byteMatchStrict(option, "filter_squawk")) {
@@ -1383,7 +2395,7 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                     tok = strtok_r(NULL, ",", &saveptr);
                 }
                 if (squawkCount == 0)
-                    return invalid;
+                    return 0;
 
                 options->squawkCount = squawkCount;
             } else if (byteMatchStrict(option, "find_type") || byteMatchStrict(option, "filter_type")) {
@@ -1408,7 +2420,7 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                     tok = strtok_r(NULL, ",", &saveptr);
                 }
                 if (typeCount == 0)
-                    return invalid;
+                    return 0;
 
                 options->typeCount = typeCount;
             } else if (byteMatchStrict(option, "filter_callsign_exact")) {
@@ -1439,7 +2451,7 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                 options->filter_alt_baro = 1;
                 options->below_alt_baro = strtol(value, NULL, 10);
             } else {
-                return invalid;
+                return 0;
             }
         } else {
             // handle parameters WITHOUT associated value
@@ -1449,6 +2461,8 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
                 options->jamesv2 = 1;
             } else if (byteMatchStrict(option, "zstd")) {
                 options->zstd = 1;
+            } else if (byteMatchStrict(option, "stream")) {
+                options->stream = 1;
             } else if (byteMatchStrict(option, "bincraft")) {
                 options->binCraft = 1;
             } else if (byteMatchStrict(option, "all")) {
@@ -1472,10 +2486,14 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
             } else if (byteMatchStrict(option, "include_version")) {
                 con->include_version = 1;
             } else {
-                return invalid;
+                return 0;
             }
         }
     }
+    if (!requireMain) {
+        return 1;
+    }
+
     int mainOptionCount = options->is_box
         + options->is_circle
         + options->is_hexList
@@ -1484,21 +2502,324 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
         + options->is_typeList
         + options->is_squawkList
         + options->all
-        + options->all_with_pos;
+        + options->all_with_pos
+        + (options->trace ? 1 : 0);
 
     if (mainOptionCount != 1) {
         if (mainOptionCount == 2 && options->is_hexList && options->is_box) {
             // this is ok
         } else {
-            return invalid;
+            return 0;
         }
     }
 
     if (options->is_squawkList && options->filter_squawkList) {
-        return invalid;
+        return 0;
     }
 
     if (options->is_typeList && options->filter_typeList) {
+        return 0;
+    }
+
+    return 1;
+}
+
+// turn the connection into a server-sent event stream, the first event contains all matching aircraft
+static struct char_buffer apiStreamStart(struct apiCon *con, struct apiThread *thread, struct apiOptions *options, struct apiBuffer *buffer) {
+    struct char_buffer invalid = { 0 };
+    struct apiStream *stream = cmCalloc(sizeof(struct apiStream));
+    if (!stream) {
+        return invalid;
+    }
+    stream->options = *options;
+
+    con->stream = stream;
+    con->keepalive = 0;
+    con->content_type = "text/event-stream";
+    thread->streamCount++;
+    atomic_fetch_add(&Modes.apiStreamCount, 1);
+
+    return apiStreamEvent(buffer, stream, API_REQ_PADSTART);
+}
+
+static void apiBatchFree(struct apiBatchQuery *queries, int n) {
+    for (int i = 0; i < n; i++) {
+        if (queries[i].doFree) {
+            sfree(queries[i].matches);
+        }
+    }
+    sfree(queries);
+}
+
+// evaluate multiple queries against the same apiBuffer
+// each aircraft is included once, the queries reference it by its index in the aircraft list
+static struct char_buffer apiBatchReq(struct apiCon *con, struct apiThread *thread, struct apiBuffer *buffer, struct apiOptions *options, char *batch, char *eob) {
+    struct char_buffer cb = { 0 };
+
+    int n = 1;
+    for (char *c = batch; c < eob; c++) {
+        if (*c == '|') {
+            n++;
+        }
+    }
+    if (n > API_BATCH_MAX) {
+        return cb;
+    }
+
+    struct apiBatchQuery *queries = cmCalloc(n * sizeof(struct apiBatchQuery));
+    // sub-query options are parsed one at a time, struct apiOptions is large
+    struct apiOptions *sub = cmalloc(sizeof(struct apiOptions));
+    if (!queries || !sub) {
+        sfree(queries);
+        sfree(sub);
+        return cb;
+    }
+
+    size_t alloc = API_REQ_PADSTART + 1024;
+    int total = 0;
+    char *start = batch;
+    for (int i = 0; i < n; i++) {
+        char *end = memchr(start, '|', eob - start);
+        if (!end) {
+            end = eob;
+        }
+        *end = '\0';
+
+        memset(sub, 0, sizeof(struct apiOptions));
+        if (!parseQuery(con, start, end, sub, 1) || sub->zstd || sub->binCraft || sub->jamesv2 || sub->stream) {
+            sfree(sub);
+            apiBatchFree(queries, i);
+            return cb;
+        }
+        start = end + 1;
+
+        struct apiBatchQuery *q = &queries[i];
+        q->count = apiFind(buffer, sub, &q->matches, &q->doFree, &alloc);
+        if (q->count < 0) {
+            q->count = 0;
+            sfree(sub);
+            apiBatchFree(queries, i + 1);
+            return cb;
+        }
+        total += q->count;
+    }
+    sfree(sub);
+
+    // deduplicate by hex using an open addressing table of indexes into unique
+    int bits = 4;
+    while ((1 << bits) < 2 * total) {
+        bits++;
+    }
+    uint32_t tableSize = 1 << bits;
+    int32_t *table = cmalloc(tableSize * sizeof(int32_t));
+    struct apiEntry **unique = cmalloc((total + 1) * sizeof(struct apiEntry *));
+    int32_t *indexes = cmalloc((total + 1) * sizeof(int32_t));
+    if (!table || !unique || !indexes) {
+        sfree(table);
+        sfree(unique);
+        sfree(indexes);
+        apiBatchFree(queries, n);
+        return cb;
+    }
+    memset(table, 0xff, tableSize * sizeof(int32_t));
+
+    int uniqueCount = 0;
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        struct apiBatchQuery *q = &queries[i];
+        for (int j = 0; j < q->count; j++) {
+            struct apiEntry *e = &q->matches[j];
+            uint32_t slot = (e->bin.hex * 2654435761u) >> (32 - bits);
+            while (table[slot] >= 0 && unique[table[slot]]->bin.hex != e->bin.hex) {
+                slot = (slot + 1) & (tableSize - 1);
+            }
+            if (table[slot] < 0) {
+                table[slot] = uniqueCount;
+                unique[uniqueCount++] = e;
+            }
+            indexes[k++] = table[slot];
+        }
+    }
+    sfree(table);
+
+    uint32_t elementSize = sizeof(struct binCraft);
+    if (options->binCraft) {
+        alloc = API_REQ_PADSTART + (uniqueCount + 1) * elementSize + (1 + n + total) * sizeof(uint32_t);
+    } else {
+        alloc += total * 12 + n * 4;
+    }
+
+    cb.buffer = cmalloc(alloc);
+    if (!cb.buffer) {
+        sfree(unique);
+        sfree(indexes);
+        apiBatchFree(queries, n);
+        return cb;
+    }
+
+    char *payload = cb.buffer + API_REQ_PADSTART;
+    char *p = payload;
+    char *end = cb.buffer + alloc;
+
+    if (options->binCraft) {
+        // flags bit 1: the aircraft are followed by the query count and for each query the number of results and their indexes
+        p = apiWriteBinCraftHeader(p, end, buffer, options, uniqueCount, (1 << 1));
+
+        for (int i = 0; i < uniqueCount && p + elementSize <= end; i++) {
+            memcpy(p, &unique[i]->bin, elementSize);
+            p += elementSize;
+        }
+
+        uint32_t val = n;
+        memcpy(p, &val, sizeof(val));
+        p += sizeof(val);
+        k = 0;
+        for (int i = 0; i < n; i++) {
+            val = queries[i].count;
+            memcpy(p, &val, sizeof(val));
+            p += sizeof(val);
+            memcpy(p, &indexes[k], queries[i].count * sizeof(uint32_t));
+            p += queries[i].count * sizeof(uint32_t);
+            k += queries[i].count;
+        }
+    } else {
+        p = safe_snprintf(p, end, "{\"now\": %.3f", buffer->timestamp / 1000.0);
+        p = safe_snprintf(p, end, "\n,\"aircraft\":[");
+
+        char *json = buffer->json;
+        for (int i = 0; i < uniqueCount; i++) {
+            struct offset off = unique[i]->jsonOffset; // READ-ONLY here
+            if (unlikely(p + off.len + 100 >= end)) {
+                fprintf(stderr, "apiBatchReq: buffer insufficient, count: %d alloc: %ld\n", uniqueCount, (long) alloc);
+                break;
+            }
+            memcpy(p, json + off.offset, off.len);
+            p += off.len;
+        }
+        // json objects in cache are terminated by a comma: \n{ .... },
+        if (*(p - 1) == ',')
+            p--;
+
+        p = safe_snprintf(p, end, "\n]\n,\"queries\":[");
+        k = 0;
+        for (int i = 0; i < n; i++) {
+            p = safe_snprintf(p, end, "%s\n[", i ? "," : "");
+            for (int j = 0; j < queries[i].count; j++) {
+                p = safe_snprintf(p, end, "%s%d", j ? "," : "", indexes[k++]);
+            }
+            p = safe_snprintf(p, end, "]");
+        }
+        options->request_processed = microtime();
+        p = safe_snprintf(p, end, "\n]");
+        p = safe_snprintf(p, end, "\n,\"resultCount\": %d", uniqueCount);
+        p = safe_snprintf(p, end, "\n,\"ptime\": %.3f", (options->request_processed - options->request_received) / 1000.0);
+        p = safe_snprintf(p, end, "\n}\n");
+    }
+
+    if (p >= end) {
+        fprintf(stderr, "apiBatchReq buffer insufficient\n");
+    }
+
+    cb.len = p - cb.buffer;
+
+    sfree(unique);
+    sfree(indexes);
+    apiBatchFree(queries, n);
+
+    if (options->zstd || options->zstd_encode) {
+        cb = apiCompress(thread, cb);
+    }
+
+    return cb;
+}
+
+// per subsystem memory accounting, see appendMemoryJson
+static struct char_buffer apiMemoryReply() {
+    struct char_buffer cb;
+    size_t alloc = API_REQ_PADSTART + 1024;
+    cb.buffer = cmalloc(alloc);
+    char *p = cb.buffer + API_REQ_PADSTART;
+    char *end = cb.buffer + alloc;
+    p = appendMemoryJson(p, end);
+    p = safe_snprintf(p, end, "\n");
+    cb.len = p - cb.buffer;
+    return cb;
+}
+
+// latest clients.json, see apiSetClientsJson
+static pthread_mutex_t clientsJsonMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct char_buffer clientsJson;
+
+void apiSetClientsJson(struct char_buffer cb) {
+    pthread_mutex_lock(&clientsJsonMutex);
+    struct char_buffer old = clientsJson;
+    clientsJson = cb;
+    pthread_mutex_unlock(&clientsJsonMutex);
+    sfree(old.buffer);
+}
+
+static struct char_buffer apiClientsReply() {
+    struct char_buffer cb = { 0 };
+    pthread_mutex_lock(&clientsJsonMutex);
+    if (clientsJson.len) {
+        cb.buffer = cmalloc(API_REQ_PADSTART + clientsJson.len);
+        memcpy(cb.buffer + API_REQ_PADSTART, clientsJson.buffer, clientsJson.len);
+        cb.len = API_REQ_PADSTART + clientsJson.len;
+    }
+    pthread_mutex_unlock(&clientsJsonMutex);
+    return cb;
+}
+
+static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *request, struct apiOptions *options, struct apiThread *thread) {
+    struct char_buffer invalid = { 0 };
+
+    char *req = request->buffer;
+
+    // GET URL HTTPVERSION
+    char *query = memchr(req, '?', request->len);
+    if (!query) {
+        return invalid;
+    }
+    // skip URL to after ? which signifies start of query options
+    query++;
+
+    // find end of query
+    char *eoq = memchr(query, ' ', request->len);
+    if (!eoq) {
+        return invalid;
+    }
+
+    // browsers encode the batch separator
+    char *w = query;
+    for (char *r = query; r < eoq; r++) {
+        if (r + 2 < eoq && r[0] == '%' && r[1] == '7' && (r[2] == 'c' || r[2] == 'C')) {
+            *w++ = '|';
+            r += 2;
+        } else {
+            *w++ = *r;
+        }
+    }
+    eoq = w;
+
+    // we only want the URL
+    *eoq = '\0';
+
+    char cacheKey[API_CACHE_KEY_MAX];
+    int cacheKeyLen = apiCacheKey(query, eoq, cacheKey);
+
+    // batch request: output options|query 1|query 2|...
+    char *batch = memchr(query, '|', eoq - query);
+    if (batch) {
+        *batch++ = '\0';
+        if (!parseQuery(con, query, batch - 1, options, 0)) {
+            return invalid;
+        }
+        if (options->stream || options->jamesv2 || options->is_box || options->is_circle || options->is_hexList
+                || options->is_callsignList || options->is_regList || options->is_typeList || options->is_squawkList
+                || options->all || options->all_with_pos || options->trace) {
+            return invalid;
+        }
+    } else if (!parseQuery(con, query, eoq, options, 1)) {
         return invalid;
     }
 
@@ -1515,7 +2836,82 @@ static struct char_buffer parseFetch(struct apiCon *con, struct char_buffer *req
         con->content_type = "application/json";
     }
 
-    return apiReq(thread, options);
+    int flip = atomic_load(&Modes.apiFlip[thread->index]);
+    struct apiBuffer *buffer = &Modes.apiBuffer[flip];
+
+    if (options->trace) {
+        if (options->zstd || options->binCraft || options->jamesv2) {
+            return invalid;
+        }
+        return apiTraceReq(con, thread, options);
+    }
+
+    if (options->stream) {
+        // server-sent events, json only
+        if (options->zstd || options->binCraft || options->jamesv2) {
+            return invalid;
+        }
+        return apiStreamStart(con, thread, options, buffer);
+    }
+
+    int json = !options->binCraft && !options->zstd;
+
+    if (!cacheKeyLen) {
+        if (batch) {
+            return apiBatchReq(con, thread, buffer, options, batch, eoq);
+        }
+        return apiReq(thread, buffer, options);
+    }
+
+    // identical requests against the same buffer generation produce identical responses
+    // (apart from ptime for json, updated on a cache hit), serve them from the cache instead of filtering / compressing again
+    // zstd encoded json is served as cached: its ptime is that of the first request against this generation
+    cacheKeyLen += snprintf(cacheKey + cacheKeyLen, API_CACHE_KEY_MAX - cacheKeyLen, "%s", options->zstd_encode ? "|zstd" : "|");
+
+    int64_t generation;
+    struct char_buffer cb = apiCacheLookup(buffer, cacheKey, cacheKeyLen, &generation);
+    if (cb.len) {
+        thread->cacheHits++;
+        if (json && !options->zstd_encode) {
+            cb = apiCacheUpdatePtime(cb, options);
+        }
+        return cb;
+    }
+    thread->cacheMisses++;
+
+    if (batch) {
+        cb = apiBatchReq(con, thread, buffer, options, batch, eoq);
+    } else {
+        cb = apiReq(thread, buffer, options);
+    }
+
+    if (cb.len > API_REQ_PADSTART && generation >= 0) {
+        apiCacheInsert(buffer, cacheKey, cacheKeyLen, generation, &cb);
+    }
+    return cb;
+}
+
+// event completely sent, keep the connection open for the next one
+static void apiStreamSent(struct apiCon *con, struct apiThread *thread) {
+    struct char_buffer *reply = &con->reply;
+
+    thread->responseBytesBuffered -= reply->len;
+
+    sfree(reply->buffer);
+    reply->len = 0;
+    reply->alloc = 0;
+    con->bytesSent = 0;
+    con->wakeups = 0;
+
+    if ((con->events & EPOLLOUT)) {
+        con->events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+        struct epoll_event epollEvent = { .events = con->events };
+        epollEvent.data.ptr = con;
+
+        if (epoll_ctl(thread->epfd, EPOLL_CTL_MOD, con->fd, &epollEvent)) {
+            perror("apiStreamSent() epoll_ctl fail:");
+        }
+    }
 }
 
 static void apiSendData(struct apiCon *con, struct apiThread *thread) {
@@ -1548,7 +2944,11 @@ static void apiSendData(struct apiCon *con, struct apiThread *thread) {
 
     // all data has been sent, reset the connection
     if (nwritten == toSend) {
-        apiResetCon(con, thread);
+        if (con->stream) {
+            apiStreamSent(con, thread);
+        } else {
+            apiResetCon(con, thread);
+        }
         return;
     }
 
@@ -1581,6 +2981,29 @@ static void apiSendData(struct apiCon *con, struct apiThread *thread) {
     return;
 }
 
+// send the changes since the last event to all stream connections of this thread
+static void apiStreamPush(struct apiThread *thread, struct apiBuffer *buffer) {
+    for (int j = 0; j < Modes.api_fds_per_thread; j++) {
+        struct apiCon *con = &thread->cons[j];
+        if (!con->open || !con->stream || con->stream->timestamp == buffer->timestamp) {
+            continue;
+        }
+        if (con->reply.len > con->bytesSent) {
+            // client hasn't received the previous event yet, the next event will contain the accumulated changes
+            continue;
+        }
+        struct char_buffer cb = apiStreamEvent(buffer, con->stream, 0);
+        if (!cb.len) {
+            continue;
+        }
+        sfree(con->reply.buffer);
+        con->reply = cb;
+        con->bytesSent = 0;
+        thread->responseBytesBuffered += cb.len;
+        apiSendData(con, thread);
+    }
+}
+
 static void apiShutdown(struct apiCon *con, struct apiThread *thread, int line, int err) {
     if (con->bytesSent != con->reply.len) {
         if (antiSpam(&thread->antiSpam[1], 5 * SECONDS)) {
@@ -1599,6 +3022,16 @@ static void apiShutdown(struct apiCon *con, struct apiThread *thread, int line,
 
 static void apiReadRequest(struct apiCon *con, struct apiThread *thread) {
 
+    if (con->stream) {
+        // nothing further is expected from stream clients, discard whatever they send
+        char discard[512];
+        int nread = recv(con->fd, discard, sizeof(discard), 0);
+        if (nread == 0 || (nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            apiCloseCon(con, thread);
+        }
+        return;
+    }
+
     // delay processing requests until we have more memory
     if (thread->responseBytesBuffered > 512 * 1024 * 1024) {
         if (antiSpam(&thread->antiSpam[2], 5 * SECONDS)) {
@@ -1721,6 +3154,9 @@ static void apiReadRequest(struct apiCon *con, struct apiThread *thread) {
             if (strstr(hl, "zstd")) {
                 options->zstd_encode = 1;
             }
+            if (strstr(hl, "gzip")) {
+                options->gzip_accept = 1;
+            }
         }
         if (byteMatchStart(hl, "connection")) {
             if (strstr(hl, "close")) {
@@ -1758,11 +3194,28 @@ static void apiReadRequest(struct apiCon *con, struct apiThread *thread) {
         return;
     }
 
-    con->content_type = "multipart/mixed";
-    struct char_buffer reply = parseFetch(con, request, options, thread);
+    struct char_buffer reply;
+    char *memory = protocol - litLen("?memory ");
+    char *clients = protocol - litLen("?clients ");
+    if (memory > req_start && byteMatchStart(memory, "?memory ")) {
+        con->content_type = "application/json";
+        reply = apiMemoryReply();
+    } else if (clients > req_start && byteMatchStart(clients, "?clients ")) {
+        con->content_type = "application/json";
+        reply = apiClientsReply();
+    } else {
+        con->content_type = "multipart/mixed";
+        PROBE1(api_start, thread->index);
+        reply = parseFetch(con, request, options, thread);
+        PROBE2(api_done, thread->index, reply.len);
+    }
     if (reply.len == 0) {
         //fprintf(stderr, "parseFetch returned invalid\n");
-        send400(con->fd, con->keepalive);
+        if (options->traceNotFound) {
+            send404(con->fd, con->keepalive);
+        } else {
+            send400(con->fd, con->keepalive);
+        }
         apiResetCon(con, thread);
         return;
     }
@@ -1776,20 +3229,33 @@ static void apiReadRequest(struct apiCon *con, struct apiThread *thread) {
 
     int content_len = reply.len - API_REQ_PADSTART;
 
-    p = safe_snprintf(p, end,
-            "HTTP/1.1 200 OK\r\n"
-            "Server: readsb/wiedehopf\r\n"
-            "%s"
-            "Content-Type: %s\r\n"
-            "Connection: %s\r\n"
-            "Cache-Control: no-store\r\n"
-            "%s"
-            "Content-Length: %d\r\n\r\n",
-            con->include_version ? "readsb_version: "MODES_READSB_VERSION"\r\n" : "",
-            con->content_type,
-            con->keepalive ? "keep-alive" : "close",
-            options->zstd_encode ? "Content-Encoding: zstd\r\n" : "",
-            content_len);
+    if (con->stream) {
+        // no Content-Length, events follow until the connection is closed
+        p = safe_snprintf(p, end,
+                "HTTP/1.1 200 OK\r\n"
+                "Server: readsb/wiedehopf\r\n"
+                "%s"
+                "Content-Type: %s\r\n"
+                "Connection: close\r\n"
+                "Cache-Control: no-store\r\n\r\n",
+                con->include_version ? "readsb_version: "MODES_READSB_VERSION"\r\n" : "",
+                con->content_type);
+    } else {
+        p = safe_snprintf(p, end,
+                "HTTP/1.1 200 OK\r\n"
+                "Server: readsb/wiedehopf\r\n"
+                "%s"
+                "Content-Type: %s\r\n"
+                "Connection: %s\r\n"
+                "Cache-Control: no-store\r\n"
+                "%s"
+                "Content-Length: %d\r\n\r\n",
+                con->include_version ? "readsb_version: "MODES_READSB_VERSION"\r\n" : "",
+                con->content_type,
+                con->keepalive ? "keep-alive" : "close",
+                options->zstd_encode ? "Content-Encoding: zstd\r\n" : (options->gzip_encoded ? "Content-Encoding: gzip\r\n" : ""),
+                content_len);
+    }
 
     int hlen = p - header;
     //fprintf(stderr, "hlen %d\n", hlen);
@@ -1919,6 +3385,14 @@ static void *apiThreadEntryPoint(void *arg) {
 
     thread->epfd = my_epoll_create(&Modes.exitNowEventfd);
 
+    if (thread->eventfd >= 0) {
+        // apiUpdate wakes us up to push events to stream connections
+        struct epoll_event epollEvent = { .events = EPOLLIN, .data = { .ptr = &thread->eventfd }};
+        if (epoll_ctl(thread->epfd, EPOLL_CTL_ADD, thread->eventfd, &epollEvent)) {
+            perror("apiThreadEntryPoint() epoll_ctl fail:");
+        }
+    }
+
     for (int i = 0; i < Modes.apiService.listener_count; ++i) {
         struct apiCon *con = Modes.apiListeners[i];
         struct epoll_event epollEvent = { .events = con->events };
@@ -1960,12 +3434,29 @@ static void *apiThreadEntryPoint(void *arg) {
             unsigned int requestCount = thread->requestCount;
             atomic_fetch_add(&Modes.apiRequestCounter, requestCount);
             thread->requestCount = 0;
+
+            atomic_fetch_add(&Modes.apiCacheHits, thread->cacheHits);
+            atomic_fetch_add(&Modes.apiCacheMisses, thread->cacheMisses);
+            thread->cacheHits = 0;
+            thread->cacheMisses = 0;
+
+            atomic_fetch_add(&Modes.apiTraceCacheHits, thread->traceCacheHits);
+            atomic_fetch_add(&Modes.apiTraceCacheMisses, thread->traceCacheMisses);
+            thread->traceCacheHits = 0;
+            thread->traceCacheMisses = 0;
         }
 
         for (int i = 0; i < count; i++) {
             struct epoll_event event = events[i];
             if (event.data.ptr == &Modes.exitNowEventfd)
                 continue;
+            if (event.data.ptr == &thread->eventfd) {
+                uint64_t val;
+                if (read(thread->eventfd, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+                    perror("apiThreadEntryPoint() eventfd read:");
+                }
+                continue;
+            }
 
             struct apiCon *con = event.data.ptr;
             if (con->accept && (event.events & EPOLLIN)) {
@@ -2008,6 +3499,15 @@ static void *apiThreadEntryPoint(void *arg) {
             }
 
         }
+
+        if (thread->streamCount) {
+            int flip = atomic_load(&Modes.apiFlip[thread->index]);
+            struct apiBuffer *buffer = &Modes.apiBuffer[flip];
+            if (buffer->timestamp != thread->streamTimestamp) {
+                thread->streamTimestamp = buffer->timestamp;
+                apiStreamPush(thread, buffer);
+            }
+        }
     }
 
     for (int j = 0; j < Modes.api_fds_per_thread; j++) {
@@ -2021,7 +3521,12 @@ static void *apiThreadEntryPoint(void *arg) {
     sfree(events);
 
     ZSTD_freeCCtx(thread->cctx);
+    free_threadpool_buffer(&thread->traceBuffers[0]);
+    free_threadpool_buffer(&thread->traceBuffers[1]);
     close(thread->epfd);
+    if (thread->eventfd >= 0) {
+        close(thread->eventfd);
+    }
 
     sfree(thread->stack);
     sfree(thread->cons);
@@ -2094,11 +3599,18 @@ void apiBufferInit() {
     size_t size = sizeof(struct apiThread) * Modes.apiThreadCount;
     Modes.apiThread = cmalloc(size);
     memset(Modes.apiThread, 0x0, size);
+    for (int i = 0; i < Modes.apiThreadCount; i++) {
+        Modes.apiThread[i].eventfd = -1;
+    }
 
     size = sizeof(atomic_int) * Modes.apiThreadCount;
     Modes.apiFlip = cmalloc(size);
     memset(Modes.apiFlip, 0x0, size);
 
+    for (int i = 0; i < 2; i++) {
+        pthread_mutex_init(&Modes.apiBuffer[i].cacheMutex, NULL);
+    }
+
     apiUpdate(); // run an initial apiUpdate
 
     Modes.apiBufferInitDone++;
@@ -2116,12 +3628,19 @@ void apiBufferCleanup() {
     threadSignalJoin(&Threads.apiUpdate);
 
     for (int i = 0; i < 2; i++) {
+        apiBufferAccount(&Modes.apiBuffer[i], 1);
         sfree(Modes.apiBuffer[i].list);
         sfree(Modes.apiBuffer[i].list_flag);
         sfree(Modes.apiBuffer[i].json);
         sfree(Modes.apiBuffer[i].hexHash);
         sfree(Modes.apiBuffer[i].regHash);
         sfree(Modes.apiBuffer[i].callsignHash);
+        sfree(Modes.apiBuffer[i].typeHash);
+        sfree(Modes.apiBuffer[i].squawkHash);
+        sfree(Modes.apiBuffer[i].altIndex);
+        sfree(Modes.apiBuffer[i].callsignIndex);
+        apiCacheClear(&Modes.apiBuffer[i]);
+        pthread_mutex_destroy(&Modes.apiBuffer[i].cacheMutex);
     }
 
     sfree(Modes.apiThread);
@@ -2166,6 +3685,9 @@ void apiInit() {
     //fprintf(stderr, "Modes.api_fds_per_thread: %d\n", Modes.api_fds_per_thread);
     for (int i = 0; i < Modes.apiThreadCount; i++) {
         Modes.apiThread[i].index = i;
+#ifndef NO_EVENT_FD
+        Modes.apiThread[i].eventfd = eventfd(0, EFD_NONBLOCK);
+#endif
         pthread_create(&Modes.apiThread[i].thread, NULL, apiThreadEntryPoint, &Modes.apiThread[i]);
     }
 }
@@ -2173,6 +3695,7 @@ void apiCleanup() {
     for (int i = 0; i < Modes.apiThreadCount; i++) {
         pthread_join(Modes.apiThread[i].thread, NULL);
     }
+    traceCacheCleanup();
     struct net_service *service = &Modes.apiService;
 
     for (int i = 0; i < service->listener_count; ++i) {
@@ -2186,6 +3709,9 @@ void apiCleanup() {
         unlink(service->unixSocket);
         sfree(service->unixSocket);
     }
+
+    sfree(clientsJson.buffer);
+    clientsJson.len = 0;
 }
 
 struct char_buffer apiGenerateAircraftJson(threadpool_buffer_t *pbuffer) {
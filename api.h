@@ -5,8 +5,22 @@
 
 #define API_REQ_LIST_MAX 1024
 
+#define API_BATCH_MAX 128
+
 #define API_ZSTD_LVL (2)
 
+// responses are cached per apiBuffer generation, keyed by the normalized query and encoding
+#define API_CACHE_ENTRIES 64
+#define API_CACHE_MAX_BYTES (64 * 1024 * 1024)
+#define API_CACHE_KEY_MAX 256
+#define API_CACHE_TOKENS_MAX 32
+
+// on demand trace_recent / trace_full responses, gzip compressed
+#define API_TRACE_CACHE_ENTRIES 512
+#define API_TRACE_CACHE_MAX_BYTES (32 * 1024 * 1024)
+// regenerate after this even if the trace didn't change (traceLast, legs depend on the time)
+#define API_TRACE_CACHE_MAX_AGE (30 * SECONDS)
+
 struct apiCon {
     int fd;
     int accept;
@@ -21,6 +35,7 @@ struct apiCon {
     struct char_buffer request;
     int64_t lastReset; // milliseconds
     char *content_type;
+    struct apiStream *stream; // set for server-sent event connections
 };
 
 struct apiCircle {
@@ -52,6 +67,12 @@ struct apiOptions {
     int binCraft;
     int zstd;
     int zstd_encode;
+    int stream;
+    int trace; // WRECENT or WMEM
+    uint32_t traceHex;
+    int traceNotFound;
+    int gzip_encoded;
+    int gzip_accept; // Accept-Encoding includes gzip
     int filter_dbFlag;
     int filter_mil;
     int filter_interesting;
@@ -91,6 +112,8 @@ struct apiEntry {
     struct apiEntry *nextHex;
     struct apiEntry *nextReg;
     struct apiEntry *nextCallsign;
+    struct apiEntry *nextType;
+    struct apiEntry *nextSquawk;
 
     float distance;
     float direction;
@@ -106,13 +129,52 @@ struct range {
     int to; // exclusive
 };
 
+// candidate sources for the query planner
+enum apiSource {
+    API_SRC_PRIMARY = 0, // the primary selector itself
+    API_SRC_TYPE,
+    API_SRC_SQUAWK,
+    API_SRC_ALT,
+    API_SRC_CALLSIGN_PREFIX,
+    API_SRC_CALLSIGN,
+};
+
+struct apiBatchQuery {
+    struct apiEntry *matches;
+    int count;
+    int doFree;
+};
+
+struct apiStreamEntry {
+    uint32_t hex;
+    uint32_t hash; // binCraft without the seen fields
+};
+
+struct apiStream {
+    struct apiOptions options;
+    int64_t timestamp; // apiBuffer timestamp of the last event
+    int len;
+    int alloc;
+    struct apiStreamEntry *list; // aircraft sent to the client, sorted by hex
+};
+
+struct apiCacheEntry {
+    uint32_t hash;
+    int keyLen;
+    char key[API_CACHE_KEY_MAX];
+    char *payload; // response body without header, possibly zstd compressed
+    int len;
+};
+
 
 struct apiBuffer {
     int len;
     int len_flag;
     int alloc;
     int jsonLen;
-    char *json;
+    size_t jsonAlloc;
+    char *json; // kept across updates, only grows
+    int64_t memBytes; // bytes accounted in MEM_API for this buffer
     struct apiEntry *list;
     struct apiEntry *list_flag;
     struct range list_pos_range;
@@ -123,8 +185,22 @@ struct apiBuffer {
     struct apiEntry **hexHash;
     struct apiEntry **regHash;
     struct apiEntry **callsignHash;
+    struct apiEntry **typeHash;
+    struct apiEntry **squawkHash;
+    // secondary indexes for the query planner
+    int altIndexLen;
+    int callsignIndexLen;
+    struct apiEntry **altIndex; // entries with altitude sorted by altitude
+    struct apiEntry **callsignIndex; // entries with callsign sorted by callsign
     uint32_t focus;
     int aircraftJsonCount;
+
+    // response cache, odd generation: buffer is being rebuilt, don't use the cache
+    pthread_mutex_t cacheMutex;
+    int64_t cacheGeneration;
+    int cacheCount;
+    int64_t cacheBytes;
+    struct apiCacheEntry cache[API_CACHE_ENTRIES];
 };
 
 struct apiThread {
@@ -134,11 +210,18 @@ struct apiThread {
     int eventfd;
     int responseBytesBuffered;
     uint32_t requestCount;
+    uint32_t cacheHits;
+    uint32_t cacheMisses;
+    int streamCount;
+    int64_t streamTimestamp;
     int conCount;
     int stackCount;
     struct apiCon *cons;
     struct apiCon **stack;
     ZSTD_CCtx* cctx;
+    threadpool_buffer_t traceBuffers[2]; // reassemble / generate for on demand traces
+    uint32_t traceCacheHits;
+    uint32_t traceCacheMisses;
     // for producing average request len numbers
     int64_t request_len_sum;
     int64_t request_count;
@@ -152,6 +235,9 @@ void apiBufferCleanup();
 void apiInit();
 void apiCleanup();
 
+// takes ownership of cb, served for ?clients
+void apiSetClientsJson(struct char_buffer cb);
+
 struct char_buffer apiGenerateAircraftJson(threadpool_buffer_t *pbuffer);
 struct char_buffer apiGenerateGlobeJson(int globe_index, threadpool_buffer_t *pbuffer);
 
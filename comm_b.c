@@ -49,6 +49,80 @@ static CommBDecoderFn comm_b_decoders[] = {
     &decodeBDS44
 };
 
+#define COMMB_DECODERS (sizeof (comm_b_decoders) / sizeof (comm_b_decoders[0]))
+
+// Register inference cache
+//
+// A ground station doing enhanced surveillance polls the same few registers of an aircraft
+// over and over. For each address remember which decoders won the full scan recently,
+// once that set is stable only those decoders are scored.
+// The result is accepted if exactly one of them scores at least COMMB_CONFIDENT_SCORE,
+// anything else (low scores, ties, a new register) falls back to the full scan.
+// Every COMMB_CACHE_RESCAN messages of an aircraft are fully scanned regardless, a full scan only
+// confirms the set if the winner leads the best decoder outside of it by COMMB_CACHE_MARGIN.
+// Registers which haven't won since the previous periodic scan are dropped from the set.
+//
+// The decoding threads share the table, an entry is a single 64 bit word:
+// bits 0-23 address, 24-32 mask of recent decoders, 33-41 decoders that won since the last periodic scan,
+// 42-45 consecutive confirmations, 46-50 messages since the last periodic scan, 63 valid
+
+#define COMMB_CACHE_BITS 12
+#define COMMB_CACHE_SIZE (1 << COMMB_CACHE_BITS)
+// number of full scans confirming the mask before the fast path is used
+#define COMMB_CACHE_TRUST 3
+// every n-th message of an aircraft does the full scan (5 bits)
+#define COMMB_CACHE_RESCAN 32
+// score lead of the winner over the best decoder outside the mask required to confirm the mask
+#define COMMB_CACHE_MARGIN 10
+// a fully valid BDS 4,0 / 5,0 / 6,0 / 2,0 / 4,4 scores above this
+#define COMMB_CONFIDENT_SCORE 40
+
+#define CE_VALID (1ULL << 63)
+#define CE_ADDR(e) ((uint32_t) ((e) & 0xFFFFFF))
+#define CE_MASK(e) ((uint32_t) (((e) >> 24) & 0x1FF))
+#define CE_SEEN(e) ((uint32_t) (((e) >> 33) & 0x1FF))
+#define CE_HITS(e) ((uint32_t) (((e) >> 42) & 0xF))
+#define CE_COUNT(e) ((uint32_t) (((e) >> 46) & 0x1F))
+#define CE_MAKE(addr, mask, seen, hits, count) (CE_VALID | ((uint64_t) (addr) & 0xFFFFFF) | ((uint64_t) (mask) << 24) \
+        | ((uint64_t) (seen) << 33) | ((uint64_t) (hits) << 42) | ((uint64_t) (count) << 46))
+
+static atomic_uint_fast64_t commbCache[COMMB_CACHE_SIZE];
+
+// after a full scan, winner is the decoder with a confident unambiguous score or -1
+// margin is its lead over the best decoder outside of the mask
+static void commbCacheUpdate(atomic_uint_fast64_t *slot, uint64_t entry, uint32_t addr, uint32_t count, int winner, int margin) {
+    uint32_t mask = 0;
+    uint32_t seen = 0;
+    uint32_t hits = 0;
+    if ((entry & CE_VALID) && CE_ADDR(entry) == addr) {
+        mask = CE_MASK(entry);
+        seen = CE_SEEN(entry);
+        hits = CE_HITS(entry);
+    } else if (winner < 0) {
+        // nothing to remember, leave the slot to the aircraft using it
+        return;
+    }
+    if (winner >= 0) {
+        if (!(mask & (1 << winner))) {
+            // the station started polling another register, don't trust the set until it's confirmed again
+            mask |= (1 << winner);
+            hits = 0;
+        } else if (margin < COMMB_CACHE_MARGIN) {
+            // a register outside of the set came close, the fast path could have picked the wrong one
+            hits = 0;
+        } else if (hits < 15) {
+            hits++;
+        }
+        seen |= (1 << winner);
+    }
+    if (count == 0) {
+        // periodic scan: age out the registers the station stopped polling
+        mask = seen;
+        seen = 0;
+    }
+    atomic_store_explicit(slot, CE_MAKE(addr, mask, seen, hits, count), memory_order_relaxed);
+}
+
 void decodeCommB(struct modesMessage *mm) {
     mm->commb_format = COMMB_UNKNOWN;
 
@@ -59,28 +133,71 @@ void decodeCommB(struct modesMessage *mm) {
         return;
     }
 
+    uint32_t addr = mm->addr & 0xFFFFFF;
+    atomic_uint_fast64_t *slot = &commbCache[addrHash(addr, COMMB_CACHE_BITS)];
+    uint64_t entry = atomic_load_explicit(slot, memory_order_relaxed);
+    int known = (entry & CE_VALID) && CE_ADDR(entry) == addr;
+    uint32_t mask = known ? CE_MASK(entry) : 0;
+    uint32_t count = known ? (CE_COUNT(entry) + 1) % COMMB_CACHE_RESCAN : 0;
+
+    // fast path: only score the registers this aircraft has recently been answering
+    if (known && CE_HITS(entry) >= COMMB_CACHE_TRUST && count != 0) {
+        int confident = 0;
+        int winner = -1;
+        for (unsigned i = 0; i < COMMB_DECODERS; ++i) {
+            if (!(mask & (1 << i)))
+                continue;
+            if (comm_b_decoders[i](mm, false) >= COMMB_CONFIDENT_SCORE) {
+                confident++;
+                winner = i;
+            }
+        }
+        if (confident == 1) {
+            atomic_fetch_add_explicit(&Modes.commbFastPath, 1, memory_order_relaxed);
+            atomic_store_explicit(slot, CE_MAKE(addr, mask, CE_SEEN(entry) | (1 << winner), CE_HITS(entry), count), memory_order_relaxed);
+            comm_b_decoders[winner](mm, true);
+            return;
+        }
+    }
+
+    atomic_fetch_add_explicit(&Modes.commbFullScan, 1, memory_order_relaxed);
+
     // This is a bit hairy as we don't know what the requested register was
+    int scores[COMMB_DECODERS];
     int bestScore = 0;
-    CommBDecoderFn bestDecoder = NULL;
+    int best = -1;
     int ambiguous = 0;
 
-    for (unsigned i = 0; i < (sizeof (comm_b_decoders) / sizeof (comm_b_decoders[0])); ++i) {
+    for (unsigned i = 0; i < COMMB_DECODERS; ++i) {
         int score = comm_b_decoders[i](mm, false);
+        scores[i] = score;
         if (score > bestScore) {
             bestScore = score;
-            bestDecoder = comm_b_decoders[i];
+            best = i;
             ambiguous = 0;
         } else if (score == bestScore) {
             ambiguous = 1;
         }
     }
 
-    if (bestDecoder) {
+    int winner = -1;
+    int bestOutside = 0;
+    if (best >= 0 && !ambiguous && bestScore >= COMMB_CONFIDENT_SCORE) {
+        winner = best;
+        for (unsigned i = 0; i < COMMB_DECODERS; ++i) {
+            if ((int) i != best && !(mask & (1 << i)) && scores[i] > bestOutside) {
+                bestOutside = scores[i];
+            }
+        }
+    }
+    commbCacheUpdate(slot, entry, addr, count, winner, bestScore - bestOutside);
+
+    if (best >= 0) {
         if (ambiguous) {
             mm->commb_format = COMMB_AMBIGUOUS;
         } else {
             // decode it
-            bestDecoder(mm, true);
+            comm_b_decoders[best](mm, true);
         }
     }
 }
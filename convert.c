@@ -23,6 +23,13 @@
 
 #include "readsb.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CONVERT_SIMD 1
+#include <immintrin.h>
+#else
+#define CONVERT_SIMD 0
+#endif
+
 struct converter_state {
     float dc_a;
     float dc_b;
@@ -419,44 +426,370 @@ static void convert_sc16q11_generic(void *iq_data,
     }
 }
 
+// SIMD converters without DC filter (the DC filter is a per sample IIR filter and stays scalar)
+// magnitude and level / power sums are computed directly, no lookup tables which would compete
+// with the demodulator for cache.
+// SSE2 is part of x86_64, AVX2 is checked at runtime, the functions are compiled with target attributes
+// so no special compiler flags are needed.
+
+static inline uint16_t mag_from_iq(float fI, float fQ) {
+    float magsq = fI * fI + fQ * fQ;
+    if (magsq > 1)
+        magsq = 1;
+    return (uint16_t) (sqrtf(magsq) * 65535.0f + 0.5f);
+}
+
+static inline void finish_sums(uint64_t sum_level, uint64_t sum_power, unsigned nsamples,
+        double *out_mean_level, double *out_mean_power) {
+    if (out_mean_level) {
+        *out_mean_level = sum_level / 65535.0 / nsamples;
+    }
+
+    if (out_mean_power) {
+        *out_mean_power = sum_power / 65535.0 / 65535.0 / nsamples;
+    }
+}
+
+#if CONVERT_SIMD
+
+// a, b: scaled interleaved I/Q for 4 samples -> 4 magnitudes as int32
+static inline __m128i sse2_mag4(__m128 a, __m128 b) {
+    a = _mm_mul_ps(a, a);
+    b = _mm_mul_ps(b, b);
+    __m128 magsq = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    magsq = _mm_min_ps(magsq, _mm_set1_ps(1.0f));
+    __m128 mag = _mm_sqrt_ps(magsq);
+    return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(mag, _mm_set1_ps(65535.0f)), _mm_set1_ps(0.5f)));
+}
+
+// sum as 64 bit so large buffers can't overflow
+static inline void sse2_sum4(__m128i m, __m128i *level, __m128i *power) {
+    __m128i even = _mm_and_si128(m, _mm_set_epi32(0, -1, 0, -1));
+    __m128i odd = _mm_srli_epi64(m, 32);
+    *level = _mm_add_epi64(*level, _mm_add_epi64(even, odd));
+    *power = _mm_add_epi64(*power, _mm_add_epi64(_mm_mul_epu32(even, even), _mm_mul_epu32(odd, odd)));
+}
+
+// store 8 magnitudes (0 .. 65535), SSE2 has no unsigned 32 -> 16 bit pack
+static inline void sse2_store8(uint16_t *out, __m128i m0, __m128i m1) {
+    const __m128i bias = _mm_set1_epi32(32768);
+    __m128i x = _mm_packs_epi32(_mm_sub_epi32(m0, bias), _mm_sub_epi32(m1, bias));
+    x = _mm_xor_si128(x, _mm_set1_epi16((short) 0x8000));
+    _mm_storeu_si128((__m128i *) out, x);
+}
+
+static inline uint64_t sse2_hsum(__m128i v) {
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, v);
+    return lanes[0] + lanes[1];
+}
+
+static void convert_uc8_sse2(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power) {
+    uint8_t *in = iq_data;
+    __m128i level = _mm_setzero_si128();
+    __m128i power = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 offset = _mm_set1_ps(127.5f);
+    const __m128 scale = _mm_set1_ps(1.0f / 127.5f);
+    unsigned i;
+
+    MODES_NOTUSED(state);
+
+    for (i = 0; i + 8 <= nsamples; i += 8) {
+        __m128i raw = _mm_loadu_si128((__m128i *) in);
+        __m128i lo = _mm_unpacklo_epi8(raw, zero);
+        __m128i hi = _mm_unpackhi_epi8(raw, zero);
+        __m128 f0 = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), offset), scale);
+        __m128 f1 = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), offset), scale);
+        __m128 f2 = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), offset), scale);
+        __m128 f3 = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), offset), scale);
+        __m128i m0 = sse2_mag4(f0, f1);
+        __m128i m1 = sse2_mag4(f2, f3);
+        sse2_sum4(m0, &level, &power);
+        sse2_sum4(m1, &level, &power);
+        sse2_store8(mag_data, m0, m1);
+        in += 16;
+        mag_data += 8;
+    }
+
+    uint64_t sum_level = sse2_hsum(level);
+    uint64_t sum_power = sse2_hsum(power);
+
+    for (; i < nsamples; i++) {
+        uint16_t mag = mag_from_iq((in[0] - 127.5f) / 127.5f, (in[1] - 127.5f) / 127.5f);
+        in += 2;
+        *mag_data++ = mag;
+        sum_level += mag;
+        sum_power += (uint32_t) mag * (uint32_t) mag;
+    }
+
+    finish_sums(sum_level, sum_power, nsamples, out_mean_level, out_mean_power);
+}
+
+// SC16 and SC16Q11 only differ in the scale
+static inline void convert_s16_sse2(int16_t *in,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        float fscale,
+        double *out_mean_level,
+        double *out_mean_power) {
+    __m128i level = _mm_setzero_si128();
+    __m128i power = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(fscale);
+    unsigned i;
+
+    for (i = 0; i + 8 <= nsamples; i += 8) {
+        __m128i r0 = _mm_loadu_si128((__m128i *) in);
+        __m128i r1 = _mm_loadu_si128((__m128i *) (in + 8));
+        // sign extend 16 -> 32 bit
+        __m128 f0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(r0, r0), 16)), scale);
+        __m128 f1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(r0, r0), 16)), scale);
+        __m128 f2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(r1, r1), 16)), scale);
+        __m128 f3 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(r1, r1), 16)), scale);
+        __m128i m0 = sse2_mag4(f0, f1);
+        __m128i m1 = sse2_mag4(f2, f3);
+        sse2_sum4(m0, &level, &power);
+        sse2_sum4(m1, &level, &power);
+        sse2_store8(mag_data, m0, m1);
+        in += 16;
+        mag_data += 8;
+    }
+
+    uint64_t sum_level = sse2_hsum(level);
+    uint64_t sum_power = sse2_hsum(power);
+
+    for (; i < nsamples; i++) {
+        uint16_t mag = mag_from_iq(in[0] * fscale, in[1] * fscale);
+        in += 2;
+        *mag_data++ = mag;
+        sum_level += mag;
+        sum_power += (uint32_t) mag * (uint32_t) mag;
+    }
+
+    finish_sums(sum_level, sum_power, nsamples, out_mean_level, out_mean_power);
+}
+
+static void convert_sc16_sse2(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power) {
+    MODES_NOTUSED(state);
+    convert_s16_sse2(iq_data, mag_data, nsamples, 1.0f / 32768.0f, out_mean_level, out_mean_power);
+}
+
+static void convert_sc16q11_sse2(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power) {
+    MODES_NOTUSED(state);
+    convert_s16_sse2(iq_data, mag_data, nsamples, 1.0f / 2048.0f, out_mean_level, out_mean_power);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+// a, b: scaled interleaved I/Q for 4 samples each -> 8 magnitudes as int32
+static inline AVX2 __m256i avx2_mag8(__m256 a, __m256 b) {
+    a = _mm256_mul_ps(a, a);
+    b = _mm256_mul_ps(b, b);
+    // shuffle works per 128 bit lane, this results in sample order 0 1 4 5 2 3 6 7
+    __m256 magsq = _mm256_add_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    magsq = _mm256_permutevar8x32_ps(magsq, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+    magsq = _mm256_min_ps(magsq, _mm256_set1_ps(1.0f));
+    __m256 mag = _mm256_sqrt_ps(magsq);
+    return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(mag, _mm256_set1_ps(65535.0f)), _mm256_set1_ps(0.5f)));
+}
+
+static inline AVX2 void avx2_sum8(__m256i m, __m256i *level, __m256i *power) {
+    __m256i even = _mm256_and_si256(m, _mm256_set1_epi64x(0xffffffff));
+    __m256i odd = _mm256_srli_epi64(m, 32);
+    *level = _mm256_add_epi64(*level, _mm256_add_epi64(even, odd));
+    *power = _mm256_add_epi64(*power, _mm256_add_epi64(_mm256_mul_epu32(even, even), _mm256_mul_epu32(odd, odd)));
+}
+
+static inline AVX2 void avx2_store16(uint16_t *out, __m256i m0, __m256i m1) {
+    // pack works per 128 bit lane, fix up the order of the 64 bit blocks
+    __m256i x = _mm256_permute4x64_epi64(_mm256_packus_epi32(m0, m1), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i *) out, x);
+}
+
+static inline AVX2 uint64_t avx2_hsum(__m256i v) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static AVX2 void convert_uc8_avx2(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power) {
+    uint8_t *in = iq_data;
+    __m256i level = _mm256_setzero_si256();
+    __m256i power = _mm256_setzero_si256();
+    const __m256 offset = _mm256_set1_ps(127.5f);
+    const __m256 scale = _mm256_set1_ps(1.0f / 127.5f);
+    unsigned i;
+
+    MODES_NOTUSED(state);
+
+    for (i = 0; i + 16 <= nsamples; i += 16) {
+        __m256 f[4];
+        for (int k = 0; k < 4; k++) {
+            __m256i raw = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (in + 8 * k)));
+            f[k] = _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(raw), offset), scale);
+        }
+        __m256i m0 = avx2_mag8(f[0], f[1]);
+        __m256i m1 = avx2_mag8(f[2], f[3]);
+        avx2_sum8(m0, &level, &power);
+        avx2_sum8(m1, &level, &power);
+        avx2_store16(mag_data, m0, m1);
+        in += 32;
+        mag_data += 16;
+    }
+
+    uint64_t sum_level = avx2_hsum(level);
+    uint64_t sum_power = avx2_hsum(power);
+
+    for (; i < nsamples; i++) {
+        uint16_t mag = mag_from_iq((in[0] - 127.5f) / 127.5f, (in[1] - 127.5f) / 127.5f);
+        in += 2;
+        *mag_data++ = mag;
+        sum_level += mag;
+        sum_power += (uint32_t) mag * (uint32_t) mag;
+    }
+
+    finish_sums(sum_level, sum_power, nsamples, out_mean_level, out_mean_power);
+}
+
+static inline AVX2 void convert_s16_avx2(int16_t *in,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        float fscale,
+        double *out_mean_level,
+        double *out_mean_power) {
+    __m256i level = _mm256_setzero_si256();
+    __m256i power = _mm256_setzero_si256();
+    const __m256 scale = _mm256_set1_ps(fscale);
+    unsigned i;
+
+    for (i = 0; i + 16 <= nsamples; i += 16) {
+        __m256 f[4];
+        for (int k = 0; k < 4; k++) {
+            __m256i raw = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *) (in + 8 * k)));
+            f[k] = _mm256_mul_ps(_mm256_cvtepi32_ps(raw), scale);
+        }
+        __m256i m0 = avx2_mag8(f[0], f[1]);
+        __m256i m1 = avx2_mag8(f[2], f[3]);
+        avx2_sum8(m0, &level, &power);
+        avx2_sum8(m1, &level, &power);
+        avx2_store16(mag_data, m0, m1);
+        in += 32;
+        mag_data += 16;
+    }
+
+    uint64_t sum_level = avx2_hsum(level);
+    uint64_t sum_power = avx2_hsum(power);
+
+    for (; i < nsamples; i++) {
+        uint16_t mag = mag_from_iq(in[0] * fscale, in[1] * fscale);
+        in += 2;
+        *mag_data++ = mag;
+        sum_level += mag;
+        sum_power += (uint32_t) mag * (uint32_t) mag;
+    }
+
+    finish_sums(sum_level, sum_power, nsamples, out_mean_level, out_mean_power);
+}
+
+static AVX2 void convert_sc16_avx2(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power) {
+    MODES_NOTUSED(state);
+    convert_s16_avx2(iq_data, mag_data, nsamples, 1.0f / 32768.0f, out_mean_level, out_mean_power);
+}
+
+static AVX2 void convert_sc16q11_avx2(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power) {
+    MODES_NOTUSED(state);
+    convert_s16_avx2(iq_data, mag_data, nsamples, 1.0f / 2048.0f, out_mean_level, out_mean_power);
+}
+
+#undef AVX2
+
+static bool cpu_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif /* CONVERT_SIMD */
+
 static struct {
     input_format_t format;
     int can_filter_dc;
     iq_convert_fn fn;
     const char *description;
     bool(*init)();
+    bool(*supported)(); // NULL: runs on any CPU
 } converters_table[] = {
     // In order of preference
-    { INPUT_UC8, 0, convert_uc8_nodc, "UC8, integer/table path", init_uc8_lookup},
-    { INPUT_UC8, 1, convert_uc8_generic, "UC8, float path", NULL},
-    { INPUT_SC16, 0, convert_sc16_nodc, "SC16, float path, no DC", NULL},
-    { INPUT_SC16, 1, convert_sc16_generic, "SC16, float path", NULL},
+#if CONVERT_SIMD
+    { INPUT_UC8, 0, convert_uc8_avx2, "UC8, AVX2 path", NULL, cpu_has_avx2},
+    { INPUT_UC8, 0, convert_uc8_sse2, "UC8, SSE2 path", NULL, NULL},
+#endif
+    { INPUT_UC8, 0, convert_uc8_nodc, "UC8, integer/table path", init_uc8_lookup, NULL},
+    { INPUT_UC8, 1, convert_uc8_generic, "UC8, float path", NULL, NULL},
+#if CONVERT_SIMD
+    { INPUT_SC16, 0, convert_sc16_avx2, "SC16, AVX2 path, no DC", NULL, cpu_has_avx2},
+    { INPUT_SC16, 0, convert_sc16_sse2, "SC16, SSE2 path, no DC", NULL, NULL},
+#endif
+    { INPUT_SC16, 0, convert_sc16_nodc, "SC16, float path, no DC", NULL, NULL},
+    { INPUT_SC16, 1, convert_sc16_generic, "SC16, float path", NULL, NULL},
+#if CONVERT_SIMD
+    { INPUT_SC16Q11, 0, convert_sc16q11_avx2, "SC16Q11, AVX2 path, no DC", NULL, cpu_has_avx2},
+    { INPUT_SC16Q11, 0, convert_sc16q11_sse2, "SC16Q11, SSE2 path, no DC", NULL, NULL},
+#endif
 #if defined(SC16Q11_TABLE_BITS)
-    { INPUT_SC16Q11, 0, convert_sc16q11_table, "SC16Q11, integer/table path", init_sc16q11_lookup},
+    { INPUT_SC16Q11, 0, convert_sc16q11_table, "SC16Q11, integer/table path", init_sc16q11_lookup, NULL},
 #else
-    { INPUT_SC16Q11, 0, convert_sc16q11_nodc, "SC16Q11, float path, no DC", NULL},
+    { INPUT_SC16Q11, 0, convert_sc16q11_nodc, "SC16Q11, float path, no DC", NULL, NULL},
 #endif
-    { INPUT_SC16Q11, 1, convert_sc16q11_generic, "SC16Q11, float path", NULL},
-    { 0, 0, NULL, NULL, NULL}
+    { INPUT_SC16Q11, 1, convert_sc16q11_generic, "SC16Q11, float path", NULL, NULL},
+    { 0, 0, NULL, NULL, NULL, NULL}
 };
 
-iq_convert_fn init_converter(input_format_t format,
+const char *converter_info(int index, input_format_t *format, int *filter_dc) {
+    for (int i = 0; converters_table[i].fn; ++i) {
+        if (i == index) {
+            *format = converters_table[i].format;
+            *filter_dc = converters_table[i].can_filter_dc;
+            return converters_table[i].description;
+        }
+    }
+    return NULL;
+}
+
+iq_convert_fn init_converter_index(int i,
         double sample_rate,
         int filter_dc,
         struct converter_state **out_state) {
-    int i;
-
-    for (i = 0; converters_table[i].fn; ++i) {
-        if (converters_table[i].format != format)
-            continue;
-        if (filter_dc && !converters_table[i].can_filter_dc)
-            continue;
-        break;
-    }
-
-    if (!converters_table[i].fn) {
-        fprintf(stderr, "no suitable converter for format=%d dc=%d\n",
-                format, filter_dc);
+    if (converters_table[i].supported && !converters_table[i].supported()) {
         return NULL;
     }
 
@@ -484,11 +817,38 @@ iq_convert_fn init_converter(input_format_t format,
         (*out_state)->dc_a = 0.0;
     }
 
-    if (Modes.sdr_type == SDR_IFILE) {
+    return converters_table[i].fn;
+}
+
+iq_convert_fn init_converter(input_format_t format,
+        double sample_rate,
+        int filter_dc,
+        struct converter_state **out_state) {
+    int i;
+
+    for (i = 0; converters_table[i].fn; ++i) {
+        if (converters_table[i].format != format)
+            continue;
+        if (filter_dc && !converters_table[i].can_filter_dc)
+            continue;
+        if (converters_table[i].supported && !converters_table[i].supported())
+            continue;
+        break;
+    }
+
+    if (!converters_table[i].fn) {
+        fprintf(stderr, "no suitable converter for format=%d dc=%d\n",
+                format, filter_dc);
+        return NULL;
+    }
+
+    iq_convert_fn fn = init_converter_index(i, sample_rate, filter_dc, out_state);
+
+    if (fn && Modes.sdr_type == SDR_IFILE) {
         fprintf(stderr, "init_converter: using %s\n", converters_table[i].description);
     }
 
-    return converters_table[i].fn;
+    return fn;
 }
 
 void cleanup_converter(struct converter_state **state) {
@@ -45,4 +45,12 @@ iq_convert_fn init_converter (input_format_t format,
 
 void cleanup_converter (struct converter_state **state);
 
+// for convert_benchmark: description / format of the converter at index, NULL past the end of the table
+const char *converter_info (int index, input_format_t *format, int *filter_dc);
+// init a specific converter, NULL if it can't run on this CPU
+iq_convert_fn init_converter_index (int index,
+                                    double sample_rate,
+                                    int filter_dc,
+                                    struct converter_state **out_state);
+
 #endif
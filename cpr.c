@@ -372,3 +372,25 @@ int decodeCPRrelative(double reflat, double reflon,
     *out_lon = rlon;
     return (0);
 }
+//
+//=========================================================================
+//
+// Inverse of the decoders above: encode lat / lon into 17 bit CPR values
+// as transmitted in airborne (surface = 0) or surface (surface = 1) position messages.
+// Used by the synthetic traffic generator and the CPR tests.
+//
+void encodeCPR(double lat, double lon, int fflag, int surface,
+        int *out_cprlat, int *out_cprlon) {
+    // surface positions have 2 bits more resolution, the top 2 bits are not transmitted
+    double scale = surface ? 524288.0 : 131072.0;
+    double Dlat = (surface ? 90.0 : 360.0) / (fflag ? 59 : 60);
+
+    int yz = (int) floor(scale * cprModDouble(lat, Dlat) / Dlat + 0.5);
+    double rlat = Dlat * (yz / scale + floor(lat / Dlat));
+
+    double Dlon = cprDlonFunction(rlat, fflag, surface);
+    int xz = (int) floor(scale * cprModDouble(lon, Dlon) / Dlon + 0.5);
+
+    *out_cprlat = yz & 0x1FFFF;
+    *out_cprlon = xz & 0x1FFFF;
+}
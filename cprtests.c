@@ -303,10 +303,49 @@ static int testCPRRelative() {
     return ok;
 }
 
+// encode even / odd pairs and check that the global decode gets the position back
+static int testCPREncode() {
+    int ok = 1;
+    static const double positions[][2] = {
+        { 52.25720, 3.91937 },
+        { -33.94610, 151.17700 },
+        { 0.01, -0.01 },
+        { 64.84830, -147.85600 },
+        { -54.80000, -68.30000 },
+        { 86.50000, 179.90000 },
+    };
+    for (unsigned i = 0; i < sizeof (positions) / sizeof (positions[0]); ++i) {
+        double lat = positions[i][0];
+        double lon = positions[i][1];
+        int elat, elon, olat, olon;
+        double rlat = 0, rlon = 0;
+
+        encodeCPR(lat, lon, 0, 0, &elat, &elon);
+        encodeCPR(lat, lon, 1, 0, &olat, &olon);
+
+        int res = decodeCPRairborne(elat, elon, olat, olon, i & 1, &rlat, &rlon);
+        // 17 bit airborne CPR resolves about 5 m, longitude zones get wider towards the poles
+        if (res != 0 || fabs(rlat - lat) > 1e-4 || fabs(rlon - lon) * cos(lat * M_PI / 180.0) > 1e-4) {
+            ok = 0;
+            fprintf(stderr,
+                    "testCPREncode[%u]:  FAIL: encodeCPR(%.6f,%.6f) -> %d,%d %d,%d decodes to:\n"
+                    " result %d  (expected 0)\n"
+                    " lat %.6f\n"
+                    " lon %.6f\n",
+                    i, lat, lon, elat, elon, olat, olon, res, rlat, rlon);
+        } else {
+            fprintf(stderr, "testCPREncode[%u]:  PASS\n", i);
+        }
+    }
+
+    return ok;
+}
+
 int main(int __attribute__ ((unused)) argc, char __attribute__ ((unused)) **argv) {
     int ok = 1;
     ok = testCPRGlobalAirborne() && ok;
     ok = testCPRGlobalSurface() && ok;
     ok = testCPRRelative() && ok;
+    ok = testCPREncode() && ok;
     return ok ? 0 : 1;
 }
@@ -212,8 +212,35 @@ static inline __attribute__((always_inline)) uint8_t slice_byte(uint16_t **pPtr,
     return theByte;
 }
 
-static void score_phase(int try_phase, uint16_t *pa, unsigned char **bestmsg, int *bestscore, int *bestphase, unsigned char **msg, unsigned char *msg1, unsigned char *msg2) {
-    Modes.stats_current.demod_preamblePhase[try_phase - 4]++;
+// Demodulation is split in two stages so the first one can run for several buffers in parallel:
+// demodScan() looks for preambles and slices / scores candidate messages, it only reads global state.
+// demodEmit() decodes the candidates and passes them on, this is always done on the decode thread
+// in buffer order and thus in sample timestamp order.
+// With only one buffer in flight both stages are done in one pass by demodScan() (batch == NULL)
+
+struct demodCandidate {
+    uint32_t offset; // sample offset of the preamble (pa - m)
+    int8_t score;
+    int8_t phase;
+    unsigned char msg[MODES_LONG_MSG_BYTES];
+};
+
+struct demodBatch {
+    struct mag_buf *mag;
+    struct demodCandidate *cand;
+    uint32_t count;
+    uint32_t alloc;
+    // stats which would otherwise be written to Modes.stats_current from the worker threads
+    uint32_t preamblePhase[5];
+    uint32_t preambles;
+    uint32_t rejectedBad;
+};
+
+static struct demodBatch *demodBatches;
+static threadpool_task_t *demodTasks;
+
+static void score_phase(int try_phase, uint16_t *pa, unsigned char **bestmsg, int *bestscore, int *bestphase, unsigned char **msg, unsigned char *msg1, unsigned char *msg2, uint32_t *preamblePhase) {
+    preamblePhase[try_phase - 4]++;
     uint16_t *pPtr;
     int phase, score, bytelen;
 
@@ -257,11 +284,94 @@ static void score_phase(int try_phase, uint16_t *pa, unsigned char **bestmsg, in
     }
 }
 
+// decode a candidate and pass it on, returns 1 if the message was used
+static int demodEmit(struct mag_buf *mag, uint16_t *pa, unsigned char *bestmsg, int bestscore, int bestphase, uint64_t *sum_scaled_signal_power) {
+    uint16_t *m = mag->data;
+    int msglen = modesMessageLenByType(getbits(bestmsg, 1, 5));
+
+    struct modesMessage *mm = netGetMM(&Modes.netMessageBuffer[0]);
+
+    // For consistency with how the Beast / Radarcape does it,
+    // we report the timestamp at the end of bit 56 (even if
+    // the frame is a 112-bit frame)
+    mm->timestamp = mag->sampleTimestamp + (pa -m) * 5 + (8 + 56) * 12 + bestphase;
+
+    // compute message receive time as block-start-time + difference in the 12MHz clock
+    mm->sysTimestamp = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm->timestamp);
+
+    // advance ifile artifical clock for every message received
+    if (Modes.sdr_type == SDR_IFILE && Modes.synthetic_now) {
+        Modes.synthetic_now = mm->sysTimestamp;
+    }
+
+    mm->score = bestscore;
+
+    // Decode the received message
+    {
+        memcpy(mm->msg, bestmsg, MODES_LONG_MSG_BYTES);
+        int result = decodeModesMessage(mm);
+        if (result < 0) {
+            if (result == -1)
+                Modes.stats_current.demod_rejected_unknown_icao++;
+            else
+                Modes.stats_current.demod_rejected_bad++;
+            return 0;
+        } else {
+            Modes.stats_current.demod_accepted[mm->correctedbits]++;
+        }
+    }
+
+    Modes.stats_current.demod_bestPhase[bestphase - 4]++;
+
+    // measure signal power
+    {
+        double signal_power;
+        uint64_t scaled_signal_power = 0;
+        int signal_len = msglen * 12 / 5;
+        int k;
+
+        for (k = 0; k < signal_len; ++k) {
+            uint32_t mag = pa[19 + k];
+            scaled_signal_power += mag * mag;
+        }
+
+        signal_power = scaled_signal_power / 65535.0 / 65535.0;
+        mm->signalLevel = signal_power / signal_len;
+        Modes.stats_current.signal_power_sum += signal_power;
+        Modes.stats_current.signal_power_count += signal_len;
+        *sum_scaled_signal_power += scaled_signal_power;
+
+        if (mm->signalLevel > Modes.stats_current.peak_signal_power)
+            Modes.stats_current.peak_signal_power = mm->signalLevel;
+        if (mm->signalLevel > 0.50119)
+            Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
+    }
+
+    // Pass data to the next layer
+    netUseMessage(mm);
+
+    return 1;
+}
+
+static void demodFinish(struct mag_buf *mag, uint64_t sum_scaled_signal_power) {
+    /* update noise power */
+    {
+        double sum_signal_power = sum_scaled_signal_power / 65535.0 / 65535.0;
+        Modes.stats_current.noise_power_sum += (mag->mean_power * mag->length - sum_signal_power);
+        Modes.stats_current.noise_power_count += mag->length;
+    }
+
+    netDrainMessageBuffers();
+}
+
 //
 // Given 'mlen' magnitude samples in 'm', sampled at 2.4MHz,
 // try to demodulate some Mode S messages.
 //
-void demodulate2400(struct mag_buf *mag) {
+// batch == NULL: decode and emit messages directly
+// otherwise only collect candidates in batch, don't touch any global state except for reading
+//
+static void demodScan(struct mag_buf *mag, struct demodBatch *batch) {
     unsigned char msg1[MODES_LONG_MSG_BYTES], msg2[MODES_LONG_MSG_BYTES], *msg;
 
     unsigned char *bestmsg = NULL;
@@ -273,17 +383,10 @@ void demodulate2400(struct mag_buf *mag) {
 
     uint64_t sum_scaled_signal_power = 0;
 
-    // initialize bitsets on first call
-    if (!valid_df_short_bitset)
-        init_bitsets();
+    uint32_t *preamblePhase = batch ? batch->preamblePhase : Modes.stats_current.demod_preamblePhase;
 
     msg = msg1;
 
-    // advance ifile artificial clock even if we don't receive anything
-    if (Modes.sdr_type == SDR_IFILE && Modes.synthetic_now) {
-        Modes.synthetic_now = mag->sysTimestamp;
-    }
-
     uint16_t *pa = m;
     uint16_t *stop = m + mlen;
 
@@ -299,7 +402,6 @@ void demodulate2400(struct mag_buf *mag) {
 
     for (; pa < stop; pa++) {
         int32_t pa_mag, base_noise, ref_level;
-        int msglen;
 
         // Look for a message starting at around sample 0 with phase offset 3..7
 
@@ -374,10 +476,10 @@ after_pre:
         pa_mag = common3456 - diff_10_11;
         if (pa_mag >= ref_level) {
             // peaks at 1,3,9,11-12: phase 3
-            score_phase(4, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
+            score_phase(4, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2, preamblePhase);
 
             // peaks at 1,3,9,12: phase 4
-            score_phase(5, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
+            score_phase(5, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2, preamblePhase);
         }
 
         // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
@@ -386,10 +488,10 @@ after_pre:
         pa_mag = common3456 + diff_10_11;
         if (pa_mag >= ref_level) {
             // peaks at 1,3-4,9-10,12: phase 5
-            score_phase(6, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
+            score_phase(6, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2, preamblePhase);
 
             // peaks at 1,4,10,12: phase 6
-            score_phase(7, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
+            score_phase(7, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2, preamblePhase);
         }
 
         // peaks at 1-2,4,10,12: phase 7
@@ -397,7 +499,7 @@ after_pre:
         // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
         pa_mag = sum_1_4 + 2 * diff_2_3 + diff_10_11 + pa[12];
         if (pa_mag >= ref_level)
-            score_phase(8, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
+            score_phase(8, pa, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2, preamblePhase);
 
 
         // no preamble detected
@@ -406,6 +508,35 @@ after_pre:
 
         // we had at least one phase greater than the preamble threshold
         // and used scoremodesmessage on those bytes
+        if (batch) {
+            batch->preambles++;
+
+            // unknown ICAO is rechecked in demodulate2400Emit(), the ICAO filter might know the address by then
+            if (bestscore < -1) {
+                batch->rejectedBad++;
+                continue;
+            }
+            if (batch->count == batch->alloc) {
+                batch->alloc = batch->alloc ? 2 * batch->alloc : 256;
+                batch->cand = realloc(batch->cand, batch->alloc * sizeof(struct demodCandidate));
+                if (!batch->cand) {
+                    fprintf(stderr, "FATAL: demodScan: out of memory!\n");
+                    exit(1);
+                }
+            }
+            struct demodCandidate *c = &batch->cand[batch->count++];
+            c->offset = pa - m;
+            c->score = bestscore;
+            c->phase = bestphase;
+            memcpy(c->msg, bestmsg, MODES_LONG_MSG_BYTES);
+
+            // skip like below, assuming the message will decode (it rarely doesn't after scoring)
+            if (bestscore >= 0) {
+                pa += modesMessageLenByType(getbits(bestmsg, 1, 5)) * 8 / 4;
+            }
+            continue;
+        }
+
         Modes.stats_current.demod_preambles++;
 
         // Do we have a candidate?
@@ -418,64 +549,8 @@ after_pre:
             continue; // nope.
         }
 
-        msglen = modesMessageLenByType(getbits(bestmsg, 1, 5));
-
-        struct modesMessage *mm = netGetMM(&Modes.netMessageBuffer[0]);
-
-        // For consistency with how the Beast / Radarcape does it,
-        // we report the timestamp at the end of bit 56 (even if
-        // the frame is a 112-bit frame)
-        mm->timestamp = mag->sampleTimestamp + (pa -m) * 5 + (8 + 56) * 12 + bestphase;
-
-        // compute message receive time as block-start-time + difference in the 12MHz clock
-        mm->sysTimestamp = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm->timestamp);
-
-        // advance ifile artifical clock for every message received
-        if (Modes.sdr_type == SDR_IFILE && Modes.synthetic_now) {
-            Modes.synthetic_now = mm->sysTimestamp;
-        }
-
-        mm->score = bestscore;
-
-        // Decode the received message
-        {
-            memcpy(mm->msg, bestmsg, MODES_LONG_MSG_BYTES);
-            int result = decodeModesMessage(mm);
-            if (result < 0) {
-                if (result == -1)
-                    Modes.stats_current.demod_rejected_unknown_icao++;
-                else
-                    Modes.stats_current.demod_rejected_bad++;
-                continue;
-            } else {
-                Modes.stats_current.demod_accepted[mm->correctedbits]++;
-            }
-        }
-
-        Modes.stats_current.demod_bestPhase[bestphase - 4]++;
-
-        // measure signal power
-        {
-            double signal_power;
-            uint64_t scaled_signal_power = 0;
-            int signal_len = msglen * 12 / 5;
-            int k;
-
-            for (k = 0; k < signal_len; ++k) {
-                uint32_t mag = pa[19 + k];
-                scaled_signal_power += mag * mag;
-            }
-
-            signal_power = scaled_signal_power / 65535.0 / 65535.0;
-            mm->signalLevel = signal_power / signal_len;
-            Modes.stats_current.signal_power_sum += signal_power;
-            Modes.stats_current.signal_power_count += signal_len;
-            sum_scaled_signal_power += scaled_signal_power;
-
-            if (mm->signalLevel > Modes.stats_current.peak_signal_power)
-                Modes.stats_current.peak_signal_power = mm->signalLevel;
-            if (mm->signalLevel > 0.50119)
-                Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
+        if (!demodEmit(mag, pa, bestmsg, bestscore, bestphase, &sum_scaled_signal_power)) {
+            continue;
         }
 
         // Skip over the message:
@@ -487,24 +562,106 @@ after_pre:
         //pa += msglen * 12 / 5;
         //
         // let's test something, only jump part of the message and let the preamble detection handle the rest.
-        pa += msglen * 8 / 4;
-
-        // Pass data to the next layer
-        netUseMessage(mm);
+        pa += modesMessageLenByType(getbits(bestmsg, 1, 5)) * 8 / 4;
     }
 
     mag->loudEvents = loudEvents;
     mag->noiseLowSamples = noiseLowSamples;
     mag->noiseHighSamples = noiseHighSamples;
 
-    /* update noise power */
-    {
-        double sum_signal_power = sum_scaled_signal_power / 65535.0 / 65535.0;
-        Modes.stats_current.noise_power_sum += (mag->mean_power * mag->length - sum_signal_power);
-        Modes.stats_current.noise_power_count += mag->length;
+    if (!batch) {
+        demodFinish(mag, sum_scaled_signal_power);
     }
+}
 
-    netDrainMessageBuffers();
+void demodulate2400(struct mag_buf *mag) {
+    // initialize bitsets on first call
+    if (!valid_df_short_bitset)
+        init_bitsets();
+
+    // advance ifile artificial clock even if we don't receive anything
+    if (Modes.sdr_type == SDR_IFILE && Modes.synthetic_now) {
+        Modes.synthetic_now = mag->sysTimestamp;
+    }
+
+    demodScan(mag, NULL);
+}
+
+static void demodScanTask(void *arg, threadpool_threadbuffers_t *buffers) {
+    MODES_NOTUSED(buffers);
+    struct demodBatch *batch = arg;
+    batch->count = 0;
+    demodScan(batch->mag, batch);
+}
+
+void demodulate2400Init() {
+    if (!valid_df_short_bitset)
+        init_bitsets();
+
+    if (Modes.demodThreads < 2) {
+        return;
+    }
+    demodBatches = cmCalloc(Modes.demodThreads * sizeof(struct demodBatch));
+    demodTasks = cmCalloc(Modes.demodThreads * sizeof(threadpool_task_t));
+    Modes.demodPool = threadpool_create(Modes.demodThreads, 0);
+}
+
+void demodulate2400Cleanup() {
+    if (!Modes.demodPool) {
+        return;
+    }
+    threadpool_destroy(Modes.demodPool);
+    Modes.demodPool = NULL;
+    for (int k = 0; k < Modes.demodThreads; k++) {
+        sfree(demodBatches[k].cand);
+    }
+    sfree(demodBatches);
+    sfree(demodTasks);
+}
+
+void demodulate2400Scan(struct mag_buf **bufs, int count) {
+    for (int k = 0; k < count; k++) {
+        demodBatches[k].mag = bufs[k];
+        demodTasks[k].function = demodScanTask;
+        demodTasks[k].argument = &demodBatches[k];
+    }
+    threadpool_run(Modes.demodPool, demodTasks, count);
+}
+
+void demodulate2400Emit(int index) {
+    struct demodBatch *batch = &demodBatches[index];
+    struct mag_buf *mag = batch->mag;
+    uint64_t sum_scaled_signal_power = 0;
+
+    if (Modes.sdr_type == SDR_IFILE && Modes.synthetic_now) {
+        Modes.synthetic_now = mag->sysTimestamp;
+    }
+
+    for (int k = 0; k < 5; k++) {
+        Modes.stats_current.demod_preamblePhase[k] += batch->preamblePhase[k];
+        batch->preamblePhase[k] = 0;
+    }
+    Modes.stats_current.demod_preambles += batch->preambles;
+    Modes.stats_current.demod_rejected_bad += batch->rejectedBad;
+    batch->preambles = 0;
+    batch->rejectedBad = 0;
+
+    for (uint32_t k = 0; k < batch->count; k++) {
+        struct demodCandidate *c = &batch->cand[k];
+        int score = c->score;
+        if (score == -1) {
+            // messages decoded from earlier buffers may have added the address to the ICAO filter
+            score = scoreModesMessage(c->msg, modesMessageLenByType(getbits(c->msg, 1, 5)));
+            if (score < 0) {
+                Modes.stats_current.demod_rejected_unknown_icao++;
+                continue;
+            }
+        }
+        demodEmit(mag, mag->data + c->offset, c->msg, score, c->phase, &sum_scaled_signal_power);
+    }
+    batch->count = 0;
+
+    demodFinish(mag, sum_scaled_signal_power);
 }
 
 
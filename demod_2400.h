@@ -36,6 +36,14 @@
 struct mag_buf;
 
 void demodulate2400 (struct mag_buf *mag);
+
+// parallel demodulation of consecutive buffers (--demod-threads)
+void demodulate2400Init();
+void demodulate2400Cleanup();
+// scan up to Modes.demodThreads buffers on the demod thread pool
+void demodulate2400Scan(struct mag_buf **bufs, int count);
+// decode and emit the messages of the buffer with the given index from the last scan, call in order
+void demodulate2400Emit(int index);
 void demodulate2400AC (struct mag_buf *mag);
 
 #endif
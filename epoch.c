@@ -0,0 +1,156 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// epoch.c: epoch based deferred reclamation
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+// A reader pins the global epoch in its slot while it may hold references.
+// An object retired in epoch e can only be referenced by readers which pinned an epoch <= e,
+// once every pinned slot is above e (or no slot is pinned) the object can be freed.
+// Epoch 0 marks an unused slot, the global epoch starts at 1.
+
+typedef struct epochItem {
+    struct epochItem *next;
+    epochFreeFunc func;
+    void *ptr;
+    uint64_t epoch;
+} epochItem;
+
+static struct {
+    atomic_uint_fast64_t global;
+    atomic_uint_fast64_t slots[EPOCH_MAX_READERS];
+    atomic_int slotCount;
+    // readers which didn't get a slot, reclamation waits until they are gone
+    atomic_int unslotted;
+
+    pthread_mutex_t mutex;
+    epochItem *retired;
+} ep = {
+    .global = 1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static _Thread_local int epochSlot = -1;
+static _Thread_local int epochDepth;
+
+void epochEnter() {
+    if (epochDepth++) {
+        return;
+    }
+    if (epochSlot < 0) {
+        int slot = atomic_fetch_add(&ep.slotCount, 1);
+        epochSlot = slot < EPOCH_MAX_READERS ? slot : EPOCH_MAX_READERS;
+    }
+    if (epochSlot == EPOCH_MAX_READERS) {
+        atomic_fetch_add(&ep.unslotted, 1);
+        return;
+    }
+    // re-check so the reclaimer can't miss a pin of an epoch it has already advanced past
+    uint64_t e;
+    do {
+        e = atomic_load(&ep.global);
+        atomic_store(&ep.slots[epochSlot], e);
+    } while (atomic_load(&ep.global) != e);
+}
+
+void epochExit() {
+    if (--epochDepth) {
+        return;
+    }
+    if (epochSlot == EPOCH_MAX_READERS) {
+        atomic_fetch_sub(&ep.unslotted, 1);
+        return;
+    }
+    atomic_store(&ep.slots[epochSlot], 0);
+}
+
+void epochRetire(epochFreeFunc func, void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    epochItem *item = cmalloc(sizeof(epochItem));
+    item->func = func;
+    item->ptr = ptr;
+    item->epoch = atomic_load(&ep.global);
+
+    pthread_mutex_lock(&ep.mutex);
+    item->next = ep.retired;
+    ep.retired = item;
+    pthread_mutex_unlock(&ep.mutex);
+
+    atomic_fetch_add(&Modes.epochRetired, 1);
+}
+
+void epochAdvance() {
+    atomic_fetch_add(&ep.global, 1);
+}
+
+static int epochFreeList(epochItem *item) {
+    int count = 0;
+    while (item) {
+        epochItem *next = item->next;
+        item->func(item->ptr);
+        sfree(item);
+        item = next;
+        count++;
+    }
+    atomic_fetch_add(&Modes.epochReclaimed, count);
+    return count;
+}
+
+int epochReclaim() {
+    if (atomic_load(&ep.unslotted)) {
+        return 0;
+    }
+
+    // objects retired in the current epoch may still be picked up by readers pinning it after the scan
+    uint64_t minPinned = atomic_load(&ep.global);
+    int slots = imin(EPOCH_MAX_READERS, atomic_load(&ep.slotCount));
+    for (int i = 0; i < slots; i++) {
+        uint64_t e = atomic_load(&ep.slots[i]);
+        if (e && e < minPinned) {
+            minPinned = e;
+        }
+    }
+
+    epochItem *reclaim = NULL;
+
+    pthread_mutex_lock(&ep.mutex);
+    epochItem **p = &ep.retired;
+    while (*p) {
+        epochItem *item = *p;
+        if (item->epoch < minPinned) {
+            *p = item->next;
+            item->next = reclaim;
+            reclaim = item;
+        } else {
+            p = &item->next;
+        }
+    }
+    pthread_mutex_unlock(&ep.mutex);
+
+    // run the free functions without holding the mutex, they may take a while
+    return epochFreeList(reclaim);
+}
+
+void epochDrain() {
+    pthread_mutex_lock(&ep.mutex);
+    epochItem *reclaim = ep.retired;
+    ep.retired = NULL;
+    pthread_mutex_unlock(&ep.mutex);
+
+    epochFreeList(reclaim);
+}
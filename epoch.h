@@ -0,0 +1,34 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// Epoch based deferred reclamation.
+//
+// Objects are unlinked from the shared structures while lockThreads() has stopped the
+// other threads, the expensive teardown (freeing traces, unlinking files, large frees)
+// is handed to epochRetire() and runs after the lock has been released.
+//
+// Threads taking part in lockThreads() can't hold references across the locked section
+// and don't need to pin an epoch.
+// Threads reading shared objects without taking part in lockThreads() wrap those
+// accesses in epochEnter() / epochExit(), nesting is allowed.
+
+#define EPOCH_MAX_READERS 256
+
+typedef void (*epochFreeFunc)(void *ptr);
+
+void epochEnter();
+void epochExit();
+
+// queue ptr to be freed by func once no reader can still reference it
+void epochRetire(epochFreeFunc func, void *ptr);
+
+// start a new epoch, called after the retiring side has finished unlinking objects
+void epochAdvance();
+
+// free retired objects no pinned reader can reference, returns the number of objects freed
+int epochReclaim();
+
+// free everything that is still queued, only to be used when no readers are left (exit)
+void epochDrain();
+
+#endif
@@ -0,0 +1,376 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// file_writer.c: asynchronous file output
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+// The json / globe / trace producing threads used to do open / write / close / rename
+// themselves which stalls them on slow disks.
+// Producers now hand a finished (already compressed) buffer to a dedicated writer thread.
+// Pending writes are kept in a FIFO and indexed by path, a newer buffer for the same path
+// replaces the pending one so only the latest content is written.
+// Queue entries and content buffers are recycled instead of freed, in the steady state the
+// same few hundred files are written over and over and this avoids allocator churn.
+// Removing a file goes through the queue as well (entry without content), otherwise a pending or
+// in flight write would recreate it.
+
+#define FW_HASH_BITS 12
+#define FW_BUCKETS (1 << FW_HASH_BITS)
+
+// recycled content buffers, allocations are rounded up to a power of 2 of at least FW_BUF_MIN
+#define FW_BUF_MIN (4 * 1024)
+#define FW_POOL_MAX_BYTES (32 * 1024 * 1024)
+// buffers larger than this are freed instead of recycled
+#define FW_POOL_MAX_BUF (4 * 1024 * 1024)
+
+typedef struct fwEntry {
+    struct fwEntry *next; // FIFO order / freelist
+    struct fwEntry *hashNext;
+    char *path;
+    size_t pathAlloc;
+    char *content; // NULL: unlink path
+    size_t len;
+    uint32_t hash;
+} fwEntry;
+
+typedef struct fwBuf {
+    struct fwBuf *next;
+    size_t alloc;
+    char data[];
+} fwBuf;
+
+static struct {
+    fwEntry *head;
+    fwEntry *tail;
+    fwEntry *buckets[FW_BUCKETS];
+    fwEntry *freeEntries;
+    fwEntry *inflight; // entry the writer thread is currently writing, no longer in the hash
+    int queueLen;
+    int64_t pendingBytes;
+    int8_t running;
+
+    pthread_mutex_t poolMutex;
+    fwBuf *pool;
+    int64_t poolBytes;
+} fw;
+
+static fwBuf *fwBufHeader(char *content) {
+    return (fwBuf *) (content - offsetof(fwBuf, data));
+}
+
+char *fileWriterAlloc(size_t size) {
+    pthread_mutex_lock(&fw.poolMutex);
+    for (fwBuf **p = &fw.pool; *p; p = &(*p)->next) {
+        fwBuf *buf = *p;
+        if (buf->alloc >= size) {
+            *p = buf->next;
+            fw.poolBytes -= buf->alloc;
+            pthread_mutex_unlock(&fw.poolMutex);
+            return buf->data;
+        }
+    }
+    pthread_mutex_unlock(&fw.poolMutex);
+
+    size_t alloc = FW_BUF_MIN;
+    while (alloc < size) {
+        alloc *= 2;
+    }
+    fwBuf *buf = cmalloc(sizeof(fwBuf) + alloc);
+    memAccountAlloc(MEM_FILE_WRITER, buf);
+    buf->alloc = alloc;
+    return buf->data;
+}
+
+void fileWriterFree(char *content) {
+    if (!content) {
+        return;
+    }
+    fwBuf *buf = fwBufHeader(content);
+
+    pthread_mutex_lock(&fw.poolMutex);
+    if (fw.running && buf->alloc <= FW_POOL_MAX_BUF && fw.poolBytes + (int64_t) buf->alloc <= FW_POOL_MAX_BYTES) {
+        buf->next = fw.pool;
+        fw.pool = buf;
+        fw.poolBytes += buf->alloc;
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&fw.poolMutex);
+
+    memAccountFree(MEM_FILE_WRITER, buf);
+    free(buf);
+}
+
+int writeFileAtomic(const char *path, const char *content, size_t len) {
+    char tmppath[PATH_MAX];
+    int fd;
+
+    snprintf(tmppath, PATH_MAX, "%s.readsb_tmp", path);
+
+    int firstOpenFail = 1;
+open:
+    fd = open(tmppath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        if (firstOpenFail) {
+            unlink(tmppath);
+            firstOpenFail = 0;
+            goto open;
+        }
+        fprintf(stderr, "writeFileAtomic open(): ");
+        perror(tmppath);
+        goto error_2;
+    }
+
+    if (write(fd, content, len) != (ssize_t) len) {
+        fprintf(stderr, "writeFileAtomic write(): ");
+        perror(tmppath);
+        goto error_1;
+    }
+
+    if (close(fd) < 0)
+        goto error_2;
+
+    if (rename(tmppath, path) == -1) {
+        fprintf(stderr, "writeFileAtomic rename(): %s -> %s", tmppath, path);
+        perror("");
+        goto error_2;
+    }
+
+    return 0;
+
+error_1:
+    close(fd);
+error_2:
+    unlink(tmppath);
+    return -1;
+}
+
+static void fwUnhash(fwEntry *entry) {
+    fwEntry **p = &fw.buckets[entry->hash % FW_BUCKETS];
+    while (*p && *p != entry) {
+        p = &(*p)->hashNext;
+    }
+    if (*p) {
+        *p = entry->hashNext;
+    }
+}
+
+// called with the writer mutex held
+static fwEntry *fwPop() {
+    fwEntry *entry = fw.head;
+    if (!entry) {
+        return NULL;
+    }
+    fw.head = entry->next;
+    if (!fw.head) {
+        fw.tail = NULL;
+    }
+    fwUnhash(entry);
+    fw.queueLen--;
+    fw.pendingBytes -= entry->len;
+    return entry;
+}
+
+static void *fileWriterEntryPoint(void *arg) {
+    MODES_NOTUSED(arg);
+    srandom(get_seed());
+
+    pthread_mutex_lock(&Threads.fileWriter.mutex);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    while (1) {
+        fwEntry *entry = fwPop();
+        if (!entry) {
+            if (Modes.exit) {
+                break;
+            }
+            threadTimedWait(&Threads.fileWriter, &ts, 1 * SECONDS);
+            clock_gettime(CLOCK_REALTIME, &ts);
+            continue;
+        }
+        fw.inflight = entry;
+        pthread_mutex_unlock(&Threads.fileWriter.mutex);
+
+        if (entry->content) {
+            writeFileAtomic(entry->path, entry->content, entry->len);
+
+            atomic_fetch_add(&Modes.fileWrites, 1);
+            atomic_fetch_add(&Modes.fileWriteBytes, entry->len);
+        } else {
+            unlink(entry->path);
+        }
+
+        fileWriterFree(entry->content);
+        entry->content = NULL;
+
+        pthread_mutex_lock(&Threads.fileWriter.mutex);
+
+        fw.inflight = NULL;
+        entry->next = fw.freeEntries;
+        fw.freeEntries = entry;
+    }
+
+    // from here on producers write synchronously
+    fw.running = 0;
+
+    pthread_mutex_unlock(&Threads.fileWriter.mutex);
+
+    return NULL;
+}
+
+// content NULL: unlink, never falls back to the caller because of the backlog
+static int fwQueue(const char *path, char *content, size_t len) {
+    uint32_t hash = fasthash32(path, strlen(path), 0x6d7dc9a3);
+
+    pthread_mutex_lock(&Threads.fileWriter.mutex);
+
+    if (!fw.running) {
+        pthread_mutex_unlock(&Threads.fileWriter.mutex);
+        return 0;
+    }
+
+    // look for a pending write of the same path first, even when backlogged:
+    // writing synchronously while an older entry is still queued would let the
+    // older content overwrite the newer one later
+    for (fwEntry *entry = fw.buckets[hash % FW_BUCKETS]; entry; entry = entry->hashNext) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            // still pending, replace the content and keep the position in the queue
+            fw.pendingBytes += (int64_t) len - (int64_t) entry->len;
+            fileWriterFree(entry->content);
+            entry->content = content;
+            entry->len = len;
+
+            pthread_mutex_unlock(&Threads.fileWriter.mutex);
+            atomic_fetch_add(&Modes.fileWritesCoalesced, 1);
+            return 1;
+        }
+    }
+
+    if (content && fw.pendingBytes + (int64_t) len > FILE_WRITER_MAX_PENDING) {
+        // the writer thread might be writing this path right now, both would use the same
+        // temporary file and the older content could be renamed last, queue it anyway
+        fwEntry *inflight = fw.inflight;
+        if (!inflight || inflight->hash != hash || strcmp(inflight->path, path) != 0) {
+            pthread_mutex_unlock(&Threads.fileWriter.mutex);
+            atomic_fetch_add(&Modes.fileWritesSync, 1);
+            return 0;
+        }
+    }
+
+    fwEntry *entry = fw.freeEntries;
+    if (entry) {
+        fw.freeEntries = entry->next;
+    } else {
+        entry = cmCalloc(sizeof(fwEntry));
+        memAccountAlloc(MEM_FILE_WRITER, entry);
+    }
+    size_t pathLen = strlen(path) + 1;
+    if (entry->pathAlloc < pathLen) {
+        memAccountFree(MEM_FILE_WRITER, entry->path);
+        sfree(entry->path);
+        entry->pathAlloc = imax(pathLen, 128);
+        entry->path = cmalloc(entry->pathAlloc);
+        memAccountAlloc(MEM_FILE_WRITER, entry->path);
+    }
+    memcpy(entry->path, path, pathLen);
+    entry->next = NULL;
+    entry->hashNext = NULL;
+    entry->content = content;
+    entry->len = len;
+    entry->hash = hash;
+
+    entry->hashNext = fw.buckets[hash % FW_BUCKETS];
+    fw.buckets[hash % FW_BUCKETS] = entry;
+
+    if (fw.tail) {
+        fw.tail->next = entry;
+    } else {
+        fw.head = entry;
+    }
+    fw.tail = entry;
+
+    fw.queueLen++;
+    fw.pendingBytes += len;
+
+    if (fw.queueLen > atomic_load(&Modes.fileWriterQueueMax)) {
+        atomic_store(&Modes.fileWriterQueueMax, fw.queueLen);
+    }
+
+    pthread_cond_signal(&Threads.fileWriter.cond);
+    pthread_mutex_unlock(&Threads.fileWriter.mutex);
+    return 1;
+}
+
+int fileWriterSubmit(const char *path, char *content, size_t len) {
+    return fwQueue(path, content, len);
+}
+
+void fileWriterUnlink(const char *path) {
+    if (!fwQueue(path, NULL, 0)) {
+        unlink(path);
+    }
+}
+
+int fileWriterRunning() {
+    return fw.running;
+}
+
+int fileWriterQueueLength() {
+    pthread_mutex_lock(&Threads.fileWriter.mutex);
+    int len = fw.queueLen;
+    pthread_mutex_unlock(&Threads.fileWriter.mutex);
+    return len;
+}
+
+void fileWriterInit() {
+    memset(&fw, 0, sizeof(fw));
+    pthread_mutex_init(&fw.poolMutex, NULL);
+    fw.running = 1;
+    threadCreate(&Threads.fileWriter, NULL, fileWriterEntryPoint, NULL);
+}
+
+void fileWriterStop() {
+    if (!fw.running) {
+        return;
+    }
+    // the writer drains the queue before exiting (Modes.exit is set at this point)
+    threadSignalJoin(&Threads.fileWriter);
+
+    // in case the join failed, make sure nobody queues anything anymore
+    pthread_mutex_lock(&Threads.fileWriter.mutex);
+    fw.running = 0;
+    while (fw.freeEntries) {
+        fwEntry *entry = fw.freeEntries;
+        fw.freeEntries = entry->next;
+        memAccountFree(MEM_FILE_WRITER, entry->path);
+        memAccountFree(MEM_FILE_WRITER, entry);
+        sfree(entry->path);
+        sfree(entry);
+    }
+    pthread_mutex_unlock(&Threads.fileWriter.mutex);
+
+    // buffers freed from now on aren't recycled anymore
+    pthread_mutex_lock(&fw.poolMutex);
+    while (fw.pool) {
+        fwBuf *buf = fw.pool;
+        fw.pool = buf->next;
+        memAccountFree(MEM_FILE_WRITER, buf);
+        free(buf);
+    }
+    fw.poolBytes = 0;
+    pthread_mutex_unlock(&fw.poolMutex);
+}
@@ -0,0 +1,31 @@
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+
+// pending bytes above which producers fall back to writing synchronously
+#define FILE_WRITER_MAX_PENDING (128 * 1024 * 1024)
+
+// write len bytes to path via a temporary file and rename, returns 0 on success
+int writeFileAtomic(const char *path, const char *content, size_t len);
+
+// start / stop the file writer thread
+// after fileWriterStop() all submissions are rejected and the caller has to write synchronously
+void fileWriterInit();
+void fileWriterStop();
+
+// content buffers for fileWriterSubmit, released buffers are recycled for later writes
+// buffers from fileWriterAlloc() must be released with fileWriterFree(), not free()
+char *fileWriterAlloc(size_t size);
+void fileWriterFree(char *content);
+
+// hand a finished buffer from fileWriterAlloc() to the file writer thread, ownership of content passes to the writer
+// if the path is already queued, the queued content is replaced (only the newest content is written)
+// returns 0 if the writer isn't running or is backlogged, in that case the caller keeps ownership
+int fileWriterSubmit(const char *path, char *content, size_t len);
+
+// remove path after the writes of it already queued / in progress, directly if the writer isn't running
+void fileWriterUnlink(const char *path);
+
+int fileWriterRunning();
+int fileWriterQueueLength();
+
+#endif
@@ -1,12 +1,11 @@
 #include "readsb.h"
-#define STATE_SAVE_MAGIC (0x7ba09e63757314ceULL)
-#define STATE_SAVE_MAGIC_END (STATE_SAVE_MAGIC + 1)
 
 static const char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
 
-static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent);
+static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent, int incremental);
 static traceBuffer reassembleTrace(struct aircraft *a, int numPoints, int64_t after_timestamp, threadpool_buffer_t *buffer);
 static void resizeTraceCurrent(struct aircraft *a, int64_t now, int extra, int force);
+static float recompressStateChunk(struct aircraft *a, struct stateChunk *chunk, threadpool_buffer_t *passbuffer, int force);
 
 void init_globe_index() {
     struct tile *s_tiles = Modes.json_globe_special_tiles = cmalloc(GLOBE_SPECIAL_INDEX * sizeof(struct tile));
@@ -483,7 +482,7 @@ static void writeRecent(struct aircraft *a, traceBuffer tb, threadpool_buffer_t
     MODES_NOTUSED(now);
     struct char_buffer recent = { 0 };
 
-    mark_legs(tb, a, imax(0, tb.len - 4 * recent_points), 1);
+    mark_legs(tb, a, imax(0, tb.len - 4 * recent_points), 1, 0);
 
     // statistics
     atomic_fetch_add(&Modes.recentTraceWrites, 1);
@@ -525,7 +524,7 @@ static int writeFull(struct aircraft *a, traceBuffer tb, threadpool_buffer_t *ge
 
     int64_t before = mono_milli_seconds();
 
-    mark_legs(tb, a, 0, 0);
+    mark_legs(tb, a, 0, 0, 1);
 
     int64_t elapsed = mono_milli_seconds() - before;
     if (elapsed > 2 * SECONDS || (a->addr == Modes.leg_focus)) {
@@ -642,7 +641,7 @@ static int writePerm(struct aircraft *a, traceBuffer tb, threadpool_buffer_t *ge
 
     int64_t before = mono_milli_seconds();
 
-    mark_legs(tb, a, 0, 0);
+    mark_legs(tb, a, 0, 0, 1);
 
     int64_t elapsed = mono_milli_seconds() - before;
     if (elapsed > 2 * SECONDS || (a->addr == Modes.leg_focus)) {
@@ -660,7 +659,21 @@ static int writePerm(struct aircraft *a, traceBuffer tb, threadpool_buffer_t *ge
 
         char filename[TRACE_PMAX];
         snprintf(filename, TRACE_PMAX, "%s/traces/%02x/trace_full_%s%06x.json", tstring, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
-        writeJsonToGzip(Modes.globe_history_dir, filename, hist, 9);
+
+        int packed = 0;
+        if (Modes.globe_history_packed) {
+            char dayDir[PATH_MAX];
+            snprintf(dayDir, PATH_MAX, "%s/%s", Modes.globe_history_dir, tstring);
+            struct char_buffer gz = gzipToBuffer(filename, hist, 9);
+            if (gz.buffer) {
+                packed = hpackAppend(dayDir, a->addr, gz.buffer, gz.len);
+                fileWriterFree(gz.buffer);
+            }
+        }
+        // fall back to the individual file if the pack can't be written
+        if (!packed) {
+            writeJsonToGzip(Modes.globe_history_dir, filename, hist, 9);
+        }
 
         //fprintf(stderr, "perm write %06x\n", a->addr);
 
@@ -676,6 +689,32 @@ perm_done:
 }
 #undef TRACE_PMAX
 
+// generate the trace_recent (WRECENT) or trace_full (WMEM) json for a on request, the json is in generate_buffer
+// unlike traceWrite this doesn't touch the aircraft, the caller must keep a from being freed (epochEnter)
+struct char_buffer traceGenerateJson(struct aircraft *a, int type, threadpool_buffer_t *reassemble_buffer, threadpool_buffer_t *generate_buffer) {
+    struct char_buffer cb = { 0 };
+    if (a->trace_len == 0) {
+        return cb;
+    }
+    int64_t now = mstime();
+    int recent_points = Modes.traceRecentPoints;
+
+    if (type == WRECENT) {
+        traceBuffer tb = reassembleTrace(a, 2 * recent_points, -1, reassemble_buffer);
+        mark_legs(tb, a, imax(0, tb.len - 4 * recent_points), 1, 0);
+        return generateTraceJson(a, tb, WRECENT | WNOCACHE, -2, -2, generate_buffer, 0, -1);
+    }
+
+    traceBuffer tb = reassembleTrace(a, -1, -1, reassemble_buffer);
+    int startFull = first_index_ge_timestamp(tb, now - Modes.keep_traces);
+    if (startFull >= tb.len) {
+        return cb;
+    }
+    // the leg state is only advanced by traceWrite, don't race it
+    mark_legs(tb, a, 0, 0, 0);
+    return generateTraceJson(a, tb, WMEM, startFull, -1, generate_buffer, 0, -1);
+}
+
 void traceWrite(struct aircraft *a, threadpool_threadbuffers_t *buffer_group) {
     //static uint32_t count2, count3, count4;
 
@@ -887,12 +926,17 @@ static void free_aircraft_range(int start, int end) {
     }
 }
 
+// blobs writeInternalState() couldn't write completely
+static atomic_int saveBlobsFailed;
+
 static void save_blobs(void *arg, threadpool_threadbuffers_t *threadbuffers) {
     readsb_task_t *info = (readsb_task_t *) arg;
     for (int j = info->from; j < info->to; j++) {
         //fprintf(stderr, "save_blob(%d)\n", j);
 
-        save_blob(j, &threadbuffers->buffers[0], &threadbuffers->buffers[1], Modes.state_dir);
+        if (!save_blob(j, &threadbuffers->buffers[0], &threadbuffers->buffers[1], Modes.state_dir, 0)) {
+            atomic_fetch_add(&saveBlobsFailed, 1);
+        }
 
         if (Modes.quickFree) {
             int stride = Modes.acBuckets / STATE_BLOBS;
@@ -903,15 +947,203 @@ static void save_blobs(void *arg, threadpool_threadbuffers_t *threadbuffers) {
     }
 }
 
-static size_t memcpySize(void *dest, const void *src, size_t n) {
-    memcpy(dest, src, n);
-    return n;
+// trace chunks switched to the current zstd dictionary while loading the state
+static atomic_llong stateChunksRecompressed;
+
+// chunk file of a blob opened by load_blobs(), see STATE_SAVE_MAGIC_LAZY
+// it stays open until all aircraft referencing it have been hydrated, the file itself can be
+// replaced / removed by the state writes in the meantime
+struct stateChunkFile {
+    int fd; // -1: missing or not matching the blob, the chunks referencing it are dropped
+    atomic_int refCount; // aircraft referencing it + 1 while loading the blob
+};
+
+// trace chunks of an aircraft loaded from the state which are still in the chunk file,
+// they are older than the chunks in a->trace_chunks and included in a->trace_len
+struct traceHydrate {
+    struct stateChunkFile *file;
+    int64_t *offsets; // of the chunks in the file, allocated after chunks[]
+    int64_t bytes;
+    int32_t numStates;
+    int32_t chunkLen;
+    stateChunk chunks[]; // compressed is NULL
+};
+
+// where save_blob() put the trace chunks of an aircraft in the chunk file of its blob, the delta
+// writes reference those instead of appending them again
+struct stateChunkRefs {
+    uint64_t generation; // of the chunk file
+    int32_t len;
+    struct stateChunkRef {
+        int64_t offset;
+        int64_t firstTimestamp;
+        int64_t lastTimestamp;
+        int32_t numStates;
+        int32_t compressed_size; // in the file, the chunk in memory may have been recompressed since
+    } refs[];
+};
+
+static void stateChunkRefsFree(struct aircraft *a) {
+    if (a->stateChunkRefs) {
+        memAccountFree(MEM_TRACES, a->stateChunkRefs);
+        sfree(a->stateChunkRefs);
+    }
+}
+
+// read the chunks from first on into data, chunks following each other in the file are read with
+// one pread()
+static int traceHydrateRead(struct traceHydrate *h, int first, unsigned char *data) {
+    int fd = h->file ? h->file->fd : -1;
+    if (fd == -1) {
+        return -1;
+    }
+    int k = first;
+    while (k < h->chunkLen) {
+        int64_t offset = h->offsets[k];
+        int64_t bytes = 0;
+        while (k < h->chunkLen && h->offsets[k] == offset + bytes) {
+            bytes += h->chunks[k].compressed_size;
+            k++;
+        }
+        if (pread(fd, data, bytes, offset) != bytes) {
+            return -1;
+        }
+        data += bytes;
+    }
+    return 0;
+}
+
+static void chunkFilePath(char *path, char *stateDir, int blob, uint64_t generation) {
+    snprintf(path, PATH_MAX, "%s/blob_%02x_%016"PRIx64".chunks", stateDir, blob, generation);
+}
+
+static void chunkFileOpen(struct stateChunkFile *cf, int blob, uint64_t generation) {
+    char path[PATH_MAX];
+    chunkFilePath(path, Modes.state_dir, blob, generation);
+    cf->fd = open(path, O_RDONLY);
+    if (cf->fd == -1) {
+        fprintf(stderr, "<3>state blob %02x: couldn't open chunk file, trace chunks will be missing: ", blob);
+        perror(path);
+        return;
+    }
+    uint64_t header[2] = { 0, 0 };
+    if (pread(cf->fd, header, sizeof(header), 0) != sizeof(header) || header[0] != STATE_SAVE_GENERATION || header[1] != generation) {
+        fprintf(stderr, "<3>%s: corrupt chunk file, trace chunks will be missing!\n", path);
+        close(cf->fd);
+        cf->fd = -1;
+    }
+}
+
+static void chunkFileRelease(struct stateChunkFile *cf) {
+    if (cf && atomic_fetch_sub(&cf->refCount, 1) == 1) {
+        if (cf->fd != -1) {
+            close(cf->fd);
+        }
+        sfree(cf);
+    }
+}
+
+// copy of the chunks of h from first on, for reading them without holding a->traceLock
+// the copy keeps the chunk file open, free it with traceHydrateCopyFree()
+static struct traceHydrate *traceHydrateCopy(struct traceHydrate *h, int first) {
+    int len = h->chunkLen - first;
+    struct traceHydrate *copy = cmalloc(sizeof(struct traceHydrate) + len * (sizeof(stateChunk) + sizeof(int64_t)));
+    memset(copy, 0, sizeof(struct traceHydrate));
+    copy->file = h->file;
+    if (copy->file) {
+        atomic_fetch_add(&copy->file->refCount, 1);
+    }
+    copy->offsets = (int64_t *) (copy->chunks + len);
+    copy->chunkLen = len;
+    for (int k = 0; k < len; k++) {
+        copy->chunks[k] = h->chunks[first + k];
+        copy->offsets[k] = h->offsets[first + k];
+        copy->numStates += copy->chunks[k].numStates;
+        copy->bytes += copy->chunks[k].compressed_size;
+    }
+    return copy;
+}
+
+static void traceHydrateCopyFree(struct traceHydrate *copy) {
+    chunkFileRelease(copy->file);
+    sfree(copy);
+}
+
+// the caller adjusts a->trace_len if the chunks aren't moved to a->trace_chunks
+static void traceHydrateFree(struct aircraft *a) {
+    struct traceHydrate *h = a->traceHydrate;
+    if (!h) {
+        return;
+    }
+    a->traceHydrate = NULL;
+    chunkFileRelease(h->file);
+    memAccountFree(MEM_TRACES, h);
+    sfree(h);
+    atomic_fetch_sub(&Modes.stateTracesPending, 1);
 }
-static int roundUp8(int value) {
-    return ((value + 7) / 8) * 8;
+
+// read the trace chunks still in the state into memory, in front of the chunks created since
+// loading
+// not run concurrently with traceMaintenance(): misc thread, lockThreads() or no other threads
+static void traceHydrate(struct aircraft *a, threadpool_buffer_t *passbuffer) {
+    struct traceHydrate *h = a->traceHydrate;
+    if (!h) {
+        return;
+    }
+    unsigned char *data = cmalloc(h->bytes);
+    if (traceHydrateRead(h, 0, data) != 0) {
+        fprintf(stderr, "<3> %06x traceHydrate: couldn't read trace chunks from the state, dropping %d points!\n", a->addr, h->numStates);
+        sfree(data);
+        spinLock(&a->traceLock);
+        a->trace_len -= h->numStates;
+        traceHydrateFree(a);
+        spinRelease(&a->traceLock);
+        return;
+    }
+
+    stateChunk *chunks = h->chunks;
+    unsigned char *p = data;
+    int64_t bytes = 0;
+    for (int k = 0; k < h->chunkLen; k++) {
+        stateChunk *chunk = &chunks[k];
+        chunk->compressed = cmalloc(chunk->compressed_size);
+        memAccountAlloc(MEM_TRACES, chunk->compressed);
+        p += memcpySize(chunk->compressed, p, chunk->compressed_size);
+
+        // the zstd dictionary was changed or removed since the chunk was written
+        if (zstdDictMismatch(chunk->compressed, chunk->compressed_size)) {
+            recompressStateChunk(a, chunk, passbuffer, 1);
+            atomic_fetch_add(&stateChunksRecompressed, 1);
+        }
+        bytes += chunk->compressed_size;
+    }
+    sfree(data);
+
+    spinLock(&a->traceLock);
+
+    int oldLen = a->trace_chunk_len;
+    stateChunk *new = cmalloc((h->chunkLen + oldLen) * sizeof(stateChunk));
+    memAccountAlloc(MEM_TRACES, new);
+    memcpy(new, chunks, h->chunkLen * sizeof(stateChunk));
+    if (oldLen > 0) {
+        memcpy(new + h->chunkLen, a->trace_chunks, oldLen * sizeof(stateChunk));
+    }
+    memAccountFree(MEM_TRACES, a->trace_chunks);
+    sfree(a->trace_chunks);
+    a->trace_chunks = new;
+    a->trace_chunk_len = h->chunkLen + oldLen;
+    a->trace_chunk_overall_bytes += bytes;
+
+    traceHydrateFree(a);
+
+    spinRelease(&a->traceLock);
+
+    atomic_fetch_add(&Modes.stateTracesHydrated, 1);
 }
 
-static int load_aircraft(char **p, char *end, int64_t now, threadpool_buffer_t *passbuffer, int strideStart, int strideEnd) {
+// lazy: magic of a record with the trace chunks left in chunkFile (STATE_SAVE_MAGIC_LAZY /
+// STATE_SAVE_MAGIC_LAZY_V1), 0 otherwise
+static int load_aircraft(char **p, char *end, int64_t now, threadpool_buffer_t *passbuffer, int strideStart, int strideEnd, struct stateChunkFile *chunkFile, uint64_t lazy) {
     static int size_changed;
     int locked = 0;
 
@@ -1051,10 +1283,63 @@ static int load_aircraft(char **p, char *end, int64_t now, threadpool_buffer_t *
         int checkNo = 0;
 #define checkSize(size) if (++checkNo && ((end - *p < (ssize_t) size) || size < 0)) { fprintf(stderr, "loadAircraft: checkSize failed for hex %06x checkNo %d size %lld\n", a->addr, checkNo, (long long) size); traceCleanupNoUnlink(a); goto err; }
 
-        if (a->trace_chunk_len > 0) {
-            a->trace_chunks = cmalloc(a->trace_chunk_len * sizeof(stateChunk));
-        } else {
+        if (a->trace_chunk_len <= 0) {
             a->trace_chunk_len = 0;
+        } else if (lazy) {
+            uint64_t chunkOffset = 0;
+            uint64_t chunkBytes = 0;
+            if (lazy == STATE_SAVE_MAGIC_LAZY_V1) {
+                checkSize(sizeof(chunkOffset));
+                *p += memcpySize(&chunkOffset, *p, sizeof(chunkOffset));
+                checkSize(sizeof(chunkBytes));
+                *p += memcpySize(&chunkBytes, *p, sizeof(chunkBytes));
+            }
+
+            struct traceHydrate *h = cmalloc(sizeof(struct traceHydrate) + a->trace_chunk_len * (sizeof(stateChunk) + sizeof(int64_t)));
+            memAccountAlloc(MEM_TRACES, h);
+            memset(h, 0, sizeof(struct traceHydrate));
+            h->file = chunkFile;
+            h->offsets = (int64_t *) (h->chunks + a->trace_chunk_len);
+            if (chunkFile) {
+                atomic_fetch_add(&chunkFile->refCount, 1);
+            }
+            a->traceHydrate = h;
+            atomic_fetch_add(&Modes.stateTracesPending, 1);
+
+            int trace_chunk_len = a->trace_chunk_len;
+            a->trace_chunk_len = 0;
+            int64_t bytes = 0;
+            for (int k = 0; k < trace_chunk_len; k++) {
+                stateChunk *chunk = &h->chunks[k];
+                checkSize(sizeof(stateChunk));
+                *p += memcpySize(chunk, *p, sizeof(stateChunk));
+                chunk->compressed = NULL;
+                if (lazy == STATE_SAVE_MAGIC_LAZY_V1) {
+                    h->offsets[k] = chunkOffset + bytes;
+                } else {
+                    uint64_t offset;
+                    checkSize(sizeof(offset));
+                    *p += memcpySize(&offset, *p, sizeof(offset));
+                    h->offsets[k] = offset;
+                }
+                h->chunkLen++;
+                h->numStates += chunk->numStates;
+                h->bytes += chunk->compressed_size;
+                bytes += chunk->compressed_size;
+
+                if (chunk->numStates % SFOUR != 0 || chunk->compressed_size <= 0) {
+                    fprintf(stderr, "<3> %06x load_aircraft: invalid trace chunk ..... this would cause issues, throwing away trace data!\n", a->addr);
+                    discard_trace = 1;
+                    break;
+                }
+            }
+            if (!discard_trace && lazy == STATE_SAVE_MAGIC_LAZY_V1 && bytes != (int64_t) chunkBytes) {
+                fprintf(stderr, "<3> %06x load_aircraft: trace chunk sizes don't add up, throwing away trace data!\n", a->addr);
+                discard_trace = 1;
+            }
+        } else {
+            a->trace_chunks = cmalloc(a->trace_chunk_len * sizeof(stateChunk));
+            memAccountAlloc(MEM_TRACES, a->trace_chunks);
         }
         // presumed trace_chunk_len, in case we error and call traceCleanup we just pretend there
         // are no chunks, this leaks some memory and prevents segfaults for badly corrupted state
@@ -1071,7 +1356,7 @@ static int load_aircraft(char **p, char *end, int64_t now, threadpool_buffer_t *
 
             checkSize(chunk->compressed_size);
             chunk->compressed = cmalloc(chunk->compressed_size);
-            a->trace_chunk_overall_bytes += chunk->compressed_size;
+            memAccountAlloc(MEM_TRACES, chunk->compressed);
             *p += memcpySize(chunk->compressed, *p, chunk->compressed_size);
 
             ssize_t padBytes = roundUp8(chunk->compressed_size) - chunk->compressed_size;
@@ -1082,6 +1367,20 @@ static int load_aircraft(char **p, char *end, int64_t now, threadpool_buffer_t *
                 discard_trace = 1;
                 break;
             }
+
+            // the zstd dictionary was changed or removed, switch the chunk to the current one so
+            // the old dictionary isn't needed anymore once the state has been written
+            if (zstdDictMismatch(chunk->compressed, chunk->compressed_size)) {
+                recompressStateChunk(a, chunk, passbuffer, 1);
+                if (zstdDictMismatch(chunk->compressed, chunk->compressed_size)) {
+                    fprintf(stderr, "<3> %06x load_aircraft: couldn't recompress trace chunk, throwing away trace data!\n", a->addr);
+                    discard_trace = 1;
+                    break;
+                }
+                atomic_fetch_add(&stateChunksRecompressed, 1);
+                Modes.writeInternalState = 1;
+            }
+            a->trace_chunk_overall_bytes += chunk->compressed_size;
         }
         resizeTraceCurrent(a, now, 0, 0);
         if (a->trace_current_len) {
@@ -1095,6 +1394,7 @@ static int load_aircraft(char **p, char *end, int64_t now, threadpool_buffer_t *
             if (oldTraceLastMax == Modes.traceLastMax) {
                 checkSize(stateBytes(Modes.traceLastMax));
                 a->traceLast = cmCalloc(stateBytes(Modes.traceLastMax));
+                memAccountAlloc(MEM_TRACES, a->traceLast);
                 *p += memcpySize(a->traceLast, *p, stateBytes(Modes.traceLastMax));
                 //fprintf(stderr, "loaded traceLast\n");
             } else {
@@ -1148,7 +1448,108 @@ static void utc_string_from_ms(int64_t ts, char *target) {
     strftime (target, 100, "%H:%M:%S", &utc);
 }
 
-static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent) {
+// Scanning a long trace for legs is expensive and writeFull / writePerm scan the whole trace on
+// every write. The state of both passes is saved per aircraft at a checkpoint behind the end of the
+// trace and the next scan continues from there, legs found before the checkpoint are kept as
+// indexes and marked again.
+// The checkpoint stays Modes.traceLastMax points behind the end as traceAdd() can replace those
+// (beforeLandHighRes), indexes are only valid as long as the start of the trace doesn't change.
+struct legState {
+    int64_t firstTimestamp; // timestamp of the first trace point
+    int32_t checkIndex; // checkpoint, both passes continue after this index
+    int64_t checkTimestamp; // timestamp of the trace point at checkIndex
+
+    // first pass: average altitude for the threshold
+    int32_t increment;
+    int32_t sampleNext;
+    int32_t sampleCount;
+    double sampleSum;
+    int32_t sampleLastAirAlt;
+    int32_t sampleLastFive[5];
+    uint32_t sampleFivePos;
+
+    // second pass, 0 == next: not started
+    int32_t threshold;
+    int32_t next;
+    int32_t stateIndex;
+    int32_t high;
+    int32_t low;
+    int32_t lastAirAlt;
+    int32_t lastFive[5];
+    uint32_t fivePos;
+    int64_t majorClimb;
+    int64_t majorDescent;
+    int32_t majorClimbIndex;
+    int32_t majorDescentIndex;
+    int64_t lastHigh;
+    int64_t lastLow;
+    int32_t lastHighIndex;
+    int32_t lastLowIndex;
+    int64_t lastAirborne;
+    int64_t lastGround;
+    int64_t lastGroundIndex;
+    int64_t firstGround;
+    int64_t firstGroundIndex;
+    int32_t last5minGapIndex;
+    int32_t last10minGapIndex;
+    struct state last5minGapState;
+    int32_t wasGround;
+    int32_t newLegIndex;
+
+    // legs found before the checkpoint
+    int32_t legCount;
+    int32_t legAlloc;
+    int32_t *legs;
+};
+
+static void legStateFree(struct aircraft *a) {
+    struct legState *ls = a->legState;
+    if (!ls) {
+        return;
+    }
+    memAccountFree(MEM_TRACES, ls->legs);
+    sfree(ls->legs);
+    memAccountFree(MEM_TRACES, ls);
+    sfree(ls);
+    a->legState = NULL;
+}
+
+static void legStateResetSecondPass(struct legState *ls) {
+    ls->next = 0;
+    ls->legCount = 0;
+}
+
+// returns the leg state of a, reset if it doesn't match the trace anymore
+static struct legState *legStateGet(struct aircraft *a, traceBuffer tb) {
+    struct legState *ls = a->legState;
+    if (!ls) {
+        ls = a->legState = cmCalloc(sizeof(struct legState));
+        memAccountAlloc(MEM_TRACES, ls);
+    }
+    if (ls->firstTimestamp != getState(tb.trace, 0)->timestamp
+            || ls->checkIndex >= tb.len
+            || ls->checkTimestamp != getState(tb.trace, ls->checkIndex)->timestamp) {
+        ls->firstTimestamp = getState(tb.trace, 0)->timestamp;
+        ls->sampleNext = 0;
+        legStateResetSecondPass(ls);
+    }
+    return ls;
+}
+
+static void legStateAddLeg(struct legState *ls, int index) {
+    if (ls->legCount > 0 && ls->legs[ls->legCount - 1] == index) {
+        return;
+    }
+    if (ls->legCount == ls->legAlloc) {
+        memAccountFree(MEM_TRACES, ls->legs);
+        ls->legAlloc = imax(8, 2 * ls->legAlloc);
+        ls->legs = cmRealloc(ls->legs, ls->legAlloc * sizeof(int32_t));
+        memAccountAlloc(MEM_TRACES, ls->legs);
+    }
+    ls->legs[ls->legCount++] = index;
+}
+
+static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent, int incremental) {
     if (tb.len < 20)
         return;
     if (start < 0) {
@@ -1168,6 +1569,13 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
         startWatch(&watch);
     }
 
+    // always scan the whole trace for the debug output of --leg-focus
+    struct legState *ls = NULL;
+    int checkIndex = tb.len - 1 - Modes.traceLastMax - SFOUR;
+    if (incremental && start == 0 && !focus && checkIndex > 0) {
+        ls = legStateGet(a, tb);
+    }
+
     int last_five_init_alt = 0;
     struct state *startState = getState(tb.trace, start);
     if (startState->baro_alt_valid) {
@@ -1189,8 +1597,28 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
     if (tb.len > 256 * SFOUR) {
         increment = 4 * SFOUR;
     }
+    int sampleStart = start - (start % SFOUR);
+    if (ls && ls->sampleNext > 0 && ls->increment == increment) {
+        sampleStart = ls->sampleNext;
+        sum = ls->sampleSum;
+        count = ls->sampleCount;
+        last_air_alt = ls->sampleLastAirAlt;
+        memcpy(last_five, ls->sampleLastFive, sizeof(last_five));
+        five_pos = ls->sampleFivePos;
+    }
+    int sampleSaved = 0;
     float inverse_alt_factor = 1 / _alt_factor;
-    for (int i = start - (start % SFOUR); i < tb.len; i += increment) {
+    for (int i = sampleStart; i < tb.len; i += increment) {
+        if (ls && !sampleSaved && i > checkIndex) {
+            sampleSaved = 1;
+            ls->increment = increment;
+            ls->sampleNext = i;
+            ls->sampleSum = sum;
+            ls->sampleCount = count;
+            ls->sampleLastAirAlt = last_air_alt;
+            memcpy(ls->sampleLastFive, last_five, sizeof(last_five));
+            ls->sampleFivePos = five_pos;
+        }
         struct state *curr = getState(tb.trace, i);
         int on_ground = curr->on_ground;
         int altitude_valid = curr->baro_alt_valid;
@@ -1239,6 +1667,12 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
     if (threshold < 200)
         threshold = 200;
 
+    if (ls && ls->threshold != threshold) {
+        // legs depend on the threshold, start over
+        ls->threshold = threshold;
+        legStateResetSecondPass(ls);
+    }
+
     high = 0;
     low = 100000;
 
@@ -1280,10 +1714,75 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
         start = 1;
     }
     int prev_index = start - 1;
-    struct state *state = getState(tb.trace, prev_index);
     int state_index = prev_index;
+    int new_leg_index = -1;
+
+    if (ls && ls->next > 0) {
+        start = ls->next;
+        state_index = ls->stateIndex;
+        high = ls->high;
+        low = ls->low;
+        last_air_alt = ls->lastAirAlt;
+        memcpy(last_five, ls->lastFive, sizeof(last_five));
+        five_pos = ls->fivePos;
+        major_climb = ls->majorClimb;
+        major_descent = ls->majorDescent;
+        major_climb_index = ls->majorClimbIndex;
+        major_descent_index = ls->majorDescentIndex;
+        last_high = ls->lastHigh;
+        last_low = ls->lastLow;
+        last_high_index = ls->lastHighIndex;
+        last_low_index = ls->lastLowIndex;
+        last_airborne = ls->lastAirborne;
+        last_ground = ls->lastGround;
+        last_ground_index = ls->lastGroundIndex;
+        first_ground = ls->firstGround;
+        first_ground_index = ls->firstGroundIndex;
+        last_5min_gap_index = ls->last5minGapIndex;
+        last_10min_gap_index = ls->last10minGapIndex;
+        last_5min_gap_state = ls->last5minGapState;
+        was_ground = ls->wasGround;
+        new_leg_index = ls->newLegIndex;
+        if (new_leg_index >= 0) {
+            new_leg = getState(tb.trace, new_leg_index);
+        }
+        for (int k = 0; k < ls->legCount; k++) {
+            getState(tb.trace, ls->legs[k])->leg_marker = 1;
+        }
+    }
+    int legStateSaved = 0;
+
+    struct state *state = getState(tb.trace, state_index);
     struct state *prev;
     for (int index = start; index < tb.len; index++) {
+        if (ls && !legStateSaved && index > checkIndex) {
+            legStateSaved = 1;
+            ls->next = index;
+            ls->stateIndex = state_index;
+            ls->high = high;
+            ls->low = low;
+            ls->lastAirAlt = last_air_alt;
+            memcpy(ls->lastFive, last_five, sizeof(last_five));
+            ls->fivePos = five_pos;
+            ls->majorClimb = major_climb;
+            ls->majorDescent = major_descent;
+            ls->majorClimbIndex = major_climb_index;
+            ls->majorDescentIndex = major_descent_index;
+            ls->lastHigh = last_high;
+            ls->lastLow = last_low;
+            ls->lastHighIndex = last_high_index;
+            ls->lastLowIndex = last_low_index;
+            ls->lastAirborne = last_airborne;
+            ls->lastGround = last_ground;
+            ls->lastGroundIndex = last_ground_index;
+            ls->firstGround = first_ground;
+            ls->firstGroundIndex = first_ground_index;
+            ls->last5minGapIndex = last_5min_gap_index;
+            ls->last10minGapIndex = last_10min_gap_index;
+            ls->last5minGapState = last_5min_gap_state;
+            ls->wasGround = was_ground;
+            ls->newLegIndex = new_leg_index;
+        }
         prev = state;
         prev_index = state_index;
 
@@ -1510,6 +2009,7 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
 
             if (leg_now) {
                 new_leg = state;
+                new_leg_index = state_index;
                 for (int k = prev_index + 1; k < index; k++) {
                     counter2++;
                     struct state *state = getState(tb.trace, k);
@@ -1517,11 +2017,13 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
 
                     if (state->timestamp > last->timestamp + 5 * MINUTES) {
                         new_leg = state;
+                        new_leg_index = k;
                         break;
                     }
                 }
             } else if (major_descent_index + 1 == major_climb_index) {
                 new_leg = getState(tb.trace, major_climb_index);
+                new_leg_index = major_climb_index;
             } else {
                 for (int i = major_climb_index; i > major_descent_index; i--) {
                     counter3++;
@@ -1530,6 +2032,7 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
 
                     if (state->timestamp > last->timestamp + 5 * 60 * 1000) {
                         new_leg = state;
+                        new_leg_index = i;
                         break;
                     }
                 }
@@ -1541,6 +2044,7 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
 
                         if (state->timestamp > half) {
                             new_leg = state;
+                            new_leg_index = i;
                             break;
                         }
                     }
@@ -1552,6 +2056,7 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
 
                         if (state->timestamp > half) {
                             new_leg = state;
+                            new_leg_index = i;
                             break;
                         }
                     }
@@ -1562,6 +2067,9 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
                 leg_ts = new_leg->timestamp;
                 new_leg->leg_marker = 1;
                 // set leg marker
+                if (ls && !legStateSaved) {
+                    legStateAddLeg(ls, new_leg_index);
+                }
             }
 
             major_climb = 0;
@@ -1598,6 +2106,10 @@ static void mark_legs(traceBuffer tb, struct aircraft *a, int start, int recent)
 
         was_ground = on_ground;
     }
+    if (ls) {
+        ls->checkIndex = checkIndex;
+        ls->checkTimestamp = getState(tb.trace, checkIndex)->timestamp;
+    }
     if (!recent) {
         elapsed2 = lapWatch(&watch);
     }
@@ -1745,14 +2257,14 @@ static void traceUnlink(struct aircraft *a) {
         return;
 
     snprintf(filename, 1024, "%s/traces/%02x/trace_recent_%s%06x.json", Modes.json_dir, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
-    unlink(filename);
+    fileWriterUnlink(filename);
 
     snprintf(filename, 1024, "%s/traces/%02x/trace_full_%s%06x.json", Modes.json_dir, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
-    unlink(filename);
+    fileWriterUnlink(filename);
 
     if (Modes.fullTraceDir) {
         snprintf(filename, 1024, "%s/traces/%02x/trace_full_%s%06x.json", Modes.fullTraceDir, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
-        unlink(filename);
+        fileWriterUnlink(filename);
     }
 
     //fprintf(stderr, "unlink %06x: %s\n", a->addr, filename);
@@ -1772,6 +2284,7 @@ static stateChunk *resizeTraceChunks(struct aircraft *a, int newLen) {
 
     a->trace_chunk_len = newLen;
     if (newLen == 0) {
+        memAccountFree(MEM_TRACES, a->trace_chunks);
         sfree(a->trace_chunks);
         return NULL;
     }
@@ -1792,6 +2305,7 @@ static stateChunk *resizeTraceChunks(struct aircraft *a, int newLen) {
     if (!new) {
         return NULL;
     }
+    memAccountAlloc(MEM_TRACES, new);
 
     if (oldLen > newLen) {
         int shrinkByLen = oldLen - newLen;
@@ -1814,6 +2328,7 @@ static stateChunk *resizeTraceChunks(struct aircraft *a, int newLen) {
         }
     }
 
+    memAccountFree(MEM_TRACES, a->trace_chunks);
     sfree(a->trace_chunks);
 
     a->trace_chunks = new;
@@ -1825,6 +2340,7 @@ static stateChunk *resizeTraceChunks(struct aircraft *a, int newLen) {
     }
 }
 
+// called with a->traceLock held
 static void tracePrune(struct aircraft *a, int64_t now) {
     if (a->trace_len <= 0) {
         traceCleanup(a);
@@ -1838,6 +2354,28 @@ static void tracePrune(struct aircraft *a, int64_t now) {
         return;
     }
 
+    struct traceHydrate *h = a->traceHydrate;
+    if (h && h->chunks[0].lastTimestamp < keep_after) {
+        // drop the expired chunks still in the state file, the ones in memory are newer
+        int expired = 0;
+        int64_t expiredBytes = 0;
+        while (expired < h->chunkLen && h->chunks[expired].lastTimestamp < keep_after) {
+            stateChunk *chunk = &h->chunks[expired];
+            a->trace_len -= chunk->numStates;
+            h->numStates -= chunk->numStates;
+            expiredBytes += chunk->compressed_size;
+            expired++;
+        }
+        if (expired == h->chunkLen) {
+            traceHydrateFree(a);
+        } else {
+            h->chunkLen -= expired;
+            h->bytes -= expiredBytes;
+            memmove(h->chunks, h->chunks + expired, h->chunkLen * sizeof(stateChunk));
+            memmove(h->offsets, h->offsets + expired, h->chunkLen * sizeof(int64_t));
+        }
+    }
+
     int deletedChunks = 0;
 
     for (int k = 0; k < a->trace_chunk_len; k++) {
@@ -1850,6 +2388,7 @@ static void tracePrune(struct aircraft *a, int64_t now) {
         a->trace_len -= chunk->numStates;
         a->trace_chunk_overall_bytes -= chunk->compressed_size;
 
+        memAccountFree(MEM_TRACES, chunk->compressed);
         sfree(chunk->compressed);
     }
 
@@ -1899,6 +2438,7 @@ static void destroyTraceCache(struct traceCache *cache) {
     if (!cache) {
         return;
     }
+    memAccountFree(MEM_TRACES, cache->entries);
     sfree(cache->entries);
     memset(cache, 0x0, sizeof(struct traceCache));
 }
@@ -1907,13 +2447,16 @@ static void destroyTraceCache(struct traceCache *cache) {
 void traceCleanupNoUnlink(struct aircraft *a) {
     if (a->trace_chunks) {
         for (int k = 0; k < a->trace_chunk_len; k++) {
+            memAccountFree(MEM_TRACES, a->trace_chunks[k].compressed);
             sfree(a->trace_chunks[k].compressed);
         }
     }
+    memAccountFree(MEM_TRACES, a->trace_chunks);
     sfree(a->trace_chunks);
     a->trace_chunk_len = 0;
     a->trace_chunk_overall_bytes = 0;
 
+    memAccountFree(MEM_TRACES, a->trace_current);
     sfree(a->trace_current);
     a->trace_current_max = 0;
     a->trace_current_len = 0;
@@ -1921,9 +2464,14 @@ void traceCleanupNoUnlink(struct aircraft *a) {
     a->tracePosBuffered = 0;
     a->trace_len = 0;
 
+    memAccountFree(MEM_TRACES, a->traceLast);
     sfree(a->traceLast);
 
+    traceHydrateFree(a);
+    stateChunkRefsFree(a);
+
     destroyTraceCache(&a->traceCache);
+    legStateFree(a);
 }
 
 void traceCleanup(struct aircraft *a) {
@@ -1944,6 +2492,12 @@ static traceBuffer reassembleTrace(struct aircraft *a, int numPoints, int64_t af
     int currentLen = a->trace_current_len;
     int allocLen = currentLen;
 
+    // the chunks not yet read from the state come before a->trace_chunks, they are read directly
+    // from the state file without hydrating the aircraft
+    struct traceHydrate *h = a->traceHydrate;
+    int hydrateLen = h ? h->chunkLen : 0;
+    int firstHydrate = hydrateLen;
+
     if (numPoints >= 0) {
         firstChunk = a->trace_chunk_len;
         for (int k = a->trace_chunk_len - 1; k >= 0 && allocLen < numPoints; k--) {
@@ -1951,6 +2505,10 @@ static traceBuffer reassembleTrace(struct aircraft *a, int numPoints, int64_t af
             allocLen += chunk->numStates;
             firstChunk = k;
         }
+        for (int k = hydrateLen - 1; k >= 0 && firstChunk == 0 && allocLen < numPoints; k--) {
+            allocLen += h->chunks[k].numStates;
+            firstHydrate = k;
+        }
     } else if (after_timestamp > 0) {
         firstChunk = a->trace_chunk_len;
         for (int k = a->trace_chunk_len - 1; k >= 0; k--) {
@@ -1961,11 +2519,70 @@ static traceBuffer reassembleTrace(struct aircraft *a, int numPoints, int64_t af
             allocLen += chunk->numStates;
             firstChunk = k;
         }
+        for (int k = hydrateLen - 1; k >= 0 && firstChunk == 0; k--) {
+            if (after_timestamp > h->chunks[k].lastTimestamp) {
+                break;
+            }
+            allocLen += h->chunks[k].numStates;
+            firstHydrate = k;
+        }
     } else {
         for (int k = 0; k < a->trace_chunk_len; k++) {
             stateChunk *chunk = &a->trace_chunks[k];
             allocLen += chunk->numStates;
         }
+        firstHydrate = 0;
+        for (int k = 0; k < hydrateLen; k++) {
+            allocLen += h->chunks[k].numStates;
+        }
+    }
+
+    fourState *hydrated = NULL;
+    int hydratedLen = 0;
+    if (firstHydrate < hydrateLen) {
+        // the file is read without holding the spinlock, the in memory part is collected after
+        struct traceHydrate *copy = traceHydrateCopy(h, firstHydrate);
+        int64_t hydratedUntil = copy->chunks[copy->chunkLen - 1].lastTimestamp;
+        spinRelease(&a->traceLock);
+
+        if (!buffer->dctx) {
+            buffer->dctx = ZSTD_createDCtx();
+        }
+        unsigned char *data = cmalloc(copy->bytes);
+        if (traceHydrateRead(copy, 0, data) != 0) {
+            // traceHydrate() drops them
+            fprintf(stderr, "%06x reassembleTrace(): couldn't read trace chunks from the state\n", a->addr);
+        } else {
+            hydrated = cmalloc(stateBytes(copy->numStates));
+            fourState *hp = hydrated;
+            unsigned char *p = data;
+            for (int k = 0; k < copy->chunkLen; k++) {
+                stateChunk *chunk = &copy->chunks[k];
+                size_t res = zstdDecompress(buffer->dctx, hp, stateBytes(chunk->numStates), p, chunk->compressed_size);
+                if (ZSTD_isError(res)) {
+                    fprintf(stderr, "reassembleTrace() zstd error: %s\n", ZSTD_getErrorName(res));
+                    break;
+                }
+                hydratedLen += chunk->numStates;
+                hp += getFourStates(chunk->numStates);
+                p += chunk->compressed_size;
+            }
+        }
+        sfree(data);
+        traceHydrateCopyFree(copy);
+
+        spinLock(&a->traceLock);
+
+        // all of a->trace_chunks come after the chunks read, skip the ones hydrated in the meantime
+        firstChunk = 0;
+        while (firstChunk < a->trace_chunk_len && a->trace_chunks[firstChunk].lastTimestamp <= hydratedUntil) {
+            firstChunk++;
+        }
+        currentLen = a->trace_current_len;
+        allocLen = hydratedLen + currentLen;
+        for (int k = firstChunk; k < a->trace_chunk_len; k++) {
+            allocLen += a->trace_chunks[k].numStates;
+        }
     }
 
     traceBuffer tb = { 0 };
@@ -1977,6 +2594,12 @@ static traceBuffer reassembleTrace(struct aircraft *a, int numPoints, int64_t af
 
 
     int actual_len = 0;
+    if (hydratedLen > 0) {
+        memcpy(tp, hydrated, stateBytes(hydratedLen));
+        tp += getFourStates(hydratedLen);
+        actual_len += hydratedLen;
+    }
+    sfree(hydrated);
     for (int k = firstChunk; k < a->trace_chunk_len; k++) {
         stateChunk *chunk = &a->trace_chunks[k];
         actual_len += chunk->numStates;
@@ -1987,11 +2610,14 @@ static traceBuffer reassembleTrace(struct aircraft *a, int numPoints, int64_t af
         if (!buffer->dctx) {
             buffer->dctx = ZSTD_createDCtx();
         }
-        size_t res = ZSTD_decompressDCtx(buffer->dctx, tp, uncompressed_len, chunk->compressed, chunk->compressed_size);
+        size_t res = zstdDecompress(buffer->dctx, tp, uncompressed_len, chunk->compressed, chunk->compressed_size);
         if (ZSTD_isError(res)) {
-            fprintf(stderr, "reassembleTrace() zstd error: %s\n", ZSTD_getErrorName(res));
+            fprintf(stderr, "%06x reassembleTrace() zstd error: %s, dropping the trace up to this chunk\n", a->addr, ZSTD_getErrorName(res));
             tb.len = 0;
-            traceCleanup(a);
+            // this can run on an API thread, leave freeing the chunks to the next tracePrune()
+            for (int j = 0; j <= k; j++) {
+                a->trace_chunks[j].lastTimestamp = 0;
+            }
             goto exit;
         }
 
@@ -2013,9 +2639,10 @@ exit:
     return tb;
 }
 
-static float recompressStateChunk(struct aircraft *a, struct stateChunk *chunk, threadpool_buffer_t *passbuffer) {
+// force: always recompress and replace the chunk, used to switch chunks to the current zstd dictionary
+static float recompressStateChunk(struct aircraft *a, struct stateChunk *chunk, threadpool_buffer_t *passbuffer, int force) {
     a->chunkRecompressed = 1;
-    if (Modes.traceChunkMaxBytes > 16 * 1024) {
+    if (Modes.traceChunkMaxBytes > 16 * 1024 && !force) {
         // priority on no delays when the chunks are bigger
         // recompressing takes a moment and it's only a 2% memory save
         // less when traceChunkPoints is > 128, then it's only 1%
@@ -2035,7 +2662,7 @@ static float recompressStateChunk(struct aircraft *a, struct stateChunk *chunk,
     char *uncompressed = check_grow_threadpool_buffer_t(passbuffer, totalBuffer);
     char *compressed = uncompressed + uncompressed_len;
 
-    size_t res = ZSTD_decompressDCtx(passbuffer->dctx, uncompressed, uncompressed_len, chunk->compressed, chunk->compressed_size);
+    size_t res = zstdDecompress(passbuffer->dctx, uncompressed, uncompressed_len, chunk->compressed, chunk->compressed_size);
     if (ZSTD_isError(res)) {
         fprintf(stderr, "recompress(): Corrupt trace chunk: zstd error: %s\n", ZSTD_getErrorName(res));
         return 0.0f;
@@ -2044,7 +2671,7 @@ static float recompressStateChunk(struct aircraft *a, struct stateChunk *chunk,
     if (!passbuffer->cctx) {
         passbuffer->cctx = ZSTD_createCCtx();
     }
-    size_t compressedSize = ZSTD_compressCCtx(
+    size_t compressedSize = zstdCompress(
             passbuffer->cctx,
             compressed, maxSize,
             uncompressed, uncompressed_len,
@@ -2059,9 +2686,11 @@ static float recompressStateChunk(struct aircraft *a, struct stateChunk *chunk,
 
     //fprintf(stderr, "%5d %5d\n", (int) compressedSize, oldSize);
 
-    if ((int) compressedSize < oldSize) {
+    if ((int) compressedSize < oldSize || force) {
+        memAccountFree(MEM_TRACES, chunk->compressed);
         sfree(chunk->compressed);
         chunk->compressed = cmalloc(compressedSize);
+        memAccountAlloc(MEM_TRACES, chunk->compressed);
 
         memcpy(chunk->compressed, compressed, compressedSize);
         chunk->compressed_size = compressedSize;
@@ -2215,7 +2844,7 @@ static int compressChunk(fourState *source, int pointCount, threadpool_buffer_t
     } else {
         if (lastChunk) {
             // recompress finished buffer
-            recompressStateChunk(a, lastChunk, passbuffer);
+            recompressStateChunk(a, lastChunk, passbuffer, 0);
         }
 
         // make new chunk
@@ -2275,13 +2904,14 @@ static int compressChunk(fourState *source, int pointCount, threadpool_buffer_t
 
         if (extending) {
             memcpy(compressed, target->compressed, target->compressed_size);
+            memAccountFree(MEM_TRACES, target->compressed);
             sfree(target->compressed);
             compressed += target->compressed_size;
         }
 
         int compressionLvl = 2;
 
-        compressedSize = ZSTD_compressCCtx(
+        compressedSize = zstdCompress(
                 passbuffer->cctx,
                 compressed, maxSize,
                 source, newBytes,
@@ -2299,6 +2929,7 @@ static int compressChunk(fourState *source, int pointCount, threadpool_buffer_t
         target->compressed_size = compressedSize;
     }
     target->compressed = cmalloc(target->compressed_size);
+    memAccountAlloc(MEM_TRACES, target->compressed);
     memcpy(target->compressed, passbuffer->buf, target->compressed_size);
 
     a->trace_chunk_overall_bytes += target->compressed_size;
@@ -2397,11 +3028,13 @@ static void resizeTraceCurrent(struct aircraft *a, int64_t now, int extra, int f
     }
     int newBytes = stateBytes(newPoints);
     fourState *new = cmalloc(newBytes);
+    memAccountAlloc(MEM_TRACES, new);
 
     memset(new, 0x0, newBytes);
 
     if (a->trace_current) {
         memcpy(new, a->trace_current, stateBytes(a->trace_current_len + 1)); // 1 extra for buffered pos
+        memAccountFree(MEM_TRACES, a->trace_current);
         sfree(a->trace_current);
     }
 
@@ -2444,7 +3077,7 @@ static void compressCurrent(struct aircraft *a, threadpool_buffer_t *passbuffer,
     memmove(dest, src, newBytes);
 }
 
-void traceMaintenance(struct aircraft *a, int64_t now, threadpool_buffer_t *passbuffer) {
+static void traceMaintenanceLocked(struct aircraft *a, int64_t now, threadpool_buffer_t *passbuffer) {
     // free trace cache for inactive aircraft
     if (a->traceCache.entries && now - a->seenPosReliable > TRACE_CACHE_LIFETIME) {
         //fprintf(stderr, "%06x free traceCache\n", a->addr);
@@ -2548,12 +3181,20 @@ void traceMaintenance(struct aircraft *a, int64_t now, threadpool_buffer_t *pass
             stateChunk *lastChunk = &a->trace_chunks[a->trace_chunk_len - 1];
             compressCurrent(a, passbuffer, now);
             if (lastChunk == &a->trace_chunks[a->trace_chunk_len - 1]) {
-                recompressStateChunk(a, lastChunk, passbuffer);
+                recompressStateChunk(a, lastChunk, passbuffer, 0);
             }
         }
     }
 }
 
+// the API threads reassemble traces without taking part in lockThreads(), the trace buffers are
+// only replaced or freed while holding a->traceLock
+void traceMaintenance(struct aircraft *a, int64_t now, threadpool_buffer_t *passbuffer) {
+    spinLock(&a->traceLock);
+    traceMaintenanceLocked(a, now, passbuffer);
+    spinRelease(&a->traceLock);
+}
+
 static int traceAddInternal(struct aircraft *a, struct modesMessage *mm, int64_t now, int stale) {
     int traceDebug = (a->addr == Modes.trace_focus);
 
@@ -2995,6 +3636,7 @@ no_save_state:
 
     if (Modes.traceLastMax && !a->traceLast) {
         a->traceLast = cmCalloc(stateBytes(Modes.traceLastMax));
+        memAccountAlloc(MEM_TRACES, a->traceLast);
         a->traceLastNext = 0;
     }
 
@@ -3057,20 +3699,79 @@ static void stride_from_blob(int blob, int *stride, int *start, int *end) {
     *end = *start + *stride;
 }
 
-void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbuffer2, char *stateDir) {
+int save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbuffer2, char *stateDir, int delta) {
     if (!stateDir)
-        return;
+        return 0;
     //static int count;
     //fprintf(stderr, "Save blob: %02x, count: %d\n", blob, ++count);
-    if (blob < 0 || blob > STATE_BLOBS) {
+    if (blob < 0 || blob >= STATE_BLOBS) {
         fprintf(stderr, "save_blob: invalid argument: %02x", blob);
-        return;
+        return 0;
     }
+    PROBE2(save_blob_start, blob, delta);
 
     int zst = 1;
 
+    // the bookkeeping for delta writes is only done for the state dir
+    struct stateBlobInfo *info = (stateDir == Modes.state_dir) ? &Modes.stateBlobs[blob] : NULL;
+    if (delta && (!info || !info->generation || info->deltaBytes > info->baseBytes)) {
+        // compaction
+        delta = 0;
+    }
+    // trace chunks go into the chunk file when writing the state dir, blobs written elsewhere are
+    // self-contained (replaceState)
+    int lazy = (info != NULL);
+    char chunkpath[PATH_MAX];
+    int chunkFd = -1;
+    int64_t chunkOffset = 0;
+    if (delta) {
+        chunkFilePath(chunkpath, stateDir, blob, info->generation);
+        chunkFd = open(chunkpath, O_WRONLY | O_APPEND);
+        chunkOffset = (chunkFd == -1) ? 0 : lseek(chunkFd, 0, SEEK_END);
+        if (chunkOffset < (int64_t) (2 * sizeof(uint64_t))) {
+            // the delta would reference a damaged chunk file
+            if (chunkFd != -1) {
+                close(chunkFd);
+                chunkFd = -1;
+            }
+            delta = 0;
+        }
+    }
+    // aircraft changing from here on are written next time
+    uint64_t seq = atomic_fetch_add(&Modes.stateSeq, 1);
+    uint64_t dirtySince = info ? info->dirtySince : 0;
+    uint64_t generation = delta ? info->generation : (uint64_t) mstime();
+    int64_t written = 0;
+    int writeFailed = 0;
+    int success = 0;
+
+    if (lazy && !delta) {
+        chunkFilePath(chunkpath, stateDir, blob, generation);
+        chunkFd = open(chunkpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        uint64_t header[2] = { STATE_SAVE_GENERATION, generation };
+        if (chunkFd == -1 || check_write(chunkFd, header, sizeof(header), chunkpath) != (ssize_t) sizeof(header)) {
+            fprintf(stderr, "save_blob: couldn't write chunk file, writing trace chunks inline: ");
+            perror(chunkpath);
+            if (chunkFd != -1) {
+                close(chunkFd);
+                chunkFd = -1;
+                unlink(chunkpath);
+            }
+            lazy = 0;
+        } else {
+            chunkOffset = sizeof(header);
+            written += sizeof(header);
+        }
+    }
+    // chunks of one aircraft are written with one write
+    threadpool_buffer_t chunkBuffer = { 0 };
+    // for traceHydrate(), the other buffers are in use
+    threadpool_buffer_t hydrateBuffer = { 0 };
+
     char filename[PATH_MAX];
     char tmppath[PATH_MAX];
+    char deltapath[PATH_MAX];
+    snprintf(deltapath, PATH_MAX, "%s/blob_%02x.delta.zstl", stateDir, blob);
     if (zst) {
         snprintf(filename, 1024, "%s/blob_%02x.zstl", stateDir, blob);
     } else {
@@ -3078,11 +3779,31 @@ void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbu
     }
     snprintf(tmppath, PATH_MAX, "%s.readsb_tmp", filename);
 
-    int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int fd;
+    if (delta) {
+        // appended to, a partially written frame is detected when loading and the rest of the
+        // delta is ignored, make the next write a full one in that case
+        fd = open(deltapath, O_WRONLY | O_CREAT | O_APPEND | (info->deltaBytes ? 0 : O_TRUNC), 0644);
+        if (fd >= 0 && info->deltaBytes == 0) {
+            uint64_t header[2] = { STATE_SAVE_GENERATION, generation };
+            if (check_write(fd, header, sizeof(header), deltapath) != (ssize_t) sizeof(header)) {
+                writeFailed = 1;
+            }
+            written += sizeof(header);
+        }
+    } else {
+        fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
     if (fd < 0) {
         fprintf(stderr, "open failed:");
-        perror(tmppath);
-        return;
+        perror(delta ? deltapath : tmppath);
+        if (chunkFd != -1) {
+            close(chunkFd);
+            if (!delta) {
+                unlink(chunkpath);
+            }
+        }
+        return 0;
     }
 
     int stride = -1;
@@ -3114,10 +3835,17 @@ void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbu
     struct aircraft *copy = &copyback;
     for (int j = start; j < end; j++) {
         for (struct aircraft *a = Modes.aircraft[j]; a || (j == end - 1); a = a->next) {
+            if (a && delta && a->stateSeq < dirtySince) {
+                continue;
+            }
             int size_state = 0;
             if (!a) {
                 copy = NULL;
             } else {
+                // the chunks still in the previous chunk file are written again, this also
+                // switches them to the current zstd dictionary
+                traceHydrate(a, &hydrateBuffer);
+
                 // work on local copy of aircraft for traceUsePosBuffered
                 memcpy(copy, a, sizeof(struct aircraft));
 
@@ -3130,12 +3858,17 @@ void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbu
                 for (int k = 0; k < copy->trace_chunk_len; k++) {
                     stateChunk *chunk = &copy->trace_chunks[k];
                     size_state += sizeof(stateChunk);
-                    size_state += roundUp8(chunk->compressed_size);
+                    if (lazy) {
+                        size_state += sizeof(uint64_t);
+                    } else {
+                        size_state += roundUp8(chunk->compressed_size);
+                    }
                 }
                 size_state += stateBytes(copy->trace_current_len);
 
-                // add space for 2 magic constants / 2 struct sizes
-                size_state += 4 * sizeof(uint64_t);
+                // add space for 2 magic constants / 2 struct sizes / the generation / the chunk
+                // offset and size
+                size_state += 8 * sizeof(uint64_t);
 
                 if (copy->traceLast) {
                     size_state += sizeof(uint64_t);
@@ -3150,11 +3883,17 @@ void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbu
                 memcpy(p, &magic_end, sizeof(magic_end));
                 p += sizeof(magic_end);
 
+                uint64_t magic_generation = STATE_SAVE_GENERATION;
+                p += memcpySize(p, &magic_generation, sizeof(magic_generation));
+                p += memcpySize(p, &generation, sizeof(generation));
+
                 if (p > buf + alloc) {
                     fprintf(stderr, "save_blob: overran buffer! %ld\n", (long) (p - (buf + alloc)));
                 }
 
-                if (zst) {
+                if (delta && chunk_ac_count == 0) {
+                    // nothing changed, don't write an empty frame
+                } else if (zst) {
                     uint32_t uncompressed_len = p - buf;
 
                     /*
@@ -3164,7 +3903,7 @@ void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbu
                      int compressionLevel);
                      */
 
-                    size_t compressedSize = ZSTD_compressCCtx(pbuffer2->cctx,
+                    size_t compressedSize = zstdCompress(pbuffer2->cctx,
                             zst_out + zst_header_len, zst_out_alloc,
                             buf, uncompressed_len,
                             1);
@@ -3183,7 +3922,10 @@ void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbu
 
                     // end header
 
-                    check_write(fd, zst_out, compressed_len + zst_header_len, tmppath);
+                    if (check_write(fd, zst_out, compressed_len + zst_header_len, delta ? deltapath : tmppath) != compressed_len + zst_header_len) {
+                        writeFailed = 1;
+                    }
+                    written += compressed_len + zst_header_len;
                 } else {
                     check_write(fd, buf, p - buf, tmppath);
                 }
@@ -3217,7 +3959,64 @@ void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbu
 
             chunk_ac_count++;
 
-            uint64_t magic = STATE_SAVE_MAGIC;
+            // the chunk data is written before the frame referencing it, chunks already written
+            // to this chunk file by an earlier delta / the base are only referenced
+            struct stateChunkRefs *refs = NULL;
+            if (lazy && copy->trace_len > 0 && copy->trace_chunk_len > 0) {
+                struct stateChunkRefs *old = a->stateChunkRefs;
+                if (old && old->generation != generation) {
+                    old = NULL;
+                }
+                refs = cmalloc(sizeof(struct stateChunkRefs) + copy->trace_chunk_len * sizeof(struct stateChunkRef));
+                memAccountAlloc(MEM_TRACES, refs);
+                refs->generation = generation;
+                refs->len = copy->trace_chunk_len;
+
+                int64_t appendBytes = 0;
+                int o = 0;
+                for (int k = 0; k < copy->trace_chunk_len; k++) {
+                    stateChunk *chunk = &copy->trace_chunks[k];
+                    struct stateChunkRef *ref = &refs->refs[k];
+                    // both are ordered by time, the chunks only change by pruning / appending
+                    while (old && o < old->len && old->refs[o].firstTimestamp < chunk->firstTimestamp) {
+                        o++;
+                    }
+                    if (old && o < old->len
+                            && old->refs[o].firstTimestamp == chunk->firstTimestamp
+                            && old->refs[o].lastTimestamp == chunk->lastTimestamp
+                            && old->refs[o].numStates == chunk->numStates) {
+                        *ref = old->refs[o];
+                        continue;
+                    }
+                    ref->offset = chunkOffset + appendBytes;
+                    ref->firstTimestamp = chunk->firstTimestamp;
+                    ref->lastTimestamp = chunk->lastTimestamp;
+                    ref->numStates = chunk->numStates;
+                    ref->compressed_size = chunk->compressed_size;
+                    appendBytes += chunk->compressed_size;
+                }
+                if (appendBytes > 0) {
+                    // the file only grows, references to earlier writes are below chunkOffset
+                    unsigned char *cp = check_grow_threadpool_buffer_t(&chunkBuffer, appendBytes);
+                    for (int k = 0; k < copy->trace_chunk_len; k++) {
+                        if (refs->refs[k].offset >= chunkOffset) {
+                            stateChunk *chunk = &copy->trace_chunks[k];
+                            cp += memcpySize(cp, chunk->compressed, chunk->compressed_size);
+                        }
+                    }
+                    if (check_write(chunkFd, chunkBuffer.buf, appendBytes, chunkpath) != (ssize_t) appendBytes) {
+                        writeFailed = 1;
+                    }
+                    chunkOffset += appendBytes;
+                    written += appendBytes;
+                }
+            }
+            if (lazy) {
+                stateChunkRefsFree(a);
+                a->stateChunkRefs = refs;
+            }
+
+            uint64_t magic = lazy ? STATE_SAVE_MAGIC_LAZY : STATE_SAVE_MAGIC;
             p += memcpySize(p, &magic, sizeof(magic));
             uint64_t size_aircraft = sizeof(struct aircraft);
             p += memcpySize(p, &size_aircraft, sizeof(size_aircraft));
@@ -3231,6 +4030,15 @@ void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbu
 
                 for (int k = 0; k < copy->trace_chunk_len; k++) {
                     stateChunk *chunk = &copy->trace_chunks[k];
+                    if (lazy) {
+                        stateChunk header = *chunk;
+                        header.compressed = NULL;
+                        header.compressed_size = refs->refs[k].compressed_size;
+                        uint64_t offset = refs->refs[k].offset;
+                        p += memcpySize(p, &header, sizeof(stateChunk));
+                        p += memcpySize(p, &offset, sizeof(offset));
+                        continue;
+                    }
                     p += memcpySize(p, chunk, sizeof(stateChunk));
 
                     p += memcpySize(p, chunk->compressed, chunk->compressed_size);
@@ -3256,23 +4064,69 @@ void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbu
     if (fd != -1) {
         close(fd);
     }
+    if (chunkFd != -1) {
+        close(chunkFd);
+        chunkFd = -1;
+    }
+
+    if (delta) {
+        if (writeFailed) {
+            info->generation = 0;
+        }
+        info->deltaBytes += written;
+        info->dirtySince = seq;
+        success = !writeFailed;
+        goto out;
+    }
 
     if (rename(tmppath, filename) == -1) {
         fprintf(stderr, "save_blob rename(): %s -> %s", tmppath, filename);
         perror("");
         unlink(tmppath);
-    }
+        if (lazy) {
+            unlink(chunkpath);
+        }
+        goto out;
+    }
+    // the delta and chunk file belong to the previous generation, they are ignored / removed when
+    // loading if this fails
+    unlink(deltapath);
+    if (info && info->generation && info->generation != generation) {
+        chunkFilePath(chunkpath, stateDir, blob, info->generation);
+        unlink(chunkpath);
+    }
+    if (info) {
+        info->generation = writeFailed ? 0 : generation;
+        info->baseBytes = written;
+        info->deltaBytes = 0;
+        info->dirtySince = seq;
+    }
+    success = !writeFailed;
     goto out;
 error:
     if (fd != -1) {
         close(fd);
     }
-    unlink(tmppath);
+    if (chunkFd != -1) {
+        close(chunkFd);
+    }
+    if (delta) {
+        // the frames already appended are valid, just make the next write a full one
+        info->generation = 0;
+    } else {
+        unlink(tmppath);
+        if (lazy) {
+            unlink(chunkpath);
+        }
+    }
 out:
-    ;
+    free_threadpool_buffer(&chunkBuffer);
+    free_threadpool_buffer(&hydrateBuffer);
+    PROBE3(save_blob_done, blob, delta, written);
+    return success;
 }
 
-static int load_aircrafts(char *p, char *end, char *filename, int64_t now, threadpool_buffer_t *passbuffer, int strideStart, int strideEnd) {
+static int load_aircrafts(char *p, char *end, char *filename, int64_t now, threadpool_buffer_t *passbuffer, int strideStart, int strideEnd, uint64_t *generation, struct stateChunkFile *chunkFile) {
     int count = 0;
     while (end - p > 0) {
         uint64_t value = 0;
@@ -3280,20 +4134,73 @@ static int load_aircrafts(char *p, char *end, char *filename, int64_t now, threa
             p += memcpySize(&value, p, sizeof(value));
         }
 
-        if (value != STATE_SAVE_MAGIC) {
+        if (value != STATE_SAVE_MAGIC && value != STATE_SAVE_MAGIC_LAZY && value != STATE_SAVE_MAGIC_LAZY_V1) {
             if (value != STATE_SAVE_MAGIC_END) {
                 fprintf(stderr, "Incomplete state file (or state format was changed and is incompatible with new format): %s\n", filename);
                 return -1;
             }
+            if (end - p >= 2 * (long) sizeof(value)) {
+                p += memcpySize(&value, p, sizeof(value));
+                if (value == STATE_SAVE_GENERATION) {
+                    memcpy(generation, p, sizeof(*generation));
+                }
+            }
             break;
         }
-        load_aircraft(&p, end, now, passbuffer, strideStart, strideEnd);
+        load_aircraft(&p, end, now, passbuffer, strideStart, strideEnd, chunkFile, (value == STATE_SAVE_MAGIC) ? 0 : value);
         count++;
     }
     return count;
 }
 
-void load_blob(int blobNumber, char *blob, threadpool_threadbuffers_t * buffer_group) {
+// frames of { uint32_t compressed_len, uint32_t uncompressed_len, zstd data }
+static int load_zstl(char *p, char *end, char *filename, int64_t now, int blobNumber, threadpool_threadbuffers_t *buffer_group, uint64_t *generation, struct stateChunkFile *chunkFile) {
+    threadpool_buffer_t *pb1 = &buffer_group->buffers[0];
+    threadpool_buffer_t *pb2 = &buffer_group->buffers[1];
+
+    int stride = -1;
+    int strideStart = -1;
+    int strideEnd = -1;
+    stride_from_blob(blobNumber, &stride, &strideStart, &strideEnd);
+
+    while (end - p > 0) {
+        if (end - p < 2 * (ssize_t) sizeof(uint32_t)) {
+            fprintf(stderr, "Corrupt state file (too small): %s\n", filename);
+            return -1;
+        }
+        uint32_t compressed_len = *((uint32_t *) p);
+        p += sizeof(compressed_len);
+
+        uint32_t uncompressed_len = *((uint32_t *) p);
+        p += sizeof(uncompressed_len);
+
+        if (end - p < (ssize_t) compressed_len) {
+            fprintf(stderr, "Corrupt state file (smaller than compressed_len): %s\n", filename);
+            return -1;
+        }
+
+        if (!pb1->dctx) {
+            pb1->dctx = ZSTD_createDCtx();
+        }
+
+        char *uncompressed = check_grow_threadpool_buffer_t(pb1, uncompressed_len);
+        char *compressed = p;
+
+        size_t res = zstdDecompress(pb1->dctx, uncompressed, uncompressed_len, compressed, compressed_len);
+        if (ZSTD_isError(res)) {
+            fprintf(stderr, "Corrupt state file %s zstd error: %s\n", filename, ZSTD_getErrorName(res));
+            return -1;
+        }
+
+        if (load_aircrafts(uncompressed, uncompressed + uncompressed_len, filename, now, pb2, strideStart, strideEnd, generation, chunkFile) < 0) {
+            return -1;
+        }
+        p += compressed_len;
+    }
+    return 0;
+}
+
+uint64_t load_blob(int blobNumber, char *blob, threadpool_threadbuffers_t * buffer_group, struct stateChunkFile *chunkFile) {
     int64_t now = mstime();
     int fd = -1;
     struct char_buffer cb;
@@ -3301,6 +4208,7 @@ void load_blob(int blobNumber, char *blob, threadpool_threadbuffers_t * buffer_g
     char *end;
     int zst = 0;
     char filename[1024];
+    uint64_t generation = 0;
 
     snprintf(filename, 1024, "%s.zstl", blob);
     fd = open(filename, O_RDONLY);
@@ -3316,66 +4224,67 @@ void load_blob(int blobNumber, char *blob, threadpool_threadbuffers_t * buffer_g
             fprintf(stderr, "missing state blob:");
             snprintf(filename, 1024, "%s.zstl", blob);
             perror(filename);
-            return;
+            return 0;
         }
         cb = readWholeFile(fd, filename);
         close(fd);
         unlink(filename);
     }
     if (!cb.buffer)
-        return;
+        return 0;
     p = cb.buffer;
     end = p + cb.len;
 
-    threadpool_buffer_t *pb1 = &buffer_group->buffers[0];
-    threadpool_buffer_t *pb2 = &buffer_group->buffers[1];
-
-    int stride = -1;
-    int strideStart = -1;
-    int strideEnd = -1;
-    stride_from_blob(blobNumber, &stride, &strideStart, &strideEnd);
-
     if (zst) {
-        while (end - p > 0) {
-            if (end - p < 2 * (ssize_t) sizeof(uint32_t)) {
-                fprintf(stderr, "Corrupt state file (too small): %s\n", filename);
-                goto out;
-            }
-            uint32_t compressed_len = *((uint32_t *) p);
-            p += sizeof(compressed_len);
-
-            uint32_t uncompressed_len = *((uint32_t *) p);
-            p += sizeof(uncompressed_len);
-
-            if (end - p < (ssize_t) compressed_len) {
-                fprintf(stderr, "Corrupt state file (smaller than compressed_len): %s\n", filename);
-                goto out;
-            }
-
-            if (!pb1->dctx) {
-                pb1->dctx = ZSTD_createDCtx();
-            }
-
-            char *uncompressed = check_grow_threadpool_buffer_t(pb1, uncompressed_len);
-            char *compressed = p;
-
-            size_t res = ZSTD_decompressDCtx(pb1->dctx, uncompressed, uncompressed_len, compressed, compressed_len);
-            if (ZSTD_isError(res)) {
-                fprintf(stderr, "Corrupt state file %s zstd error: %s\n", filename, ZSTD_getErrorName(res));
-                goto out;
-            }
-
-            if (load_aircrafts(uncompressed, uncompressed + uncompressed_len, filename, now, pb2, strideStart, strideEnd) < 0) {
-                goto out;
-            }
-            p += compressed_len;
+        if (load_zstl(p, end, filename, now, blobNumber, buffer_group, &generation, chunkFile) < 0) {
+            // don't write deltas on top of a damaged blob
+            generation = 0;
         }
     } else {
-        load_aircrafts(p, end, filename, now, pb2, strideStart, strideEnd);
+        threadpool_buffer_t *pb2 = &buffer_group->buffers[1];
+        int stride = -1;
+        int strideStart = -1;
+        int strideEnd = -1;
+        stride_from_blob(blobNumber, &stride, &strideStart, &strideEnd);
+        load_aircrafts(p, end, filename, now, pb2, strideStart, strideEnd, &generation, chunkFile);
     }
 
-out:
     sfree(cb.buffer);
+    return generation;
+}
+
+// apply blob_xx.delta.zstl, returns its size or 0 if it doesn't belong to this generation of the blob
+static int64_t load_blob_delta(int blobNumber, uint64_t generation, threadpool_threadbuffers_t *buffer_group, struct stateChunkFile *chunkFile) {
+    char filename[PATH_MAX];
+    snprintf(filename, PATH_MAX, "%s/blob_%02x.delta.zstl", Modes.state_dir, blobNumber);
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    struct char_buffer cb = readWholeFile(fd, filename);
+    close(fd);
+    if (!cb.buffer) {
+        return 0;
+    }
+    uint64_t header[2] = { 0, 0 };
+    if (cb.len >= sizeof(header)) {
+        memcpy(header, cb.buffer, sizeof(header));
+    }
+    if (header[0] != STATE_SAVE_GENERATION || header[1] != generation || generation == 0) {
+        // left over from before the base was last written
+        sfree(cb.buffer);
+        unlink(filename);
+        return 0;
+    }
+    uint64_t deltaGeneration = 0;
+    int res = load_zstl(cb.buffer + sizeof(header), cb.buffer + cb.len, filename, mstime(), blobNumber, buffer_group, &deltaGeneration, chunkFile);
+    int64_t size = cb.len;
+    sfree(cb.buffer);
+    if (res < 0) {
+        // can't append after a damaged frame
+        return -1;
+    }
+    return size;
 }
 
 static void load_blobs(void *arg, threadpool_threadbuffers_t * buffer_group) {
@@ -3384,7 +4293,28 @@ static void load_blobs(void *arg, threadpool_threadbuffers_t * buffer_group) {
     for (int j = info->from; j < info->to; j++) {
         char blob[1024];
         snprintf(blob, 1024, "%s/blob_%02x", Modes.state_dir, j);
-        load_blob(j, blob, buffer_group);
+        struct stateChunkFile *chunkFile = cmalloc(sizeof(struct stateChunkFile));
+        chunkFile->fd = -1;
+        chunkFile->refCount = 1;
+
+        uint64_t generation = load_blob(j, blob, buffer_group, chunkFile);
+        int64_t deltaBytes = load_blob_delta(j, generation, buffer_group, chunkFile);
+
+        // the generation is only known after reading the blob, nothing reads the chunks before
+        // the loading is done
+        if (atomic_load(&chunkFile->refCount) > 1) {
+            chunkFileOpen(chunkFile, j, generation);
+        }
+        chunkFileRelease(chunkFile);
+
+        struct stateBlobInfo *sb = &Modes.stateBlobs[j];
+        struct stat st;
+        snprintf(blob, 1024, "%s/blob_%02x.zstl", Modes.state_dir, j);
+        // without a valid base and delta the next write of this blob is a full one
+        sb->generation = (deltaBytes >= 0 && stat(blob, &st) == 0) ? generation : 0;
+        sb->baseBytes = sb->generation ? st.st_size : 0;
+        sb->deltaBytes = imax(deltaBytes, 0);
+        sb->dirtySince = Modes.stateSeq;
     }
 }
 
@@ -3699,6 +4629,49 @@ void checkNewDay(int64_t now) {
     }
 }
 
+// compact the packed history of the previous day once no more traces are written for it
+// writePerm stops writing the previous day 55 min after midnight, wait another 10 minutes for
+// writes already in progress
+int historyPackCheckDay(int64_t now) {
+    if (!Modes.globe_history_dir || !Modes.globe_history_packed)
+        return 0;
+
+    time_t sixtyfive = now / 1000 - 65 * 60;
+    struct tm utc;
+    gmtime_r(&sixtyfive, &utc);
+
+    if (utc.tm_mday == Modes.historyPackDay) {
+        return 0;
+    }
+    Modes.historyPackDay = utc.tm_mday;
+
+    time_t yesterday = sixtyfive - 24 * 3600;
+    gmtime_r(&yesterday, &utc);
+
+    char dateDir[PATH_MAX * 3/4];
+    sprintDateDir(Modes.globe_history_dir, &utc, dateDir);
+
+    //////////// UNLOCK MISC
+    pthread_mutex_unlock(&Threads.misc.mutex);
+    //////////// UNLOCK MISC
+
+    struct timespec watch;
+    startWatch(&watch);
+
+    if (hpackFinalize(dateDir) == 0) {
+        double elapsed = stopWatch(&watch) / 1000.0;
+        if (elapsed > 1) {
+            fprintf(stderr, "%s: packed history finalized in %.1f seconds\n", dateDir, elapsed);
+        }
+    }
+
+    //////////// LOCK MISC
+    pthread_mutex_lock(&Threads.misc.mutex);
+    //////////// LOCK MISC
+
+    return 1;
+}
+
 // this blocks other stuff, so the compression is done a bit later in the checkNewDay function which
 // does not block other stuff
 void checkNewDayAcas(int64_t now) {
@@ -3812,6 +4785,8 @@ void writeInternalState() {
     threadpool_task_t *tasks = group->tasks;
     readsb_task_t *infos = group->infos;
 
+    atomic_store(&saveBlobsFailed, 0);
+
     // assign tasks
     int taskCount = 0;
     {
@@ -3847,16 +4822,50 @@ void writeInternalState() {
     if (Modes.state_dir) {
         double elapsed = stopWatch(&watch) / 1000.0;
         fprintf(stderr, " .......... done, saved %llu aircraft in %.3f seconds!\n", (unsigned long long) Modes.total_aircraft_count, elapsed);
+        int failed = atomic_load(&saveBlobsFailed);
+        if (failed) {
+            // blobs that weren't rewritten can still reference older dictionaries
+            fprintf(stderr, "<3> couldn't write %d of %d state blobs, keeping the old zstd dictionaries\n", failed, STATE_BLOBS);
+        } else {
+            // every blob has been written with the current zstd dictionary
+            zstdDictPrune(Modes.state_dir);
+        }
     }
 }
 
 
+// chunk files not belonging to the generation of their blob are left over from interrupted
+// state writes, the ones still needed for loading are open already
+static void pruneChunkFiles() {
+    DIR *dp = opendir(Modes.state_dir);
+    if (!dp) {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dp))) {
+        unsigned int blob;
+        uint64_t generation;
+        char path[PATH_MAX];
+        if (sscanf(ent->d_name, "blob_%2x_%16"SCNx64, &blob, &generation) != 2 || blob >= STATE_BLOBS) {
+            continue;
+        }
+        chunkFilePath(path, Modes.state_dir, blob, generation);
+        if (strcmp(path + strlen(Modes.state_dir) + 1, ent->d_name) != 0 || generation == Modes.stateBlobs[blob].generation) {
+            continue;
+        }
+        unlink(path);
+    }
+    closedir(dp);
+}
+
 void readInternalState() {
     int retval = mkdir(Modes.state_dir, 0755);
     if (retval != 0 && errno != EEXIST) {
         fprintf(stderr, "Unable to create state directory (%s): %s\n", Modes.state_dir, strerror(errno));
         return;
     }
+    // the dictionary has to be in the state dir before anything is written with it
+    zstdDictStore(Modes.state_dir);
     if (retval == 0) {
         fprintf(stderr, "%s: state directory didn't exist, created it, possible reasons: "
                 "first start with state enabled / directory not backed by persistent storage\n",
@@ -3920,11 +4929,60 @@ void readInternalState() {
     }
     Modes.total_aircraft_count = aircraftCount;
 
-    double elapsed = stopWatch(&watch) / 1000.0;
+    pruneChunkFiles();
+
+    Modes.stateLoadTime = stopWatch(&watch);
+    double elapsed = Modes.stateLoadTime / 1000.0;
     fprintf(stderr, " .......... done, loaded %llu aircraft in %.3f seconds!\n", (unsigned long long) aircraftCount, elapsed);
+    if (Modes.stateTracesPending) {
+        fprintf(stderr, "reading the older trace chunks of %d aircraft in the background\n", (int) Modes.stateTracesPending);
+    }
+    if (stateChunksRecompressed) {
+        fprintf(stderr, "recompressed %lld trace chunks for zstd dictionary %08x\n", (long long) stateChunksRecompressed, zstdDictId());
+    }
     fprintf(stderr, "aircraft table fill: %0.1f\n", aircraftCount / (double) Modes.acBuckets );
 }
 
+// runs on the misc thread with a time limit per call, goes over all aircraft once after loading
+int traceHydrateStep() {
+    static int bucket;
+    static int done;
+    static struct timespec watch;
+    if (done || !Modes.state_dir) {
+        return 0;
+    }
+    if (bucket == 0) {
+        startWatch(&watch);
+    }
+
+    threadpool_buffer_t passbuffer = { 0 };
+    int64_t deadline = mono_milli_seconds() + 50;
+    while (bucket < Modes.acBuckets && atomic_load(&Modes.stateTracesPending) > 0) {
+        for (struct aircraft *a = Modes.aircraft[bucket]; a; a = a->next) {
+            traceHydrate(a, &passbuffer);
+        }
+        bucket++;
+        if (mono_milli_seconds() > deadline) {
+            break;
+        }
+    }
+    free_threadpool_buffer(&passbuffer);
+
+    if (bucket < Modes.acBuckets && atomic_load(&Modes.stateTracesPending) > 0) {
+        return 1;
+    }
+    // aircraft removed in the meantime release their chunks when they are freed
+    done = 1;
+    if (Modes.stateTracesHydrated) {
+        fprintf(stderr, "read the older trace chunks of %d aircraft from the state in %.1f seconds\n",
+                (int) Modes.stateTracesHydrated, stopWatch(&watch) / 1000.0);
+    }
+    if (stateChunksRecompressed) {
+        fprintf(stderr, "recompressed %lld trace chunks for zstd dictionary %08x\n", (long long) stateChunksRecompressed, zstdDictId());
+    }
+    return 0;
+}
+
 void unlinkPerm(struct aircraft *a) {
     if (!Modes.globe_history_dir) {
         return;
@@ -3950,7 +5008,12 @@ void unlinkPerm(struct aircraft *a) {
     snprintf(filename, PATH_MAX, "%s/%s/traces/%02x/trace_full_%s%06x.json", Modes.globe_history_dir, tstring, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
     filename[PATH_MAX - 101] = 0;
 
-    unlink(filename);
+    fileWriterUnlink(filename);
+
+    if (Modes.globe_history_packed) {
+        snprintf(filename, PATH_MAX, "%s/%s", Modes.globe_history_dir, tstring);
+        hpackAppend(filename, a->addr, NULL, 0);
+    }
 
 }
 
@@ -4019,7 +5082,9 @@ void traceDelete() {
         }
 
 
+        spinLock(&a->traceLock);
         setTrace(a, trace, trace_len, &passbuffer);
+        spinRelease(&a->traceLock);
 
         int64_t now = mstime();
         a->trace_next_perm = now;
@@ -3,9 +3,50 @@
 
 #define TRACE_FOCUS BADDR
 
+// framing of the serialized aircraft in the state blobs
+#define STATE_SAVE_MAGIC (0x7ba09e63757314ceULL)
+#define STATE_SAVE_MAGIC_END (STATE_SAVE_MAGIC + 1)
+// followed by the generation of the base blob, after the end magic of every frame and at the start
+// of a delta file
+#define STATE_SAVE_GENERATION (STATE_SAVE_MAGIC + 2)
+
+// aircraft record with the trace chunks in the chunk file of the blob instead of inline:
+// blob_xx_<generation>.chunks starts with { STATE_SAVE_GENERATION, generation }, followed by the
+// compressed chunks appended by the state writes. The records only have the stateChunk headers of
+// the chunks of an aircraft, each followed by the uint64_t offset of the chunk in that file.
+// A delta write only appends the chunks not yet in the file and references the others.
+// Loading the state reads the records only, the chunks are read into memory later by a background
+// pass (traceHydrateStep) or when a trace is generated before that.
+#define STATE_SAVE_MAGIC_LAZY (STATE_SAVE_MAGIC + 4)
+// still loaded: the chunks of an aircraft in one piece, the record has their offset / size
+#define STATE_SAVE_MAGIC_LAZY_V1 (STATE_SAVE_MAGIC + 3)
+
+// The periodic state writes append the aircraft which changed since the last write of a blob to
+// blob_xx.delta.zstl instead of rewriting blob_xx.zstl. Once the delta is larger than the base, the
+// next periodic write of that blob rewrites the base from memory (compaction) and removes the delta.
+// A delta is only applied on top of the base with the same generation.
+// Aircraft removed from memory aren't recorded in the delta, they are loaded from the base again
+// and expire the usual way.
+struct stateBlobInfo {
+    uint64_t generation; // of blob_xx.zstl, 0: unknown, the next write is a full one
+    uint64_t dirtySince; // aircraft with a->stateSeq >= dirtySince changed since the last write
+    int64_t baseBytes; // size of blob_xx.zstl
+    int64_t deltaBytes; // size of blob_xx.delta.zstl
+};
+
+static inline size_t memcpySize(void *dest, const void *src, size_t n) {
+    memcpy(dest, src, n);
+    return n;
+}
+static inline int roundUp8(int value) {
+    return ((value + 7) / 8) * 8;
+}
+
 #define WRECENT (1<<10)
 #define WMEM (1<<11)
 #define WPERM (1<<12)
+// with WRECENT: leave the per aircraft trace cache alone, for generating traces outside the trace writer
+#define WNOCACHE (1<<13)
 
 // this setting is no longer an interval how often this is written, rather the interval to check if
 // it should be written
@@ -40,16 +81,26 @@ struct tile {
 
 void checkNewDay(int64_t now);
 void checkNewDayAcas(int64_t now);
+// can unlock / lock misc mutex
+int historyPackCheckDay(int64_t now);
 int globe_index(double lat_in, double lon_in);
 int globe_index_index(int index);
 void init_globe_index();
 void cleanup_globe_index();
-void save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbuffer2, char *stateDir);
-void load_blob(int blobNumber, char *blob, threadpool_threadbuffers_t * buffer_group);
+// delta: only write changed aircraft if possible, see struct stateBlobInfo
+// returns 1 if the blob was written completely, 0 otherwise
+int save_blob(int blob, threadpool_buffer_t *pbuffer1, threadpool_buffer_t *pbuffer2, char *stateDir, int delta);
+struct stateChunkFile;
+// returns the generation of the blob, 0 if it has none
+// chunkFile: chunk file for the records with STATE_SAVE_MAGIC_LAZY, NULL: drop their trace chunks
+uint64_t load_blob(int blobNumber, char *blob, threadpool_threadbuffers_t * buffer_group, struct stateChunkFile *chunkFile);
 void writeRangeDirs();
 void writeInternalState();
 void readInternalState();
+// read trace chunks still in the state files into memory for a while, returns 1 if there was work
+int traceHydrateStep();
 void traceWrite(struct aircraft *a, threadpool_threadbuffers_t *buffer_group);
+struct char_buffer traceGenerateJson(struct aircraft *a, int type, threadpool_buffer_t *reassemble_buffer, threadpool_buffer_t *generate_buffer);
 void traceCleanup(struct aircraft *a);
 void traceCleanupNoUnlink(struct aircraft *a);
 int traceAdd(struct aircraft *a, struct modesMessage *mm, int64_t now, int stale);
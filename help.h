@@ -104,9 +104,11 @@ static struct argp_option optionsReadsb[] = {
     {"write-json", OptJsonDir, "<dir>", 0, "Periodically write json output to <dir>", 1},
     {"write-prom", OptPromFile, "<file>", 0, "Periodically write prometheus output to <file>", 1},
     {"write-globe-history", OptGlobeHistoryDir, "<dir>", 0, "Write traces to this directory, 1 gz compressed json per day and airframe", 1},
+    {"write-globe-history-packed", OptGlobeHistoryPacked, 0, 0, "Append the traces of a day to a single indexed traces.pack instead of 1 file per airframe (extract with history_extract)", 1},
     {"write-state", OptStateDir, "<dir>", 0, "Write state to disk to have traces after a restart", 1},
     {"write-state-every", OptStateInterval, "<seconds>", 0, "Continuously write state to disk every X seconds (default: 3600)", 1},
     {"write-state-only-on-exit", OptStateOnlyOnExit, 0, 0, "Don't continously update state.", 1},
+    {"zstd-dict", OptZstdDict, "<file>", 0, "Compress trace chunks and state with this zstd dictionary (create with zstd_dict_train), a copy is kept in the state directory", 1},
     {"heatmap-dir", OptHeatmapDir, "<dir>", 0, "Change the directory where heatmaps are saved (default is in globe history dir)", 1},
     {"heatmap", OptHeatmap, "<interval in seconds>", 0, "Make Heatmap, each aircraft at most every interval seconds (creates historydir/heatmap.bin and exit after that)", 1},
     {"dump-beast", OptDumpBeastDir, "<dir>,<interval>,<compressionLevel>", 0, "Dump compressed beast files to this directory, start a new file evey interval seconds", 1},
@@ -120,12 +122,13 @@ static struct argp_option optionsReadsb[] = {
     {"full-trace-dir", OptFullTraceDir, "<dir>", 0, "when using globe-index, write full traces to this directory instead of --write-json dir (typically /run/readsb), this can be used to reduce memory usage at the cost of roughly 100 IOPS for global traffic", 1},
     {"write-json-gzip", OptJsonGzip, 0, 0, "Write aircraft.json also as aircraft.json.gz", 1},
     {"write-json-binCraft-only", OptJsonOnlyBin, "<n>", 0, "Use only binary binCraft format for globe files (1), for aircraft.json as well (2)", 1},
+    {"write-json-sync", OptJsonWriteSync, 0, 0, "Write json / trace / history files from the thread generating them instead of handing them to the file writer thread", 1},
     {"write-binCraft-old", OptEnableBinGz, 0, 0, "write old gzipped binCraft files\n", 1},
     {"json-reliable", OptJsonReliable,"<n>", 0, "Minimum position reliability to put it into json (default: 1, globe options will default set this to 2, disable speed filter: -1, max: 4)", 1},
     {"json-separate-alt-ground", OptJsonSeparateGround, "<n>", 0, "setting 1: json output: alt_baro always a number. extra ground flag (true or false); setting 0 (default): alt_baro changes to the string ground when aircraft are on the ground", 1},
     {"position-persistence", OptPositionPersistence,"<n>", 0, "Position persistence against outliers (default: 4), incremented by json-reliable minus 1", 1},
     {"jaero-timeout", OptJaeroTimeout,"<n>", 0, "How long in minutes JAERO positions remain valid and on the map in tar1090 (default:33)", 1},
-    {"db-file", OptDbFile, "<file.csv.gz>", 0, "Default: \"none\" (as of writing a compatible file is available here: https://github.com/wiedehopf/tar1090-db/tree/csv)", 1},
+    {"db-file", OptDbFile, "<file.csv.gz>", 0, "Default: \"none\" (as of writing a compatible file is available here: https://github.com/wiedehopf/tar1090-db/tree/csv), binary database from db_convert also accepted", 1},
     {"db-file-lt", OptDbFileLongtype, 0, 0, "aircraft.json: add long type as field desc, add field ownOp for the owner, add field year", 1},
     {0,0,0,0, "Network options:", 2},
     {"net-connector", OptNetConnector, "<IP,PORT,PROTOCOL>", 0, "connect as TCP client to listen port / TCP server at IP and PORT, can be specified multiple times (e.g. 127.0.0.1,23004,beast_out) Protocols: beast_out, beast_in, raw_out, raw_in, sbs_in, sbs_in_jaero, sbs_out, sbs_out_jaero, vrs_out, json_out, gpsd_in, uat_in, uat_replay_out, planefinder_in, asterix_in, asterix_out (one failover ip/address,port can be specified: primary-address,primary-port,protocol,failover-address,failover-port) (any position in the comma separated list can also be either silent_fail or uuid=<uuid>)", 2},
@@ -162,8 +165,10 @@ static struct argp_option optionsReadsb[] = {
     {"net-sbs-reduce", OptNetSbsReduce, 0, 0, "Apply beast reduce logic and interval to SBS outputs", 2},
     {"net-receiver-id", OptNetReceiverId, 0, 0, "forward receiver ID", 2},
     {"net-ingest", OptNetIngest, 0, 0, "primary ingest node", 2},
+    {"net-overload-shed", OptNetOverloadShed, 0, 0, "When decoding falls behind, drop input from redundant feeders, then from Mode S only / low quality feeders", 2},
     {"net-garbage", OptGarbage, "<ports>", 0, "timeout receivers, output messages from timed out receivers as beast on <ports>", 2},
     {"decode-threads", OptDecodeThreads, "<n>", 0, "Number of decode threads, either 1 or 2 (default: 1). Only use 2 when you have beast traffic > 200 MBit/s, expect 1.4x speedup for 2x CPU", 2},
+    {"demod-threads", OptDemodThreads, "<n>", 0, "Number of threads demodulating consecutive SDR sample buffers in parallel (default: 1). Helps slow CPUs which drop samples", 2},
     {"uuid-file", OptUuidFile, "<path>", 0, "path to UUID file", 2},
     {"net-ro-size", OptNetRoSize, "<size>", 0, "TCP output flush size (maximum amount of internally buffered data before writing to network) (default: 1280)", 2},
     {"net-ro-interval", OptNetRoInterval, "<seconds>", 0, "TCP output flush interval in seconds (maximum delay between placing data in the output buffer and sending)(default: 0.05, valid values 0.0 - 1.0)", 2},
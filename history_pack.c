@@ -0,0 +1,397 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// history_pack.c: packed per day history archive
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+// the trace writer threads append to the pack of the day currently being written,
+// the file is kept open until the day changes or the pack is finalized
+static struct {
+    pthread_mutex_t mutex;
+    int fd;
+    int64_t size;
+    char path[PATH_MAX];
+    // finalized pack, late appends would be lost in the compaction
+    char sealed[PATH_MAX];
+} hp = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+// position of a record found while scanning the pack
+struct hpackScanEntry {
+    uint32_t addr;
+    uint32_t len;
+    uint64_t offset;
+};
+
+static int hpackScanCompare(const void *p1, const void *p2) {
+    const struct hpackScanEntry *e1 = p1;
+    const struct hpackScanEntry *e2 = p2;
+    if (e1->addr != e2->addr) {
+        return e1->addr < e2->addr ? -1 : 1;
+    }
+    // same hex: the record further back in the pack is newer
+    return (e1->offset > e2->offset) - (e1->offset < e2->offset);
+}
+
+// walk the record headers, returns the end of the last complete record
+// if entries is not NULL, *entries receives all records in file order
+static int64_t hpackScan(int fd, const char *path, struct hpackScanEntry **entries, int64_t *count) {
+    struct stat st;
+    if (fstat(fd, &st)) {
+        perror(path);
+        return -1;
+    }
+    int64_t alloc = 0;
+    int64_t n = 0;
+    int64_t pos = 0;
+    while (pos + (int64_t) sizeof(struct hpackRecord) <= st.st_size) {
+        struct hpackRecord rec;
+        if (pread(fd, &rec, sizeof(rec), pos) != sizeof(rec)) {
+            break;
+        }
+        int64_t dataStart = pos + sizeof(rec);
+        if (rec.magic != HPACK_RECORD_MAGIC || dataStart + rec.len > st.st_size) {
+            break;
+        }
+        if (entries) {
+            if (n == alloc) {
+                alloc = imax(1024, alloc * 2);
+                *entries = cmRealloc(*entries, alloc * sizeof(struct hpackScanEntry));
+            }
+            (*entries)[n].addr = rec.addr;
+            (*entries)[n].len = rec.len;
+            (*entries)[n].offset = dataStart;
+        }
+        n++;
+        pos = dataStart + rec.len;
+    }
+    if (count) {
+        *count = n;
+    }
+    if (pos != st.st_size) {
+        fprintf(stderr, "%s: ignoring %lld bytes of incomplete or corrupt data at the end\n",
+                path, (long long) (st.st_size - pos));
+    }
+    return pos;
+}
+
+static int hpackOpen(const char *path) {
+    if (hp.fd >= 0) {
+        close(hp.fd);
+        hp.fd = -1;
+        hp.path[0] = '\0';
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    // a crash can leave a partial record at the end, cut it off so the pack stays readable
+    int64_t end = hpackScan(fd, path, NULL, NULL);
+    if (end < 0 || ftruncate(fd, end)) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    hp.fd = fd;
+    hp.size = end;
+    snprintf(hp.path, PATH_MAX, "%s", path);
+    return 0;
+}
+
+static int pwriteAll(int fd, const void *buf, size_t len, int64_t offset) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t res = pwrite(fd, p, len, offset);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += res;
+        len -= res;
+        offset += res;
+    }
+    return 0;
+}
+
+int hpackAppend(const char *dayDir, uint32_t addr, const char *gz, uint32_t len) {
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s", dayDir, HPACK_FILE);
+
+    struct hpackRecord rec = {
+        .magic = HPACK_RECORD_MAGIC,
+        .addr = addr,
+        .len = len,
+        .written = mstime(),
+    };
+
+    int success = 0;
+    pthread_mutex_lock(&hp.mutex);
+
+    if (strcmp(path, hp.sealed) == 0) {
+        fprintf(stderr, "%s: pack already finalized, can't append %06x\n", path, addr);
+        goto out;
+    }
+    if (strcmp(path, hp.path) != 0 && hpackOpen(path)) {
+        goto out;
+    }
+
+    if (pwriteAll(hp.fd, &rec, sizeof(rec), hp.size) || (len && pwriteAll(hp.fd, gz, len, hp.size + sizeof(rec)))) {
+        perror(path);
+        // don't leave a partial record behind
+        if (ftruncate(hp.fd, hp.size)) {
+            perror(path);
+        }
+        goto out;
+    }
+    hp.size += sizeof(rec) + len;
+    success = 1;
+
+out:
+    pthread_mutex_unlock(&hp.mutex);
+    return success;
+}
+
+// index entries if the index is present and matches the pack, -1 otherwise
+static int64_t hpackLoadIndex(const char *dayDir, struct hpackIndexEntry **entries) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    snprintf(path, PATH_MAX, "%s/%s", dayDir, HPACK_FILE);
+    if (stat(path, &st)) {
+        return -1;
+    }
+
+    snprintf(path, PATH_MAX, "%s/%s", dayDir, HPACK_INDEX);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    int64_t count = -1;
+    struct hpackIndexHeader hdr;
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+            || hdr.magic != HPACK_INDEX_MAGIC || hdr.version != HPACK_INDEX_VERSION
+            || hdr.packSize != (uint64_t) st.st_size) {
+        goto out;
+    }
+    size_t bytes = hdr.count * sizeof(struct hpackIndexEntry);
+    *entries = cmalloc(imax(1, bytes));
+    if (pread(fd, *entries, bytes, sizeof(hdr)) != (ssize_t) bytes) {
+        fprintf(stderr, "%s: truncated index\n", path);
+        sfree(*entries);
+        goto out;
+    }
+    count = hdr.count;
+out:
+    close(fd);
+    return count;
+}
+
+int64_t hpackLoad(const char *dayDir, struct hpackIndexEntry **entries) {
+    *entries = NULL;
+
+    int64_t count = hpackLoadIndex(dayDir, entries);
+    if (count >= 0) {
+        return count;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s", dayDir, HPACK_FILE);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct hpackScanEntry *scan = NULL;
+    int64_t n = 0;
+    if (hpackScan(fd, path, &scan, &n) < 0) {
+        close(fd);
+        sfree(scan);
+        return -1;
+    }
+    close(fd);
+
+    qsort(scan, n, sizeof(struct hpackScanEntry), hpackScanCompare);
+
+    *entries = cmalloc(imax(1, n * sizeof(struct hpackIndexEntry)));
+    count = 0;
+    for (int64_t i = 0; i < n; i++) {
+        // keep only the newest record per hex, drop deleted traces
+        if (i + 1 < n && scan[i + 1].addr == scan[i].addr) {
+            continue;
+        }
+        if (scan[i].len == 0) {
+            continue;
+        }
+        struct hpackIndexEntry *e = &(*entries)[count++];
+        e->addr = scan[i].addr;
+        e->len = scan[i].len;
+        e->offset = scan[i].offset;
+    }
+    sfree(scan);
+    return count;
+}
+
+struct hpackIndexEntry *hpackFind(struct hpackIndexEntry *entries, int64_t count, uint32_t addr) {
+    int64_t lo = 0;
+    int64_t hi = count - 1;
+    while (lo <= hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].addr == addr) {
+            return &entries[mid];
+        }
+        if (entries[mid].addr < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+struct char_buffer hpackReadEntry(const char *dayDir, struct hpackIndexEntry *entry) {
+    struct char_buffer cb = { 0 };
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s", dayDir, HPACK_FILE);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return cb;
+    }
+    cb.buffer = cmalloc(entry->len);
+    if (pread(fd, cb.buffer, entry->len, entry->offset) != (ssize_t) entry->len) {
+        fprintf(stderr, "%s: short read for %06x\n", path, entry->addr);
+        sfree(cb.buffer);
+    } else {
+        cb.len = entry->len;
+        cb.alloc = entry->len;
+    }
+    close(fd);
+    return cb;
+}
+
+int hpackFinalize(const char *dayDir) {
+    char path[PATH_MAX];
+    char tmpPath[PATH_MAX];
+    char indexPath[PATH_MAX];
+    char indexTmp[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s", dayDir, HPACK_FILE);
+    snprintf(tmpPath, PATH_MAX, "%s.readsb_tmp", path);
+    snprintf(indexPath, PATH_MAX, "%s/%s", dayDir, HPACK_INDEX);
+    snprintf(indexTmp, PATH_MAX, "%s.readsb_tmp", indexPath);
+
+    pthread_mutex_lock(&hp.mutex);
+    if (strcmp(path, hp.path) == 0) {
+        close(hp.fd);
+        hp.fd = -1;
+        hp.path[0] = '\0';
+    }
+    snprintf(hp.sealed, PATH_MAX, "%s", path);
+    pthread_mutex_unlock(&hp.mutex);
+
+    struct hpackIndexEntry *entries = NULL;
+    if (hpackLoadIndex(dayDir, &entries) >= 0) {
+        // already done
+        sfree(entries);
+        return 0;
+    }
+
+    int64_t count = hpackLoad(dayDir, &entries);
+    if (count < 0) {
+        // no pack for this day
+        return 0;
+    }
+
+    int res = -1;
+    int in = open(path, O_RDONLY);
+    int out = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int indexFd = -1;
+    char *buf = NULL;
+    size_t bufSize = 0;
+    if (in < 0 || out < 0) {
+        perror(in < 0 ? path : tmpPath);
+        goto out;
+    }
+
+    // copy the newest record per hex in hex order, this also makes a scan of the pack come out sorted
+    int64_t pos = 0;
+    for (int64_t i = 0; i < count; i++) {
+        struct hpackIndexEntry *e = &entries[i];
+        size_t recLen = sizeof(struct hpackRecord) + e->len;
+        if (recLen > bufSize) {
+            bufSize = recLen * 2;
+            buf = cmRealloc(buf, bufSize);
+        }
+        if (pread(in, buf, recLen, e->offset - sizeof(struct hpackRecord)) != (ssize_t) recLen) {
+            fprintf(stderr, "%s: short read for %06x\n", path, e->addr);
+            goto out;
+        }
+        if (pwriteAll(out, buf, recLen, pos)) {
+            perror(tmpPath);
+            goto out;
+        }
+        e->offset = pos + sizeof(struct hpackRecord);
+        pos += recLen;
+    }
+    if (fsync(out)) {
+        perror(tmpPath);
+        goto out;
+    }
+
+    struct hpackIndexHeader hdr = {
+        .magic = HPACK_INDEX_MAGIC,
+        .version = HPACK_INDEX_VERSION,
+        .count = count,
+        .packSize = pos,
+    };
+    indexFd = open(indexTmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (indexFd < 0
+            || pwriteAll(indexFd, &hdr, sizeof(hdr), 0)
+            || pwriteAll(indexFd, entries, count * sizeof(struct hpackIndexEntry), sizeof(hdr))
+            || fsync(indexFd)) {
+        perror(indexTmp);
+        goto out;
+    }
+
+    // the index only matches the compacted pack, if we crash in between the next finalize redoes it
+    if (rename(tmpPath, path) || rename(indexTmp, indexPath)) {
+        perror(path);
+        goto out;
+    }
+    res = 0;
+
+out:
+    if (in >= 0) {
+        close(in);
+    }
+    if (out >= 0) {
+        close(out);
+    }
+    if (indexFd >= 0) {
+        close(indexFd);
+    }
+    if (res) {
+        unlink(tmpPath);
+        unlink(indexTmp);
+    }
+    sfree(buf);
+    sfree(entries);
+    return res;
+}
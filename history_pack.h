@@ -0,0 +1,62 @@
+#ifndef HISTORY_PACK_H
+#define HISTORY_PACK_H
+
+// Packed per day history archive (--write-globe-history-packed)
+//
+// Instead of one gzip file per aircraft and day (traces/xx/trace_full_<hex>.json) all permanent
+// traces of a day are appended to <day dir>/traces.pack.
+// Every record is an independently gzip compressed trace_full json, a newer record for the
+// same hex supersedes older ones, a record of length 0 marks a deleted trace.
+//
+// Once no more writes for a day can happen the pack is compacted to the newest record per hex
+// sorted by hex and the sorted hex -> offset index <day dir>/traces.idx is written.
+
+#define HPACK_FILE "traces.pack"
+#define HPACK_INDEX "traces.idx"
+
+#define HPACK_RECORD_MAGIC (0x4b435048) // "HPCK"
+#define HPACK_INDEX_MAGIC (0x58444948) // "HIDX"
+#define HPACK_INDEX_VERSION (1)
+
+// precedes every record in the pack file
+struct hpackRecord {
+    uint32_t magic;
+    uint32_t addr;
+    uint32_t len; // bytes of gzip data following the header, 0: trace deleted
+    uint32_t reserved;
+    int64_t written; // ms since epoch
+};
+
+struct hpackIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+    uint64_t packSize; // size of the pack this index was written for
+};
+
+// entries are sorted by addr
+struct hpackIndexEntry {
+    uint32_t addr;
+    uint32_t len;
+    uint64_t offset; // offset of the gzip data in the pack file
+};
+
+// append the gzip compressed trace of addr to the pack in dayDir, len 0 marks the trace deleted
+// returns 0 if the record couldn't be written
+int hpackAppend(const char *dayDir, uint32_t addr, const char *gz, uint32_t len);
+
+// compact the pack of a finished day and write its index, no-op if the index is current
+// returns -1 on error
+int hpackFinalize(const char *dayDir);
+
+// newest record per hex, sorted by addr, uses the index if it's current, otherwise scans the pack
+// returns the number of entries or -1 on error, *entries must be freed by the caller
+int64_t hpackLoad(const char *dayDir, struct hpackIndexEntry **entries);
+
+// binary search in entries returned by hpackLoad
+struct hpackIndexEntry *hpackFind(struct hpackIndexEntry *entries, int64_t count, uint32_t addr);
+
+// read the gzip data for an entry, the buffer must be freed by the caller
+struct char_buffer hpackReadEntry(const char *dayDir, struct hpackIndexEntry *entry);
+
+#endif
@@ -631,7 +631,7 @@ char *sprintAircraftObject(char *p, char *end, struct aircraft *a, int64_t now,
     }
     if (printMode != 1) {
 
-        if (Modes.db) {
+        if (Modes.dbBin) {
             if (a->registration[0])
                 p = safe_snprintf(p, end, ",\"r\":\"%.*s\"", (int) sizeof(a->registration), a->registration);
             if (a->typeCode[0])
@@ -1519,6 +1519,7 @@ static void checkTraceCache(struct aircraft *a, traceBuffer tb, int64_t now) {
         }
         if (cache->entries || cache->json || cache->json_max) {
             fprintf(stderr, "%06x wtf Eijo0eep\n", a->addr);
+            memAccountFree(MEM_TRACES, cache->entries);
             sfree(cache->entries);
             sfree(cache->json);
         }
@@ -1532,6 +1533,7 @@ static void checkTraceCache(struct aircraft *a, traceBuffer tb, int64_t now) {
         // allocate memory
         cache->totalAlloc = size_entries + cache->json_max;
         cache->entries = cmalloc(cache->totalAlloc);
+        memAccountAlloc(MEM_TRACES, cache->entries);
         cache->json = ((char *) cache->entries) + size_entries;
 
         if (!cache->entries || !cache->json) {
@@ -1739,9 +1741,9 @@ struct char_buffer generateTraceJson(struct aircraft *a, traceBuffer tb, int typ
     }
     int64_t now = mstime();
 
-    int recent = (type == WRECENT);
-    //int full = (type == WMEM);
-    int perm = (type == WPERM);
+    int recent = (type & WRECENT);
+    //int full = (type & WMEM);
+    int perm = (type & WPERM);
 
     if (last < 0) {
         last = tb.len - 1;
@@ -1763,7 +1765,7 @@ struct char_buffer generateTraceJson(struct aircraft *a, traceBuffer tb, int typ
 
     p = safe_snprintf(p, bufEnd, "{\"icao\":\"%s%06x\"", (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
 
-    if (Modes.db) {
+    if (Modes.dbBin) {
         char *regInfo = p;
         if (a->registration[0]) {
             p = safe_snprintf(p, bufEnd, ",\n\"r\":\"%.*s\"", (int) sizeof(a->registration), a->registration);
@@ -1801,7 +1803,7 @@ struct char_buffer generateTraceJson(struct aircraft *a, traceBuffer tb, int typ
     struct traceCache *tCache = NULL;
     struct traceCacheEntry *entries = NULL;
     // due to timestamping, only use trace cache for recent trace jsons
-    if (recent && firstStamp != 0) {
+    if (recent && firstStamp != 0 && !(type & WNOCACHE)) {
         checkTraceCache(a, tb, now);
         tCache = &a->traceCache;
         if (tCache->entries && tCache->entriesLen > 0) {
@@ -1927,7 +1929,7 @@ struct char_buffer generateReceiverJson() {
     p = safe_snprintf(p, end, ", \"readsb\": true"); // for tar1090 so it can tell it's not dump1090-fa
 
 
-    if (Modes.db || Modes.db2) {
+    if (Modes.dbBin) {
         p = safe_snprintf(p, end, ", \"dbServer\": true");
     }
 
@@ -2019,85 +2021,142 @@ struct char_buffer generateOutlineJson() {
     return cb;
 }
 
+// deflate streams are kept for reuse, deflateInit2 allocates a few hundred kB of state
+typedef struct gzipStream {
+    struct gzipStream *next;
+    z_stream strm;
+} gzipStream;
+
+static struct {
+    pthread_mutex_t mutex;
+    gzipStream *free;
+} gzipPool = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static gzipStream *gzipStreamGet(const char *file, int gzip_level, int strategy) {
+    pthread_mutex_lock(&gzipPool.mutex);
+    gzipStream *gs = gzipPool.free;
+    if (gs) {
+        gzipPool.free = gs->next;
+    }
+    pthread_mutex_unlock(&gzipPool.mutex);
+
+    if (gs) {
+        deflateReset(&gs->strm);
+        if (deflateParams(&gs->strm, gzip_level, strategy) == Z_OK) {
+            return gs;
+        }
+        deflateEnd(&gs->strm);
+        memset(&gs->strm, 0, sizeof(gs->strm));
+    } else {
+        gs = cmCalloc(sizeof(gzipStream));
+    }
+
+    // windowBits 15 + 16: write a gzip header and trailer
+    if (deflateInit2(&gs->strm, gzip_level, Z_DEFLATED, 15 + 16, 8, strategy) != Z_OK) {
+        fprintf(stderr, "%s: deflateInit2 failed\n", file);
+        sfree(gs);
+    }
+    return gs;
+}
+
+static void gzipStreamPut(gzipStream *gs) {
+    pthread_mutex_lock(&gzipPool.mutex);
+    gs->next = gzipPool.free;
+    gzipPool.free = gs;
+    pthread_mutex_unlock(&gzipPool.mutex);
+}
+
+void gzipPoolCleanup() {
+    pthread_mutex_lock(&gzipPool.mutex);
+    while (gzipPool.free) {
+        gzipStream *gs = gzipPool.free;
+        gzipPool.free = gs->next;
+        deflateEnd(&gs->strm);
+        sfree(gs);
+    }
+    pthread_mutex_unlock(&gzipPool.mutex);
+}
+
+// gzip compress into a buffer from fileWriterAlloc()
+static struct char_buffer gzipBuffer(const char *file, struct char_buffer src, int gzip_level) {
+    struct char_buffer out = { 0 };
+
+    int strategy = Z_DEFAULT_STRATEGY;
+    int name_len = strlen(file);
+    if (name_len > 8 && strcmp("binCraft", file + (name_len - 8)) == 0) {
+        strategy = Z_FILTERED;
+    }
+
+    gzipStream *gs = gzipStreamGet(file, gzip_level, strategy);
+    if (!gs) {
+        return out;
+    }
+    z_stream *strm = &gs->strm;
+
+    out.alloc = deflateBound(strm, src.len);
+    out.buffer = fileWriterAlloc(out.alloc);
+
+    strm->next_in = (Bytef *) src.buffer;
+    strm->avail_in = src.len;
+    strm->next_out = (Bytef *) out.buffer;
+    strm->avail_out = out.alloc;
+
+    int res = deflate(strm, Z_FINISH);
+    if (res != Z_STREAM_END) {
+        fprintf(stderr, "%s: deflate of length %ld failed: %d\n", file, (long) src.len, res);
+        fileWriterFree(out.buffer);
+        out.buffer = NULL;
+        out.alloc = 0;
+    } else {
+        out.len = strm->total_out;
+    }
+
+    gzipStreamPut(gs);
+    return out;
+}
+
+struct char_buffer gzipToBuffer(const char *file, struct char_buffer cb, int gzip_level) {
+    return gzipBuffer(file, cb, gzip_level);
+}
+
 // Write JSON to file
+// the content is copied (and compressed if requested) and handed to the file writer thread,
+// the returned cb is untouched and still owned by the caller
 static inline __attribute__((always_inline)) struct char_buffer writeJsonTo (const char* dir, const char *file, struct char_buffer cb, int gzip, int gzip_level) {
 
     char pathbuf[PATH_MAX];
-    char tmppath[PATH_MAX];
-    int fd;
-    int len = cb.len;
-    char *content = cb.buffer;
 
     if (dir) {
         snprintf(pathbuf, PATH_MAX, "%s/%s", dir, file);
     } else {
         snprintf(pathbuf, PATH_MAX, "%s", file);
     }
-    snprintf(tmppath, PATH_MAX, "%s.readsb_tmp", pathbuf);
 
-    int firstOpenFail = 1;
-open:
-    fd = open(tmppath, O_WRONLY | O_CREAT | O_EXCL, 0644);
-    if (fd < 0) {
-        if (firstOpenFail) {
-            unlink(tmppath);
-            firstOpenFail = 0;
-            goto open;
-        }
-        fprintf(stderr, "writeJsonTo open(): ");
-        perror(tmppath);
-        goto error_2;
+    if (!gzip && !fileWriterRunning()) {
+        writeFileAtomic(pathbuf, cb.buffer, cb.len);
+        return cb;
     }
 
-
+    struct char_buffer out;
     if (gzip) {
-        gzFile gzfp = gzdopen(fd, "wb");
-        if (!gzfp) {
-            goto error_1;
-        }
-
-        gzbuffer(gzfp, GZBUFFER_BIG);
-
-        int name_len = strlen(file);
-        if (name_len > 8 && strcmp("binCraft", file + (name_len - 8)) == 0) {
-            gzsetparams(gzfp, gzip_level, Z_FILTERED);
-        } else {
-            gzsetparams(gzfp, gzip_level, Z_DEFAULT_STRATEGY);
-        }
-
-        int res = gzwrite(gzfp, content, len);
-        if (res != len) {
-            int error;
-            fprintf(stderr, "%s: gzwrite of length %d failed: %s (res == %d)\n", pathbuf, len, gzerror(gzfp, &error), res);
+        out = gzipBuffer(file, cb, gzip_level);
+        if (!out.buffer) {
+            return cb;
         }
-
-        if (gzclose(gzfp) < 0)
-            goto error_2;
     } else {
-        if (write(fd, content, len) != len) {
-            fprintf(stderr, "writeJsonTo write(): ");
-            perror(tmppath);
-            goto error_1;
+        out.len = cb.len;
+        out.buffer = fileWriterAlloc(out.len);
+        if (cb.len) {
+            memcpy(out.buffer, cb.buffer, cb.len);
         }
-
-        if (close(fd) < 0)
-            goto error_2;
     }
 
-    if (rename(tmppath, pathbuf) == -1) {
-        fprintf(stderr, "writeJsonTo rename(): %s -> %s", tmppath, pathbuf);
-        perror("");
-        goto error_2;
+    if (!fileWriterSubmit(pathbuf, out.buffer, out.len)) {
+        // writer not running or backlogged
+        writeFileAtomic(pathbuf, out.buffer, out.len);
+        fileWriterFree(out.buffer);
     }
 
-    goto out;
-
-error_1:
-    close(fd);
-error_2:
-    unlink(tmppath);
-
-out:
     return cb;
 }
 
@@ -2307,7 +2366,8 @@ struct char_buffer generateClientsJson() {
     p = safe_snprintf(p, end, "{ \"now\" : %.3f,\n", now / 1000.0);
     p = safe_snprintf(p, end, "  \"format\" : "
             "[ \"receiverId\", \"host:port\", \"avg. kbit/s\", \"conn time(s)\","
-            " \"messages/s\", \"positions/s\", \"reduce_signal\", \"recent_rtt(ms)\", \"positions\" ],\n");
+            " \"messages/s\", \"positions/s\", \"reduce_signal\", \"recent_rtt(ms)\", \"positions\","
+            " \"decoded\", \"accepted\", \"duplicates\", \"decode cpu(ms)\", \"shed\", \"shed class\" ],\n");
 
     p = safe_snprintf(p, end, "  \"clients\" : [\n");
 
@@ -2335,7 +2395,7 @@ struct char_buffer generateClientsJson() {
             double elapsed = (now - c->connectedSince) / 1000.0;
             int reduceSignaled = c->service->writer == &Modes.beast_in
                 && c->pingReceived + 120 * SECONDS > now;
-            p = safe_snprintf(p, end, "[\"%s\",\"%49s\",%6.2f,%6.0f,%8.3f,%7.3f, %d,%5.0f, %10lld],\n",
+            p = safe_snprintf(p, end, "[\"%s\",\"%49s\",%6.2f,%6.0f,%8.3f,%7.3f, %d,%5.0f, %10lld, %10llu, %10llu, %10llu, %8llu, %10llu, %d],\n",
                     uuid,
                     c->proxy_string,
                     c->bytesReceived / 128.0 / elapsed,
@@ -2344,7 +2404,13 @@ struct char_buffer generateClientsJson() {
                     (double) c->positionCounter / elapsed,
                     reduceSignaled,
                     c->recent_rtt,
-                    (long long) c->positionCounter);
+                    (long long) c->positionCounter,
+                    (unsigned long long) c->messagesDecoded,
+                    (unsigned long long) c->messagesAccepted,
+                    (unsigned long long) c->duplicates,
+                    (unsigned long long) (c->decodeNs / (1000 * 1000)),
+                    (unsigned long long) c->messagesShed,
+                    c->shedClass);
 
 
 
@@ -2356,7 +2422,81 @@ struct char_buffer generateClientsJson() {
     if (*(p-2) == ',')
         *(p-2) = ' ';
 
-    p = safe_snprintf(p, end, "\n  ]\n}\n");
+    p = safe_snprintf(p, end, "\n  ],\n");
+
+    p = safe_snprintf(p, end, "  \"outputs_format\" : "
+            "[ \"service\", \"host:port\", \"avg. kbit/s\", \"conn time(s)\", \"bytes sent\", \"bytes dropped\" ],\n");
+    p = safe_snprintf(p, end, "  \"outputs\" : [\n");
+
+    for (struct net_service *service = Modes.services_out.services; service && service->descr; service++) {
+        for (struct client *c = service->clients; c; c = c->next) {
+            if (!c->service)
+                continue;
+
+            // host can be up to NI_MAXHOST
+            if ((p + 3000) >= end) {
+                int used = p - buf;
+                buflen *= 2;
+                buf = (char *) realloc(buf, buflen);
+                p = buf + used;
+                end = buf + buflen;
+            }
+
+            double elapsed = (now - c->connectedSince) / 1000.0;
+            p = safe_snprintf(p, end, "[\"%s\",\"%s:%s\",%8.2f,%6.0f, %12llu, %12llu],\n",
+                    service->descr,
+                    c->host, c->port,
+                    c->bytesSent / 128.0 / elapsed,
+                    elapsed,
+                    (unsigned long long) c->bytesSent,
+                    (unsigned long long) c->bytesDropped);
+        }
+    }
+
+    if (*(p-2) == ',')
+        *(p-2) = ' ';
+
+    p = safe_snprintf(p, end, "\n  ],\n");
+
+    // totals per service including clients no longer connected, updated every 10 seconds
+    p = safe_snprintf(p, end, "  \"services\" : [\n");
+
+    struct net_service_group *groups[2] = { &Modes.services_in, &Modes.services_out };
+    for (int g = 0; g < 2; g++) {
+        for (struct net_service *service = groups[g]->services; service && service->descr; service++) {
+            struct net_service_counters sum = service->totals;
+            if (!service->connections && !sum.bytesReceived && !sum.bytesSent) {
+                continue;
+            }
+
+            if ((p + 1000) >= end) {
+                int used = p - buf;
+                buflen *= 2;
+                buf = (char *) realloc(buf, buflen);
+                p = buf + used;
+                end = buf + buflen;
+            }
+
+            p = safe_snprintf(p, end, "    { \"service\": \"%s\", \"connections\": %d,"
+                    " \"bytes_in\": %llu, \"bytes_out\": %llu, \"bytes_dropped\": %llu,"
+                    " \"decoded\": %llu, \"accepted\": %llu, \"duplicates\": %llu, \"decode_cpu_ms\": %llu,"
+                    " \"shed\": %llu },\n",
+                    service->descr, service->connections,
+                    (unsigned long long) sum.bytesReceived,
+                    (unsigned long long) sum.bytesSent,
+                    (unsigned long long) sum.bytesDropped,
+                    (unsigned long long) sum.messagesDecoded,
+                    (unsigned long long) sum.messagesAccepted,
+                    (unsigned long long) sum.duplicates,
+                    (unsigned long long) (sum.decodeNs / (1000 * 1000)),
+                    (unsigned long long) sum.messagesShed);
+        }
+    }
+
+    if (*(p-2) == ',')
+        *(p-2) = ' ';
+
+    p = safe_snprintf(p, end, "  ]\n}\n");
 
     cb.len = p - buf;
     cb.buffer = buf;
@@ -48,6 +48,10 @@ struct char_buffer generateVRS(int part, int n_parts, int reduced_data);
 
 struct char_buffer writeJsonToFile (const char* dir, const char *file, struct char_buffer cb);
 struct char_buffer writeJsonToGzip (const char* dir, const char *file, struct char_buffer cb, int gzip);
+// gzip compress cb into a buffer from fileWriterAlloc(), file is only used for messages / choosing the strategy
+struct char_buffer gzipToBuffer(const char *file, struct char_buffer cb, int gzip_level);
+// free the deflate streams kept by writeJsonToGzip, no writers may be running anymore
+void gzipPoolCleanup();
 
 __attribute__ ((format(printf, 3, 4))) static inline char *safe_snprintf(char *p, char *end, const char *format, ...) {
     va_list ap;
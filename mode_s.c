@@ -436,11 +436,14 @@ static void decodeExtendedSquitter(struct modesMessage *mm);
     do {                                                \
         mm->decodeResult = X;                           \
         if (!Modes.decode_all) {                        \
+            PROBE4(decode_done, mm->msgtype, mm->addr,  \
+                    mm->decodeResult, mm->receiverId);  \
             return mm->decodeResult;                    \
         }                                               \
     } while(0)
 
 int decodeModesMessage(struct modesMessage *mm) {
+    PROBE0(decode_start);
     if (Modes.net_verbatim) {
         // Preserve the original uncorrected copy for later forwarding
         memcpy(mm->verbatim, mm->msg, MODES_LONG_MSG_BYTES);
@@ -799,6 +802,7 @@ int decodeModesMessage(struct modesMessage *mm) {
     }
 
     // all done
+    PROBE4(decode_done, mm->msgtype, mm->addr, mm->decodeResult, mm->receiverId);
     return mm->decodeResult;
 }
 #undef decode_return
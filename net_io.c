@@ -105,6 +105,12 @@ static char *read_uuid(struct client *c, char *p, char *eod);
 static void modesReadFromClient(struct client *c, struct messageBuffer *mb);
 
 static void drainMessageBuffer(struct messageBuffer *buf);
+// thread CPU time spent in drainMessageBuffer, excluded from the decode time of the clients
+static _Thread_local int64_t drainCpuNs;
+
+static int netShedMessage(struct client *c, struct modesMessage *mm, int result, int64_t now);
+// microseconds modesNetPeriodicWork spent waiting in epoll_wait, used by netOverloadCheck()
+static int64_t netWaitMicros;
 
 // ModeAC all zero messag
 static const char beast_heartbeat_msg[] = {0x1a, '1', 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -318,6 +324,7 @@ static struct client *createSocketClient(struct net_service *service, int fd, ch
         exit(1);
     }
     memset(c, 0, sizeof (struct client));
+    memAccountAlloc(MEM_CLIENTS, c);
 
     c->service = service;
     c->fd = fd;
@@ -365,6 +372,7 @@ static struct client *createSocketClient(struct net_service *service, int fd, ch
     }
 
     c->buf = cmalloc(c->bufmax);
+    memAccountAlloc(MEM_CLIENTS, c->buf);
 
     if (service->writer) {
         c->sendq_max = Modes.netBufSize;
@@ -375,6 +383,7 @@ static struct client *createSocketClient(struct net_service *service, int fd, ch
             fprintf(stderr, "Out of memory allocating client SendQ\n");
             exit(1);
         }
+        memAccountAlloc(MEM_CLIENTS, c->sendq);
 
         service->writer->connections++;
     }
@@ -1602,6 +1611,7 @@ static void flushWrites(struct net_writer *writer) {
         fprintTimePrecise(stderr, now);
         fprintf(stderr, " %s: flushWrites %5d bytes\n", writer->service->descr, writer->dataUsed);
     }
+    PROBE2(flush_start, writer->service->descr, writer->dataUsed);
     for (struct client *c = writer->service->clients; c; c = c->next) {
         if (!c->service)
             continue;
@@ -1623,8 +1633,12 @@ static void flushWrites(struct net_writer *writer) {
                 dropHalfUntil(now, c, now + 2 * SECONDS);
             }
 
-            if ((c->dropHalfUntil > now && c->dropHalfDrop) || bufferInsufficient) {
+            int drop = (c->dropHalfUntil > now && c->dropHalfDrop) || bufferInsufficient;
+            PROBE5(flush_client, c->service->descr, c->host, c->port, writer->dataUsed, drop);
+
+            if (drop) {
                 // drop this chunk of data
+                c->bytesDropped += writer->dataUsed;
             } else {
                 // Append the data to the end of the queue, increment len
                 memcpy(c->sendq + c->sendq_len, writer->data, writer->dataUsed);
@@ -1650,6 +1664,7 @@ static void flushWrites(struct net_writer *writer) {
             }
         }
     }
+    PROBE2(flush_done, writer->service->descr, writer->dataUsed);
     writer->lastReceiverId = 0; // unconditionally emit receiver id on start of new "packet"
     writer->dataUsed = 0;
     writer->lastWrite = now;
@@ -4116,6 +4131,9 @@ static int decodeBinMessage(struct client *c, char *p, int remote, int64_t now,
     if ((Modes.garbage_ports || Modes.netReceiverId) && receiverCheckBad(mm->receiverId, now)) {
         mm->garbage = 1;
     }
+    if (Modes.netOverloadShed && netShedMessage(c, mm, result, now)) {
+        return 0;
+    }
 
     netUseMessage(mm);
     return 0;
@@ -4819,7 +4837,9 @@ static int readClient(struct client *c, int64_t now) {
         }
     }
 
-    if (!Modes.debug_no_discard && !c->discard && now - c->last_read < 800 && now - c->last_read_flush > 2400 && !Modes.synthetic_now) {
+    // while the overload shedding can still escalate, give it the chance to before discarding
+    int64_t discardLag = (Modes.netOverloadShed && Modes.netShedLevel < 2) ? 5 * SECONDS : 2400;
+    if (!Modes.debug_no_discard && !c->discard && now - c->last_read < 800 && now - c->last_read_flush > discardLag && !Modes.synthetic_now) {
         c->discard = 1;
         if (Modes.netIngest && c->proxy_string[0] != '\0') {
             fprintf(stderr, "<3>ERROR, not enough CPU: Discarding data from: %s\n", c->proxy_string);
@@ -5597,7 +5617,11 @@ static void modesReadFromClient(struct client *c, struct messageBuffer *mb) {
 
         c->processing++;
         //fprintf(stderr, "%d", c->processing);
+        int64_t cpuBefore = nsThreadTime();
+        int64_t drainBefore = drainCpuNs;
         int res = processClient(c, now, mb);
+        // tracking and output of the buffered messages is not part of decoding this client
+        c->decodeNs += imax(0, (nsThreadTime() - cpuBefore) - (drainCpuNs - drainBefore));
         c->processing--;
         c->bufferToProcess = 0;
 
@@ -5668,15 +5692,197 @@ const char *airground_enum_string(airground_t ag) {
     }
 }
 
+static void clientFreeBuffers(struct client *c) {
+    memAccountFree(MEM_CLIENTS, c->sendq);
+    memAccountFree(MEM_CLIENTS, c->buf);
+    memAccountFree(MEM_CLIENTS, c);
+    sfree(c->sendq);
+    sfree(c->buf);
+    sfree(c);
+}
+
+static void addClientCounters(struct net_service_counters *sum, struct client *c) {
+    sum->bytesReceived += c->bytesReceived;
+    sum->bytesSent += c->bytesSent;
+    sum->bytesDropped += c->bytesDropped;
+    sum->messagesDecoded += c->messagesDecoded;
+    sum->messagesAccepted += c->messagesAccepted;
+    sum->duplicates += c->duplicates;
+    sum->decodeNs += c->decodeNs;
+    sum->messagesShed += c->messagesShed;
+}
+
+void netUpdateServiceTotals() {
+    struct net_service_group *groups[2] = { &Modes.services_in, &Modes.services_out };
+    for (int g = 0; g < 2; g++) {
+        for (struct net_service *service = groups[g]->services; service && service->descr; service++) {
+            struct net_service_counters sum = service->closedClients;
+            for (struct client *c = service->clients; c; c = c->next) {
+                addClientCounters(&sum, c);
+            }
+            service->totals = sum;
+        }
+    }
+}
+
+//
+//=========================================================================
+//
+// Overload shedding (--net-overload-shed)
+//
+// Without it, an overloaded network thread falls behind reading its input until the kernel
+// socket buffers fill up and the clients are discarded wholesale (not enough CPU).
+// netOverloadCheck() instead watches the input backlog and the time the thread isn't waiting
+// for data and raises Modes.netShedLevel before that happens, netShedMessage() applies it:
+//
+// level 1: drop messages for aircraft other receivers currently deliver positions for
+//          (trackCoveredByOthers), unless this receiver is one of them
+// level 2: also drop the rest of the non ADS-B messages from Mode S only / low quality feeders
+//
+// ADS-B from a feeder that is the only one covering an aircraft is never dropped.
+// Only beast input is shed, other formats don't carry a per feeder receiverId.
+//
+static int netShedMessage(struct client *c, struct modesMessage *mm, int result, int64_t now) {
+    c->shedWindowMessages++;
+    if (result < 0) {
+        c->shedWindowBad++;
+        return 0;
+    }
+    int adsb = (mm->msgtype == 17 || mm->msgtype == 18);
+    c->shedWindowAdsb += adsb;
+
+    if (!Modes.netShedLevel || !mm->remote || c->serial
+            || mm->source == SOURCE_MLAT || mm->source == SOURCE_PRIO) {
+        return 0;
+    }
+
+    if (mm->msgtype != DFTYPE_MODEAC) {
+        struct aircraft *a = aircraftGet(mm->addr);
+        if (a && trackCoveredByOthers(a, mm->receiverId, now)) {
+            c->messagesShed++;
+            Modes.stats_current.remote_shed_redundant++;
+            return 1;
+        }
+    }
+
+    if (Modes.netShedLevel < 2 || adsb) {
+        return 0;
+    }
+    if ((c->shedClass & SHED_CLASS_LOW_QUALITY) || mm->garbage) {
+        c->messagesShed++;
+        Modes.stats_current.remote_shed_low_quality++;
+        return 1;
+    }
+    if (c->shedClass & SHED_CLASS_MODES_ONLY) {
+        c->messagesShed++;
+        Modes.stats_current.remote_shed_modes_only++;
+        return 1;
+    }
+    return 0;
+}
+
+// called once a second from modesNetPeriodicWork
+static void netOverloadCheck(int64_t now) {
+    static int64_t lastCheck;
+    static int64_t lastWait;
+    static int64_t nextClassify;
+    static int64_t lastChange;
+    static int hot;
+    static int cool;
+
+    int64_t elapsed = now - lastCheck;
+    int64_t waited = netWaitMicros - lastWait;
+    lastCheck = now;
+    lastWait = netWaitMicros;
+    if (elapsed <= 0 || elapsed > 10 * SECONDS) {
+        // first call or the thread was stopped for a long time, no useful measurement
+        return;
+    }
+
+    int classify = (now > nextClassify);
+    if (classify) {
+        nextClassify = now + 10 * SECONDS;
+    }
+
+    int64_t lag = 0;
+    for (struct net_service *service = Modes.services_in.services; service->descr; service++) {
+        for (struct client *c = service->clients; c; c = c->next) {
+            if (!c->service) {
+                continue;
+            }
+            // last_read_flush: last time the socket was read empty, only clients still sending data
+            if (now - c->last_read < 1 * SECONDS) {
+                lag = imax(lag, now - c->last_read_flush);
+            }
+            if (!classify) {
+                continue;
+            }
+            if (c->shedWindowMessages >= 100) {
+                c->shedClass = 0;
+                if (c->shedWindowAdsb * 10 < c->shedWindowMessages) {
+                    c->shedClass |= SHED_CLASS_MODES_ONLY;
+                }
+                if (c->shedWindowBad * 4 > c->shedWindowMessages) {
+                    c->shedClass |= SHED_CLASS_LOW_QUALITY;
+                }
+            }
+            if (c->unreasonable_messagerate || c->recent_rtt > Modes.ping_reduce) {
+                c->shedClass |= SHED_CLASS_LOW_QUALITY;
+            }
+            c->shedWindowMessages = 0;
+            c->shedWindowAdsb = 0;
+            c->shedWindowBad = 0;
+        }
+    }
+
+    // without waiting when reading from an SDR, only the input backlog is meaningful
+    int waits = !(Modes.sdr_type != SDR_NONE && Modes.sdr_type != SDR_MODESBEAST && Modes.sdr_type != SDR_GNS);
+    float busy = waits ? 1.0f - (float) waited / (elapsed * 1000) : 0;
+    busy = fmaxf(0, fminf(1, busy));
+
+    Modes.netShedLag = lag;
+    Modes.netShedBusy = busy;
+
+    // a growing input backlog leads to discarding whole clients (see readClient), react to it on
+    // the first check, the busy fraction alone needs a few
+    if (lag > 500) {
+        hot = 3;
+        cool = 0;
+    } else if (busy > 0.95f) {
+        hot++;
+        cool = 0;
+    } else if (lag < 250 && busy < 0.8f) {
+        cool++;
+        hot = 0;
+    } else {
+        hot = 0;
+        cool = 0;
+    }
+
+    int level = Modes.netShedLevel;
+    if (hot >= 3 && level < 2 && now > lastChange + 1500) {
+        level++;
+    } else if (cool >= 10 && level > 0) {
+        level--;
+        cool = 0;
+    }
+    if (level != Modes.netShedLevel) {
+        fprintf(stderr, "<3>Overload shedding level %d -> %d (input backlog %d ms, busy %.0f%%)\n",
+                Modes.netShedLevel, level, (int) lag, busy * 100);
+        Modes.netShedLevel = level;
+        lastChange = now;
+        hot = 0;
+    }
+}
+
 static void serviceFreeClients(struct net_service *s) {
     struct client *c, **prev;
     for (prev = &s->clients, c = *prev; c; c = *prev) {
         if (c->fd == -1) {
             // Recently closed, prune from list
             *prev = c->next;
-            sfree(c->sendq);
-            sfree(c->buf);
-            sfree(c);
+            addClientCounters(&s->closedClients, c);
+            clientFreeBuffers(c);
         } else {
             prev = &c->next;
         }
@@ -5833,7 +6039,9 @@ void modesNetPeriodicWork(void) {
     if (priorityTasksPending()) {
         sched_yield();
     }
+    int64_t waitStart = mono_micro_seconds();
     Modes.net_event_count = epoll_wait(Modes.net_epfd, Modes.net_events, Modes.net_maxEvents, (int) wait_ms);
+    netWaitMicros += mono_micro_seconds() - waitStart;
     Modes.services_in.event_progress = 0;
     Modes.services_out.event_progress = 0;
 
@@ -5951,20 +6159,15 @@ void modesNetPeriodicWork(void) {
 
         netFreeClients();
 
+        if (Modes.netOverloadShed) {
+            netOverloadCheck(now);
+        }
+
         if (Modes.receiverTable) {
             static uint32_t upcount;
             int nParts = RECEIVER_MAINTENANCE_INTERVAL / free_client_interval;
             receiverTimeout((upcount % nParts), nParts, now);
             upcount++;
-
-            if (Modes.receiverCount > Modes.receiver_table_size * 3 / 4 && Modes.receiver_table_hash_bits < 16) {
-                // we clear the table, rehashing would be nicer but more complex
-                // this should be fine
-                receiverCleanup();
-                Modes.receiver_table_hash_bits = 16;
-                receiverInit();
-                fprintf(stderr, "receiverTable table size increased to: %d\n", Modes.receiver_table_size);
-            }
         }
     }
 
@@ -6080,9 +6283,7 @@ static void cleanupService(struct net_service *s) {
 
         anetCloseSocket(c->fd);
         c->sendq_len = 0;
-        sfree(c->sendq);
-        sfree(c->buf);
-        sfree(c);
+        clientFreeBuffers(c);
 
         c = nc;
     }
@@ -6260,6 +6461,8 @@ static void outputMessage(struct modesMessage *mm) {
         return;
     }
 
+    PROBE2(output_start, mm->msgtype, mm->addr);
+
     int noforward = (mm->timestamp == MAGIC_NOFORWARD_TIMESTAMP) && !Modes.beast_forward_noforward;
     int64_t orig_ts = mm->timestamp;
     if (Modes.beast_set_noforward_timestamp) {
@@ -6345,6 +6548,7 @@ static void outputMessage(struct modesMessage *mm) {
 
     mm->timestamp = orig_ts;
 
+    PROBE2(output_done, mm->msgtype, mm->addr);
 }
 
 static inline int skipMessage(struct modesMessage *mm) {
@@ -6362,6 +6566,7 @@ static inline int skipMessage(struct modesMessage *mm) {
 
 static void drainMessageBuffer(struct messageBuffer *buf) {
     //fprintf(stderr, "drainMessageBuffer: %d\n", buf->len);
+    int64_t cpuBefore = buf->len ? nsThreadTime() : 0;
     if (Modes.decodeThreads < 2) {
         for (int k = 0; k < buf->len; k++) {
             struct modesMessage *mm = &buf->msg[k];
@@ -6411,6 +6616,9 @@ static void drainMessageBuffer(struct messageBuffer *buf) {
         pthread_mutex_lock(&Modes.decodeLock);
         //fprintf(stderr, "thread %d drain done, back to decoding\n", buf->id);
     }
+    if (cpuBefore) {
+        drainCpuNs += nsThreadTime() - cpuBefore;
+    }
 }
 
 // get a zeroed spot in in the message buffer, only messages from this buffer may be passed to netUseMessage
@@ -52,6 +52,19 @@ typedef struct {
     int32_t len;
 } heartbeat_t;
 
+// client counters summed up per service
+struct net_service_counters
+{
+    uint64_t bytesReceived;
+    uint64_t bytesSent;
+    uint64_t bytesDropped;
+    uint64_t messagesDecoded;
+    uint64_t messagesAccepted;
+    uint64_t duplicates;
+    uint64_t decodeNs;
+    uint64_t messagesShed;
+};
+
 // Describes one network service (a group of clients with common behaviour)
 
 struct net_service
@@ -75,10 +88,16 @@ struct net_service
     int recvqOverrideSize;
     heartbeat_t heartbeat_in;
     heartbeat_t heartbeat_out;
+    struct net_service_counters closedClients; // counters of clients already freed
+    struct net_service_counters totals; // all clients including closedClients, see netUpdateServiceTotals
 };
 
 #define NET_SERVICE_GROUP_MAX 16
 
+// client classes for overload shedding (--net-overload-shed), see netOverloadCheck()
+#define SHED_CLASS_MODES_ONLY (1 << 0) // feeder sends (almost) no ADS-B
+#define SHED_CLASS_LOW_QUALITY (1 << 1) // many bad messages, high latency or excessive message rate
+
 struct net_service_group {
     struct net_service *services;
     int len;
@@ -111,6 +130,7 @@ struct client
     int8_t receiverIdLocked; // receiverId has been transmitted by other side.
     int8_t unreasonable_messagerate;
     int8_t dropHalfDrop;
+    int8_t shedClass; // SHED_CLASS_* bits, set by netOverloadCheck() when --net-overload-shed is enabled
     int64_t dropHalfUntil;
     char *sendq;  // Write buffer - allocated later
     int sendq_len; // Amount of data in SendQ
@@ -137,6 +157,15 @@ struct client
     uint64_t messageCounter; // counter for incoming data
     uint64_t positionCounter; // counter for incoming data
     uint64_t garbage; // amount of garbage we have received from this client
+    uint64_t messagesDecoded; // messages decoded without error
+    uint64_t messagesAccepted; // messages applied to an aircraft by trackUpdateFromMessage
+    uint64_t duplicates; // duplicate positions, another receiver delivered the position first
+    uint64_t decodeNs; // thread CPU time reading and decoding data from this client
+    uint64_t bytesDropped; // output not queued because the client is too slow (dropHalfUntil)
+    uint64_t messagesShed; // input messages dropped by the overload controller
+    uint32_t shedWindowMessages; // classification window of netOverloadCheck()
+    uint32_t shedWindowAdsb;
+    uint32_t shedWindowBad;
     int64_t rtt; // last reported rtt in milliseconds
     double latest_rtt; // in milliseconds, pseudo average with factor 0.9
     // crude IIR pseudo rolling average, old value factor 0.995
@@ -219,6 +248,9 @@ void cleanupNetwork(void);
 
 void writeJsonToNet(struct net_writer *writer, struct char_buffer cb);
 
+// update net_service.totals, only call while the network threads are stopped (lockThreads)
+void netUpdateServiceTotals();
+
 // GNS HULC status message
 
 typedef union __packed {
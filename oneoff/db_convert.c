@@ -0,0 +1,84 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// db_convert.c: convert the csv aircraft database to the binary format
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "../readsb.h"
+
+// build: make db_convert
+//
+// db_convert <aircraft.csv.gz> <aircraft.bin>
+//   write the binary database, the target is replaced atomically so a running readsb
+//   using it with --db-file picks up the new version within 30 seconds
+// db_convert --check <aircraft.bin>
+//   validate a binary database and print the number of aircraft
+//
+// example:
+//   ./db_convert /usr/local/share/tar1090/git-db/aircraft.csv.gz /var/lib/readsb/aircraft.bin
+
+struct _Modes Modes;
+
+// this is called by cmalloc and friends on allocation failure
+void setExit(int arg) {
+    exit(arg);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s <aircraft.csv.gz> <aircraft.bin>\n"
+            "       %s --check <aircraft.bin>\n",
+            name, name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "--check") == 0) {
+        struct dbBin *db = dbBinOpen(argv[2]);
+        if (!db) {
+            return 1;
+        }
+        printf("%s: %u aircraft, %llu bytes of strings\n", argv[2], db->count,
+                (unsigned long long) (db->size - sizeof(struct dbBinHeader) - db->count * sizeof(struct dbBinRecord)));
+        dbBinFree(db);
+        return 0;
+    }
+    if (argc != 3 || argv[1][0] == '-') {
+        usage(argv[0]);
+    }
+
+    gzFile gzfp = gzopen(argv[1], "r");
+    if (!gzfp) {
+        perror(argv[1]);
+        return 1;
+    }
+    struct char_buffer cb = readWholeGz(gzfp, argv[1]);
+    gzclose(gzfp);
+    if (!cb.buffer) {
+        return 1;
+    }
+
+    struct dbBin *db = dbBinFromCsv(cb);
+    if (db->count < 1) {
+        fprintf(stderr, "%s: no aircraft found, maybe old / incorrect format?!\n", argv[1]);
+        dbBinFree(db);
+        return 1;
+    }
+    int res = dbBinWrite(db, argv[2]);
+    if (res == 0) {
+        fprintf(stderr, "wrote %u aircraft to %s (%llu bytes)\n", db->count, argv[2], (unsigned long long) db->size);
+    }
+    dbBinFree(db);
+    return res ? 1 : 0;
+}
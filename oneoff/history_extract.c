@@ -0,0 +1,226 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// history_extract.c: read traces from a packed history day (--write-globe-history-packed)
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "../readsb.h"
+#include <getopt.h>
+
+// build: make history_extract
+//
+// history_extract <day dir> <hex> [<hex> ...]
+//   print the trace_full json of the given aircraft (non-ICAO addresses prefixed with ~)
+// history_extract --list <day dir>
+//   list the aircraft in the pack with their compressed size
+// history_extract --unpack <out dir> <day dir>
+//   write <out dir>/traces/xx/trace_full_<hex>.json for every aircraft, gzip compressed
+//   like the files written without --write-globe-history-packed
+// history_extract --finalize <day dir>
+//   compact the pack and write the index, readsb does this itself for finished days
+//
+// example:
+//   ./history_extract /var/globe_history/2024/05/17 3c6444 | jq .
+
+struct _Modes Modes;
+
+// this is called by cmalloc and friends on allocation failure
+void setExit(int arg) {
+    exit(arg);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s <day dir> <hex> [<hex> ...]\n"
+            "       %s --list <day dir>\n"
+            "       %s --unpack <out dir> <day dir>\n"
+            "       %s --finalize <day dir>\n",
+            name, name, name, name);
+    exit(1);
+}
+
+static int parseAddr(const char *arg, uint32_t *addr) {
+    uint32_t flag = 0;
+    if (arg[0] == '~') {
+        flag = MODES_NON_ICAO_ADDRESS;
+        arg++;
+    }
+    char *end;
+    unsigned long val = strtoul(arg, &end, 16);
+    if (*arg == '\0' || *end != '\0' || val > 0xFFFFFF) {
+        return 0;
+    }
+    *addr = val | flag;
+    return 1;
+}
+
+static void sprintAddr(char *buf, size_t len, uint32_t addr) {
+    snprintf(buf, len, "%s%06x", (addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", addr & 0xFFFFFF);
+}
+
+static int printJson(struct char_buffer gz) {
+    z_stream strm = { 0 };
+    // windowBits 15 + 16: expect a gzip header
+    if (inflateInit2(&strm, 15 + 16) != Z_OK) {
+        return -1;
+    }
+    char out[64 * 1024];
+    strm.next_in = (Bytef *) gz.buffer;
+    strm.avail_in = gz.len;
+    int res;
+    do {
+        strm.next_out = (Bytef *) out;
+        strm.avail_out = sizeof(out);
+        res = inflate(&strm, Z_NO_FLUSH);
+        if (res != Z_OK && res != Z_STREAM_END) {
+            fprintf(stderr, "inflate failed: %d\n", res);
+            inflateEnd(&strm);
+            return -1;
+        }
+        fwrite(out, 1, sizeof(out) - strm.avail_out, stdout);
+    } while (res != Z_STREAM_END);
+    inflateEnd(&strm);
+    fputc('\n', stdout);
+    return 0;
+}
+
+static int writeFile(const char *path, const char *content, size_t len) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    int res = 0;
+    if (fwrite(content, 1, len, f) != len) {
+        perror(path);
+        res = -1;
+    }
+    if (fclose(f)) {
+        perror(path);
+        res = -1;
+    }
+    return res;
+}
+
+static int unpack(const char *outDir, const char *dayDir, struct hpackIndexEntry *entries, int64_t count) {
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/traces", outDir);
+    if (mkdir(outDir, 0755) && errno != EEXIST) {
+        perror(outDir);
+        return -1;
+    }
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+    for (int i = 0; i < 256; i++) {
+        snprintf(path, PATH_MAX, "%s/traces/%02x", outDir, i);
+        if (mkdir(path, 0755) && errno != EEXIST) {
+            perror(path);
+            return -1;
+        }
+    }
+    for (int64_t i = 0; i < count; i++) {
+        struct hpackIndexEntry *e = &entries[i];
+        struct char_buffer gz = hpackReadEntry(dayDir, e);
+        if (!gz.buffer) {
+            return -1;
+        }
+        char hex[16];
+        sprintAddr(hex, sizeof(hex), e->addr);
+        snprintf(path, PATH_MAX, "%s/traces/%02x/trace_full_%s.json", outDir, e->addr % 256, hex);
+        int res = writeFile(path, gz.buffer, gz.len);
+        free(gz.buffer);
+        if (res) {
+            return -1;
+        }
+    }
+    fprintf(stderr, "unpacked %lld traces to %s/traces\n", (long long) count, outDir);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int list = 0;
+    int finalize = 0;
+    char *unpackDir = NULL;
+
+    static struct option long_options[] = {
+        { "list", no_argument, NULL, 'l' },
+        { "unpack", required_argument, NULL, 'u' },
+        { "finalize", no_argument, NULL, 'f' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "lu:fh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'l': list = 1; break;
+            case 'u': unpackDir = optarg; break;
+            case 'f': finalize = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+    }
+    const char *dayDir = argv[optind++];
+
+    if (finalize) {
+        return hpackFinalize(dayDir) ? 1 : 0;
+    }
+
+    struct hpackIndexEntry *entries = NULL;
+    int64_t count = hpackLoad(dayDir, &entries);
+    if (count < 0) {
+        fprintf(stderr, "%s: no %s found\n", dayDir, HPACK_FILE);
+        return 1;
+    }
+
+    int res = 0;
+    if (list) {
+        for (int64_t i = 0; i < count; i++) {
+            char hex[16];
+            sprintAddr(hex, sizeof(hex), entries[i].addr);
+            printf("%s %u\n", hex, entries[i].len);
+        }
+    } else if (unpackDir) {
+        res = unpack(unpackDir, dayDir, entries, count) ? 1 : 0;
+    } else {
+        if (optind >= argc) {
+            usage(argv[0]);
+        }
+        for (int i = optind; i < argc; i++) {
+            uint32_t addr;
+            if (!parseAddr(argv[i], &addr)) {
+                fprintf(stderr, "invalid hex: %s\n", argv[i]);
+                res = 1;
+                continue;
+            }
+            struct hpackIndexEntry *e = hpackFind(entries, count, addr);
+            if (!e) {
+                fprintf(stderr, "%s: no trace for %s\n", dayDir, argv[i]);
+                res = 1;
+                continue;
+            }
+            struct char_buffer gz = hpackReadEntry(dayDir, e);
+            if (!gz.buffer || printJson(gz)) {
+                res = 1;
+            }
+            free(gz.buffer);
+        }
+    }
+    free(entries);
+    return res;
+}
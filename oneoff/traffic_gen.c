@@ -0,0 +1,663 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// traffic_gen.c: synthetic Beast traffic generator / load test
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "../readsb.h"
+#include <getopt.h>
+#include <netdb.h>
+
+// build: make traffic_gen
+//
+// Simulates N aircraft heard by M receivers and feeds the resulting Beast
+// traffic into a readsb beast input port (--net-bi-port) over loopback.
+// Every receiver is its own TCP connection announcing its receiver id
+// with a 0xe3 frame, like an aggregator sees it.
+//
+// Traffic mix per aircraft: DF17 airborne positions (even / odd CPR), DF17 velocity,
+// DF17 identification, DF20 Comm-B (BDS 5,0 / 6,0). A share of the aircraft
+// doesn't transmit ADS-B, their positions arrive as MLAT results (MLAT magic timestamp).
+//
+// The generator sends at a fixed rate or ramps the rate up step by step.
+// Sockets are non-blocking, when readsb doesn't read fast enough the per connection
+// output buffers fill up and frames are counted as backlogged instead of being sent.
+// With --json pointing at the aircraft.json of the instance, the message counter in it
+// is compared against the frames sent as well.
+// A step where less than 95% of the target rate was delivered marks the saturation point.
+//
+// example:
+// ./readsb --net-only --net-bi-port 30004 --write-json /run/readsb --quiet &
+// ./traffic_gen --port 30004 --aircraft 5000 --receivers 200 --rate 20000 --ramp --step 10 --json /run/readsb/aircraft.json
+
+struct _Modes Modes;
+
+// crc.c wants this, normally provided by readsb.c
+void setExit(int arg) {
+    exit(arg);
+}
+
+#define GEN_MAX_COVER 8
+#define GEN_TICK_MS 10
+#define GEN_OUT_MAX (256 * 1024)
+
+struct genAircraft {
+    uint32_t addr;
+    double lat;
+    double lon;
+    double alt; // ft
+    double track; // degrees
+    double gs; // kt
+    double vrate; // ft/min
+    char callsign[9];
+    int mlat; // no ADS-B, positions via MLAT results
+    int odd;
+    int cover;
+    int receivers[GEN_MAX_COVER];
+};
+
+struct genReceiver {
+    int fd;
+    uint64_t uuid;
+    int64_t clockOffset;
+    char *out;
+    size_t outLen;
+};
+
+static struct {
+    const char *host;
+    const char *port;
+    const char *json;
+    int aircraftCount;
+    int receiverCount;
+    int cover;
+    double rate; // frames per second, all receivers
+    double maxRate;
+    int duration; // seconds, constant rate
+    int step; // seconds per step when ramping
+    int ramp;
+    double mlatShare;
+    double lat;
+    double lon;
+    unsigned seed;
+
+    struct genAircraft *aircraft;
+    struct genReceiver *receivers;
+    int next;
+
+    uint64_t frames;
+    uint64_t backlogged;
+    uint64_t bytes;
+    double referenceRatio; // valid messages counted by readsb per frame sent in the first step
+} gen;
+
+static double rnd() {
+    return rand_r(&gen.seed) / (RAND_MAX + 1.0);
+}
+
+static int64_t gen_mono_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//
+// Mode S encoding
+//
+
+static void setCRC(uint8_t *msg, int bytes, uint32_t xorValue) {
+    uint32_t crc = modesChecksum(msg, bytes * 8) ^ xorValue;
+    msg[bytes - 3] = crc >> 16;
+    msg[bytes - 2] = crc >> 8;
+    msg[bytes - 1] = crc;
+}
+
+static void putME(uint8_t *msg, uint64_t me) {
+    for (int i = 0; i < 7; i++) {
+        msg[4 + i] = me >> (8 * (6 - i));
+    }
+}
+
+static void startDF17(uint8_t *msg, uint32_t addr) {
+    memset(msg, 0, MODES_LONG_MSG_BYTES);
+    msg[0] = (17 << 3) | 5;
+    msg[1] = addr >> 16;
+    msg[2] = addr >> 8;
+    msg[3] = addr;
+}
+
+static uint32_t altitudeN(double alt) {
+    int n = (int) nearbyint((alt + 1000) / 25);
+    return imax(0, imin(n, 0x7FF));
+}
+
+static void encodePosition(struct genAircraft *a, uint8_t *msg) {
+    int cprlat, cprlon;
+    encodeCPR(a->lat, a->lon, a->odd, 0, &cprlat, &cprlon);
+
+    uint32_t n = altitudeN(a->alt);
+    uint64_t ac12 = ((n & 0x7F0) << 1) | 0x10 | (n & 0xF);
+
+    uint64_t me = (uint64_t) 11 << 51;
+    me |= ac12 << 36;
+    me |= (uint64_t) a->odd << 34;
+    me |= (uint64_t) cprlat << 17;
+    me |= (uint64_t) cprlon;
+
+    startDF17(msg, a->addr);
+    putME(msg, me);
+    setCRC(msg, MODES_LONG_MSG_BYTES, 0);
+
+    a->odd ^= 1;
+}
+
+static void encodeVelocity(struct genAircraft *a, uint8_t *msg) {
+    double rad = a->track * M_PI / 180.0;
+    int vew = (int) nearbyint(a->gs * sin(rad));
+    int vns = (int) nearbyint(a->gs * cos(rad));
+    int vr = (int) nearbyint(fabs(a->vrate) / 64.0);
+
+    uint64_t me = (uint64_t) 19 << 51;
+    me |= (uint64_t) 1 << 48; // subtype 1, ground speed
+    me |= (uint64_t) (vew < 0) << 42;
+    me |= (uint64_t) imin(abs(vew) + 1, 1023) << 32;
+    me |= (uint64_t) (vns < 0) << 31;
+    me |= (uint64_t) imin(abs(vns) + 1, 1023) << 21;
+    me |= (uint64_t) (a->vrate < 0) << 19;
+    me |= (uint64_t) imin(vr + 1, 511) << 10;
+
+    startDF17(msg, a->addr);
+    putME(msg, me);
+    setCRC(msg, MODES_LONG_MSG_BYTES, 0);
+}
+
+static int aisChar(char c) {
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A' + 1;
+    if (c >= '0' && c <= '9')
+        return c;
+    return 32;
+}
+
+static void encodeIdent(struct genAircraft *a, uint8_t *msg) {
+    uint64_t me = (uint64_t) 4 << 51;
+    me |= (uint64_t) 3 << 48; // category A3
+    for (int i = 0; i < 8; i++) {
+        me |= (uint64_t) aisChar(a->callsign[i]) << (42 - 6 * i);
+    }
+
+    startDF17(msg, a->addr);
+    putME(msg, me);
+    setCRC(msg, MODES_LONG_MSG_BYTES, 0);
+}
+
+static uint64_t encodeBDS50(struct genAircraft *a) {
+    int track = (int) nearbyint((a->track > 180 ? a->track - 360 : a->track) / (90.0 / 512)) & 0x7FF;
+    int gs = imin((int) nearbyint(a->gs / 2), 1023);
+    int tas = imin((int) nearbyint((a->gs + 10) / 2), 1023);
+
+    uint64_t v = 0;
+    v |= (uint64_t) 1 << 55; // roll status, roll 0
+    v |= (uint64_t) 1 << 44; // track status
+    v |= (uint64_t) track << 33;
+    v |= (uint64_t) 1 << 32; // ground speed status
+    v |= (uint64_t) gs << 22;
+    v |= (uint64_t) 1 << 21; // track rate status, rate 0
+    v |= (uint64_t) 1 << 10; // true airspeed status
+    v |= (uint64_t) tas;
+    return v;
+}
+
+static uint64_t encodeBDS60(struct genAircraft *a) {
+    int heading = (int) nearbyint((a->track > 180 ? a->track - 360 : a->track) / (90.0 / 512)) & 0x7FF;
+    // rough IAS / mach for the altitude, good enough to pass the plausibility checks
+    int ias = imin((int) nearbyint(a->gs * (1 - a->alt / 80000.0)), 1023);
+    int mach = imin((int) nearbyint(a->gs / 600.0 / (2.048 / 512)), 1023);
+    int vr = (int) nearbyint(a->vrate / 32) & 0x3FF;
+
+    uint64_t v = 0;
+    v |= (uint64_t) 1 << 55; // heading status
+    v |= (uint64_t) heading << 44;
+    v |= (uint64_t) 1 << 43; // IAS status
+    v |= (uint64_t) ias << 33;
+    v |= (uint64_t) 1 << 32; // mach status
+    v |= (uint64_t) mach << 22;
+    v |= (uint64_t) 1 << 21; // baro rate status
+    v |= (uint64_t) vr << 11;
+    v |= (uint64_t) 1 << 10; // inertial rate status
+    v |= (uint64_t) vr;
+    return v;
+}
+
+static void encodeCommB(struct genAircraft *a, uint8_t *msg) {
+    uint32_t n = altitudeN(a->alt);
+    uint32_t ac13 = ((n & 0x7E0) << 2) | ((n & 0x10) << 1) | 0x10 | (n & 0xF);
+
+    memset(msg, 0, MODES_LONG_MSG_BYTES);
+    msg[0] = 20 << 3;
+    msg[1] = ac13 >> 16; // DR / UM zero
+    msg[2] = ac13 >> 8;
+    msg[3] = ac13;
+    putME(msg, rnd() < 0.5 ? encodeBDS50(a) : encodeBDS60(a));
+    // address / parity
+    setCRC(msg, MODES_LONG_MSG_BYTES, a->addr);
+}
+
+//
+// Beast framing, see modesSendBeastOutput in net_io.c
+//
+
+static char *beastByte(char *p, unsigned char ch) {
+    *p++ = ch;
+    if (ch == 0x1A) {
+        *p++ = ch;
+    }
+    return p;
+}
+
+static char *beastReceiverId(char *p, uint64_t uuid) {
+    *p++ = 0x1A;
+    *p++ = 0xE3;
+    for (int i = 7; i >= 0; i--) {
+        p = beastByte(p, uuid >> (8 * i));
+    }
+    return p;
+}
+
+static char *beastFrame(char *p, uint64_t timestamp, uint8_t signal, uint8_t *msg, int len) {
+    *p++ = 0x1A;
+    *p++ = (len == MODES_SHORT_MSG_BYTES) ? '2' : '3';
+    for (int i = 5; i >= 0; i--) {
+        p = beastByte(p, timestamp >> (8 * i));
+    }
+    p = beastByte(p, signal);
+    for (int i = 0; i < len; i++) {
+        p = beastByte(p, msg[i]);
+    }
+    return p;
+}
+
+//
+// connections
+//
+
+static int genConnect() {
+    struct addrinfo hints, *res, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int err = getaddrinfo(gen.host, gen.port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "getaddrinfo %s:%s: %s\n", gen.host, gen.port, gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        // keep the kernel buffers small so backpressure shows up quickly
+        int sndbuf = 64 * 1024;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fprintf(stderr, "connect %s:%s: %s\n", gen.host, gen.port, strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void genFlush(struct genReceiver *r) {
+    size_t done = 0;
+    while (done < r->outLen) {
+        ssize_t res = send(r->fd, r->out + done, r->outLen - done, MSG_NOSIGNAL);
+        if (res <= 0) {
+            if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                fprintf(stderr, "send: %s, giving up\n", strerror(errno));
+                exit(1);
+            }
+            break;
+        }
+        done += res;
+        gen.bytes += res;
+    }
+    memmove(r->out, r->out + done, r->outLen - done);
+    r->outLen -= done;
+}
+
+//
+// simulation
+//
+
+static void genInit() {
+    gen.aircraft = cmCalloc(gen.aircraftCount * sizeof(struct genAircraft));
+    gen.receivers = cmCalloc(gen.receiverCount * sizeof(struct genReceiver));
+
+    for (int i = 0; i < gen.receiverCount; i++) {
+        struct genReceiver *r = &gen.receivers[i];
+        r->uuid = ((uint64_t) rand_r(&gen.seed) << 32) ^ rand_r(&gen.seed) ^ ((uint64_t) i << 48);
+        r->clockOffset = (int64_t) (rnd() * 1e12);
+        r->out = cmalloc(GEN_OUT_MAX + 1024);
+        r->fd = genConnect();
+        if (r->fd < 0) {
+            exit(1);
+        }
+        char *p = beastReceiverId(r->out, r->uuid);
+        r->outLen = p - r->out;
+    }
+
+    for (int i = 0; i < gen.aircraftCount; i++) {
+        struct genAircraft *a = &gen.aircraft[i];
+        // stay clear of the addresses readsb treats specially (non ICAO / TIS-B)
+        a->addr = 0x100000 + (uint32_t) i * 7 + (rand_r(&gen.seed) % 7);
+        a->lat = gen.lat + (rnd() - 0.5) * 8;
+        a->lon = gen.lon + (rnd() - 0.5) * 12;
+        a->alt = 2000 + floor(rnd() * 38000 / 100) * 100;
+        a->track = rnd() * 360;
+        a->gs = 250 + rnd() * 250;
+        a->vrate = (rnd() < 0.7) ? 0 : (rnd() - 0.5) * 4000;
+        snprintf(a->callsign, sizeof(a->callsign), "GEN%04d ", i % 10000);
+        a->mlat = rnd() < gen.mlatShare;
+        a->odd = rand_r(&gen.seed) & 1;
+        a->cover = 1 + rand_r(&gen.seed) % gen.cover;
+        for (int k = 0; k < a->cover; k++) {
+            a->receivers[k] = rand_r(&gen.seed) % gen.receiverCount;
+        }
+    }
+}
+
+static void genMove(double seconds) {
+    for (int i = 0; i < gen.aircraftCount; i++) {
+        struct genAircraft *a = &gen.aircraft[i];
+        double nm = a->gs * seconds / 3600.0;
+        double rad = a->track * M_PI / 180.0;
+        a->lat += nm / 60.0 * cos(rad);
+        a->lon += nm / 60.0 * sin(rad) / fmax(0.1, cos(a->lat * M_PI / 180.0));
+        a->alt = fmin(45000, fmax(0, a->alt + a->vrate * seconds / 60.0));
+        if (a->lat > 80 || a->lat < -80) {
+            a->track = fmod(a->track + 180, 360);
+        }
+        if (a->lon > 180)
+            a->lon -= 360;
+        if (a->lon < -180)
+            a->lon += 360;
+    }
+}
+
+// queue one frame on a receiver connection, returns 0 if its buffer is full
+static int genQueue(struct genReceiver *r, uint64_t timestamp, uint8_t *msg) {
+    if (r->outLen > GEN_OUT_MAX) {
+        gen.backlogged++;
+        return 0;
+    }
+    uint8_t signal = 30 + rand_r(&gen.seed) % 170;
+    char *p = beastFrame(r->out + r->outLen, timestamp, signal, msg, MODES_LONG_MSG_BYTES);
+    r->outLen = p - r->out;
+    gen.frames++;
+    return 1;
+}
+
+// one transmission by the next aircraft, heard by all its receivers
+static void genTransmit(int64_t now_ns) {
+    struct genAircraft *a = &gen.aircraft[gen.next];
+    if (++gen.next >= gen.aircraftCount)
+        gen.next = 0;
+
+    uint8_t msg[MODES_LONG_MSG_BYTES];
+    double x = rnd();
+
+    if (a->mlat) {
+        if (x < 0.3) {
+            // MLAT result, only the first receiver (standing in for the mlat server) delivers it
+            encodePosition(a, msg);
+            genQueue(&gen.receivers[a->receivers[0]], MAGIC_MLAT_TIMESTAMP, msg);
+            return;
+        }
+        encodeCommB(a, msg);
+    } else if (x < 0.45) {
+        encodePosition(a, msg);
+    } else if (x < 0.7) {
+        encodeVelocity(a, msg);
+    } else if (x < 0.75) {
+        encodeIdent(a, msg);
+    } else {
+        encodeCommB(a, msg);
+    }
+
+    for (int k = 0; k < a->cover; k++) {
+        struct genReceiver *r = &gen.receivers[a->receivers[k]];
+        // 12 MHz clock, small per receiver propagation delay
+        uint64_t timestamp = ((now_ns * 12 / 1000) + r->clockOffset + rand_r(&gen.seed) % 12000) & 0xFFFFFFFFFFFFULL;
+        if (timestamp >= MAGIC_MLAT_TIMESTAMP - 100)
+            timestamp -= 1000000;
+        genQueue(r, timestamp, msg);
+    }
+}
+
+// total messages counter of the readsb instance and the time it was written, -1 if not available
+static int64_t readMessages(double *now) {
+    if (!gen.json)
+        return -1;
+    char buf[256];
+    int fd = open(gen.json, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+    char *p = strstr(buf, "\"now\"");
+    if (!p || !(p = strchr(p, ':')))
+        return -1;
+    *now = strtod(p + 1, NULL);
+    p = strstr(buf, "\"messages\"");
+    if (!p || !(p = strchr(p, ':')))
+        return -1;
+    return strtoll(p + 1, NULL, 10);
+}
+
+// run at rate frames / s for the given seconds, returns the delivered share of the target
+static double genRun(double rate, int seconds) {
+    // a transmission produces about (cover + 1) / 2 frames
+    double transmissionsPerSecond = rate / ((gen.cover + 1) / 2.0);
+
+    uint64_t frames = gen.frames;
+    uint64_t backlogged = gen.backlogged;
+    uint64_t bytes = gen.bytes;
+    double messagesTime = 0;
+    int64_t messages = readMessages(&messagesTime);
+
+    int64_t start = gen_mono_ns();
+    int64_t end = start + (int64_t) seconds * 1000000000LL;
+    int64_t last = start;
+    double budget = 0;
+
+    while (1) {
+        int64_t now = gen_mono_ns();
+        if (now >= end)
+            break;
+
+        double elapsed = (now - last) / 1e9;
+        last = now;
+
+        genMove(elapsed);
+
+        budget += transmissionsPerSecond * elapsed;
+        while (budget >= 1) {
+            genTransmit(now);
+            budget -= 1;
+        }
+
+        for (int i = 0; i < gen.receiverCount; i++) {
+            genFlush(&gen.receivers[i]);
+        }
+
+        struct timespec ts = { 0, GEN_TICK_MS * 1000 * 1000 };
+        nanosleep(&ts, NULL);
+    }
+
+    double dur = (gen_mono_ns() - start) / 1e9;
+    double sent = (gen.frames - frames) / dur;
+    double target = (gen.frames - frames + gen.backlogged - backlogged) / dur;
+    double share = target > 0 ? sent / target : 1;
+
+    printf("target %9.0f frames/s  queued %9.0f frames/s  backlogged %9.0f frames/s  %7.2f MB/s  delivered %5.1f%%",
+            target, sent, (gen.backlogged - backlogged) / dur, (gen.bytes - bytes) / dur / 1e6, share * 100);
+
+    // readsb writes aircraft.json once a second, use its timestamps for the rate
+    double messagesEndTime = 0;
+    int64_t messagesEnd = readMessages(&messagesEndTime);
+    if (messages >= 0 && messagesEnd >= 0 && messagesEndTime > messagesTime) {
+        double processed = (messagesEnd - messages) / (messagesEndTime - messagesTime);
+        // not every frame counts as a valid message (Comm-B of aircraft readsb hasn't seen
+        // a DF17 / DF11 from yet for example), the first step is the reference
+        double ratio = target > 0 ? processed / target : 1;
+        if (gen.referenceRatio == 0)
+            gen.referenceRatio = ratio;
+        printf("  readsb %9.0f msgs/s (%5.1f%%)", processed, ratio / gen.referenceRatio * 100);
+        share = fmin(share, ratio / gen.referenceRatio);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    return share;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --host <host>          readsb host (default 127.0.0.1)\n"
+            "  --port <port>          readsb beast input port, --net-bi-port (default 30004)\n"
+            "  --aircraft <n>         simulated aircraft (default 1000)\n"
+            "  --receivers <n>        simulated receivers / connections (default 50)\n"
+            "  --cover <n>            max receivers hearing an aircraft, 1..%d (default 4)\n"
+            "  --rate <frames/s>      total frame rate, start rate with --ramp (default 5000)\n"
+            "  --duration <s>         run time at constant rate (default 30)\n"
+            "  --ramp                 double the rate every step until readsb can't keep up\n"
+            "  --step <s>             seconds per ramp step (default 10)\n"
+            "  --max-rate <frames/s>  stop ramping at this rate (default 10000000)\n"
+            "  --mlat-share <0..1>    share of aircraft only positioned by MLAT (default 0.1)\n"
+            "  --lat <deg> --lon <deg> center of the simulated traffic (default 50, 10)\n"
+            "  --seed <n>             random seed (default 1)\n"
+            "  --json <path>          aircraft.json of the instance, compare its message counter\n",
+            name, GEN_MAX_COVER);
+}
+
+int main(int argc, char **argv) {
+    gen.host = "127.0.0.1";
+    gen.port = "30004";
+    gen.aircraftCount = 1000;
+    gen.receiverCount = 50;
+    gen.cover = 4;
+    gen.rate = 5000;
+    gen.maxRate = 10000000;
+    gen.duration = 30;
+    gen.step = 10;
+    gen.mlatShare = 0.1;
+    gen.lat = 50;
+    gen.lon = 10;
+    gen.seed = 1;
+
+    static struct option options[] = {
+        { "host", required_argument, NULL, 'h' },
+        { "port", required_argument, NULL, 'p' },
+        { "aircraft", required_argument, NULL, 'a' },
+        { "receivers", required_argument, NULL, 'r' },
+        { "cover", required_argument, NULL, 'c' },
+        { "rate", required_argument, NULL, 'R' },
+        { "duration", required_argument, NULL, 'd' },
+        { "ramp", no_argument, NULL, 'm' },
+        { "step", required_argument, NULL, 's' },
+        { "max-rate", required_argument, NULL, 'M' },
+        { "mlat-share", required_argument, NULL, 'l' },
+        { "lat", required_argument, NULL, 'y' },
+        { "lon", required_argument, NULL, 'x' },
+        { "seed", required_argument, NULL, 'S' },
+        { "json", required_argument, NULL, 'j' },
+        { "help", no_argument, NULL, '?' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+            case 'h': gen.host = optarg; break;
+            case 'p': gen.port = optarg; break;
+            case 'a': gen.aircraftCount = atoi(optarg); break;
+            case 'r': gen.receiverCount = atoi(optarg); break;
+            case 'c': gen.cover = atoi(optarg); break;
+            case 'R': gen.rate = atof(optarg); break;
+            case 'd': gen.duration = atoi(optarg); break;
+            case 'm': gen.ramp = 1; break;
+            case 's': gen.step = atoi(optarg); break;
+            case 'M': gen.maxRate = atof(optarg); break;
+            case 'l': gen.mlatShare = atof(optarg); break;
+            case 'y': gen.lat = atof(optarg); break;
+            case 'x': gen.lon = atof(optarg); break;
+            case 'S': gen.seed = atoi(optarg); break;
+            case 'j': gen.json = optarg; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (gen.aircraftCount < 1 || gen.receiverCount < 1 || gen.rate <= 0 || gen.step < 1 || gen.duration < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    gen.cover = imax(1, imin(gen.cover, imin(GEN_MAX_COVER, gen.receiverCount)));
+
+    modesChecksumInit(0);
+    genInit();
+
+    printf("%d aircraft, %d receivers, up to %d receivers per aircraft, feeding %s:%s\n",
+            gen.aircraftCount, gen.receiverCount, gen.cover, gen.host, gen.port);
+
+    if (!gen.ramp) {
+        genRun(gen.rate, gen.duration);
+    } else {
+        double kept = 0;
+        double rate = gen.rate;
+        while (rate <= gen.maxRate) {
+            if (genRun(rate, gen.step) < 0.95) {
+                if (kept > 0)
+                    printf("saturated: readsb kept up with %.0f frames/s but not with %.0f frames/s\n", kept, rate);
+                else
+                    printf("saturated: readsb didn't keep up with the start rate of %.0f frames/s\n", rate);
+                break;
+            }
+            kept = rate;
+            rate *= 2;
+        }
+        if (rate > gen.maxRate) {
+            printf("no saturation up to %.0f frames/s\n", kept);
+        }
+    }
+
+    for (int i = 0; i < gen.receiverCount; i++) {
+        close(gen.receivers[i].fd);
+        free(gen.receivers[i].out);
+    }
+    free(gen.receivers);
+    free(gen.aircraft);
+    return 0;
+}
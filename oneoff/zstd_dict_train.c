@@ -0,0 +1,381 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// zstd_dict_train.c: train a zstd dictionary for --zstd-dict from a state directory
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "../readsb.h"
+#include <getopt.h>
+#include <zdict.h>
+
+// build: make zstd_dict_train
+//
+// zstd_dict_train [--size <bytes>] <state dir> <dict>
+//   train a dictionary on the serialized aircraft and trace chunks in the state blobs
+//   (--write-state <dir> uses <dir>/internal_state), must be built from the same source as
+//   the readsb writing the state
+//
+// example:
+//   ./zstd_dict_train /var/globe_history/internal_state /var/lib/readsb/zstd_dict
+//   readsb ... --zstd-dict /var/lib/readsb/zstd_dict
+//
+// Every dictionary gets a new random id, readsb keeps the dictionaries still in use by the
+// state in the state directory so a new one can be deployed by just restarting readsb with it.
+
+#define DEFAULT_DICT_SIZE (112640) // default of zstd --train
+#define MAX_SAMPLE_BYTES (256 * 1024 * 1024)
+#define MAX_SAMPLE_SIZE (128 * 1024)
+
+struct _Modes Modes;
+
+// this is called by cmalloc and friends on allocation failure
+void setExit(int arg) {
+    exit(arg);
+}
+
+static struct {
+    char *buffer;
+    size_t len;
+    size_t alloc;
+    size_t *sizes;
+    uint32_t count;
+    uint32_t countAlloc;
+} samples;
+
+// trace chunks of STATE_SAVE_MAGIC_LAZY records, read from the chunk file after the blob
+struct lazyChunk {
+    uint64_t offset; // in the chunk file
+    stateChunk chunk;
+};
+static struct {
+    struct lazyChunk *chunks;
+    uint32_t count;
+    uint32_t alloc;
+} lazyChunks;
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--size <bytes>] <state dir> <dict>\n", name);
+    exit(1);
+}
+
+static int samplesFull() {
+    return samples.len >= MAX_SAMPLE_BYTES;
+}
+
+static void addSample(const void *data, size_t len) {
+    len = imin(len, MAX_SAMPLE_SIZE);
+    if (len == 0 || samplesFull()) {
+        return;
+    }
+    if (samples.len + len > samples.alloc) {
+        samples.alloc = imax(2 * samples.alloc, samples.len + len);
+        samples.buffer = realloc(samples.buffer, samples.alloc);
+    }
+    if (samples.count == samples.countAlloc) {
+        samples.countAlloc = imax(1024, 2 * samples.countAlloc);
+        samples.sizes = realloc(samples.sizes, samples.countAlloc * sizeof(size_t));
+    }
+    if (!samples.buffer || !samples.sizes) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(samples.buffer + samples.len, data, len);
+    samples.len += len;
+    samples.sizes[samples.count++] = len;
+}
+
+static void addLazyChunk(stateChunk *chunk, uint64_t offset) {
+    if (lazyChunks.count == lazyChunks.alloc) {
+        lazyChunks.alloc = imax(1024, 2 * lazyChunks.alloc);
+        lazyChunks.chunks = realloc(lazyChunks.chunks, lazyChunks.alloc * sizeof(struct lazyChunk));
+        if (!lazyChunks.chunks) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    struct lazyChunk *c = &lazyChunks.chunks[lazyChunks.count++];
+    c->offset = offset;
+    c->chunk = *chunk;
+}
+
+static void addChunkSample(ZSTD_DCtx *dctx, stateChunk *chunk, const void *compressed) {
+    static char *chunkBuffer;
+    static size_t chunkAlloc;
+    size_t uncompressed_len = stateBytes(chunk->numStates);
+    if (uncompressed_len > chunkAlloc) {
+        chunkAlloc = uncompressed_len;
+        chunkBuffer = realloc(chunkBuffer, chunkAlloc);
+        if (!chunkBuffer) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    size_t res = zstdDecompress(dctx, chunkBuffer, uncompressed_len, compressed, chunk->compressed_size);
+    if (!ZSTD_isError(res)) {
+        addSample(chunkBuffer, res);
+    }
+}
+
+// mirrors save_blob() / load_aircraft() in globe_index.c
+static int parseAircrafts(char *p, char *end, ZSTD_DCtx *dctx, const char *filename, uint64_t *generation) {
+    static struct aircraft a;
+#define need(size) do { if (end - p < (ssize_t) (size)) { fprintf(stderr, "%s: truncated state\n", filename); return -1; } } while (0)
+    while (end - p > 0) {
+        uint64_t value;
+        need(sizeof(value));
+        p += memcpySize(&value, p, sizeof(value));
+        if (value == STATE_SAVE_MAGIC_END) {
+            if (end - p >= 2 * (ssize_t) sizeof(value)) {
+                p += memcpySize(&value, p, sizeof(value));
+                if (value == STATE_SAVE_GENERATION) {
+                    memcpy(generation, p, sizeof(*generation));
+                }
+            }
+            return 0;
+        }
+        int lazy = (value == STATE_SAVE_MAGIC_LAZY);
+        if (value != STATE_SAVE_MAGIC && !lazy) {
+            fprintf(stderr, "%s: unknown state format\n", filename);
+            return -1;
+        }
+        need(sizeof(value));
+        p += memcpySize(&value, p, sizeof(value));
+        if (value != sizeof(struct aircraft)) {
+            fprintf(stderr, "%s: sizeof(struct aircraft) is %llu, this build: %llu, rebuild zstd_dict_train from the source of the running readsb\n",
+                    filename, (unsigned long long) value, (unsigned long long) sizeof(struct aircraft));
+            return -1;
+        }
+        need(sizeof(struct aircraft));
+        addSample(p, sizeof(struct aircraft));
+        p += memcpySize(&a, p, sizeof(struct aircraft));
+
+        if (a.trace_len <= 0) {
+            continue;
+        }
+        need(sizeof(value));
+        p += memcpySize(&value, p, sizeof(value));
+        if (value != sizeof(fourState)) {
+            fprintf(stderr, "%s: sizeof(fourState) has changed\n", filename);
+            return -1;
+        }
+        uint64_t chunkOffset = 0;
+        if (lazy && a.trace_chunk_len > 0) {
+            need(2 * sizeof(value));
+            p += memcpySize(&chunkOffset, p, sizeof(chunkOffset));
+            p += sizeof(value); // size of all chunks
+        }
+        for (int k = 0; k < a.trace_chunk_len; k++) {
+            stateChunk chunk;
+            need(sizeof(stateChunk));
+            p += memcpySize(&chunk, p, sizeof(stateChunk));
+            if (lazy) {
+                addLazyChunk(&chunk, chunkOffset);
+                chunkOffset += chunk.compressed_size;
+                continue;
+            }
+            need(roundUp8(chunk.compressed_size));
+            addChunkSample(dctx, &chunk, p);
+            p += roundUp8(chunk.compressed_size);
+        }
+        need(stateBytes(a.trace_current_len));
+        addSample(p, stateBytes(a.trace_current_len));
+        p += stateBytes(a.trace_current_len);
+        if (a.traceLast) {
+            need(sizeof(value));
+            p += memcpySize(&value, p, sizeof(value));
+            need(stateBytes(value));
+            p += stateBytes(value);
+        }
+    }
+#undef need
+    return 0;
+}
+
+static void readChunkFile(int blob, uint64_t generation, ZSTD_DCtx *dctx) {
+    char filename[PATH_MAX];
+    snprintf(filename, PATH_MAX, "%s/blob_%02x_%016"PRIx64".chunks", Modes.state_dir, blob, generation);
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror(filename);
+        return;
+    }
+    char *buf = NULL;
+    for (uint32_t i = 0; i < lazyChunks.count && !samplesFull(); i++) {
+        stateChunk *chunk = &lazyChunks.chunks[i].chunk;
+        buf = realloc(buf, chunk->compressed_size);
+        if (!buf || pread(fd, buf, chunk->compressed_size, lazyChunks.chunks[i].offset) != chunk->compressed_size) {
+            fprintf(stderr, "%s: truncated chunk file\n", filename);
+            break;
+        }
+        addChunkSample(dctx, chunk, buf);
+    }
+    sfree(buf);
+    close(fd);
+}
+
+static int readBlob(int blob, const char *filename, ZSTD_DCtx *dctx) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    struct char_buffer cb = readWholeFile(fd, (char *) filename);
+    close(fd);
+    if (!cb.buffer) {
+        return -1;
+    }
+    int res = 0;
+    uint64_t generation = 0;
+    lazyChunks.count = 0;
+    char *uncompressed = NULL;
+    size_t alloc = 0;
+    char *p = cb.buffer;
+    char *end = p + cb.len;
+    while (end - p > 0 && !samplesFull()) {
+        uint32_t compressed_len;
+        uint32_t uncompressed_len;
+        if (end - p < 2 * (ssize_t) sizeof(uint32_t)) {
+            break;
+        }
+        p += memcpySize(&compressed_len, p, sizeof(compressed_len));
+        p += memcpySize(&uncompressed_len, p, sizeof(uncompressed_len));
+        if (end - p < (ssize_t) compressed_len) {
+            fprintf(stderr, "%s: truncated state\n", filename);
+            break;
+        }
+        if (uncompressed_len > alloc) {
+            alloc = uncompressed_len;
+            sfree(uncompressed);
+            uncompressed = cmalloc(alloc);
+        }
+        size_t dres = zstdDecompress(dctx, uncompressed, uncompressed_len, p, compressed_len);
+        if (ZSTD_isError(dres)) {
+            fprintf(stderr, "%s: zstd error: %s\n", filename, ZSTD_getErrorName(dres));
+            break;
+        }
+        if (parseAircrafts(uncompressed, uncompressed + dres, dctx, filename, &generation) < 0) {
+            res = -1;
+            break;
+        }
+        p += compressed_len;
+    }
+    if (lazyChunks.count > 0) {
+        readChunkFile(blob, generation, dctx);
+    }
+    sfree(uncompressed);
+    sfree(cb.buffer);
+    return res;
+}
+
+// compressed size of all samples at the trace chunk compression level
+static size_t evaluate(ZSTD_CCtx *cctx, ZSTD_CDict *cdict) {
+    size_t total = 0;
+    size_t capacity = ZSTD_compressBound(MAX_SAMPLE_SIZE);
+    char *out = cmalloc(capacity);
+    char *p = samples.buffer;
+    for (uint32_t i = 0; i < samples.count; i++) {
+        size_t res;
+        if (cdict) {
+            res = ZSTD_compress_usingCDict(cctx, out, capacity, p, samples.sizes[i], cdict);
+        } else {
+            res = ZSTD_compressCCtx(cctx, out, capacity, p, samples.sizes[i], 2);
+        }
+        if (!ZSTD_isError(res)) {
+            total += res;
+        }
+        p += samples.sizes[i];
+    }
+    sfree(out);
+    return total;
+}
+
+int main(int argc, char **argv) {
+    size_t dictSize = DEFAULT_DICT_SIZE;
+
+    static struct option long_options[] = {
+        { "size", required_argument, NULL, 's' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's': dictSize = strtoull(optarg, NULL, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || dictSize < 1024) {
+        usage(argv[0]);
+    }
+    const char *outFile = argv[optind + 1];
+
+    // dictionaries already in use by the state are needed to read it
+    Modes.state_dir = strdup(argv[optind]);
+    zstdDictInit();
+
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    for (int j = 0; j < STATE_BLOBS && !samplesFull(); j++) {
+        char filename[PATH_MAX];
+        snprintf(filename, PATH_MAX, "%s/blob_%02x.zstl", Modes.state_dir, j);
+        if (readBlob(j, filename, dctx) < 0) {
+            return 1;
+        }
+    }
+    ZSTD_freeDCtx(dctx);
+
+    if (samples.count < 100) {
+        fprintf(stderr, "%s: only %u samples found, not enough state to train a dictionary\n", Modes.state_dir, samples.count);
+        return 1;
+    }
+    fprintf(stderr, "training on %u samples, %zu bytes\n", samples.count, samples.len);
+
+    char *dict = cmalloc(dictSize);
+    size_t res = ZDICT_trainFromBuffer(dict, dictSize, samples.buffer, samples.sizes, samples.count);
+    if (ZDICT_isError(res)) {
+        fprintf(stderr, "ZDICT_trainFromBuffer: %s\n", ZDICT_getErrorName(res));
+        return 1;
+    }
+    dictSize = res;
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_CDict *cdict = ZSTD_createCDict(dict, dictSize, 2);
+    size_t plain = evaluate(cctx, NULL);
+    size_t withDict = evaluate(cctx, cdict);
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeCCtx(cctx);
+    fprintf(stderr, "samples compressed without dictionary: %zu bytes, with dictionary: %zu bytes (%.1f%%)\n",
+            plain, withDict, 100.0 * withDict / imax(plain, 1));
+
+    char tmpFile[PATH_MAX];
+    snprintf(tmpFile, PATH_MAX, "%s.tmp", outFile);
+    int fd = open(tmpFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror(tmpFile);
+        return 1;
+    }
+    if (check_write(fd, dict, dictSize, tmpFile) != (ssize_t) dictSize || close(fd) || rename(tmpFile, outFile)) {
+        perror(outFile);
+        unlink(tmpFile);
+        return 1;
+    }
+    fprintf(stderr, "wrote %s: dictionary id %08x, %zu bytes\n", outFile, ZDICT_getDictID(dict, dictSize), dictSize);
+
+    sfree(dict);
+    zstdDictCleanup();
+    sfree(Modes.state_dir);
+    sfree(samples.buffer);
+    sfree(samples.sizes);
+    sfree(lazyChunks.chunks);
+    return 0;
+}
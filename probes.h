@@ -0,0 +1,69 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes (static tracepoints) on the major pipeline stages
+//
+// Compiled out unless built with make USDT=yes, that needs sys/sdt.h (debian / ubuntu:
+// systemtap-sdt-dev). With the probes compiled in, a probe nobody is attached to is a single
+// nop, so a production binary can be built with them and traced live when needed:
+//
+//   bpftrace -l 'usdt:/usr/bin/readsb:*'
+//   bpftrace -p $(pidof readsb) bpftrace/stage_latency.bt
+//
+// Most stages have a _start and a _done probe on the same thread, the latency is the time
+// between the two (see bpftrace/). Arguments are cheap to evaluate, they are computed
+// even when no tracer is attached.
+
+#ifdef ENABLE_USDT
+
+#include <sys/sdt.h>
+
+#define PROBE0(name) DTRACE_PROBE(readsb, name)
+#define PROBE1(name, a1) DTRACE_PROBE1(readsb, name, a1)
+#define PROBE2(name, a1, a2) DTRACE_PROBE2(readsb, name, a1, a2)
+#define PROBE3(name, a1, a2, a3) DTRACE_PROBE3(readsb, name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(readsb, name, a1, a2, a3, a4)
+#define PROBE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(readsb, name, a1, a2, a3, a4, a5)
+
+#else
+
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a1) do { } while (0)
+#define PROBE2(name, a1, a2) do { } while (0)
+#define PROBE3(name, a1, a2, a3) do { } while (0)
+#define PROBE4(name, a1, a2, a3, a4) do { } while (0)
+#define PROBE5(name, a1, a2, a3, a4, a5) do { } while (0)
+
+#endif
+
+// probes and their arguments:
+//
+// decode_start()
+// decode_done(msgtype, addr, decodeResult, receiverId)
+//   decodeModesMessage(), msgtype (DF) and addr are only meaningful for decodeResult >= 0
+// track_start(msgtype, addr)
+// track_done(msgtype, addr, accepted, duplicate, receiverId)
+//   trackUpdateFromMessage(), accepted: message was applied to an aircraft
+// output_start(msgtype, addr)
+// output_done(msgtype, addr)
+//   outputMessage(), messages filtered before any output is generated don't hit the probes
+// flush_start(service, bytes)
+// flush_client(service, host, port, bytes, dropped)
+// flush_done(service, bytes)
+//   flushWrites() for one net writer, flush_client for every client the data is queued for,
+//   dropped: data not queued because the client is too slow
+// api_start(thread)
+// api_done(thread, bytes)
+//   one API request, bytes: size of the response (0: error response)
+// trace_write_start(addr, trace_write)
+// trace_write_done(addr)
+//   traceWrite() for one aircraft, trace_write are the WRECENT / WMEM / WPERM flags
+// save_blob_start(blob, delta)
+// save_blob_done(blob, delta, bytes)
+//   save_blob(), delta as requested / as written (a full write when compacting), bytes written,
+//   save_blob_done is skipped when the blob couldn't be opened
+// priority_start()
+// priority_done(pause_us, remove_stale_ms, stats_ms)
+//   priorityTasksRun(), pause_us: time the other threads were stopped by lockThreads()
+
+#endif
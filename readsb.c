@@ -146,8 +146,6 @@ static void configSetDefaults(void) {
     Modes.acHashBits = AIRCRAFT_HASH_BITS;
     Modes.acBuckets = 1 << Modes.acHashBits; // this is critical for hashing purposes
 
-    Modes.receiver_table_hash_bits = 6; // dynamically resized, start very small
-
     Modes.freq = MODES_DEFAULT_FREQ;
     Modes.check_crc = 1;
     Modes.net_heartbeat_interval = MODES_NET_HEARTBEAT_INTERVAL;
@@ -214,8 +212,10 @@ static void configSetDefaults(void) {
 
     Modes.state_chunk_size = 12 * 1024 * 1024;
     Modes.state_chunk_size_read = Modes.state_chunk_size;
+    Modes.stateSeq = 1;
 
     Modes.decodeThreads = 1;
+    Modes.demodThreads = 1;
 
     Modes.filterDF = 0;
     Modes.filterDFbitset = 0;
@@ -326,14 +326,15 @@ static void modesInit(void) {
     threadInit(&Threads.globeBin, "globeBin");
     threadInit(&Threads.misc, "misc");
     threadInit(&Threads.apiUpdate, "apiUpdate");
+    threadInit(&Threads.fileWriter, "fileWriter");
 
     if (Modes.json_globe_index || Modes.netReceiverId || Modes.acHashBits >= 16) {
-        Modes.allPoolSize = imin(8, Modes.num_procs);
+        Modes.allPoolSize = imin(STATS_POOL_THREADS, Modes.num_procs);
     } else {
         Modes.allPoolSize = 1;
     }
 
-    Modes.allTasks = allocate_task_group(2 * Modes.allPoolSize);
+    Modes.allTasks = allocate_task_group(4 * Modes.allPoolSize);
     Modes.allPool = threadpool_create(Modes.allPoolSize, 4);
 
     if (Modes.json_globe_index) {
@@ -364,6 +365,7 @@ static void modesInit(void) {
             Modes.mag_buffers[i].dropped = 0;
             Modes.mag_buffers[i].sampleTimestamp = 0;
         }
+        fifoInit();
     }
 
     // Prepare error correction tables
@@ -444,6 +446,7 @@ void priorityTasksRun() {
         strftime(timebuf, 128, "%T", &local);
         fprintf(stderr, "priorityTasksRun: utcTime: %s.%03lld epoch: %.3f\n", timebuf, (long long) now % 1000, now / 1000.0);
     }
+    PROBE0(priority_start);
     pthread_mutex_lock(&Modes.hungTimerMutex);
     startWatch(&Modes.hungTimer1);
     pthread_mutex_unlock(&Modes.hungTimerMutex);
@@ -467,6 +470,7 @@ void priorityTasksRun() {
     // in the cache used by the json threads.
 
     Modes.currentTask = "locking";
+    int64_t pauseStart = mono_micro_seconds();
     lockThreads();
     Modes.currentTask = "locked";
 
@@ -493,10 +497,7 @@ void priorityTasksRun() {
         checkReplaceState();
     }
 
-    // finish db update under lock
-    if (dbFinishUpdate()) {
-        // don't do trackRemoveStale at the same time as dbFinishUpdate
-    } else if (mono >= Modes.next_remove_stale) {
+    if (mono >= Modes.next_remove_stale) {
         pthread_mutex_lock(&Modes.hungTimerMutex);
         startWatch(&Modes.hungTimer2);
         pthread_mutex_unlock(&Modes.hungTimerMutex);
@@ -527,10 +528,19 @@ void priorityTasksRun() {
 
     int64_t elapsed2 = lapWatch(&watch);
 
+    // record the pause while stats_current is still protected, unlockThreads() itself is quick
+    int64_t pauseTime = mono_micro_seconds() - pauseStart;
+    statsPause(pauseTime);
+
     Modes.currentTask = "unlocking";
     unlockThreads();
     Modes.currentTask = "unlocked";
 
+    // everything retired above is unreachable for threads starting after the unlock
+    Modes.currentTask = "epochReclaim";
+    epochAdvance();
+    epochReclaim();
+
     static int64_t antiSpam;
     if (0 || (Modes.debug_removeStaleDuration) || ((elapsed1 > 150 || elapsed2 > 150) && mono > antiSpam + 30 * SECONDS)) {
         fprintf(stderr, "<3>High load: removeStale took %"PRIi64"/%"PRIi64" ms! stats: %d (suppressing for 30 seconds)\n", elapsed1, elapsed2, Modes.updateStats);
@@ -567,6 +577,7 @@ void priorityTasksRun() {
         timespec_add_elapsed(&before, &after, &Modes.stats_current.remove_stale_cpu);
     }
     Modes.currentTask = "priorityTasks_end";
+    PROBE3(priority_done, pauseTime, elapsed1, elapsed2);
 }
 
 //
@@ -1031,45 +1042,52 @@ static void *decodeEntryPoint(void *arg) {
 
         int watchdogCounter = 200; // roughly 20 seconds
 
+        demodulate2400Init();
+
         while (!Modes.exit) {
             struct timespec start_time;
 
-            lockReader();
-            // reader is locked, and possibly we have data.
-            // copy out reader CPU time and reset it
-            add_timespecs(&Modes.reader_cpu_accumulator, &Modes.stats_current.reader_cpu, &Modes.stats_current.reader_cpu);
-            Modes.reader_cpu_accumulator.tv_sec = 0;
-            Modes.reader_cpu_accumulator.tv_nsec = 0;
-
-            struct mag_buf *buf = NULL;
-            if (Modes.first_free_buffer != Modes.first_filled_buffer) {
-                // FIFO is not empty, process one buffer.
-                buf = &Modes.mag_buffers[Modes.first_filled_buffer];
-            } else {
-                buf = NULL;
-            }
-            unlockReader();
+            // copy out reader CPU time
+            fifoReaderCpu(&Modes.stats_current.reader_cpu);
+
+            // FIFO is not empty: process up to demodThreads buffers
+            // the samples each buffer shares with the previous one (trailing_samples) are
+            // copied by the reader so the buffers can be demodulated independently
+            struct mag_buf *bufs[MODES_MAG_BUFFERS];
+            int count = fifoPeek(bufs, Modes.demodThreads);
 
-            if (buf) {
+            if (count) {
                 start_cpu_timing(&start_time);
-                demodulate2400(buf);
-                if (Modes.mode_ac) {
-                    demodulate2400AC(buf);
+                if (count > 1) {
+                    // preamble detection / slicing in parallel, decoding and tracking
+                    // below in buffer order so messages stay ordered by sample timestamp
+                    struct timespec before = threadpool_get_cumulative_thread_time(Modes.demodPool);
+                    demodulate2400Scan(bufs, count);
+                    struct timespec after = threadpool_get_cumulative_thread_time(Modes.demodPool);
+                    timespec_add_elapsed(&before, &after, &Modes.stats_current.demod_cpu);
                 }
+                for (int k = 0; k < count; k++) {
+                    struct mag_buf *buf = bufs[k];
+                    if (count > 1) {
+                        demodulate2400Emit(k);
+                    } else {
+                        demodulate2400(buf);
+                    }
+                    if (Modes.mode_ac) {
+                        demodulate2400AC(buf);
+                    }
 
-                gainStatistics(buf);
-                timingStatistics(buf);
+                    gainStatistics(buf);
+                    timingStatistics(buf);
 
-                Modes.stats_current.samples_lost += Modes.sdr_buf_samples - buf->length;
-                Modes.stats_current.samples_processed += buf->length;
-                Modes.stats_current.samples_dropped += buf->dropped;
+                    Modes.stats_current.samples_lost += Modes.sdr_buf_samples - buf->length;
+                    Modes.stats_current.samples_processed += buf->length;
+                    Modes.stats_current.samples_dropped += buf->dropped;
+                }
                 end_cpu_timing(&start_time, &Modes.stats_current.demod_cpu);
 
-                // Mark the buffer we just processed as completed.
-                lockReader();
-                Modes.first_filled_buffer = (Modes.first_filled_buffer + 1) % MODES_MAG_BUFFERS;
-                pthread_cond_signal(&Threads.reader.cond);
-                unlockReader();
+                // Mark the buffers we just processed as completed.
+                fifoRelease(count);
 
                 watchdogCounter = 100; // roughly 10 seconds
             } else {
@@ -1085,16 +1103,12 @@ static void *decodeEntryPoint(void *arg) {
             backgroundTasks(now);
             end_cpu_timing(&start_time, &Modes.stats_current.background_cpu);
 
-            lockReader();
-            int newData = (Modes.first_free_buffer != Modes.first_filled_buffer);
-            unlockReader();
-
-            if (!newData) {
-                /* wait for more data.
+            if (!fifoFilled()) {
+                /* wait for more data, the reader wakes us as soon as a buffer is published.
                  * we should be getting data every 50-60ms. wait for max 80 before we give up and do some background work.
                  * this is fairly aggressive as all our network I/O runs out of the background work!
                  */
-                threadTimedWait(&Threads.decode, &ts, 80);
+                fifoWaitData(80);
             }
             if (priorityTasksPending()) {
                 if (Modes.synthetic_now) {
@@ -1110,6 +1124,7 @@ static void *decodeEntryPoint(void *arg) {
             }
         }
         sdrCancel();
+        demodulate2400Cleanup();
     }
 
     pthread_mutex_unlock(&Threads.decode.mutex);
@@ -1125,6 +1140,8 @@ static void traceWriteTask(void *arg, threadpool_threadbuffers_t *buffer_group)
 
     struct aircraft *a;
     // increment info->from to mark this part of the task as finshed
+    // writeTraces() blocks the upkeep thread which also does lockThreads() and epochReclaim(),
+    // aircraft can't be removed or freed while this runs
     for (int j = info->from; j < info->to; j++, info->from++) {
         for (a = Modes.aircraft[j]; a; a = a->next) {
             if (Modes.triggerPastDayTraceWrite && a->trace_len > 0 && !a->initialTraceWriteDone) {
@@ -1136,7 +1153,9 @@ static void traceWriteTask(void *arg, threadpool_threadbuffers_t *buffer_group)
                 if (before > Modes.traceWriteTimelimit) {
                     return;
                 }
+                PROBE2(trace_write_start, a->addr, a->trace_write);
                 traceWrite(a, buffer_group);
+                PROBE1(trace_write_done, a->addr);
                 int64_t elapsed = mono_milli_seconds() - before;
                 if (elapsed > 4 * SECONDS) {
                     fprintf(stderr, "<3>traceWrite() for %06x took %.1f s!\n", a->addr, elapsed / 1000.0);
@@ -1159,7 +1178,7 @@ static void writeTraces(int64_t mono) {
         int oldPrio = getpriority(PRIO_PROCESS, 0);
         setpriority(PRIO_PROCESS, 0, oldPrio + 10);
 
-        Modes.tracePoolSize = imin(8, imax(1, Modes.num_procs * 3 / 4));
+        Modes.tracePoolSize = imin(STATS_POOL_THREADS, imax(1, Modes.num_procs * 3 / 4));
         Modes.tracePool = threadpool_create(Modes.tracePoolSize, 4);
         Modes.traceTasks = allocate_task_group(8 * Modes.tracePoolSize);
         lastRunFinished = 1;
@@ -1437,6 +1456,8 @@ static void cleanup_and_exit(int code) {
     sfree(Modes.globalStatsCount.rssi_table);
     sfree(Modes.net_bind_address);
     sfree(Modes.db_file);
+    sfree(Modes.zstd_dict_file);
+    zstdDictCleanup();
     sfree(Modes.net_input_beast_ports);
     sfree(Modes.net_input_planefinder_ports);
     sfree(Modes.net_output_beast_ports);
@@ -1456,9 +1477,8 @@ static void cleanup_and_exit(int code) {
     sfree(Modes.garbage_ports);
     sfree(Modes.beast_serial);
     sfree(Modes.uuidFile);
-    sfree(Modes.dbIndex);
-    sfree(Modes.dbRaw.buffer);
-    sfree(Modes.db);
+    dbBinFree(Modes.dbBin);
+    Modes.dbBin = NULL;
     sfree(Modes.latString);
     sfree(Modes.lonString);
 
@@ -1469,6 +1489,7 @@ static void cleanup_and_exit(int code) {
     for (i = 0; i < MODES_MAG_BUFFERS; ++i) {
         sfree(Modes.mag_buffers[i].data);
     }
+    fifoCleanup();
     crcCleanupTables();
 
     receiverCleanup();
@@ -1860,6 +1881,9 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             sfree(Modes.globe_history_dir);
             Modes.globe_history_dir = strdup(arg);
             break;
+        case OptGlobeHistoryPacked:
+            Modes.globe_history_packed = 1;
+            break;
         case OptStateOnlyOnExit:
             Modes.state_only_on_exit = 1;
             break;
@@ -1875,6 +1899,10 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             sfree(Modes.state_parent_dir);
             Modes.state_parent_dir = strdup(arg);
             break;
+        case OptZstdDict:
+            sfree(Modes.zstd_dict_file);
+            Modes.zstd_dict_file = strdup(arg);
+            break;
         case OptJsonTime:
             Modes.json_interval = (int64_t) (1000.0 * atof(arg));
             if (Modes.json_interval < 100) // 0.1s
@@ -1925,6 +1953,9 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case OptEnableBinGz:
             Modes.enableBinGz = 1;
             break;
+        case OptJsonWriteSync:
+            Modes.fileWriteSync = 1;
+            break;
         case OptJsonOnlyBin:
             Modes.onlyBin = (int8_t) atoi(arg);
             break;
@@ -2100,9 +2131,15 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case OptDecodeThreads:
             Modes.decodeThreads = imax(1, atoi(arg));
             break;
+        case OptDemodThreads:
+            Modes.demodThreads = imax(1, imin(MODES_MAG_BUFFERS / 2, atoi(arg)));
+            break;
         case OptNetIngest:
             Modes.netIngest = 1;
             break;
+        case OptNetOverloadShed:
+            Modes.netOverloadShed = 1;
+            break;
         case OptUuidFile:
             sfree(Modes.uuidFile);
             Modes.uuidFile = strdup(arg);
@@ -2721,10 +2758,10 @@ static void configAfterParse() {
     }
 }
 
-static void notask_save_blob(uint32_t blob, char *stateDir) {
+static void notask_save_blob(uint32_t blob, char *stateDir, int delta) {
     threadpool_buffer_t pbuffer1 = { 0 };
     threadpool_buffer_t pbuffer2 = { 0 };
-    save_blob(blob, &pbuffer1, &pbuffer2, stateDir);
+    save_blob(blob, &pbuffer1, &pbuffer2, stateDir, delta);
     free_threadpool_buffer(&pbuffer1);
     free_threadpool_buffer(&pbuffer2);
 }
@@ -2738,7 +2775,9 @@ static void loadReplaceState() {
     threadpool_buffer_t buffers[4];
     memset(buffers, 0x0, sizeof(buffers));
     threadpool_threadbuffers_t group = { .buffer_count = 4, .buffers = buffers };
-    load_blob(Modes.replace_state_blob_number, Modes.replace_state_blob, &group);
+    load_blob(Modes.replace_state_blob_number, Modes.replace_state_blob, &group, NULL);
+    // the loaded aircraft aren't marked as changed, write the whole blob next time
+    Modes.stateBlobs[Modes.replace_state_blob_number].generation = 0;
 
     char blob[1024];
     snprintf(blob, 1024, "%s.zstl", Modes.replace_state_blob);
@@ -2773,7 +2812,7 @@ static int checkWriteStateDir(char *baseDir) {
         writeInternalState();
     } else if (len == 2) {
         uint32_t suffix = strtol(tmp, NULL, 16);
-        notask_save_blob(suffix, baseDir);
+        notask_save_blob(suffix, baseDir, 0);
         fprintf(stderr, "save_blob: %02x\n", suffix);
     }
 
@@ -2938,7 +2977,7 @@ static void miscStuff(int64_t now) {
             struct timespec watch;
             startWatch(&watch);
 
-            notask_save_blob(blob, Modes.state_dir);
+            notask_save_blob(blob, Modes.state_dir, 1);
 
             int64_t elapsed = stopWatch(&watch);
             if (elapsed > 0.5 * SECONDS || elapsed > blob_interval) {
@@ -2950,20 +2989,38 @@ static void miscStuff(int64_t now) {
         }
     }
 
+    // older trace chunks not read when loading the state
+    if (traceHydrateStep()) {
+        return;
+    }
+
     // function can unlock / lock misc mutex
     if (handleHeatmap(now)) {
         return;
     }
 
+    // function can unlock / lock misc mutex
+    if (historyPackCheckDay(now)) {
+        return;
+    }
+
     static int64_t next_clients_json;
-    if (Modes.json_dir && now > next_clients_json) {
+    if ((Modes.json_dir || Modes.api) && now > next_clients_json) {
         next_clients_json = now + 10 * SECONDS;
 
         if (Modes.netIngest || Modes.enableClientsJson) {
-            free(writeJsonToFile(Modes.json_dir, "clients.json", generateClientsJson()).buffer);
+            struct char_buffer cb = generateClientsJson();
+            if (Modes.json_dir) {
+                writeJsonToFile(Modes.json_dir, "clients.json", cb);
+            }
+            if (Modes.api) {
+                apiSetClientsJson(cb);
+            } else {
+                free(cb.buffer);
+            }
         }
 
-        if (Modes.netReceiverIdJson) {
+        if (Modes.json_dir && Modes.netReceiverIdJson) {
             free(writeJsonToFile(Modes.json_dir, "receivers.json", generateReceiversJson()).buffer);
         }
 
@@ -3182,9 +3239,15 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Unable to create globe history directory (%s): %s\n", Modes.globe_history_dir, strerror(errno));
     }
 
+    if ((Modes.json_dir || Modes.globe_history_dir || Modes.prom_file) && !Modes.fileWriteSync) {
+        fileWriterInit();
+    }
+
     checkNewDay(mstime());
     checkNewDayAcas(mstime());
 
+    zstdDictInit();
+
     if (Modes.state_dir) {
         readInternalState();
         if (Modes.writeInternalState) {
@@ -3313,6 +3376,9 @@ int main(int argc, char **argv) {
     close(mainEpfd);
     sfree(events);
 
+    // write out pending files, threads still running will write synchronously from now on
+    fileWriterStop();
+
     if (Modes.json_dir) {
         // mark this instance as deactivated, webinterface won't load
         char pathbuf[PATH_MAX];
@@ -3390,11 +3456,16 @@ int main(int argc, char **argv) {
         Modes.state_dir = NULL;
     }
 
+    // retired aircraft aren't in Modes.aircraft anymore, free them before the state is written
+    epochDrain();
+
     Modes.quickFree = 1; // certain shortcuts, only used on exit when the state matters not
     // frees aircraft when Modes.quickFree is set
     // writes state if Modes.state_dir is set
     writeInternalState();
 
+    gzipPoolCleanup();
+
     {
         char *exitString = "Normal exit.";
         if (Modes.exit != 1) {
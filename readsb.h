@@ -103,6 +103,9 @@
 #ifndef __APPLE__
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <malloc.h>
+#else
+#include <malloc/malloc.h>
 #endif
 
 
@@ -212,6 +215,20 @@ typedef enum
     UNIT_METERS
 } altitude_unit_t;
 
+// memory accounting categories (Modes.memBytes), names in stats.c
+typedef enum
+{
+    MEM_TRACES, // trace_current, trace chunks, traceLast, trace cache
+    MEM_AIRCRAFT, // aircraft structs in use
+    MEM_AIRCRAFT_SLABS, // aircraftBack slabs the aircraft structs are allocated from
+    MEM_RECEIVERS, // receiver table and receivers
+    MEM_API, // api double buffers
+    MEM_FILE_WRITER, // file writer queue entries and content buffers
+    MEM_CLIENTS, // network client structs, receive buffers and send queues
+    MEM_DATABASE, // aircraft database converted from csv, a binary database is mmapped
+    MEM_CATEGORIES
+} mem_category_t;
+
 typedef enum
 {
     ALTITUDE_BARO,
@@ -318,9 +335,6 @@ typedef enum {
 
 #define MODES_ICAO_FILTER_TTL 60000
 
-#define DB_HASH_BITS 19
-#define DB_BUCKETS (1 << DB_HASH_BITS) // this is critical for hashing purposes
-
 #define STATE_BLOBS 256 // change naming scheme if increasing this
 #define LOCK_THREADS_MAX 64
 #define PERIODIC_UPDATE (1 * SECONDS)
@@ -430,6 +444,18 @@ static inline void *calloc_or_exit(size_t alignment, size_t size, const char *fi
     memset(buf, 0x0, size);
     return buf;
 }
+static inline void *realloc_or_exit(void *ptr, size_t size, const char *file, int line) {
+    void *buf = realloc(ptr, size);
+    if (unlikely(!buf)) {
+        fprintf(stderr, "FATAL: realloc_or_exit() of size %lld failed: %s:%d (insufficient memory?)\n", (long long) size, file, line);
+        #ifdef CRCDEBUG
+        exit(1);
+        #else
+        setExit(2); // irregular exit ... soon
+        #endif
+    }
+    return buf;
+}
 
 #define CM_HUGEPAGE 1
 #define CM_NO_HUGEPAGE 0
@@ -464,14 +490,23 @@ static inline void munmap_or_exit(void *ptr, size_t size, const char *file, int
 #define cmMmap(size, huge) mmap_or_exit(size, huge, __FILE__, __LINE__)
 #define cmMunmap(ptr, size) munmap_or_exit(ptr, size, __FILE__, __LINE__)
 
+// allocations via cmalloc / cmCalloc / cmRealloc are counted in Modes.mallocCount (stats: malloc_count)
+// so allocations sneaking into the steady state processing show up
+#ifdef CRCDEBUG
+#define cmCountAlloc() ((void) 0)
+#else
+#define cmCountAlloc() atomic_fetch_add_explicit(&Modes.mallocCount, 1, memory_order_relaxed)
+#endif
+
 // disable this ... maybe it test in the future if it makes a diff if i'm bored
 #if 0
-#define cmalloc(size) malloc_or_exit(MemoryAlignment, size, __FILE__, __LINE__)
-#define cmCalloc(size) calloc_or_exit(MemoryAlignment, size, __FILE__, __LINE__)
+#define cmalloc(size) (cmCountAlloc(), malloc_or_exit(MemoryAlignment, size, __FILE__, __LINE__))
+#define cmCalloc(size) (cmCountAlloc(), calloc_or_exit(MemoryAlignment, size, __FILE__, __LINE__))
 #else
-#define cmalloc(size) malloc_or_exit(0, size, __FILE__, __LINE__)
-#define cmCalloc(size) calloc_or_exit(0, size, __FILE__, __LINE__)
+#define cmalloc(size) (cmCountAlloc(), malloc_or_exit(0, size, __FILE__, __LINE__))
+#define cmCalloc(size) (cmCountAlloc(), calloc_or_exit(0, size, __FILE__, __LINE__))
 #endif
+#define cmRealloc(ptr, size) (cmCountAlloc(), realloc_or_exit(ptr, size, __FILE__, __LINE__))
 
 // Include subheaders after all the #defines are in place
 
@@ -493,6 +528,12 @@ static inline void munmap_or_exit(void *ptr, size_t size, const char *file, int
 #include "geomag.h"
 #include "json_out.h"
 #include "api.h"
+#include "file_writer.h"
+#include "epoch.h"
+#include "history_pack.h"
+#include "aircraft_db.h"
+#include "zstd_dict.h"
+#include "probes.h"
 
 //======================== structure declarations =========================
 
@@ -536,6 +577,7 @@ struct _Threads {
     threadT globeBin; // thread writing binCraft
     threadT misc;
     threadT apiUpdate;
+    threadT fileWriter; // writes files handed over by json / trace producers
 };
 extern struct _Threads Threads;
 
@@ -575,8 +617,8 @@ struct _Modes
     char *currentTask;
     int64_t joinTimeout;
 
-    unsigned first_free_buffer; // Entry in mag_buffers that will next be filled with input.
-    unsigned first_filled_buffer; // Entry in mag_buffers that has valid data and will be demodulated next. If equal to next_free_buffer, there is no unprocessed data.
+    atomic_uint first_free_buffer; // Entry in mag_buffers that will next be filled with input. (only written by the reader, see fifoPublish)
+    atomic_uint first_filled_buffer; // Entry in mag_buffers that has valid data and will be demodulated next. If equal to next_free_buffer, there is no unprocessed data. (only written by the decode thread, see fifoRelease)
     unsigned trailing_samples; // extra trailing samples in magnitude buffers
     int volatile exit; // Exit from the main loop when true
     int volatile exitSoon;
@@ -618,6 +660,8 @@ struct _Modes
     struct messageBuffer *netMessageBuffer;
     int decodeThreads;
     threadpool_t *decodePool;
+    int demodThreads;
+    threadpool_t *demodPool;
     task_group_t *decodeTasks;
     pthread_mutex_t decodeLock;
     pthread_mutex_t trackLock;
@@ -653,16 +697,12 @@ struct _Modes
 
     struct craftArray *globeLists;
 
-    int receiver_table_hash_bits;
-    int receiver_table_size;
-    struct receiver **receiverTable;
+    struct receiverTable *receiverTable;
+    struct receiverTable *receiverTableOld; // being migrated into receiverTable
+    uint32_t receiverMigratePos;
     struct craftArray aircraftActive;
-    dbEntry *db;
-    dbEntry **dbIndex;
-    struct char_buffer dbRaw;
-    dbEntry *db2;
-    dbEntry **db2Index;
-    struct char_buffer db2Raw;
+    _Atomic(struct dbBin *) dbBin; // aircraft database, swapped by dbUpdate()
+    atomic_int_fast64_t dbGeneration; // generation of dbBin
     int64_t dbModificationTime;
     int64_t receiverCount;
     struct net_writer raw_out; // Raw output
@@ -689,6 +729,11 @@ struct _Modes
 
     int write_state_blob;
     int writeInternalState;
+    struct stateBlobInfo stateBlobs[STATE_BLOBS]; // periodic writes of the state blobs
+    atomic_uint_fast64_t stateSeq; // stamped into a->stateSeq when an aircraft changes
+    int64_t stateLoadTime; // ms readInternalState() took
+    atomic_int stateTracesPending; // aircraft with trace chunks not yet read from the state
+    atomic_int stateTracesHydrated; // aircraft with trace chunks read from the state after loading
     int replace_state_blob_number;
     char *replace_state_blob;
     int64_t replace_state_inhibit_traces_until;
@@ -701,9 +746,25 @@ struct _Modes
     int apiThreadCount;
     atomic_int apiWorkerCpuMicro;
     atomic_uint apiRequestCounter;
+    atomic_uint apiCacheHits;
+    atomic_uint apiCacheMisses;
+    atomic_uint apiTraceCacheHits;
+    atomic_uint apiTraceCacheMisses;
+    atomic_int apiStreamCount;
     atomic_int recentTraceWrites;
     atomic_int fullTraceWrites;
     atomic_int permTraceWrites;
+    atomic_uint fileWrites;
+    atomic_uint fileWritesCoalesced;
+    atomic_uint fileWritesSync;
+    atomic_int fileWriterQueueMax;
+    atomic_ullong fileWriteBytes;
+    atomic_uint commbFastPath;
+    atomic_uint commbFullScan;
+    atomic_uint epochRetired;
+    atomic_uint epochReclaimed;
+    atomic_uint mallocCount;
+    atomic_llong memBytes[MEM_CATEGORIES];
     struct net_service apiService;
     struct apiCon **apiListeners;
 
@@ -779,6 +840,8 @@ struct _Modes
     int8_t netReceiverIdPrint;
     int8_t netReceiverIdJson;
     int8_t netIngest;
+    int8_t netOverloadShed; // shed input messages when the decode thread falls behind
+    int8_t netShedLevel; // current overload level, 0: not shedding, see netOverloadCheck()
     int8_t readProxy;
     int8_t enableClientsJson;
     int8_t forward_mlat; // forward beast mlat messages to beast output ports
@@ -808,6 +871,9 @@ struct _Modes
 
     int ingestLimitRate;
     int ingestLimitPositionRate;
+    int netShedLag; // ms, input backlog of the most delayed client, updated by netOverloadCheck()
+    float netShedBusy; // fraction of time the network thread isn't waiting for data
+
     int position_persistence; // Maximum number of consecutive implausible positions from global CPR to invalidate a known position
     int json_reliable;
 
@@ -861,6 +927,7 @@ struct _Modes
     double mlatForceDistance;
     int64_t mlatForceInterval;
     char *db_file;
+    char *zstd_dict_file; // --zstd-dict
     char *net_output_raw_ports; // List of raw output TCP ports
     char *net_input_raw_ports; // List of raw input TCP ports
     char *net_output_uat_replay_ports; // List of UAT replay output TCP ports
@@ -890,6 +957,8 @@ struct _Modes
     char *net_bind_address; // Bind address
     char *json_dir; // Path to json base directory, or NULL not to write json.
     char *globe_history_dir;
+    int8_t globe_history_packed;
+    int historyPackDay; // day of month of the last history pack finalize check
     char *fullTraceDir; // reduce memory usage in /run tmpfs by writing full traces to this directory
     char *state_dir;
     char *state_parent_dir;
@@ -951,13 +1020,13 @@ struct _Modes
     int8_t traceDay;
     int8_t onlyBin; // only write binCraft for globe (1) and also aircraft.json (2)
     int8_t enableBinGz;
+    int8_t fileWriteSync; // don't use the file writer thread
 
     int8_t updateStats;
     int8_t staleStop;
 
     int8_t tcpBuffersAuto;
 
-    struct timespec reader_cpu_accumulator; // CPU time used by the reader thread, copied out and reset by the main thread under the mutex
     ALIGNED struct mag_buf mag_buffers[MODES_MAG_BUFFERS]; // Converted magnitude buffers from RTL or file input
 
     int64_t startup_time;
@@ -985,6 +1054,29 @@ struct _Modes
 
 extern struct _Modes Modes;
 
+// memory accounting by subsystem, heap allocations are accounted with their usable size
+static inline size_t cmUsableSize(void *ptr) {
+#ifdef __APPLE__
+    return malloc_size(ptr);
+#else
+    return malloc_usable_size(ptr);
+#endif
+}
+static inline void memAccountBytes(int category, int64_t bytes) {
+    atomic_fetch_add_explicit(&Modes.memBytes[category], bytes, memory_order_relaxed);
+}
+// call after allocating / before freeing ptr, NULL is ignored
+static inline void memAccountAlloc(int category, void *ptr) {
+    if (ptr) {
+        memAccountBytes(category, cmUsableSize(ptr));
+    }
+}
+static inline void memAccountFree(int category, void *ptr) {
+    if (ptr) {
+        memAccountBytes(category, -(int64_t) cmUsableSize(ptr));
+    }
+}
+
 // The struct we use to store information about a decoded message.
 
 struct modesMessage
@@ -1293,6 +1385,7 @@ enum {
     OptJsonOnlyBin,
     OptEnableBinGz,
     OptJsonReliable,
+    OptJsonWriteSync,
     OptJsonSeparateGround,
     OptPositionPersistence,
     OptJaeroTimeout,
@@ -1300,7 +1393,9 @@ enum {
     OptDbFileLongtype,
     OptPromFile,
     OptGlobeHistoryDir,
+    OptGlobeHistoryPacked,
     OptStateDir,
+    OptZstdDict,
     OptStateInterval,
     OptStateOnlyOnExit,
     OptHeatmap,
@@ -1358,9 +1453,11 @@ enum {
     OptNetReceiverId,
     OptNetReceiverIdJson,
     OptNetIngest,
+    OptNetOverloadShed,
     OptSdrBufSize,
     OptGarbage,
     OptDecodeThreads,
+    OptDemodThreads,
     OptUuidFile,
     OptRtlSdrEnableAgc,
     OptRtlSdrPpm,
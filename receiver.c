@@ -2,27 +2,141 @@
 
 #define RECEIVER_MAX_RANGE 800e3
 
-uint32_t receiverHash(uint64_t id) {
+// Open addressing with linear probing, the slots only hold id and pointer so a probe sequence
+// mostly stays within a cache line and only the matching receiver is dereferenced.
+//
+// Growing or shrinking doesn't rehash everything at once: a new table is allocated and the
+// old one is kept around (read only apart from tombstones) while its entries are moved over
+// a few slots at a time on every insert and during receiverTimeout().
+// Lookups check the current table first and then the old one.
+//
+// The misc thread walks the table for receivers.json without taking part in the decode lock,
+// tables and receivers are therefore handed to epochRetire() instead of being freed directly.
+
+// marks a slot of the old table whose entry has been moved or deleted, probing continues past it
+static struct receiver receiverTombstone;
+
+uint32_t receiverHash(uint64_t id, uint32_t bits) {
     uint64_t h = 0x30732349f7810465ULL ^ (4 * 0x2127599bf4325c37ULL);
     h ^= mix_fasthash(id);
 
     h -= (h >> 32);
     h &= (1ULL << 32) - 1;
-    h -= (h >> Modes.receiver_table_hash_bits);
+    h -= (h >> bits);
 
-    return h & (Modes.receiver_table_size - 1);
+    return h & ((1ULL << bits) - 1);
+}
+
+static receiverTable *receiverTableAlloc(uint32_t bits) {
+    receiverTable *t = cmCalloc(sizeof(receiverTable) + (sizeof(struct receiverSlot) << bits));
+    memAccountAlloc(MEM_RECEIVERS, t);
+    t->bits = bits;
+    t->size = 1 << bits;
+    return t;
+}
+
+static void receiverTableFree(void *ptr) {
+    memAccountFree(MEM_RECEIVERS, ptr);
+    free(ptr);
+}
+
+static void receiverFree(void *ptr) {
+    memAccountFree(MEM_RECEIVERS, ptr);
+    free(ptr);
+}
+
+static struct receiverSlot *receiverFind(receiverTable *t, uint64_t id) {
+    uint32_t mask = t->size - 1;
+    for (uint32_t i = receiverHash(id, t->bits);; i = (i + 1) & mask) {
+        struct receiverSlot *slot = &t->slots[i];
+        if (!slot->r) {
+            return NULL;
+        }
+        if (slot->id == id && slot->r != &receiverTombstone) {
+            return slot;
+        }
+    }
+}
+
+// only used on the current table which never contains tombstones or the id already
+static void receiverInsert(receiverTable *t, uint64_t id, struct receiver *r) {
+    uint32_t mask = t->size - 1;
+    uint32_t i = receiverHash(id, t->bits);
+    while (t->slots[i].r) {
+        i = (i + 1) & mask;
+    }
+    t->slots[i].id = id;
+    t->slots[i].r = r;
+    t->count++;
+}
+
+// backward shift deletion, keeps probe sequences intact without tombstones
+// returns 1 if an entry was moved into the deleted slot
+static int receiverRemoveSlot(receiverTable *t, uint32_t i) {
+    uint32_t mask = t->size - 1;
+    uint32_t hole = i;
+    int moved = 0;
+    t->count--;
+    for (uint32_t j = (i + 1) & mask; t->slots[j].r; j = (j + 1) & mask) {
+        uint32_t home = receiverHash(t->slots[j].id, t->bits);
+        // the entry at j can fill the hole if its home isn't cyclically within (hole, j]
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            t->slots[hole] = t->slots[j];
+            hole = j;
+            moved = 1;
+        }
+    }
+    t->slots[hole].id = 0;
+    t->slots[hole].r = NULL;
+    return moved;
+}
+
+// move up to n slots from the old table into the current one
+static void receiverMigrate(uint32_t n) {
+    receiverTable *old = Modes.receiverTableOld;
+    if (!old) {
+        return;
+    }
+    uint32_t end = imin(old->size, (int64_t) Modes.receiverMigratePos + n);
+    for (uint32_t i = Modes.receiverMigratePos; i < end; i++) {
+        struct receiverSlot *slot = &old->slots[i];
+        if (slot->r && slot->r != &receiverTombstone) {
+            receiverInsert(Modes.receiverTable, slot->id, slot->r);
+            slot->r = &receiverTombstone;
+            old->count--;
+        }
+    }
+    Modes.receiverMigratePos = end;
+    if (end == old->size) {
+        Modes.receiverTableOld = NULL;
+        epochRetire(receiverTableFree, old);
+    }
+}
+
+static void receiverResize(uint32_t bits) {
+    // a resize while the previous one is still in progress is rare, just finish it first
+    receiverMigrate(UINT32_MAX);
+
+    receiverTable *old = Modes.receiverTable;
+    Modes.receiverTableOld = old;
+    Modes.receiverMigratePos = 0;
+    Modes.receiverTable = receiverTableAlloc(bits);
+
+    if (Modes.debug_receiver) {
+        fprintf(stderr, "receiverTable resize: %u -> %u slots, receiverCount: %"PRIu64"\n",
+                old->size, Modes.receiverTable->size, Modes.receiverCount);
+    }
 }
 
 struct receiver *receiverGet(uint64_t id) {
     if (!Modes.receiverTable) {
         return NULL;
     }
-    struct receiver *r = Modes.receiverTable[receiverHash(id)];
-
-    while (r && r->id != id) {
-        r = r->next;
+    struct receiverSlot *slot = receiverFind(Modes.receiverTable, id);
+    if (!slot && Modes.receiverTableOld) {
+        slot = receiverFind(Modes.receiverTableOld, id);
     }
-    return r;
+    return slot ? slot->r : NULL;
 }
 struct receiver *receiverCreate(uint64_t id) {
     if (!Modes.receiverTable) {
@@ -32,25 +146,31 @@ struct receiver *receiverCreate(uint64_t id) {
     if (r) {
         return r;
     }
-    if (Modes.receiverCount > 2 * Modes.receiver_table_size) {
-        return NULL;
+    receiverTable *t = Modes.receiverTable;
+    // keep the load factor below 1/2, probe sequences get long quickly above that
+    if (t->count + 1 > t->size / 2) {
+        if (t->bits >= RECEIVER_TABLE_MAX_BITS) {
+            static int64_t antiSpam;
+            int64_t now = mstime();
+            if (now > antiSpam) {
+                antiSpam = now + 60 * SECONDS;
+                fprintf(stderr, "receiverTable full: %"PRIu64" receivers\n", Modes.receiverCount);
+            }
+            return NULL;
+        }
+        receiverResize(t->bits + 1);
     }
-    uint32_t hash = receiverHash(id);
+    // the new table is at most 1/4 full after a resize, migrating 8 slots per insert
+    // finishes the migration long before it can reach 1/2
+    receiverMigrate(8);
+
     r = cmalloc(sizeof(struct receiver));
+    memAccountAlloc(MEM_RECEIVERS, r);
     *r = (struct receiver) {0};
     r->id = id;
-    r->next = Modes.receiverTable[hash];
     r->firstSeen = r->lastSeen = mstime();
-    Modes.receiverTable[hash] = r;
+    receiverInsert(Modes.receiverTable, id, r);
     Modes.receiverCount++;
-    if (Modes.receiverCount > Modes.receiver_table_size * 3 / 4) {
-        static int64_t antiSpam;
-        int64_t now = mstime();
-        if (now > antiSpam && Modes.receiver_table_hash_bits == 16) {
-            antiSpam = now + 60 * SECONDS;
-            fprintf(stderr, "receiverTable fill: %0.8f\n", Modes.receiverCount / (double) Modes.receiver_table_size);
-        }
-    }
 
     if (Modes.debug_receiver && Modes.receiverCount % 128 == 0)
         fprintf(stderr, "receiverCount: %"PRIu64"\n", Modes.receiverCount);
@@ -89,57 +209,70 @@ void receiverTimeout(int part, int nParts, int64_t now) {
     if (!Modes.receiverTable) {
         return;
     }
-    int stride = Modes.receiver_table_size / nParts;
-    int start = stride * part;
-    int end = start + stride;
-    //fprintf(stderr, "START: %8d END: %8d\n", start, end);
-    for (int i = start; i < end; i++) {
-        struct receiver **r = &Modes.receiverTable[i];
-        struct receiver *del;
-        while (*r) {
-            /*
-            receiver *b = *r;
-            fprintf(stderr, "%016"PRIx64" %9"PRu64" %4.0f %4.0f %4.0f %4.0f\n",
-                    b->id, b->positionCounter,
-                    b->latMin, b->latMax, b->lonMin, b->lonMax);
-            */
-            if (
-                    (Modes.receiverCount > Modes.receiver_table_size && (*r)->lastSeen < now - 20 * MINUTES)
-                    || (now > (*r)->lastSeen + 24 * HOURS)
-                    || ((*r)->badExtent && now > (*r)->badExtent + 30 * MINUTES)
-               ) {
+    // spread the migration over the periodic calls as well in case there are few inserts
+    receiverMigrate(4096);
 
-                del = *r;
-                *r = (*r)->next;
-                Modes.receiverCount--;
-                free(del);
-            } else {
-                receiverMaintenance(*r);
-                r = &(*r)->next;
+    receiverTable *t = Modes.receiverTable;
+    uint32_t start = (uint64_t) t->size * part / nParts;
+    uint32_t end = (uint64_t) t->size * (part + 1) / nParts;
+    int nearlyFull = (t->bits >= RECEIVER_TABLE_MAX_BITS && t->count > t->size * 3 / 8);
+    //fprintf(stderr, "START: %8d END: %8d\n", start, end);
+    for (uint32_t i = start; i < end; i++) {
+        struct receiver *r = t->slots[i].r;
+        if (!r) {
+            continue;
+        }
+        /*
+        fprintf(stderr, "%016"PRIx64" %9"PRu64" %4.0f %4.0f %4.0f %4.0f\n",
+                r->id, r->positionCounter,
+                r->latMin, r->latMax, r->lonMin, r->lonMax);
+        */
+        if (
+                (nearlyFull && r->lastSeen < now - 20 * MINUTES)
+                || (now > r->lastSeen + 24 * HOURS)
+                || (r->badExtent && now > r->badExtent + 30 * MINUTES)
+           ) {
+            Modes.receiverCount--;
+            // unlink before retiring: once retired, r can be freed as soon as the epoch advances
+            int moved = receiverRemoveSlot(t, i);
+            epochRetire(receiverFree, r);
+            if (moved) {
+                // another entry was shifted into this slot, look at it again
+                i--;
             }
+        } else {
+            receiverMaintenance(r);
         }
     }
+
+    // shrink when mostly empty, only once a possible previous resize has finished
+    if (!Modes.receiverTableOld && t->bits > RECEIVER_TABLE_MIN_BITS && t->count < t->size / 16) {
+        receiverResize(t->bits - 1);
+    }
 }
 void receiverInit() {
-    Modes.receiver_table_size = 1 << Modes.receiver_table_hash_bits;
-
-    Modes.receiverTable = cmalloc(Modes.receiver_table_size * sizeof(struct receiver *));
-    memset(Modes.receiverTable, 0x0,  Modes.receiver_table_size * sizeof(struct receiver *));
+    Modes.receiverTable = receiverTableAlloc(RECEIVER_TABLE_MIN_BITS);
 }
-void receiverCleanup() {
-    if (!Modes.receiverTable) {
+static void receiverTableCleanup(receiverTable *t) {
+    if (!t) {
         return;
     }
-    for (int i = 0; i < Modes.receiver_table_size; i++) {
-        struct receiver *r = Modes.receiverTable[i];
-        struct receiver *next;
-        while (r) {
-            next = r->next;
-            free(r);
-            r = next;
+    for (uint32_t i = 0; i < t->size; i++) {
+        struct receiver *r = t->slots[i].r;
+        if (r && r != &receiverTombstone) {
+            receiverFree(r);
         }
     }
-    sfree(Modes.receiverTable);
+    receiverTableFree(t);
+}
+void receiverCleanup() {
+    if (!Modes.receiverTable) {
+        return;
+    }
+    receiverTableCleanup(Modes.receiverTableOld);
+    receiverTableCleanup(Modes.receiverTable);
+    Modes.receiverTableOld = NULL;
+    Modes.receiverTable = NULL;
     Modes.receiverCount = 0;
 }
 int receiverPositionReceived(struct aircraft *a, struct modesMessage *mm, double lat, double lon, int64_t now) {
@@ -320,8 +453,17 @@ void receiverTest() {
             r = receiverCreate(i);
     }
     printf("%"PRIu64"\n", Modes.receiverCount);
+    uint64_t missing = 0;
+    for (uint64_t i = 0; i < (1<<22); i++) {
+        if (!receiverGet(i << 22) || !receiverGet(i)) {
+            missing++;
+        }
+    }
+    printf("missing: %"PRIu64"\n", missing);
     receiverTimeout(0, 1, mstime());
     printf("%"PRIu64"\n", Modes.receiverCount);
+    receiverTimeout(0, 1, mstime() + 25 * HOURS);
+    printf("%"PRIu64"\n", Modes.receiverCount);
 }
 
 int receiverCheckBad(uint64_t id, int64_t now) {
@@ -376,42 +518,50 @@ struct char_buffer generateReceiversJson() {
     //p = safe_snprintf(p, end, "  \"columns\" : [ \"receiverId\", \"\"],\n");
     p = safe_snprintf(p, end, "  \"receivers\" : [\n");
 
-    struct receiver *r;
+    epochEnter();
+    // the decode thread may swap tables at any time, work on a snapshot
+    receiverTable *tables[2] = { Modes.receiverTable, Modes.receiverTableOld };
 
-    if (Modes.receiverTable) {
-        for (int j = 0; j < Modes.receiver_table_size; j++) {
-            for (r = Modes.receiverTable[j]; r; r = r->next) {
-
-                // check if we have enough space
-                if ((p + 1000) >= end) {
-                    int used = p - buf;
-                    buflen *= 2;
-                    buf = (char *) realloc(buf, buflen);
-                    p = buf + used;
-                    end = buf + buflen;
-                }
-
-                char uuid[64];
-                sprint_uuid1(r->id, uuid);
-
-                double elapsed = (r->lastSeen - r->firstSeen) / 1000.0 + 1.0;
-                p = safe_snprintf(p, end, "    [ \"%s\", %6.2f, %6.2f, %6.2f, %6.2f, %7.2f, %7.2f, %d, %0.2f,%0.2f ],\n",
-                        uuid,
-                        r->positionCounter / elapsed,
-                        r->timedOutCounter * 3600.0 / elapsed,
-                        r->latMin,
-                        r->latMax,
-                        r->lonMin,
-                        r->lonMax,
-                        r->badExtent ? 1 : 0,
-                        r->latMin + (r->latMax - r->latMin) / 2.0,
-                        r->lonMin + (r->lonMax - r->lonMin) / 2.0);
-
-                if (p >= end)
-                    fprintf(stderr, "buffer overrun client json\n");
+    for (int k = 0; k < 2; k++) {
+        receiverTable *t = tables[k];
+        if (!t) {
+            continue;
+        }
+        for (uint32_t j = 0; j < t->size; j++) {
+            struct receiver *r = t->slots[j].r;
+            if (!r || r == &receiverTombstone) {
+                continue;
             }
+            // check if we have enough space
+            if ((p + 1000) >= end) {
+                int used = p - buf;
+                buflen *= 2;
+                buf = (char *) realloc(buf, buflen);
+                p = buf + used;
+                end = buf + buflen;
+            }
+
+            char uuid[64];
+            sprint_uuid1(r->id, uuid);
+
+            double elapsed = (r->lastSeen - r->firstSeen) / 1000.0 + 1.0;
+            p = safe_snprintf(p, end, "    [ \"%s\", %6.2f, %6.2f, %6.2f, %6.2f, %7.2f, %7.2f, %d, %0.2f,%0.2f ],\n",
+                    uuid,
+                    r->positionCounter / elapsed,
+                    r->timedOutCounter * 3600.0 / elapsed,
+                    r->latMin,
+                    r->latMax,
+                    r->lonMin,
+                    r->lonMax,
+                    r->badExtent ? 1 : 0,
+                    r->latMin + (r->latMax - r->latMin) / 2.0,
+                    r->lonMin + (r->lonMax - r->lonMin) / 2.0);
+
+            if (p >= end)
+                fprintf(stderr, "buffer overrun client json\n");
         }
     }
+    epochExit();
 
     if (*(p-2) == ',')
         *(p-2) = ' ';
@@ -9,13 +9,16 @@
 
 #define RECEIVER_MAINTENANCE_INTERVAL (5 * MINUTES)
 
+// table size limits in bits, with a maximum load factor of 1/2 this allows 2^23 receivers
+#define RECEIVER_TABLE_MIN_BITS (6)
+#define RECEIVER_TABLE_MAX_BITS (24)
+
 struct bad_ac {
   uint32_t addr;
   int64_t ts;
 };
 typedef struct receiver {
     uint64_t id;
-    struct receiver *next;
     int64_t firstSeen;
     int64_t lastSeen;
     uint64_t positionCounter;
@@ -32,8 +35,19 @@ typedef struct receiver {
     uint32_t timedOutCounter; // how many times a receiver has been timed out
 } receiver;
 
+struct receiverSlot {
+    uint64_t id;
+    struct receiver *r; // NULL: empty slot
+};
+
+typedef struct receiverTable {
+    uint32_t bits;
+    uint32_t size;
+    uint32_t count;
+    struct receiverSlot slots[];
+} receiverTable;
 
-uint32_t receiverHash(uint64_t id);
+uint32_t receiverHash(uint64_t id, uint32_t bits);
 struct receiver *receiverGet(uint64_t id);
 struct receiver *receiverCreate(uint64_t id);
 
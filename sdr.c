@@ -23,6 +23,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "readsb.h"
+#include <poll.h>
 
 #include "sdr_ifile.h"
 #ifdef ENABLE_RTLSDR
@@ -221,12 +222,155 @@ void sdrSetGain(char *reason){
     pthread_mutex_unlock(&Modes.sdrControlMutex);
 }
 
-void lockReader() {
-    pthread_mutex_lock(&Threads.reader.mutex);
+// Modes.mag_buffers is a single producer / single consumer ring:
+// only the SDR reader advances first_free_buffer, only the decode thread advances first_filled_buffer.
+// Buffer contents are handed over by the release / acquire ordering of those indexes, no lock needed.
+// Waiting is done on eventfds, apple falls back to the thread condition variables.
+
+static struct {
+    int dataFd; // decode thread waits for filled buffers
+    int freeFd; // reader waits for free buffers
+    atomic_int_fast64_t readerCpu; // reader CPU time in ns, collected by the decode thread
+} fifo = { -1, -1, 0 };
+
+void fifoInit() {
+#ifndef NO_EVENT_FD
+    fifo.dataFd = eventfd(0, EFD_NONBLOCK);
+    fifo.freeFd = eventfd(0, EFD_NONBLOCK);
+#endif
+    atomic_store(&Modes.first_free_buffer, 0);
+    atomic_store(&Modes.first_filled_buffer, 0);
+}
+
+void fifoCleanup() {
+    if (fifo.dataFd != -1) {
+        close(fifo.dataFd);
+        fifo.dataFd = -1;
+    }
+    if (fifo.freeFd != -1) {
+        close(fifo.freeFd);
+        fifo.freeFd = -1;
+    }
+}
+
+#ifndef NO_EVENT_FD
+static void fifoSignal(int fd) {
+    uint64_t one = 1;
+    ssize_t res = write(fd, &one, sizeof(one));
+    MODES_NOTUSED(res);
+}
+
+static void fifoWait(int fd, int64_t timeout) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, (int) timeout) > 0) {
+        uint64_t count;
+        ssize_t res = read(fd, &count, sizeof(count));
+        MODES_NOTUSED(res);
+    }
+}
+#endif
+
+struct mag_buf *fifoAcquire(struct mag_buf **lastbuf, unsigned *free_bufs) {
+    unsigned first_free = atomic_load_explicit(&Modes.first_free_buffer, memory_order_relaxed);
+    unsigned first_filled = atomic_load_explicit(&Modes.first_filled_buffer, memory_order_acquire);
+    unsigned next_free = (first_free + 1) % MODES_MAG_BUFFERS;
+
+    if (lastbuf) {
+        *lastbuf = &Modes.mag_buffers[(first_free + MODES_MAG_BUFFERS - 1) % MODES_MAG_BUFFERS];
+    }
+    if (free_bufs) {
+        *free_bufs = (first_filled - next_free + MODES_MAG_BUFFERS) % MODES_MAG_BUFFERS;
+    }
+    return &Modes.mag_buffers[first_free];
+}
+
+void fifoPublish(struct timespec *thread_cpu) {
+    unsigned first_free = atomic_load_explicit(&Modes.first_free_buffer, memory_order_relaxed);
+    unsigned next_free = (first_free + 1) % MODES_MAG_BUFFERS;
+
+    // the caller made sure next_free isn't the buffer the decode thread works on
+    Modes.mag_buffers[next_free].dropped = 0;
+    Modes.mag_buffers[next_free].length = 0; // just in case
+
+    if (thread_cpu) {
+        // accumulate CPU and restart measurement
+        struct timespec used = { 0, 0 };
+        end_cpu_timing(thread_cpu, &used);
+        start_cpu_timing(thread_cpu);
+        atomic_fetch_add(&fifo.readerCpu, (int64_t) used.tv_sec * 1000000000LL + used.tv_nsec);
+    }
+
+    atomic_store_explicit(&Modes.first_free_buffer, next_free, memory_order_release);
+
+    wakeDecode();
 }
-void unlockReader() {
+
+void fifoWaitFree(int64_t timeout) {
+#ifdef NO_EVENT_FD
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    pthread_mutex_lock(&Threads.reader.mutex);
+    threadTimedWait(&Threads.reader, &ts, timeout);
     pthread_mutex_unlock(&Threads.reader.mutex);
+#else
+    fifoWait(fifo.freeFd, timeout);
+#endif
+}
+
+unsigned fifoFilled() {
+    unsigned first_filled = atomic_load_explicit(&Modes.first_filled_buffer, memory_order_relaxed);
+    unsigned first_free = atomic_load_explicit(&Modes.first_free_buffer, memory_order_acquire);
+    return (first_free - first_filled + MODES_MAG_BUFFERS) % MODES_MAG_BUFFERS;
+}
+
+unsigned fifoPeek(struct mag_buf **bufs, unsigned max) {
+    unsigned first_filled = atomic_load_explicit(&Modes.first_filled_buffer, memory_order_relaxed);
+    unsigned count = fifoFilled();
+    if (count > max) {
+        count = max;
+    }
+    for (unsigned k = 0; k < count; k++) {
+        bufs[k] = &Modes.mag_buffers[(first_filled + k) % MODES_MAG_BUFFERS];
+    }
+    return count;
 }
+
+void fifoRelease(unsigned count) {
+    unsigned first_filled = atomic_load_explicit(&Modes.first_filled_buffer, memory_order_relaxed);
+    atomic_store_explicit(&Modes.first_filled_buffer, (first_filled + count) % MODES_MAG_BUFFERS, memory_order_release);
+#ifdef NO_EVENT_FD
+    pthread_cond_signal(&Threads.reader.cond);
+#else
+    fifoSignal(fifo.freeFd);
+#endif
+}
+
+void fifoWaitData(int64_t timeout) {
+#ifdef NO_EVENT_FD
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    threadTimedWait(&Threads.decode, &ts, timeout);
+#else
+    // the decode mutex is held by the caller, release it while waiting like threadTimedWait does
+    pthread_mutex_unlock(&Threads.decode.mutex);
+    if (!Modes.exit) {
+        fifoWait(fifo.dataFd, timeout);
+    }
+    pthread_mutex_lock(&Threads.decode.mutex);
+#endif
+}
+
+void fifoReaderCpu(struct timespec *total) {
+    int64_t ns = atomic_exchange(&fifo.readerCpu, 0);
+    total->tv_sec += ns / 1000000000LL;
+    total->tv_nsec += ns % 1000000000LL;
+    normalize_timespec(total);
+}
+
 void wakeDecode() {
+#ifdef NO_EVENT_FD
     pthread_cond_signal(&Threads.decode.cond);
+#else
+    fifoSignal(fifo.dataFd);
+#endif
 }
@@ -36,8 +36,29 @@ void sdrCancel ();
 void sdrClose ();
 void sdrSetGain (char *reason);
 
-void lockReader();
-void unlockReader();
+// Lock-free FIFO of Modes.mag_buffers between the SDR reader (producer) and the decode thread (consumer)
+void fifoInit();
+void fifoCleanup();
+
+// producer: buffer to fill next, lastbuf is the previously published buffer (for the overlap)
+// free_bufs: number of free buffers after this one, don't publish if this is 0
+struct mag_buf *fifoAcquire(struct mag_buf **lastbuf, unsigned *free_bufs);
+// producer: hand the buffer from fifoAcquire to the decode thread, thread_cpu (optional) is accumulated as reader CPU
+void fifoPublish(struct timespec *thread_cpu);
+// producer: wait up to timeout ms for the decode thread to release buffers
+void fifoWaitFree(int64_t timeout);
+
+// consumer: number of filled buffers
+unsigned fifoFilled();
+// consumer: get up to max filled buffers in order without removing them, returns the count
+unsigned fifoPeek(struct mag_buf **bufs, unsigned max);
+// consumer: give the first count filled buffers back to the producer
+void fifoRelease(unsigned count);
+// consumer: wait up to timeout ms for new buffers, called with Threads.decode.mutex held
+void fifoWaitData(int64_t timeout);
+// consumer: add reader CPU time accumulated since the last call to total
+void fifoReaderCpu(struct timespec *total);
+
 void wakeDecode();
 
 #endif
@@ -159,7 +159,6 @@ static int hackrfCallback(hackrf_transfer *transfer) {
     struct mag_buf *outbuf;
     struct mag_buf *lastbuf;
     uint32_t slen;
-    unsigned next_free_buffer;
     unsigned free_bufs;
     int64_t block_duration;
 
@@ -173,18 +172,12 @@ static int hackrfCallback(hackrf_transfer *transfer) {
     int64_t sysMicroseconds = mono_micro_seconds();
     int64_t sysTimestamp = mstime();
 
-    // Lock the data buffer variables before accessing them
-    lockReader();
-
     // HackRF one returns signed IQ values, convert them to unsigned
     for (uint32_t i = 0; i < len; i++) {
         buf[i] ^= 0x80; // Flip the MSB to convert
     }
 
-    next_free_buffer = (Modes.first_free_buffer + 1) % MODES_MAG_BUFFERS;
-    outbuf = &Modes.mag_buffers[Modes.first_free_buffer];
-    lastbuf = &Modes.mag_buffers[(Modes.first_free_buffer + MODES_MAG_BUFFERS - 1) % MODES_MAG_BUFFERS];
-    free_bufs = (Modes.first_filled_buffer - next_free_buffer + MODES_MAG_BUFFERS) % MODES_MAG_BUFFERS;
+    outbuf = fifoAcquire(&lastbuf, &free_bufs);
 
     if (len != Modes.sdr_buf_size) {
         static int64_t antiSpam;
@@ -216,12 +209,11 @@ static int hackrfCallback(hackrf_transfer *transfer) {
         outbuf->dropped += slen;
         sampleCounter += slen;
         // make extra sure that the decode thread isn't sleeping
-        unlockReader();
+        wakeDecode();
         return 1;
     }
 
     dropping = 0;
-    unlockReader();
 
     // Compute the sample timestamp and system timestamp for the start of the block
     outbuf->sampleTimestamp = sampleCounter * 12e6 / Modes.sample_rate;
@@ -246,18 +238,7 @@ static int hackrfCallback(hackrf_transfer *transfer) {
     outbuf->length = slen;
     hackRF.converter(buf, &outbuf->data[Modes.trailing_samples], slen, hackRF.converter_state, &outbuf->mean_level, &outbuf->mean_power);
     // Push the new data to the demodulation thread
-    lockReader();
-
-    Modes.mag_buffers[next_free_buffer].dropped = 0;
-    Modes.mag_buffers[next_free_buffer].length = 0; // just in case
-    Modes.first_free_buffer = next_free_buffer;
-
-    // accumulate CPU while holding the mutex, and restart measurement
-    end_cpu_timing(&thread_cpu, &Modes.reader_cpu_accumulator);
-    start_cpu_timing(&thread_cpu);
-
-    wakeDecode();
-    unlockReader();
+    fifoPublish(&thread_cpu);
 
     return 0;
 }
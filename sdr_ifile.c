@@ -181,28 +181,20 @@ void ifileRun() {
 
     clock_gettime(CLOCK_MONOTONIC, &next_buffer_delivery);
 
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-
-    lockReader();
     while (!Modes.exit && !eof) {
         ssize_t nread, toread;
         void *r;
         struct mag_buf *outbuf, *lastbuf;
-        unsigned next_free_buffer;
+        unsigned free_bufs;
         unsigned slen;
 
-        next_free_buffer = (Modes.first_free_buffer + 1) % MODES_MAG_BUFFERS;
-        if (next_free_buffer == Modes.first_filled_buffer) {
+        outbuf = fifoAcquire(&lastbuf, &free_bufs);
+        if (free_bufs == 0) {
             // no space for output yet
-            threadTimedWait(&Threads.reader, &ts, 50);
+            fifoWaitFree(50);
             continue;
         }
 
-        outbuf = &Modes.mag_buffers[Modes.first_free_buffer];
-        lastbuf = &Modes.mag_buffers[(Modes.first_free_buffer + MODES_MAG_BUFFERS - 1) % MODES_MAG_BUFFERS];
-        unlockReader();
-
         // Compute the sample timestamp for the start of the block
         outbuf->sampleTimestamp = sampleCounter * 12e6 / Modes.sample_rate;
 
@@ -252,22 +244,16 @@ void ifileRun() {
         }
 
         // Push the new data to the main thread
-        lockReader();
-        Modes.first_free_buffer = next_free_buffer;
-        // accumulate CPU while holding the mutex, and restart measurement
-        end_cpu_timing(&thread_cpu, &Modes.reader_cpu_accumulator);
-        start_cpu_timing(&thread_cpu);
-        wakeDecode();
+        fifoPublish(&thread_cpu);
     }
 
-    // Wait for the main thread to consume all data (reader still locked here)
-    while (!Modes.exit && Modes.first_filled_buffer != Modes.first_free_buffer) {
+    // Wait for the main thread to consume all data
+    while (!Modes.exit && fifoFilled()) {
         wakeDecode();
-        threadTimedWait(&Threads.reader, &ts, 50);
+        fifoWaitFree(50);
     }
 
     setExit(1);
-    unlockReader();
 }
 
 void ifileClose() {
@@ -446,7 +446,6 @@ void soapyRun()
     struct mag_buf *outbuf;
     struct mag_buf *lastbuf;
     uint32_t slen;
-    unsigned next_free_buffer;
     unsigned free_bufs;
     int64_t block_duration;
 
@@ -480,15 +479,7 @@ void soapyRun()
         int64_t sysMicroseconds = mono_micro_seconds();
         int64_t sysTimestamp = mstime();
 
-        // Lock the data buffer variables before accessing them
-        lockReader();
-
-        next_free_buffer = (Modes.first_free_buffer + 1) % MODES_MAG_BUFFERS;
-        outbuf = &Modes.mag_buffers[Modes.first_free_buffer];
-        lastbuf = &Modes.mag_buffers[(Modes.first_free_buffer + MODES_MAG_BUFFERS - 1) % MODES_MAG_BUFFERS];
-        free_bufs = (Modes.first_filled_buffer - next_free_buffer + MODES_MAG_BUFFERS) % MODES_MAG_BUFFERS;
-
-        unlockReader();
+        outbuf = fifoAcquire(&lastbuf, &free_bufs);
 
         slen = (uint32_t) samples_read;
 
@@ -557,18 +548,7 @@ void soapyRun()
         SOAPY.converter(buf, &outbuf->data[Modes.trailing_samples], slen, SOAPY.converter_state, &outbuf->mean_level, &outbuf->mean_power);
 
         // Push the new data to the demodulation thread
-        lockReader();
-
-        Modes.mag_buffers[next_free_buffer].dropped = 0;
-        Modes.mag_buffers[next_free_buffer].length = 0; // just in case
-        Modes.first_free_buffer = next_free_buffer;
-
-        // accumulate CPU while holding the mutex, and restart measurement
-        end_cpu_timing(&thread_cpu, &Modes.reader_cpu_accumulator);
-        start_cpu_timing(&thread_cpu);
-
-        wakeDecode();
-        unlockReader();
+        fifoPublish(&thread_cpu);
     }
 }
 
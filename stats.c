@@ -137,6 +137,11 @@ void display_stats(struct stats *st) {
         printf("    %u accepted with correct CRC\n", st->remote_accepted[0]);
         for (j = 1; j <= Modes.nfix_crc; ++j)
             printf("    %u accepted with %d-bit error repaired\n", st->remote_accepted[j], j);
+        if (Modes.netOverloadShed) {
+            printf("  %u messages shed due to overload, aircraft covered by other receivers\n", st->remote_shed_redundant);
+            printf("  %u messages shed due to overload, Mode S only feeders\n", st->remote_shed_modes_only);
+            printf("  %u messages shed due to overload, low quality feeders\n", st->remote_shed_low_quality);
+        }
     }
 
     printf("%u total usable messages\n",
@@ -318,11 +323,43 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     }
 
     target->api_request_count = st1->api_request_count + st2->api_request_count;
+    target->api_cache_hits = st1->api_cache_hits + st2->api_cache_hits;
+    target->api_cache_misses = st1->api_cache_misses + st2->api_cache_misses;
+    target->api_trace_cache_hits = st1->api_trace_cache_hits + st2->api_trace_cache_hits;
+    target->api_trace_cache_misses = st1->api_trace_cache_misses + st2->api_trace_cache_misses;
 
     target->recentTraceWrites = st1->recentTraceWrites + st2->recentTraceWrites;
     target->fullTraceWrites = st1->fullTraceWrites + st2->fullTraceWrites;
     target->permTraceWrites = st1->permTraceWrites + st2->permTraceWrites;
 
+    target->file_writes = st1->file_writes + st2->file_writes;
+    target->file_writes_coalesced = st1->file_writes_coalesced + st2->file_writes_coalesced;
+    target->file_writes_sync = st1->file_writes_sync + st2->file_writes_sync;
+    target->file_write_bytes = st1->file_write_bytes + st2->file_write_bytes;
+    target->file_writer_queue_max = imax(st1->file_writer_queue_max, st2->file_writer_queue_max);
+
+    target->commb_fast_path = st1->commb_fast_path + st2->commb_fast_path;
+    target->commb_full_scan = st1->commb_full_scan + st2->commb_full_scan;
+
+    for (int k = 0; k < STATS_POOLS; k++) {
+        for (int i = 0; i < STATS_POOL_THREADS; i++) {
+            target->pool_tasks[k][i] = st1->pool_tasks[k][i] + st2->pool_tasks[k][i];
+            target->pool_steals[k][i] = st1->pool_steals[k][i] + st2->pool_steals[k][i];
+            target->pool_busy_ns[k][i] = st1->pool_busy_ns[k][i] + st2->pool_busy_ns[k][i];
+        }
+    }
+
+    for (int i = 0; i < STATS_PAUSE_BUCKETS; i++) {
+        target->pause_hist[i] = st1->pause_hist[i] + st2->pause_hist[i];
+    }
+    target->pause_total_us = st1->pause_total_us + st2->pause_total_us;
+    target->pause_max_us = imax(st1->pause_max_us, st2->pause_max_us);
+
+    target->epoch_retired = st1->epoch_retired + st2->epoch_retired;
+    target->epoch_reclaimed = st1->epoch_reclaimed + st2->epoch_reclaimed;
+
+    target->malloc_count = st1->malloc_count + st2->malloc_count;
+
     // noise power:
     target->noise_power_sum = st1->noise_power_sum + st2->noise_power_sum;
     target->noise_power_count = st1->noise_power_count + st2->noise_power_count;
@@ -347,6 +384,9 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     target->remote_received_basestation_invalid = st1->remote_received_basestation_invalid + st2->remote_received_basestation_invalid;
     target->remote_rejected_bad = st1->remote_rejected_bad + st2->remote_rejected_bad;
     target->remote_rejected_delayed = st1->remote_rejected_delayed + st2->remote_rejected_delayed;
+    target->remote_shed_redundant = st1->remote_shed_redundant + st2->remote_shed_redundant;
+    target->remote_shed_modes_only = st1->remote_shed_modes_only + st2->remote_shed_modes_only;
+    target->remote_shed_low_quality = st1->remote_shed_low_quality + st2->remote_shed_low_quality;
     target->remote_malformed_beast = st1->remote_malformed_beast + st2->remote_malformed_beast;
 
     if (Modes.ping) {
@@ -403,17 +443,67 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
         target->distance_min = st2->distance_min;
 }
 
+static const char *statsPoolName[STATS_POOLS] = { "all", "trace" };
+
+// upper bounds in ms for pause_hist
+static const int statsPauseBounds[STATS_PAUSE_BUCKETS - 1] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000 };
+
+void statsPause(int64_t micro) {
+    int i = 0;
+    while (i < STATS_PAUSE_BUCKETS - 1 && micro > statsPauseBounds[i] * 1000LL) {
+        i++;
+    }
+    Modes.stats_current.pause_hist[i]++;
+    Modes.stats_current.pause_total_us += micro;
+    Modes.stats_current.pause_max_us = imax(Modes.stats_current.pause_max_us, micro);
+}
+
+static threadpool_t *statsPool(int k) {
+    return k == 0 ? Modes.allPool : Modes.tracePool;
+}
+
+static int statsPoolThreads(int k) {
+    threadpool_t *pool = statsPool(k);
+    return pool ? imin(STATS_POOL_THREADS, threadpool_get_thread_count(pool)) : 0;
+}
+
 static void lockCurrent() {
+    for (int k = 0; k < STATS_POOLS; k++) {
+        threadpool_t *pool = statsPool(k);
+        for (int i = 0; i < statsPoolThreads(k); i++) {
+            threadpool_worker_stats_t ws;
+            threadpool_get_worker_stats(pool, i, &ws, 1);
+            Modes.stats_current.pool_tasks[k][i] += ws.tasks;
+            Modes.stats_current.pool_steals[k][i] += ws.steals;
+            Modes.stats_current.pool_busy_ns[k][i] += ws.busy_ns;
+        }
+    }
+
     int micro = atomic_exchange(&Modes.apiWorkerCpuMicro, 0);
     Modes.stats_current.api_worker_cpu.tv_sec += micro / (1000LL * 1000LL);
     Modes.stats_current.api_worker_cpu.tv_nsec += 1000LL * (micro % (1000LL * 1000LL));
     normalize_timespec(&Modes.stats_current.api_worker_cpu);
 
     Modes.stats_current.api_request_count += atomic_exchange(&Modes.apiRequestCounter, 0);
+    Modes.stats_current.api_cache_hits += atomic_exchange(&Modes.apiCacheHits, 0);
+    Modes.stats_current.api_cache_misses += atomic_exchange(&Modes.apiCacheMisses, 0);
+    Modes.stats_current.api_trace_cache_hits += atomic_exchange(&Modes.apiTraceCacheHits, 0);
+    Modes.stats_current.api_trace_cache_misses += atomic_exchange(&Modes.apiTraceCacheMisses, 0);
 
     Modes.stats_current.recentTraceWrites += atomic_exchange(&Modes.recentTraceWrites, 0);
     Modes.stats_current.fullTraceWrites += atomic_exchange(&Modes.fullTraceWrites, 0);
     Modes.stats_current.permTraceWrites += atomic_exchange(&Modes.permTraceWrites, 0);
+
+    Modes.stats_current.file_writes += atomic_exchange(&Modes.fileWrites, 0);
+    Modes.stats_current.file_writes_coalesced += atomic_exchange(&Modes.fileWritesCoalesced, 0);
+    Modes.stats_current.file_writes_sync += atomic_exchange(&Modes.fileWritesSync, 0);
+    Modes.stats_current.file_write_bytes += atomic_exchange(&Modes.fileWriteBytes, 0);
+    Modes.stats_current.commb_fast_path += atomic_exchange(&Modes.commbFastPath, 0);
+    Modes.stats_current.commb_full_scan += atomic_exchange(&Modes.commbFullScan, 0);
+    Modes.stats_current.epoch_retired += atomic_exchange(&Modes.epochRetired, 0);
+    Modes.stats_current.epoch_reclaimed += atomic_exchange(&Modes.epochReclaimed, 0);
+    Modes.stats_current.malloc_count += atomic_exchange(&Modes.mallocCount, 0);
+    Modes.stats_current.file_writer_queue_max = imax(Modes.stats_current.file_writer_queue_max, atomic_exchange(&Modes.fileWriterQueueMax, 0));
 }
 static void unlockCurrent() {
 }
@@ -481,6 +571,10 @@ void statsUpdate(int64_t now) {
     reset_stats(&Modes.stats_current);
     Modes.stats_current.start = Modes.stats_current.end = now;
     unlockCurrent();
+
+    if (Modes.net) {
+        netUpdateServiceTotals();
+    }
 }
 
 static char * appendTypeCounts(char *p, char *end) {
@@ -496,6 +590,23 @@ static char * appendTypeCounts(char *p, char *end) {
     return p;
 }
 
+static const char *memCategoryName[MEM_CATEGORIES] = {
+    "traces", "aircraft", "aircraft_slabs", "receivers", "api", "file_writer", "clients", "database",
+};
+
+// current heap usage per subsystem in bytes, gauge (not part of the stats periods)
+char * appendMemoryJson(char *p, char *end) {
+    p = safe_snprintf(p, end, "{");
+    int64_t total = 0;
+    for (int i = 0; i < MEM_CATEGORIES; i++) {
+        int64_t bytes = atomic_load(&Modes.memBytes[i]);
+        total += bytes;
+        p = safe_snprintf(p, end, "\"%s\":%"PRId64",", memCategoryName[i], bytes);
+    }
+    p = safe_snprintf(p, end, "\"total\":%"PRId64"}", total);
+    return p;
+}
+
 static char * appendStatsJson(char *p, char *end, struct stats *st, const char *key) {
     int i;
 
@@ -547,6 +658,43 @@ static char * appendStatsJson(char *p, char *end, struct stats *st, const char *
         p = safe_snprintf(p, end, "}");
     }
 
+    if (Modes.api) {
+        p = safe_snprintf(p, end, ",\"api_cache\":{\"hits\":%u,\"misses\":%u}",
+                st->api_cache_hits, st->api_cache_misses);
+        p = safe_snprintf(p, end, ",\"api_trace_cache\":{\"hits\":%u,\"misses\":%u}",
+                st->api_trace_cache_hits, st->api_trace_cache_misses);
+    }
+
+    if (!Modes.fileWriteSync) {
+        p = safe_snprintf(p, end, ",\"file_writer\":{\"writes\":%u,\"coalesced\":%u,\"sync\":%u,\"queue_max\":%u,\"bytes\":%"PRIu64"}",
+                st->file_writes, st->file_writes_coalesced, st->file_writes_sync, st->file_writer_queue_max, st->file_write_bytes);
+    }
+
+    p = safe_snprintf(p, end, ",\"comm_b\":{\"fast_path\":%u,\"full_scan\":%u}", st->commb_fast_path, st->commb_full_scan);
+
+    p = safe_snprintf(p, end, ",\"threadpool\":{");
+    for (int k = 0; k < STATS_POOLS; k++) {
+        int n = statsPoolThreads(k);
+        p = safe_snprintf(p, end, "%s\"%s\":{\"tasks\":[", k ? "," : "", statsPoolName[k]);
+        for (int i = 0; i < n; i++) p = safe_snprintf(p, end, "%s%u", i ? "," : "", st->pool_tasks[k][i]);
+        p = safe_snprintf(p, end, "],\"steals\":[");
+        for (int i = 0; i < n; i++) p = safe_snprintf(p, end, "%s%u", i ? "," : "", st->pool_steals[k][i]);
+        p = safe_snprintf(p, end, "],\"busy_ms\":[");
+        for (int i = 0; i < n; i++) p = safe_snprintf(p, end, "%s%.1f", i ? "," : "", st->pool_busy_ns[k][i] / 1e6);
+        p = safe_snprintf(p, end, "]}");
+    }
+    p = safe_snprintf(p, end, "}");
+
+    p = safe_snprintf(p, end, ",\"pauses\":{\"bounds_ms\":[");
+    for (int i = 0; i < STATS_PAUSE_BUCKETS - 1; i++) p = safe_snprintf(p, end, "%s%d", i ? "," : "", statsPauseBounds[i]);
+    p = safe_snprintf(p, end, "],\"counts\":[");
+    for (int i = 0; i < STATS_PAUSE_BUCKETS; i++) p = safe_snprintf(p, end, "%s%u", i ? "," : "", st->pause_hist[i]);
+    p = safe_snprintf(p, end, "],\"total_ms\":%.1f,\"max_ms\":%.1f}", st->pause_total_us / 1000.0, st->pause_max_us / 1000.0);
+
+    p = safe_snprintf(p, end, ",\"epoch\":{\"retired\":%u,\"reclaimed\":%u}", st->epoch_retired, st->epoch_reclaimed);
+
+    p = safe_snprintf(p, end, ",\"malloc_count\":%u", st->malloc_count);
+
     p = safe_snprintf(p, end, ",\"messages_valid\": %u", st->messages_total);
     p = safe_snprintf(p, end, ",\"position_count_total\": %u", st->pos_all);
 
@@ -579,6 +727,16 @@ static char * appendStatsJson(char *p, char *end, struct stats *st, const char *
         p = safe_snprintf(p, end, ",\"bytes_in\": %lu", (long) st->network_bytes_in);
         p = safe_snprintf(p, end, ",\"bytes_out\": %lu", (long) st->network_bytes_out);
 
+        if (Modes.netOverloadShed) {
+            p = safe_snprintf(p, end,
+                    ",\"shed\":{\"redundant\":%u"
+                    ",\"modes_only\":%u"
+                    ",\"low_quality\":%u}",
+                    st->remote_shed_redundant,
+                    st->remote_shed_modes_only,
+                    st->remote_shed_low_quality);
+        }
+
         p = safe_snprintf(p, end, "}");
     }
 
@@ -717,6 +875,15 @@ struct char_buffer generateStatsJson(int64_t now) {
 
     p = appendTypeCounts(p, end);
 
+    p = safe_snprintf(p, end, ",\n\"memory\": ");
+    p = appendMemoryJson(p, end);
+
+    if (Modes.state_dir) {
+        // startup progress: trace chunks are read from the state in the background after loading
+        p = safe_snprintf(p, end, ",\n\"state_load\": { \"seconds\": %.3f, \"traces_pending\": %d, \"traces_hydrated\": %d }",
+                Modes.stateLoadTime / 1000.0, (int) atomic_load(&Modes.stateTracesPending), (int) atomic_load(&Modes.stateTracesHydrated));
+    }
+
     p = appendStatsJson(p, end, &Modes.stats_1min, "last1min");
 
     p = appendStatsJson(p, end, &Modes.stats_5min, "last5min");
@@ -799,11 +966,64 @@ struct char_buffer generatePromFile(int64_t now) {
 #undef CPU_MILLIS
 
     p = safe_snprintf(p, end, "readsb_api_request_count %llu\n", (unsigned long long) st->api_request_count);
+    if (Modes.api) {
+        p = safe_snprintf(p, end, "readsb_api_cache_hits %u\n", st->api_cache_hits);
+        p = safe_snprintf(p, end, "readsb_api_cache_misses %u\n", st->api_cache_misses);
+        p = safe_snprintf(p, end, "readsb_api_trace_cache_hits %u\n", st->api_trace_cache_hits);
+        p = safe_snprintf(p, end, "readsb_api_trace_cache_misses %u\n", st->api_trace_cache_misses);
+        p = safe_snprintf(p, end, "readsb_api_streams %d\n", atomic_load(&Modes.apiStreamCount));
+    }
     p = safe_snprintf(p, end, "readsb_tracewrites_recent %u\n", st->recentTraceWrites);
     p = safe_snprintf(p, end, "readsb_tracewrites_full %u\n", st->fullTraceWrites);
     p = safe_snprintf(p, end, "readsb_tracewrites_perm %u\n", st->permTraceWrites);
     p = safe_snprintf(p, end, "readsb_tracewrites_cycle_duration %lld\n", (long long) Modes.writeTracesActualDuration);
 
+    if (!Modes.fileWriteSync) {
+        p = safe_snprintf(p, end, "readsb_filewriter_queue_length %d\n", fileWriterQueueLength());
+        p = safe_snprintf(p, end, "readsb_filewriter_queue_max %u\n", st->file_writer_queue_max);
+        p = safe_snprintf(p, end, "readsb_filewriter_writes %u\n", st->file_writes);
+        p = safe_snprintf(p, end, "readsb_filewriter_writes_coalesced %u\n", st->file_writes_coalesced);
+        p = safe_snprintf(p, end, "readsb_filewriter_writes_sync %u\n", st->file_writes_sync);
+        p = safe_snprintf(p, end, "readsb_filewriter_bytes %"PRIu64"\n", st->file_write_bytes);
+    }
+
+    p = safe_snprintf(p, end, "readsb_commb_fast_path %u\n", st->commb_fast_path);
+    p = safe_snprintf(p, end, "readsb_commb_full_scan %u\n", st->commb_full_scan);
+
+    for (int k = 0; k < STATS_POOLS; k++) {
+        for (int i = 0; i < statsPoolThreads(k); i++) {
+            p = safe_snprintf(p, end, "readsb_threadpool_tasks{pool=\"%s\",worker=\"%d\"} %u\n", statsPoolName[k], i, st->pool_tasks[k][i]);
+            p = safe_snprintf(p, end, "readsb_threadpool_steals{pool=\"%s\",worker=\"%d\"} %u\n", statsPoolName[k], i, st->pool_steals[k][i]);
+            p = safe_snprintf(p, end, "readsb_threadpool_busy_ms{pool=\"%s\",worker=\"%d\"} %"PRIu64"\n", statsPoolName[k], i, st->pool_busy_ns[k][i] / 1000000);
+        }
+    }
+
+    {
+        uint32_t cumulative = 0;
+        for (int i = 0; i < STATS_PAUSE_BUCKETS; i++) {
+            cumulative += st->pause_hist[i];
+            if (i < STATS_PAUSE_BUCKETS - 1) {
+                p = safe_snprintf(p, end, "readsb_pause_ms_bucket{le=\"%d\"} %u\n", statsPauseBounds[i], cumulative);
+            } else {
+                p = safe_snprintf(p, end, "readsb_pause_ms_bucket{le=\"+Inf\"} %u\n", cumulative);
+            }
+        }
+        p = safe_snprintf(p, end, "readsb_pause_ms_sum %.1f\n", st->pause_total_us / 1000.0);
+        p = safe_snprintf(p, end, "readsb_pause_ms_count %u\n", cumulative);
+        p = safe_snprintf(p, end, "readsb_pause_ms_max %.1f\n", st->pause_max_us / 1000.0);
+    }
+    p = safe_snprintf(p, end, "readsb_epoch_retired %u\n", st->epoch_retired);
+    p = safe_snprintf(p, end, "readsb_epoch_reclaimed %u\n", st->epoch_reclaimed);
+    p = safe_snprintf(p, end, "readsb_malloc_count %u\n", st->malloc_count);
+    for (int i = 0; i < MEM_CATEGORIES; i++) {
+        p = safe_snprintf(p, end, "readsb_memory_bytes{subsystem=\"%s\"} %"PRId64"\n", memCategoryName[i], (int64_t) atomic_load(&Modes.memBytes[i]));
+    }
+    if (Modes.state_dir) {
+        p = safe_snprintf(p, end, "readsb_state_load_seconds %.3f\n", Modes.stateLoadTime / 1000.0);
+        p = safe_snprintf(p, end, "readsb_state_traces_pending %d\n", (int) atomic_load(&Modes.stateTracesPending));
+        p = safe_snprintf(p, end, "readsb_state_traces_hydrated %d\n", (int) atomic_load(&Modes.stateTracesHydrated));
+    }
+
 
     p = safe_snprintf(p, end, "readsb_distance_max %u\n", (uint32_t) st->distance_max);
     if (st->distance_min < 1E42)
@@ -823,6 +1043,15 @@ struct char_buffer generatePromFile(int64_t now) {
     p = safe_snprintf(p, end, "readsb_messages_modes_invalid_unknown_icao %u\n", st->remote_rejected_unknown_icao + st->demod_rejected_unknown_icao);
     p = safe_snprintf(p, end, "readsb_messages_modes_rejected_delayed %u\n", st->remote_rejected_delayed);
 
+    if (Modes.netOverloadShed) {
+        p = safe_snprintf(p, end, "readsb_net_shed_level %d\n", Modes.netShedLevel);
+        p = safe_snprintf(p, end, "readsb_net_shed_input_lag_ms %d\n", Modes.netShedLag);
+        p = safe_snprintf(p, end, "readsb_net_shed_busy %.3f\n", Modes.netShedBusy);
+        p = safe_snprintf(p, end, "readsb_messages_shed_redundant %u\n", st->remote_shed_redundant);
+        p = safe_snprintf(p, end, "readsb_messages_shed_modes_only %u\n", st->remote_shed_modes_only);
+        p = safe_snprintf(p, end, "readsb_messages_shed_low_quality %u\n", st->remote_shed_low_quality);
+    }
+
     p = safe_snprintf(p, end, "readsb_messages_basestation_valid %u\n", st->remote_received_basestation_valid);
     p = safe_snprintf(p, end, "readsb_messages_basestation_invalid %u\n", st->remote_received_basestation_invalid);
 
@@ -864,6 +1093,30 @@ struct char_buffer generatePromFile(int64_t now) {
                 con->address, con->port, value);
     }
 
+    if (Modes.net) {
+        struct net_service_group *groups[2] = { &Modes.services_in, &Modes.services_out };
+        for (int g = 0; g < 2; g++) {
+            for (struct net_service *service = groups[g]->services; service && service->descr; service++) {
+                struct net_service_counters *t = &service->totals;
+                if (!service->connections && !t->bytesReceived && !t->bytesSent) {
+                    continue;
+                }
+                const char *d = service->descr;
+                p = safe_snprintf(p, end, "readsb_net_service_connections{service=\"%s\"} %d\n", d, service->connections);
+                p = safe_snprintf(p, end, "readsb_net_service_bytes_in{service=\"%s\"} %"PRIu64"\n", d, t->bytesReceived);
+                p = safe_snprintf(p, end, "readsb_net_service_bytes_out{service=\"%s\"} %"PRIu64"\n", d, t->bytesSent);
+                p = safe_snprintf(p, end, "readsb_net_service_bytes_dropped{service=\"%s\"} %"PRIu64"\n", d, t->bytesDropped);
+                p = safe_snprintf(p, end, "readsb_net_service_messages_decoded{service=\"%s\"} %"PRIu64"\n", d, t->messagesDecoded);
+                p = safe_snprintf(p, end, "readsb_net_service_messages_accepted{service=\"%s\"} %"PRIu64"\n", d, t->messagesAccepted);
+                p = safe_snprintf(p, end, "readsb_net_service_duplicates{service=\"%s\"} %"PRIu64"\n", d, t->duplicates);
+                p = safe_snprintf(p, end, "readsb_net_service_decode_cpu_ms{service=\"%s\"} %"PRIu64"\n", d, t->decodeNs / (1000 * 1000));
+                if (Modes.netOverloadShed) {
+                    p = safe_snprintf(p, end, "readsb_net_service_messages_shed{service=\"%s\"} %"PRIu64"\n", d, t->messagesShed);
+                }
+            }
+        }
+    }
+
     if (Modes.sdr_type != SDR_NONE) {
         if (!Modes.net_only) {
             p = safe_snprintf(p, end, "readsb_sdr_gain %.1f\n", Modes.gain / 10.0);
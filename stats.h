@@ -93,6 +93,10 @@ struct stats
   struct timespec api_worker_cpu;
   struct timespec api_update_cpu;
   uint64_t api_request_count;
+  uint32_t api_cache_hits;
+  uint32_t api_cache_misses;
+  uint32_t api_trace_cache_hits;
+  uint32_t api_trace_cache_misses;
   // remote messages:
   uint32_t remote_received_modeac;
   uint32_t remote_received_modes;
@@ -101,6 +105,9 @@ struct stats
   uint32_t remote_rejected_bad;
   uint32_t remote_rejected_unknown_icao;
   uint32_t remote_rejected_delayed;
+  uint32_t remote_shed_redundant; // --net-overload-shed: aircraft covered by other receivers
+  uint32_t remote_shed_modes_only; // --net-overload-shed: non ADS-B from Mode S only feeders
+  uint32_t remote_shed_low_quality; // --net-overload-shed: non ADS-B from low quality feeders
   uint32_t remote_accepted[MODES_MAX_BITERRORS + 1];
   uint32_t remote_malformed_beast;
   uint32_t remote_ping_rtt[PING_BUCKETS];
@@ -133,6 +140,38 @@ struct stats
   uint32_t fullTraceWrites;
   uint32_t permTraceWrites;
 
+  // file writer thread
+  uint32_t file_writes;
+  uint32_t file_writes_coalesced;
+  uint32_t file_writes_sync; // writer backlogged, written by the producer
+  uint32_t file_writer_queue_max;
+  uint64_t file_write_bytes;
+
+  // Comm-B decoding, register known from the inference cache / all decoders scored
+  uint32_t commb_fast_path;
+  uint32_t commb_full_scan;
+
+  // threadpool workers, index 0: allPool, 1: tracePool
+  // both pools are created with at most STATS_POOL_THREADS workers so every worker is counted
+#define STATS_POOLS 2
+#define STATS_POOL_THREADS 8
+  uint32_t pool_tasks[STATS_POOLS][STATS_POOL_THREADS];
+  uint32_t pool_steals[STATS_POOLS][STATS_POOL_THREADS];
+  uint64_t pool_busy_ns[STATS_POOLS][STATS_POOL_THREADS];
+
+  // lockThreads() pauses in priorityTasksRun, bucket upper bounds in statsPauseBounds, last bucket unbounded
+#define STATS_PAUSE_BUCKETS 12
+  uint32_t pause_hist[STATS_PAUSE_BUCKETS];
+  uint64_t pause_total_us;
+  uint32_t pause_max_us;
+
+  // deferred reclamation (epoch.c)
+  uint32_t epoch_retired;
+  uint32_t epoch_reclaimed;
+
+  // cmalloc / cmCalloc / cmRealloc calls
+  uint32_t malloc_count;
+
   // number of altitude messages ignored because
   // we had a recent DF17/18 altitude
   uint32_t suppressed_altitude_messages;
@@ -193,6 +232,7 @@ void display_total_short_range_stats();
 void add_timespecs (const struct timespec *x, const struct timespec *y, struct timespec *z);
 
 struct char_buffer generateStatusJson(int64_t now);
+char * appendMemoryJson(char *p, char *end);
 struct char_buffer generateStatusProm(int64_t now);
 struct char_buffer generateStatsJson(int64_t now);
 struct char_buffer generatePromFile(int64_t now);
@@ -202,5 +242,7 @@ void checkDisplayStats(int64_t now);
 void statsResetCount();
 void statsCountAircraft(int64_t now);
 void statsProcess(int64_t now);
+// record a lockThreads() pause, call before unlockThreads()
+void statsPause(int64_t micro);
 
 #endif
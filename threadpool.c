@@ -1,298 +1,466 @@
-/*
-Copyright (c) 2021, Youssef Touil <youssef@airspy.com>
-Copyright (c) 2021, Matthias Wirth <matthias.wirth@gmail.com>
-
-Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following
-conditions are met:
-
-1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
-
-2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following
-disclaimer in the documentation and/or other materials provided with the distribution.
-
-3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived
-from this software without specific prior written permission.
-
-THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
-BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
-SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
-DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
-INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
-NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
-*/
-
-#include <stdlib.h>
-#include "threadpool.h"
-#include <pthread.h>
-#include <stdatomic.h>
-//#include <sys/types.h>
-#include <unistd.h>
-#include <string.h>
-
-#undef DEBUG
-
-#ifdef DEBUG
-#include <stdio.h>
-#endif
-
-typedef struct {
-    int index;
-    threadpool_t* pool;
-    pthread_t pthread;
-    struct timespec thread_time;
-
-    threadpool_threadbuffers_t user_buffers;
-} thread_t;
-
-struct threadpool_t
-{
-    pthread_mutex_t worker_lock;
-    pthread_cond_t notify_worker;
-
-    pthread_mutex_t master_lock;
-    pthread_cond_t notify_master;
-
-    thread_t* threads;
-    uint32_t thread_count;
-    uint32_t terminate;
-    atomic_intptr_t tasks;
-    atomic_int remaining_tasks;
-    atomic_int pending_count;
-};
-
-static void *threadpool_threadproc(void *threadpool);
-
-static void normalize_timespec(struct timespec *ts) {
-    if (ts->tv_nsec >= 1000000000) {
-        ts->tv_sec += ts->tv_nsec / 1000000000;
-        ts->tv_nsec = ts->tv_nsec % 1000000000;
-    } else if (ts->tv_nsec < 0) {
-        long adjust = ts->tv_nsec / 1000000000 + 1;
-        ts->tv_sec -= adjust;
-        ts->tv_nsec = (ts->tv_nsec + 1000000000 * adjust) % 1000000000;
-    }
-}
-
-struct timespec threadpool_get_cumulative_thread_time(threadpool_t* pool) {
-    struct timespec sum = { 0, 0 };
-    for (uint32_t i = 0; i < pool->thread_count; i++) {
-        struct timespec ts = pool->threads[i].thread_time;
-        sum.tv_sec += ts.tv_sec;
-        sum.tv_nsec += ts.tv_nsec;
-    }
-    normalize_timespec(&sum);
-    return sum;
-}
-
-threadpool_t *threadpool_create(uint32_t thread_count, uint32_t buffer_count)
-{
-    threadpool_t *pool = (threadpool_t *) malloc(sizeof(threadpool_t));
-
-    pool->terminate = 0;
-    atomic_store(&pool->remaining_tasks, 0);
-    atomic_store(&pool->pending_count, 0);
-    atomic_store(&pool->tasks, (intptr_t) NULL);
-    pool->thread_count = thread_count;
-    pool->threads = (thread_t *) malloc(sizeof(thread_t) * thread_count);
-
-    pthread_mutex_init(&pool->worker_lock, NULL);
-    pthread_cond_init(&pool->notify_worker, NULL);
-
-    pthread_mutex_init(&pool->master_lock, NULL);
-    pthread_cond_init(&pool->notify_master, NULL);
-
-    for (uint32_t i = 0; i < thread_count; i++)
-    {
-        thread_t *thread = &pool->threads[i];
-        thread->index = i;
-        thread->pool = pool;
-        thread->thread_time.tv_sec = 0;
-        thread->thread_time.tv_nsec = 0;
-
-        thread->user_buffers.buffer_count = buffer_count;
-        thread->user_buffers.buffers = malloc(buffer_count * sizeof(threadpool_buffer_t));
-        memset(thread->user_buffers.buffers, 0x0, buffer_count * sizeof(threadpool_buffer_t));
-
-        pthread_create(&thread->pthread, NULL, threadpool_threadproc, thread);
-    }
-
-    return pool;
-}
-
-void threadpool_reset_buffers(threadpool_t *pool)
-{
-    for (uint32_t i = 0; i < pool->thread_count; i++)
-    {
-        thread_t *thread = &pool->threads[i];
-        for (uint32_t k = 0; k < thread->user_buffers.buffer_count; k++) {
-            free_threadpool_buffer(&thread->user_buffers.buffers[k]);
-        }
-    }
-}
-
-void threadpool_destroy(threadpool_t *pool)
-{
-    pool->terminate = 1;
-
-    pthread_mutex_lock(&pool->worker_lock);
-    atomic_store(&pool->remaining_tasks, 0);
-    pthread_cond_broadcast(&pool->notify_worker);
-    pthread_mutex_unlock(&pool->worker_lock);
-
-    pthread_mutex_lock(&pool->master_lock);
-    atomic_store(&pool->pending_count, 0);
-    pthread_cond_broadcast(&pool->notify_master);
-    pthread_mutex_unlock(&pool->master_lock);
-
-
-    for (uint32_t i = 0; i < pool->thread_count; i++)
-    {
-        thread_t *thread = &pool->threads[i];
-        pthread_join(thread->pthread, NULL);
-
-        for (uint32_t k = 0; k < thread->user_buffers.buffer_count; k++) {
-            free_threadpool_buffer(&thread->user_buffers.buffers[k]);
-        }
-        free(thread->user_buffers.buffers);
-    }
-
-    pthread_mutex_destroy(&pool->worker_lock);
-    pthread_cond_destroy(&pool->notify_worker);
-
-    pthread_mutex_destroy(&pool->master_lock);
-    pthread_cond_destroy(&pool->notify_master);
-
-    free(pool->threads);
-    free(pool);
-}
-
-void threadpool_run(threadpool_t *pool, threadpool_task_t* tasks, uint32_t count)
-{
-    #ifdef DEBUG
-    fprintf(stderr, "%p threadpool_run, threads: %4d tasks: %4d\n", pool, pool->thread_count, count);
-    #endif
-
-    atomic_store(&pool->pending_count, count);
-    atomic_store(&pool->tasks, (intptr_t) tasks);
-    // setting remaining_tasks means a thread could start doing work already
-    // pending_count / tasks need to be in place, so this order is important
-    atomic_store(&pool->remaining_tasks, count);
-
-    pthread_mutex_lock(&pool->worker_lock);
-    pthread_cond_broadcast(&pool->notify_worker); // wake up sleeping worker threads after remaining_tasks has been set
-    pthread_mutex_unlock(&pool->worker_lock);
-
-    pthread_mutex_lock(&pool->master_lock);
-    while (atomic_load(&pool->pending_count) > 0 && !pool->terminate)
-    {
-        pthread_cond_wait(&pool->notify_master, &pool->master_lock);
-    }
-    pthread_mutex_unlock(&pool->master_lock);
-
-    #ifdef DEBUG
-    fprintf(stderr, "%p threadpool_run, threads: %4d tasks: %4d ... done\n", pool, pool->thread_count, count);
-    #endif
-}
-
-static unsigned get_seed() {
-    struct timespec time;
-    clock_gettime(CLOCK_REALTIME, &time);
-    return (time.tv_sec ^ time.tv_nsec ^ (getpid() << 16) ^ (uintptr_t) pthread_self());
-}
-
-static void *threadpool_threadproc(void *arg)
-{
-    srandom(get_seed());
-
-    thread_t *thread = (thread_t *) arg;
-    threadpool_t *pool = thread->pool;
-    int remaining_tasks;
-    int task_index;
-
-    while (1)
-    {
-        remaining_tasks = atomic_load(&pool->remaining_tasks);
-
-        if (remaining_tasks <= 0)
-        {
-            pthread_mutex_lock(&pool->worker_lock);
-
-            if (pool->terminate)
-            {
-                pthread_mutex_unlock(&pool->worker_lock);
-                return NULL;
-            }
-            // re-check remaining_tasks inside worker_lock before sleeping
-            // this makes lost wakeup impossible
-            // (remaining_tasks is incremented BEFORE taking worker_lock to wake the workers)
-            remaining_tasks = atomic_load(&pool->remaining_tasks);
-            if (remaining_tasks <= 0)
-            {
-                // update thread_time
-                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &thread->thread_time);
-
-                #ifdef DEBUG
-                fprintf(stderr, "%p thread %d waiting (remaining_tasks %4d)\n", pool, thread->index, remaining_tasks);
-                #endif
-
-                // wait until we have more work
-                pthread_cond_wait(&pool->notify_worker, &pool->worker_lock);
-            }
-            else
-            {
-                #ifdef DEBUG
-                fprintf(stderr, "%p thread %d not waiting (remaining_tasks %4d)\n", pool, thread->index, remaining_tasks);
-                #endif
-            }
-
-            pthread_mutex_unlock(&pool->worker_lock);
-
-            continue;
-        }
-
-        task_index = atomic_fetch_sub(&pool->remaining_tasks, 1) - 1;
-
-        if (task_index < 0) {
-            continue;
-        }
-
-        #ifdef DEBUG
-        fprintf(stderr, "%p thread %d got task: %4d\n", pool, thread->index, task_index);
-        #endif
-
-        threadpool_task_t* task = (threadpool_task_t*) atomic_load(&pool->tasks) + task_index;
-
-        task->function(task->argument, &thread->user_buffers);
-
-        int pending_count = atomic_fetch_sub(&pool->pending_count, 1) - 1;
-
-        if (pending_count == 0)
-        {
-            pthread_mutex_lock(&pool->master_lock);
-            pthread_cond_broadcast(&pool->notify_master);
-            pthread_mutex_unlock(&pool->master_lock);
-        }
-    }
-
-    //pthread_exit(NULL);
-
-    return NULL;
-}
-
-void free_threadpool_buffer(threadpool_buffer_t *buffer) {
-    if (buffer->buf) {
-        free(buffer->buf);
-        buffer->buf = NULL;
-        buffer->size = 0;
-    }
-#ifdef _THREADPOOL_WITH_ZSTD
-    if (buffer->cctx) {
-        ZSTD_freeCCtx(buffer->cctx);
-        buffer->cctx = NULL;
-    }
-    if (buffer->dctx) {
-        ZSTD_freeDCtx(buffer->dctx);
-        buffer->dctx = NULL;
-    }
-#endif
-}
+/*
+Copyright (c) 2021, Youssef Touil <youssef@airspy.com>
+Copyright (c) 2021, Matthias Wirth <matthias.wirth@gmail.com>
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following
+conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following
+disclaimer in the documentation and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived
+from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include "readsb.h"
+#include <pthread.h>
+//#include <sys/types.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#undef DEBUG
+
+#ifdef DEBUG
+#include <stdio.h>
+#endif
+
+// Every worker owns a double ended queue of tasks.
+// The owner pops at the tail (LIFO), idle workers steal from the head of a random victim (FIFO).
+// The deques are protected by a per deque mutex which is only contended when stealing.
+
+// counts the tasks of a threadpool_run() which haven't finished yet
+typedef struct {
+    atomic_int pending;
+} future_t;
+
+typedef struct {
+    threadpool_function_t function;
+    void *argument;
+    future_t *future;
+} queued_task_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    queued_task_t *items;
+    uint32_t alloc; // power of 2
+    uint32_t head; // steal end
+    uint32_t tail; // owner end
+} deque_t;
+
+typedef struct {
+    int index;
+    threadpool_t* pool;
+    pthread_t pthread;
+    struct timespec thread_time;
+
+    deque_t deque;
+    unsigned seed;
+
+    atomic_uint_fast64_t tasks;
+    atomic_uint_fast64_t steals;
+    atomic_uint_fast64_t busy_ns;
+
+    threadpool_threadbuffers_t user_buffers;
+} thread_t;
+
+struct threadpool_t
+{
+    pthread_mutex_t worker_lock;
+    pthread_cond_t notify_worker;
+
+    pthread_mutex_t master_lock;
+    pthread_cond_t notify_master;
+
+    thread_t* threads;
+    uint32_t thread_count;
+    atomic_int terminate;
+    // number of tasks sitting in the deques (can be negative for a short moment)
+    atomic_int queued;
+    // number of workers sleeping or about to sleep on notify_worker
+    atomic_int sleeping;
+    // round robin start for the tasks of a threadpool_run()
+    atomic_uint next_thread;
+};
+
+static void *threadpool_threadproc(void *threadpool);
+
+static uint64_t mono_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct timespec threadpool_get_cumulative_thread_time(threadpool_t* pool) {
+    struct timespec sum = { 0, 0 };
+    for (uint32_t i = 0; i < pool->thread_count; i++) {
+        struct timespec ts = pool->threads[i].thread_time;
+        sum.tv_sec += ts.tv_sec;
+        sum.tv_nsec += ts.tv_nsec;
+    }
+    normalize_timespec(&sum);
+    return sum;
+}
+
+uint32_t threadpool_get_thread_count(threadpool_t *pool) {
+    return pool->thread_count;
+}
+
+void threadpool_get_worker_stats(threadpool_t *pool, uint32_t index, threadpool_worker_stats_t *stats, int reset) {
+    memset(stats, 0, sizeof(threadpool_worker_stats_t));
+    if (index >= pool->thread_count) {
+        return;
+    }
+    thread_t *thread = &pool->threads[index];
+    if (reset) {
+        stats->tasks = atomic_exchange(&thread->tasks, 0);
+        stats->steals = atomic_exchange(&thread->steals, 0);
+        stats->busy_ns = atomic_exchange(&thread->busy_ns, 0);
+    } else {
+        stats->tasks = atomic_load(&thread->tasks);
+        stats->steals = atomic_load(&thread->steals);
+        stats->busy_ns = atomic_load(&thread->busy_ns);
+    }
+}
+
+static void deque_init(deque_t *deque) {
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->alloc = 64;
+    deque->items = cmalloc(deque->alloc * sizeof(queued_task_t));
+    deque->head = 0;
+    deque->tail = 0;
+}
+
+static void deque_destroy(deque_t *deque) {
+    pthread_mutex_destroy(&deque->lock);
+    free(deque->items);
+    deque->items = NULL;
+}
+
+// called with deque->lock held
+static void deque_push(deque_t *deque, queued_task_t *task) {
+    if (deque->tail - deque->head == deque->alloc) {
+        uint32_t alloc = deque->alloc * 2;
+        queued_task_t *items = cmalloc(alloc * sizeof(queued_task_t));
+        for (uint32_t i = deque->head; i != deque->tail; i++) {
+            items[i & (alloc - 1)] = deque->items[i & (deque->alloc - 1)];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->alloc = alloc;
+    }
+    deque->items[deque->tail & (deque->alloc - 1)] = *task;
+    deque->tail++;
+}
+
+static int deque_pop_tail(deque_t *deque, queued_task_t *task) {
+    int res = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail != deque->head) {
+        deque->tail--;
+        *task = deque->items[deque->tail & (deque->alloc - 1)];
+        res = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return res;
+}
+
+static int deque_pop_head(deque_t *deque, queued_task_t *task) {
+    int res = 0;
+    // don't wait for a busy victim, just try the next one
+    if (pthread_mutex_trylock(&deque->lock) != 0) {
+        return 0;
+    }
+    if (deque->tail != deque->head) {
+        *task = deque->items[deque->head & (deque->alloc - 1)];
+        deque->head++;
+        res = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return res;
+}
+
+threadpool_t *threadpool_create(uint32_t thread_count, uint32_t buffer_count)
+{
+    threadpool_t *pool = (threadpool_t *) malloc(sizeof(threadpool_t));
+
+    atomic_store(&pool->terminate, 0);
+    atomic_store(&pool->queued, 0);
+    atomic_store(&pool->sleeping, 0);
+    atomic_store(&pool->next_thread, 0);
+    pool->thread_count = thread_count;
+    pool->threads = (thread_t *) malloc(sizeof(thread_t) * thread_count);
+
+    pthread_mutex_init(&pool->worker_lock, NULL);
+    pthread_cond_init(&pool->notify_worker, NULL);
+
+    pthread_mutex_init(&pool->master_lock, NULL);
+    pthread_cond_init(&pool->notify_master, NULL);
+
+    // initialize all deques before starting any thread, workers steal from each other
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        thread_t *thread = &pool->threads[i];
+        thread->index = i;
+        thread->pool = pool;
+        thread->thread_time.tv_sec = 0;
+        thread->thread_time.tv_nsec = 0;
+
+        deque_init(&thread->deque);
+        atomic_store(&thread->tasks, 0);
+        atomic_store(&thread->steals, 0);
+        atomic_store(&thread->busy_ns, 0);
+
+        thread->user_buffers.buffer_count = buffer_count;
+        thread->user_buffers.buffers = malloc(buffer_count * sizeof(threadpool_buffer_t));
+        memset(thread->user_buffers.buffers, 0x0, buffer_count * sizeof(threadpool_buffer_t));
+    }
+
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        thread_t *thread = &pool->threads[i];
+        pthread_create(&thread->pthread, NULL, threadpool_threadproc, thread);
+    }
+
+    return pool;
+}
+
+void threadpool_reset_buffers(threadpool_t *pool)
+{
+    for (uint32_t i = 0; i < pool->thread_count; i++)
+    {
+        thread_t *thread = &pool->threads[i];
+        for (uint32_t k = 0; k < thread->user_buffers.buffer_count; k++) {
+            threadpool_buffer_t *buffer = &thread->user_buffers.buffers[k];
+            if (buffer->peak == 0) {
+                // idle
+                free_threadpool_buffer(buffer);
+            } else if (buffer->buf && buffer->size > 4 * buffer->peak) {
+                // grown for an outlier, the next use allocates what is needed
+                free(buffer->buf);
+                buffer->buf = NULL;
+                buffer->size = 0;
+            }
+            buffer->peak = 0;
+        }
+    }
+}
+
+void threadpool_destroy(threadpool_t *pool)
+{
+    atomic_store(&pool->terminate, 1);
+
+    pthread_mutex_lock(&pool->worker_lock);
+    pthread_cond_broadcast(&pool->notify_worker);
+    pthread_mutex_unlock(&pool->worker_lock);
+
+    pthread_mutex_lock(&pool->master_lock);
+    pthread_cond_broadcast(&pool->notify_master);
+    pthread_mutex_unlock(&pool->master_lock);
+
+
+    for (uint32_t i = 0; i < pool->thread_count; i++)
+    {
+        thread_t *thread = &pool->threads[i];
+        pthread_join(thread->pthread, NULL);
+
+        for (uint32_t k = 0; k < thread->user_buffers.buffer_count; k++) {
+            free_threadpool_buffer(&thread->user_buffers.buffers[k]);
+        }
+        free(thread->user_buffers.buffers);
+        deque_destroy(&thread->deque);
+    }
+
+    pthread_mutex_destroy(&pool->worker_lock);
+    pthread_cond_destroy(&pool->notify_worker);
+
+    pthread_mutex_destroy(&pool->master_lock);
+    pthread_cond_destroy(&pool->notify_master);
+
+    free(pool->threads);
+    free(pool);
+}
+
+static void wake_workers(threadpool_t *pool, uint32_t count) {
+    // queued has been incremented before this load (seq_cst), a worker increments sleeping
+    // before checking queued, so either it sees the new tasks or we see it sleeping
+    if (atomic_load(&pool->sleeping) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool->worker_lock);
+    if (count == 1) {
+        pthread_cond_signal(&pool->notify_worker);
+    } else {
+        pthread_cond_broadcast(&pool->notify_worker);
+    }
+    pthread_mutex_unlock(&pool->worker_lock);
+}
+
+static void submit_tasks(threadpool_t *pool, future_t *future, threadpool_task_t *tasks, uint32_t count)
+{
+    // must be in place before any of the tasks can complete
+    atomic_fetch_add(&future->pending, count);
+
+    // spread the tasks over all workers, start with a different worker every time
+    uint32_t start = atomic_fetch_add(&pool->next_thread, 1);
+    for (uint32_t i = 0; i < count; i++) {
+        thread_t *thread = &pool->threads[(start + i) % pool->thread_count];
+        queued_task_t task = { tasks[i].function, tasks[i].argument, future };
+        pthread_mutex_lock(&thread->deque.lock);
+        deque_push(&thread->deque, &task);
+        pthread_mutex_unlock(&thread->deque.lock);
+    }
+
+    atomic_fetch_add(&pool->queued, count);
+    wake_workers(pool, count);
+}
+
+// take a task from the own deque or steal one from another worker
+static int take_task(threadpool_t *pool, thread_t *thread, queued_task_t *task) {
+    if (atomic_load(&pool->queued) <= 0) {
+        return 0;
+    }
+    if (deque_pop_tail(&thread->deque, task)) {
+        atomic_fetch_sub(&pool->queued, 1);
+        return 1;
+    }
+    uint32_t count = pool->thread_count;
+    uint32_t start = rand_r(&thread->seed) % count;
+    for (uint32_t k = 0; k < count; k++) {
+        thread_t *victim = &pool->threads[(start + k) % count];
+        if (victim == thread) {
+            continue;
+        }
+        if (deque_pop_head(&victim->deque, task)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            atomic_fetch_add_explicit(&thread->steals, 1, memory_order_relaxed);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void execute_task(threadpool_t *pool, thread_t *thread, queued_task_t *task) {
+    uint64_t start = mono_ns();
+
+    task->function(task->argument, &thread->user_buffers);
+
+    atomic_fetch_add_explicit(&thread->busy_ns, mono_ns() - start, memory_order_relaxed);
+    atomic_fetch_add_explicit(&thread->tasks, 1, memory_order_relaxed);
+
+    // the future may be gone as soon as pending hits zero, don't touch it afterwards
+    if (atomic_fetch_sub(&task->future->pending, 1) == 1)
+    {
+        pthread_mutex_lock(&pool->master_lock);
+        pthread_cond_broadcast(&pool->notify_master);
+        pthread_mutex_unlock(&pool->master_lock);
+    }
+}
+
+void threadpool_run(threadpool_t *pool, threadpool_task_t* tasks, uint32_t count)
+{
+    #ifdef DEBUG
+    fprintf(stderr, "%p threadpool_run, threads: %4d tasks: %4d\n", pool, pool->thread_count, count);
+    #endif
+
+    if (count == 0) {
+        return;
+    }
+
+    future_t future = { 0 };
+
+    submit_tasks(pool, &future, tasks, count);
+
+    pthread_mutex_lock(&pool->master_lock);
+    while (atomic_load(&future.pending) > 0 && !atomic_load(&pool->terminate))
+    {
+        pthread_cond_wait(&pool->notify_master, &pool->master_lock);
+    }
+    pthread_mutex_unlock(&pool->master_lock);
+
+    #ifdef DEBUG
+    fprintf(stderr, "%p threadpool_run, threads: %4d tasks: %4d ... done\n", pool, pool->thread_count, count);
+    #endif
+}
+
+static void *threadpool_threadproc(void *arg)
+{
+    srandom(get_seed());
+
+    thread_t *thread = (thread_t *) arg;
+    threadpool_t *pool = thread->pool;
+    queued_task_t task;
+
+    thread->seed = get_seed();
+
+    while (1)
+    {
+        if (take_task(pool, thread, &task))
+        {
+            #ifdef DEBUG
+            fprintf(stderr, "%p thread %d got task\n", pool, thread->index);
+            #endif
+
+            execute_task(pool, thread, &task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->worker_lock);
+
+        if (atomic_load(&pool->terminate))
+        {
+            pthread_mutex_unlock(&pool->worker_lock);
+            return NULL;
+        }
+
+        // announce sleeping before re-checking queued, see wake_workers
+        atomic_fetch_add(&pool->sleeping, 1);
+        if (atomic_load(&pool->queued) <= 0)
+        {
+            // update thread_time
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &thread->thread_time);
+
+            #ifdef DEBUG
+            fprintf(stderr, "%p thread %d waiting\n", pool, thread->index);
+            #endif
+
+            // wait until we have more work
+            pthread_cond_wait(&pool->notify_worker, &pool->worker_lock);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+
+        pthread_mutex_unlock(&pool->worker_lock);
+    }
+
+    //pthread_exit(NULL);
+
+    return NULL;
+}
+
+void free_threadpool_buffer(threadpool_buffer_t *buffer) {
+    if (buffer->buf) {
+        free(buffer->buf);
+        buffer->buf = NULL;
+        buffer->size = 0;
+    }
+#ifdef _THREADPOOL_WITH_ZSTD
+    if (buffer->cctx) {
+        ZSTD_freeCCtx(buffer->cctx);
+        buffer->cctx = NULL;
+    }
+    if (buffer->dctx) {
+        ZSTD_freeDCtx(buffer->dctx);
+        buffer->dctx = NULL;
+    }
+#endif
+}
@@ -1045,6 +1045,26 @@ static void addReceiverId(struct aircraft *a, struct modesMessage *mm, int64_t e
     a->receiverCount = div;
 }
 
+// overload shedding (--net-overload-shed): other receivers currently deliver positions for this
+// aircraft, messages from receiverId aren't needed to track it
+int trackCoveredByOthers(struct aircraft *a, uint64_t receiverId, int64_t now) {
+    if (now - a->seenPosReliable > 2 * SECONDS || a->pos_reliable_valid.source < SOURCE_TISB) {
+        return 0;
+    }
+    if (!Modes.netReceiverId) {
+        // no receiver list without receiverIds, only the receiver of the last position is known
+        return a->lastPosReceiverId != receiverId;
+    }
+    // receivers on the receiverIds list delivered the most recent positions first, keep them
+    uint16_t hash = simpleHash(receiverId);
+    for (int i = 0; i < RECEIVERIDBUFFER; i++) {
+        if (a->receiverIds[i] == hash) {
+            return 0;
+        }
+    }
+    return a->receiverCount >= 2;
+}
+
 #if defined(WITH_UUIDS)
 static void setRecentReceiverIds(struct aircraft *a, struct modesMessage *mm, int64_t now) {
     int64_t oldestTime = now;
@@ -1997,6 +2017,8 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
     struct aircraft *res = NULL;
     int64_t now = mm->sysTimestamp;
 
+    PROBE2(track_start, mm->msgtype, mm->addr);
+
     if (mm->msgtype == DFTYPE_MODEAC) {
         // Mode A/C, just count it (we ignore SPI)
         modeAC_count[modeAToIndex(mm->squawkHex)]++;
@@ -2096,6 +2118,9 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
         }
     }
 
+    // periodic state writes only write aircraft changed since the last write
+    a->stateSeq = atomic_load_explicit(&Modes.stateSeq, memory_order_relaxed);
+
     struct aircraft scratch;
     bool haveScratch = false;
     if (mm->cpr_valid || mm->sbs_pos_valid) {
@@ -2930,6 +2955,20 @@ exit:
 
     ac = res;
 
+    if (mm->client) {
+        if (mm->decodeResult >= 0) {
+            mm->client->messagesDecoded++;
+        }
+        if (res) {
+            mm->client->messagesAccepted++;
+        }
+        if (mm->duplicate) {
+            mm->client->duplicates++;
+        }
+    }
+
+    PROBE5(track_done, mm->msgtype, mm->addr, res != NULL, mm->duplicate, mm->receiverId);
+
     //fprintf(stderr, "epoch: %.6f\n", mm->sysTimestamp / 1000.0);
 
     // In non-interactive non-quiet mode, display messages on standard output
@@ -2961,9 +3000,9 @@ exit:
                     mm->addr);
             //displayModesMessage(mm);
         } else if (0 && !ac) {
-            if (mm->addr != HEX_UNKNOWN && !dbGet(mm->addr, Modes.dbIndex))
+            if (mm->addr != HEX_UNKNOWN && !dbContains(mm->addr))
                 displayModesMessage(mm);
-            if (mm->addr == HEX_UNKNOWN && !dbGet(mm->maybe_addr, Modes.dbIndex))
+            if (mm->addr == HEX_UNKNOWN && !dbContains(mm->maybe_addr))
                 displayModesMessage(mm);
         }
     }
@@ -3104,6 +3143,8 @@ static void removeStaleRange(void *arg, threadpool_threadbuffers_t * buffer_grou
     int64_t noposTimeout = now - 5 * MINUTES;
     int64_t jaeroTimeout = now - Modes.trackExpireJaero;
 
+    int64_t dbGeneration = atomic_load(&Modes.dbGeneration);
+
     for (int j = info->from; j < info->to; j++) {
         struct aircraft **nextPointer = &(Modes.aircraft[j]);
         while (*nextPointer) {
@@ -3131,6 +3172,9 @@ static void removeStaleRange(void *arg, threadpool_threadbuffers_t * buffer_grou
                 freeAircraft(a);
 
             } else {
+                if (a->dbGeneration != dbGeneration) {
+                    updateTypeReg(a);
+                }
                 if (Modes.keep_traces) {
                     traceMaintenance(a, now, &buffer_group->buffers[0]);
                 }
@@ -3146,11 +3190,18 @@ static void activeUpdateRange(void *arg, threadpool_threadbuffers_t * buffer_gro
     int64_t now = info->now;
     struct craftArray *ca = &Modes.aircraftActive;
 
+    // the aircraft database was replaced since the details were filled in
+    // active aircraft are updated here, all others by removeStaleRange()
+    int64_t dbGeneration = atomic_load(&Modes.dbGeneration);
+
     for (int i = info->from; i < info->to; i++) {
         struct aircraft *a = ca->list[i];
         if (!a) {
             continue;
         }
+        if (a->dbGeneration != dbGeneration) {
+            updateTypeReg(a);
+        }
         updateValidities(a, now);
         if (Modes.keep_traces) {
             traceMaintenance(a, now, &buffer_group->buffers[0]);
@@ -3222,7 +3273,8 @@ void trackRemoveStale(int64_t now) {
     threadpool_task_t *tasks;
     readsb_task_t *infos;
 
-    taskCount = imin(Modes.allPoolSize, Modes.allTasks->task_count);
+    // more tasks than threads, workers running out of work steal from the ones with heavy ranges
+    taskCount = Modes.allTasks->task_count;
     tasks = Modes.allTasks->tasks;
     infos = Modes.allTasks->infos;
 
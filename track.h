@@ -581,9 +581,14 @@ struct aircraft
   char ownOp[64];
   char year[4];
   uint16_t dbFlags;
+  int64_t dbGeneration; // generation of the database the details above are from
+  uint64_t stateSeq; // Modes.stateSeq when last changed by a message, see struct stateBlobInfo
 
   int8_t initialTraceWriteDone;
   atomic_int traceLock;
+  struct legState *legState; // incremental mark_legs() for full traces, see globe_index.c
+  struct traceHydrate *traceHydrate; // trace chunks not yet read from the state, see globe_index.c
+  struct stateChunkRefs *stateChunkRefs; // trace chunks already in the chunk file, see save_blob()
   uint32_t trace_chunk_overall_bytes;
 
   float messageRate;
@@ -718,6 +723,8 @@ void trackRemoveStale(int64_t now);
 
 void updateValidities(struct aircraft *a, int64_t now);
 
+int trackCoveredByOthers(struct aircraft *a, uint64_t receiverId, int64_t now);
+
 struct aircraft *trackFindAircraft(uint32_t addr);
 
 /* Convert from a (hex) mode A value to a 0-4095 index */
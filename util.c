@@ -865,6 +865,9 @@ void check_grow_buffer_t(buffer_t *buffer, ssize_t newSize) {
 }
 
 void *check_grow_threadpool_buffer_t(threadpool_buffer_t *buffer, ssize_t newSize) {
+    if (newSize > buffer->peak) {
+        buffer->peak = newSize;
+    }
     if (buffer->size < newSize || !buffer->buf) {
         //fprintf(stderr, "check_grow_threadpool_buffer: buffer->size %ld requested size %ld\n", (long) buffer->size, (long) newSize);
         sfree(buffer->buf);
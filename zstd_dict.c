@@ -0,0 +1,260 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// zstd_dict.c: zstd dictionary for trace chunks and state blobs
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+#include <dirent.h>
+#include <zstd_errors.h>
+
+// compression levels used with a dictionary get a prepared ZSTD_CDict each:
+// save_blob uses level 1, trace chunks use level 2
+#define ZSTD_DICT_LEVELS (2)
+#define ZSTD_DICT_MAX (16)
+
+struct zstdDict {
+    uint32_t id;
+    struct char_buffer content;
+    ZSTD_DDict *ddict;
+    ZSTD_CDict *cdict[ZSTD_DICT_LEVELS]; // only for the current dictionary
+};
+
+// only modified by zstdDictInit / zstdDictCleanup before / after all other threads
+static struct {
+    struct zstdDict dicts[ZSTD_DICT_MAX];
+    int count;
+    struct zstdDict *current;
+} zd;
+
+static struct zstdDict *findDict(uint32_t id) {
+    for (int i = 0; i < zd.count; i++) {
+        if (zd.dicts[i].id == id) {
+            return &zd.dicts[i];
+        }
+    }
+    return NULL;
+}
+
+// takes ownership of content.buffer
+static struct zstdDict *addDict(struct char_buffer content, const char *file) {
+    uint32_t id = ZSTD_getDictID_fromDict(content.buffer, content.len);
+    if (id == 0) {
+        fprintf(stderr, "%s: not a zstd dictionary (use zstd_dict_train to create one)\n", file);
+        sfree(content.buffer);
+        return NULL;
+    }
+    struct zstdDict *dict = findDict(id);
+    if (dict) {
+        if (dict->content.len != content.len || memcmp(dict->content.buffer, content.buffer, content.len) != 0) {
+            fprintf(stderr, "%s: different zstd dictionary with the same id %08x already loaded, ignoring it!\n", file, id);
+        }
+        sfree(content.buffer);
+        return dict;
+    }
+    if (zd.count == ZSTD_DICT_MAX) {
+        fprintf(stderr, "%s: too many zstd dictionaries, ignoring it!\n", file);
+        sfree(content.buffer);
+        return NULL;
+    }
+    dict = &zd.dicts[zd.count];
+    memset(dict, 0, sizeof(struct zstdDict));
+    dict->id = id;
+    dict->content = content;
+    dict->ddict = ZSTD_createDDict(content.buffer, content.len);
+    if (!dict->ddict) {
+        fprintf(stderr, "%s: ZSTD_createDDict failed\n", file);
+        sfree(content.buffer);
+        return NULL;
+    }
+    zd.count++;
+    return dict;
+}
+
+static struct zstdDict *loadDict(const char *file) {
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "zstd dictionary: ");
+        perror(file);
+        return NULL;
+    }
+    struct char_buffer cb = readWholeFile(fd, (char *) file);
+    close(fd);
+    if (!cb.buffer) {
+        return NULL;
+    }
+    return addDict(cb, file);
+}
+
+void zstdDictInit() {
+    if (Modes.state_dir) {
+        DIR *dir = opendir(Modes.state_dir);
+        struct dirent *ent;
+        while (dir && (ent = readdir(dir))) {
+            if (strncmp(ent->d_name, ZSTD_DICT_PREFIX, strlen(ZSTD_DICT_PREFIX)) != 0) {
+                continue;
+            }
+            char path[PATH_MAX];
+            snprintf(path, PATH_MAX, "%s/%s", Modes.state_dir, ent->d_name);
+            loadDict(path);
+        }
+        if (dir) {
+            closedir(dir);
+        }
+    }
+
+    if (!Modes.zstd_dict_file) {
+        return;
+    }
+    struct zstdDict *dict = loadDict(Modes.zstd_dict_file);
+    if (!dict) {
+        fprintf(stderr, "zstd dictionary: couldn't load %s, compressing without dictionary!\n", Modes.zstd_dict_file);
+        return;
+    }
+    for (int k = 0; k < ZSTD_DICT_LEVELS; k++) {
+        dict->cdict[k] = ZSTD_createCDict(dict->content.buffer, dict->content.len, k + 1);
+        if (!dict->cdict[k]) {
+            fprintf(stderr, "zstd dictionary: ZSTD_createCDict failed, compressing without dictionary!\n");
+            return;
+        }
+    }
+    zd.current = dict;
+    fprintf(stderr, "zstd dictionary: using %s (id %08x, %zu bytes)\n", Modes.zstd_dict_file, dict->id, dict->content.len);
+}
+
+void zstdDictCleanup() {
+    for (int i = 0; i < zd.count; i++) {
+        struct zstdDict *dict = &zd.dicts[i];
+        for (int k = 0; k < ZSTD_DICT_LEVELS; k++) {
+            ZSTD_freeCDict(dict->cdict[k]);
+        }
+        ZSTD_freeDDict(dict->ddict);
+        sfree(dict->content.buffer);
+    }
+    memset(&zd, 0, sizeof(zd));
+}
+
+uint32_t zstdDictId() {
+    return zd.current ? zd.current->id : 0;
+}
+
+void zstdDictStore(const char *dir) {
+    if (!zd.current) {
+        return;
+    }
+    char path[PATH_MAX];
+    char tmppath[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s%08x", dir, ZSTD_DICT_PREFIX, zd.current->id);
+    if (access(path, F_OK) == 0) {
+        return;
+    }
+    // the dictionary prefix is used to find dictionaries, don't use it for the temporary file
+    snprintf(tmppath, PATH_MAX, "%s/tmp_%s%08x", dir, ZSTD_DICT_PREFIX, zd.current->id);
+    int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "zstdDictStore: ");
+        perror(tmppath);
+        return;
+    }
+    ssize_t res = check_write(fd, zd.current->content.buffer, zd.current->content.len, tmppath);
+    close(fd);
+    if (res != (ssize_t) zd.current->content.len || rename(tmppath, path) == -1) {
+        fprintf(stderr, "zstdDictStore: couldn't write %s\n", path);
+        unlink(tmppath);
+    }
+}
+
+void zstdDictPrune(const char *dir) {
+    char keep[64];
+    snprintf(keep, sizeof(keep), "%s%08x", ZSTD_DICT_PREFIX, zstdDictId());
+
+    DIR *dp = opendir(dir);
+    if (!dp) {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dp))) {
+        if (strncmp(ent->d_name, ZSTD_DICT_PREFIX, strlen(ZSTD_DICT_PREFIX)) != 0 || strcmp(ent->d_name, keep) == 0) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, PATH_MAX, "%s/%s", dir, ent->d_name);
+        fprintf(stderr, "zstd dictionary: removing %s, no longer used by the state\n", path);
+        unlink(path);
+    }
+    closedir(dp);
+}
+
+size_t zstdCompress(ZSTD_CCtx *cctx, void *dst, size_t dstCapacity, const void *src, size_t srcSize, int level) {
+    if (!zd.current) {
+        return ZSTD_compressCCtx(cctx, dst, dstCapacity, src, srcSize, level);
+    }
+    if (level >= 1 && level <= ZSTD_DICT_LEVELS) {
+        return ZSTD_compress_usingCDict(cctx, dst, dstCapacity, src, srcSize, zd.current->cdict[level - 1]);
+    }
+    return ZSTD_compress_usingDict(cctx, dst, dstCapacity, src, srcSize,
+            zd.current->content.buffer, zd.current->content.len, level);
+}
+
+size_t zstdDecompress(ZSTD_DCtx *dctx, void *dst, size_t dstCapacity, const void *src, size_t srcSize) {
+    if (zd.count == 0) {
+        return ZSTD_decompressDCtx(dctx, dst, dstCapacity, src, srcSize);
+    }
+    // frames in a trace chunk can use different dictionaries, decompress them one by one
+    const char *in = src;
+    const char *end = in + srcSize;
+    char *out = dst;
+    size_t total = 0;
+    while (in < end) {
+        size_t frameSize = ZSTD_findFrameCompressedSize(in, end - in);
+        if (ZSTD_isError(frameSize)) {
+            return frameSize;
+        }
+        size_t res;
+        uint32_t id = ZSTD_getDictID_fromFrame(in, frameSize);
+        if (id == 0) {
+            res = ZSTD_decompressDCtx(dctx, out + total, dstCapacity - total, in, frameSize);
+        } else {
+            struct zstdDict *dict = findDict(id);
+            if (!dict) {
+                return (size_t) -ZSTD_error_dictionary_wrong;
+            }
+            res = ZSTD_decompress_usingDDict(dctx, out + total, dstCapacity - total, in, frameSize, dict->ddict);
+        }
+        if (ZSTD_isError(res)) {
+            return res;
+        }
+        total += res;
+        in += frameSize;
+    }
+    return total;
+}
+
+int zstdDictMismatch(const void *src, size_t srcSize) {
+    uint32_t current = zstdDictId();
+    const char *in = src;
+    const char *end = in + srcSize;
+    while (in < end) {
+        size_t frameSize = ZSTD_findFrameCompressedSize(in, end - in);
+        if (ZSTD_isError(frameSize)) {
+            // not zstd or corrupt, leave it to the decompression to complain
+            return 0;
+        }
+        if (ZSTD_getDictID_fromFrame(in, frameSize) != current) {
+            return 1;
+        }
+        in += frameSize;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef ZSTD_DICT_H
+#define ZSTD_DICT_H
+
+// zstd dictionary for trace chunks and state blobs (--zstd-dict)
+//
+// Trace chunks and the serialized aircraft in the state blobs are small and very similar to
+// each other, a dictionary trained on them (zstd_dict_train) improves the compression a lot.
+//
+// The dictionary id is its version: it's written into every zstd frame compressed with it.
+// A copy of each dictionary in use is kept in the state directory as zstd_dict_<id> so the
+// state can be read back with a different or no dictionary configured.
+// When loading the state, trace chunks compressed with another dictionary are recompressed,
+// after the next complete state write the other dictionaries are removed from the state dir.
+
+#define ZSTD_DICT_PREFIX "zstd_dict_"
+
+// load the dictionaries from the state dir and Modes.zstd_dict_file, call before loading state
+void zstdDictInit();
+void zstdDictCleanup();
+
+// id of the dictionary used for compression, 0: no dictionary
+uint32_t zstdDictId();
+
+// copy the current dictionary into dir (no-op if already there)
+void zstdDictStore(const char *dir);
+// remove all dictionaries except the current one from dir
+void zstdDictPrune(const char *dir);
+
+// like ZSTD_compressCCtx, uses the current dictionary if there is one
+size_t zstdCompress(ZSTD_CCtx *cctx, void *dst, size_t dstCapacity, const void *src, size_t srcSize, int level);
+
+// like ZSTD_decompressDCtx, src can be several concatenated frames, each using any of the known
+// dictionaries
+size_t zstdDecompress(ZSTD_DCtx *dctx, void *dst, size_t dstCapacity, const void *src, size_t srcSize);
+
+// 1 if any frame in src wasn't compressed with the current dictionary
+int zstdDictMismatch(const void *src, size_t srcSize);
+
+#endif